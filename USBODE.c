@@ -17,19 +17,78 @@ void main(void)
 {
     ToolBoxInit();
     MenuBarInit();
+    WindowInit();
+    
+    /* Show the last catalog at once; the device is checked at idle time */
+    LoadCatalogSnapshot();
+    BeginDiscoverySearch(&gGlobals.discovery, &gGlobals.search);
+    TaskStart(&gGlobals.tasks, &gGlobals.startTask, StartupDiscovery, nil);
+    
+    EventLoop();
+}
+
+/*
+ * Find the device and bring the catalog up to date (startTask's step)
+ * Starts on the first null event, after the window has been drawn from
+ * the snapshot, and probes one SCSI ID per step.  A snapshot catalog
+ * stays on screen while the device is listed and is only replaced if
+ * the listing differs.
+ */
+short StartupDiscovery(USBODETask *task)
+{
+    (void)task;
     
     /* Find USBODE device on SCSI bus */
-    gGlobals.deviceFound = FindUSBODEDevice(&gGlobals.scsiID);
+    if (!DiscoverySearchStep(&gGlobals.discovery, &gGlobals.search)) {
+        return kTaskContinue;
+    }
     
-    WindowInit();
+    gGlobals.scsiID = gGlobals.search.found;
+    gGlobals.deviceFound = (gGlobals.search.found >= 0);
     
     if (gGlobals.deviceFound) {
+        if (gGlobals.scsiID != gGlobals.savedID) {
+            SaveDiscoveryPrefs(gGlobals.scsiID);
+        }
+        NegotiateCapabilities();
         RefreshDiscList();
     } else {
         ShowError("\pUSBODE device not found on SCSI bus");
     }
     
-    EventLoop();
+    /* The status beside the disc count changes either way */
+    SetPort(gGlobals.window);
+    InvalRect(&gGlobals.window->portRect);
+    
+    return kTaskDone;
+}
+
+/*
+ * Learn once, at discovery, which optional commands the firmware has,
+ * so refreshes go straight to the fastest listing it supports
+ * Firmware without GET DEVICE INFO leaves each extension to be probed
+ * on first use.
+ */
+void NegotiateCapabilities(void)
+{
+    DeviceInfo *info;
+    
+    info = &gGlobals.device;
+    gGlobals.paging = kExtensionUnknown;
+    gGlobals.generations = kExtensionUnknown;
+    gGlobals.mountedIndex = kNoCurrentDisc;
+    
+    if (ProbeDeviceInfo(gGlobals.scsiID, info) != noErr || !info->answered) {
+        return;
+    }
+    
+    gGlobals.paging = DeviceHas(info, kCapPagedListing) ?
+                      kExtensionPresent : kExtensionAbsent;
+    gGlobals.generations = DeviceHas(info, kCapCatalogChanges) ?
+                           kExtensionPresent : kExtensionAbsent;
+    if (!DeviceHas(info, kCapCatalogChanges)) {
+        gGlobals.generationKnown = false;
+    }
 }
 
 /*
@@ -50,8 +109,30 @@ void ToolBoxInit(void)
                        NGetTrapAddress(_Unimplemented, ToolTrap));
     
     gGlobals.done = false;
-    gGlobals.discCount = 0;
     gGlobals.deviceFound = false;
+    InitTaskQueue(&gGlobals.tasks, kTaskSliceMicros);
+    gGlobals.startTask.queued = false;
+    gGlobals.listTask.queued = false;
+    gGlobals.mountTask.queued = false;
+    gGlobals.paging = kExtensionUnknown;
+    gGlobals.generations = kExtensionUnknown;
+    gGlobals.generationKnown = false;
+    gGlobals.device.answered = false;
+    gGlobals.device.capabilities = 0;
+    gGlobals.mountedIndex = kNoCurrentDisc;
+    InitMountScheduler(&gGlobals.mounts, kMountDebounceMicros);
+    gGlobals.snapshotHash = 0;
+    gGlobals.snapshotHasGeneration = false;
+    InitDiscoveryCache(&gGlobals.discovery, LoadDiscoveryPrefs());
+    (void)InitDiscCatalog(&gGlobals.catalog);
+    (void)InitDiscCatalog(&gGlobals.incoming);
+    (void)InitRowCache(&gGlobals.rows);
+    (void)InitPrefixIndex(&gGlobals.prefixes);
+    (void)InitSortViews(&gGlobals.sorts);
+    (void)InitNameIndex(&gGlobals.names);
+    
+    /* Talk to the device through the classic SCSI Manager */
+    SetUSBODETransport(NewSCSIManagerTransport());
 }
 
 /*
@@ -85,23 +166,19 @@ void WindowInit(void)
 
 /*
  * Find USBODE device on SCSI bus
- * Returns true if found, sets scsiID to device ID
+ * Returns true if found, sets scsiID to device ID.  The ID found last
+ * time is tried first, so this is normally a single INQUIRY.
  */
 Boolean FindUSBODEDevice(short *scsiID)
 {
-    short id;
+    Boolean found;
     
-    /* Scan SCSI bus for USBODE device */
-    for (id = 0; id < 7; id++) {
-        if (IsUSBODEDevice(id)) {
-            *scsiID = id;
-            return true;
-        }
+    found = DiscoverUSBODE(&gGlobals.discovery, scsiID);
+    if (found && *scsiID != gGlobals.savedID) {
+        SaveDiscoveryPrefs(*scsiID);
     }
     
-    /* Device not found */
-    *scsiID = -1;
-    return false;
+    return found;
 }
 
 /*
@@ -112,198 +189,510 @@ short ScanSCSIBus(void)
 {
     short id;
     short deviceCount;
-    OSErr err;
     Str255 message;
     
-    deviceCount = 0;
+    deviceCount = DiscoveryScanBus(&gGlobals.discovery);
     
-    /* Try each SCSI ID from 0 to 6 (7 is typically the Mac itself) */
-    for (id = 0; id < 7; id++) {
-        err = SCSIGet();
-        if (err != noErr) continue;
+    for (id = 0; id < kDiscoveryIDCount; id++) {
+        if (DiscoveryState(&gGlobals.discovery, id) == kProbeEmpty) {
+            continue;
+        }
         
-        err = SCSISelect(id);
-        if (err == noErr) {
-            /* Device found at this ID */
-            deviceCount++;
-            
-            /* Build message */
-            message[0] = 0;
-            BlockMove("\pDevice found at SCSI ID ", message, 25);
-            message[0] = 24;
-            message[25] = '0' + id;
-            message[0] = 25;
-            
-            /* Check if it's USBODE */
-            if (IsUSBODEDevice(id)) {
-                BlockMove(" (USBODE)", message + 26, 10);
-                message[0] = 35;
-            }
-            
-            /* Show in debugger or alert */
-            DebugStr(message);
+        /* Build message */
+        BlockMove("\pDevice found at SCSI ID ", message, 25);
+        message[0] = 24;
+        message[25] = '0' + id;
+        message[0] = 25;
+        
+        if (DiscoveryState(&gGlobals.discovery, id) == kProbeUSBODE) {
+            BlockMove(" (USBODE)", message + 26, 10);
+            message[0] = 34;
         }
         
-        SCSIComplete(nil, nil, 0);
+        /* Show in debugger */
+        DebugStr(message);
     }
     
     return deviceCount;
 }
 
 /*
- * Test if a device at given SCSI ID responds to USBODE commands
+ * Test if a device at given SCSI ID is a USBODE
  */
 Boolean IsUSBODEDevice(short scsiID)
 {
-    unsigned char count;
+    return (DiscoveryProbe(&gGlobals.discovery, scsiID) == kProbeUSBODE);
+}
+
+/*
+ * Open a file in the Preferences folder, creating it if asked
+ */
+OSErr OpenPrefsFile(ConstStr255Param name, OSType fileType, SInt8 permission,
+                    short *refNum)
+{
+    FSSpec spec;
+    short vRefNum;
+    long dirID;
+    Boolean create;
     OSErr err;
     
-    /* Try to get disc count - if this works, it's likely USBODE */
-    err = GetDiscCount(scsiID, &count);
+    create = (permission != fsRdPerm);
+    
+    err = FindFolder(kOnSystemDisk, kPreferencesFolderType,
+                     create ? kCreateFolder : kDontCreateFolder,
+                     &vRefNum, &dirID);
+    if (err == noErr) {
+        err = FSMakeFSSpec(vRefNum, dirID, name, &spec);
+        if (err == fnfErr && create) {
+            err = FSpCreate(&spec, kCreatorType, fileType, smSystemScript);
+        }
+    }
+    if (err == noErr) {
+        err = FSpOpenDF(&spec, permission, refNum);
+    }
     
-    return (err == noErr);
+    return err;
 }
 
 /*
- * Send a SCSI command to the USBODE device
+ * Last USBODE ID from the preferences file, or -1
  */
-OSErr SendSCSICommand(short scsiID, unsigned char cmd, unsigned char param,
-                      void *buffer, long bufferSize, long *actualSize)
+short LoadDiscoveryPrefs(void)
 {
+    DiscoveryPrefs prefs;
+    short refNum;
+    long count;
     OSErr err;
-    unsigned char cdb[12];
-    int i;
-    short scsiResult;
     
-    /* Initialize CDB */
-    for (i = 0; i < 12; i++) {
-        cdb[i] = 0;
+    gGlobals.savedID = -1;
+    
+    if (OpenPrefsFile(kPrefsFileName, kPrefsFileType, fsRdPerm,
+                      &refNum) != noErr) {
+        return -1;
     }
-    cdb[0] = cmd;
-    cdb[1] = param;
     
-    /* Open SCSI Manager */
-    err = SCSIGet();
-    if (err != noErr) return err;
+    count = sizeof(prefs);
+    err = FSRead(refNum, &count, &prefs);
+    FSClose(refNum);
     
-    /* Select target device */
-    err = SCSISelect(scsiID);
-    if (err != noErr) {
-        SCSIComplete(&scsiResult, nil, 0);
-        return err;
+    if (err == noErr && count == sizeof(prefs) &&
+        prefs.signature == kCreatorType && prefs.version == kPrefsVersion) {
+        gGlobals.savedID = prefs.lastID;
     }
     
-    /* Send command */
-    err = SCSICmd((char *)cdb, 12);
-    if (err != noErr) {
-        SCSIComplete(&scsiResult, nil, 0);
-        return err;
+    return gGlobals.savedID;
+}
+
+/*
+ * Remember where the USBODE was for the next launch
+ */
+void SaveDiscoveryPrefs(short scsiID)
+{
+    DiscoveryPrefs prefs;
+    short refNum;
+    long count;
+    OSErr err;
+    
+    if (OpenPrefsFile(kPrefsFileName, kPrefsFileType, fsWrPerm,
+                      &refNum) != noErr) {
+        return;     /* not worth bothering the user about */
     }
     
-    /* Read response if buffer provided */
-    if (buffer != nil && bufferSize > 0) {
-        err = SCSIRead(buffer);
-        if (err != noErr) {
-            SCSIComplete(&scsiResult, nil, 0);
-            return err;
-        }
+    prefs.signature = kCreatorType;
+    prefs.version = kPrefsVersion;
+    prefs.lastID = scsiID;
+    
+    count = sizeof(prefs);
+    err = SetEOF(refNum, 0);
+    if (err == noErr) {
+        err = FSWrite(refNum, &count, &prefs);
     }
+    FSClose(refNum);
     
-    /* Complete transaction */
-    err = SCSIComplete(&scsiResult, nil, 0);
-    if (actualSize != nil) {
-        *actualSize = (long)scsiResult;
+    if (err == noErr) {
+        gGlobals.savedID = scsiID;
     }
+}
+
+/*
+ * Snapshot input from an open data fork
+ */
+static OSErr ReadSnapshotData(void *refCon, void *data, long length)
+{
+    long count;
+    OSErr err;
     
+    count = length;
+    err = FSRead(*(short *)refCon, &count, data);
+    if (err == noErr && count != length) {
+        err = eofErr;
+    }
     return err;
 }
 
 /*
- * Get number of discs available on USBODE
+ * Snapshot output to an open data fork
  */
-OSErr GetDiscCount(short scsiID, unsigned char *count)
+static OSErr WriteSnapshotData(void *refCon, const void *data, long length)
 {
-    long actualSize;
-    unsigned char response;
+    long count;
+    
+    count = length;
+    return FSWrite(*(short *)refCon, &count, data);
+}
+
+/*
+ * Load the catalog saved by the last session, if there is one
+ */
+void LoadCatalogSnapshot(void)
+{
+    SnapshotInfo info;
+    short refNum;
     OSErr err;
     
-    err = SendSCSICommand(scsiID, SCSI_CMD_NUM_CDS, 0, 
-                         &response, (long)sizeof(response), &actualSize);
+    if (OpenPrefsFile(kSnapshotFileName, kSnapshotFileType, fsRdPerm,
+                      &refNum) != noErr) {
+        return;
+    }
     
-    if (err == noErr && actualSize >= 1) {
-        *count = response;
-        if (*count > kMaxDiscs) {
-            *count = kMaxDiscs;
-        }
-    } else {
-        *count = 0;
+    err = ReadCatalogSnapshot(&gGlobals.catalog, &info,
+                              ReadSnapshotData, &refNum);
+    FSClose(refNum);
+    
+    if (err != noErr) {
+        return;     /* damaged or old: the device listing replaces it */
     }
     
-    return err;
+    gGlobals.snapshotHash = info.hash;
+    gGlobals.snapshotHasGeneration = info.hasGeneration;
+    gGlobals.snapshotGeneration = info.generation;
+    gGlobals.generationKnown = info.hasGeneration;
+    gGlobals.generation = info.generation;
+    
+    /* Start discovery where the catalog came from if nothing better is known */
+    if (gGlobals.discovery.lastID < 0 && info.scsiID >= 0) {
+        InitDiscoveryCache(&gGlobals.discovery, info.scsiID);
+    }
+    
+    (void)RowCacheSync(&gGlobals.rows, &gGlobals.catalog);
+    (void)SortViewsSync(&gGlobals.sorts, &gGlobals.prefixes,
+                        &gGlobals.catalog);
+    (void)NameIndexSync(&gGlobals.names, &gGlobals.catalog);
+    InvalRect(&gGlobals.window->portRect);
 }
 
 /*
- * Get list of discs from USBODE
+ * Save the catalog for the next launch, unless the snapshot already
+ * holds it at the same generation
  */
-OSErr GetDiscList(short scsiID, DiscEntry *discs, unsigned char count)
+void SaveCatalogSnapshot(void)
 {
-    long actualSize;
+    UInt32 hash;
+    short refNum;
     OSErr err;
-    long bufferSize = count * sizeof(DiscEntry);
     
-    err = SendSCSICommand(scsiID, SCSI_CMD_LIST_CDS, 0,
-                         discs, bufferSize, &actualSize);
+    hash = CatalogHash(&gGlobals.catalog);
+    if (hash == gGlobals.snapshotHash &&
+        (!gGlobals.generationKnown ||
+         (gGlobals.snapshotHasGeneration &&
+          gGlobals.snapshotGeneration == gGlobals.generation))) {
+        return;
+    }
     
-    return err;
+    if (OpenPrefsFile(kSnapshotFileName, kSnapshotFileType, fsWrPerm,
+                      &refNum) != noErr) {
+        return;
+    }
+    
+    err = SetEOF(refNum, 0);
+    if (err == noErr) {
+        err = WriteCatalogSnapshot(&gGlobals.catalog, gGlobals.scsiID,
+                                   gGlobals.generationKnown ?
+                                       &gGlobals.generation : nil,
+                                   WriteSnapshotData, &refNum);
+    }
+    if (err != noErr) {
+        (void)SetEOF(refNum, 0);    /* an empty file is simply ignored */
+    }
+    FSClose(refNum);
+    
+    if (err == noErr) {
+        gGlobals.snapshotHash = hash;
+        gGlobals.snapshotHasGeneration = gGlobals.generationKnown;
+        gGlobals.snapshotGeneration = gGlobals.generation;
+    }
 }
 
 /*
- * Set the active disc on USBODE
+ * Paged listing format the firmware offers: front-coded pages carry
+ * the same entries in fewer bytes, long names keep whole image names
+ * Entries of the packed formats vary in length, so a page of them can
+ * only be read through a transport that reports how much arrived;
+ * otherwise names stay at 32 bytes in the fixed format.
  */
-OSErr SetActiveDisc(short scsiID, unsigned char index)
+static unsigned char ListingFormat(void)
 {
-    long actualSize;
+    unsigned char format;
+    
+    format = kListFormatFixed;
+    if (!TransportReportsResidual(GetUSBODETransport())) {
+        return format;
+    }
+    if (DeviceHas(&gGlobals.device, kCapCompressedListing)) {
+        format |= kListFormatFrontCoded;
+    }
+    if (DeviceHas(&gGlobals.device, kCapLongNames)) {
+        format |= kListFormatLongNames;
+    }
+    
+    return format;
+}
+
+/*
+ * Note which image is mounted and redraw the list if that changed
+ */
+static void SetMountedDisc(unsigned short index)
+{
+    if (index == gGlobals.mountedIndex) {
+        return;
+    }
+    
+    gGlobals.mountedIndex = index;
+    if (gGlobals.window != nil) {
+        SetPort(gGlobals.window);
+        InvalRect(&gGlobals.window->portRect);
+    }
+}
+
+/*
+ * Ask which image is mounted, on firmware that can say
+ */
+static void UpdateMountedDisc(void)
+{
+    unsigned short index;
+    
+    if (DeviceHas(&gGlobals.device, kCapCurrentDisc) &&
+        GetCurrentDisc(gGlobals.scsiID, &index) == noErr) {
+        SetMountedDisc(index);
+    }
+}
+
+/*
+ * Bring the catalog up to date from just the entries that changed
+ * Returns false when the whole catalog has to be listed instead, with
+ * listingGeneration set for that listing.  generationRead says the
+ * probe has just put the device's generation there.
+ */
+static Boolean SyncDiscChanges(Boolean generationRead)
+{
+    CatalogChanges changes;
     OSErr err;
     
-    err = SendSCSICommand(scsiID, SCSI_CMD_SET_NEXT_CD, index,
-                         nil, 0, &actualSize);
+    if (!gGlobals.generationKnown) {
+        if (generationRead) {
+            return false;
+        }
+        err = GetCatalogGeneration(gGlobals.scsiID,
+                                   &gGlobals.listingGeneration);
+        if (err != noErr) {
+            FinishDiscListing(err, 0);
+            return true;
+        }
+        return false;
+    }
     
-    return err;
+    err = GetCatalogChanges(gGlobals.scsiID, gGlobals.generation, &changes);
+    if (err != noErr) {
+        FinishDiscListing(err, 0);
+        return true;
+    }
+    
+    gGlobals.listingGeneration = changes.generation;
+    if (changes.resync) {
+        return false;
+    }
+    
+    /* Nothing to fetch: the catalog on screen is current */
+    if (changes.rangeCount == 0 && changes.total == gGlobals.catalog.count) {
+        gGlobals.generation = changes.generation;
+        SaveCatalogSnapshot();
+        UpdateMountedDisc();
+        return true;
+    }
+    
+    /* Build the new catalog in the shadow and publish it like a listing */
+    err = CatalogApplyChanges(&gGlobals.incoming, &gGlobals.catalog,
+                              &changes, gGlobals.scsiID,
+                              kDefaultPageEntries, ListingFormat());
+    if (err == paramErr) {
+        CatalogClear(&gGlobals.incoming);
+        return false;
+    }
+    
+    FinishDiscListing(err, changes.total);
+    return true;
 }
 
 /*
  * Refresh the disc list from device
+ * Every listing fills the incoming catalog, off the one on screen,
+ * which FinishDiscListing replaces only with a complete listing; until
+ * then drawing uses the last good catalog and never waits on the bus.
+ * Devices that keep catalog generations send only what changed since
+ * the last listing.  Devices with paged listing deliver their pages
+ * from idle time, a page per listTask step (ContinueDiscListing), so
+ * large catalogs never block the event loop for the whole transfer.
  */
 void RefreshDiscList(void)
 {
     OSErr err;
     unsigned char count;
+    Boolean paged;
+    Boolean supported;
+    Boolean generationRead;
+    DiscEntry *discs;
     
     if (!gGlobals.deviceFound) {
         return;
     }
     
-    /* Get count */
-    err = GetDiscCount(gGlobals.scsiID, &count);
-    if (err != noErr) {
-        ShowError("\pError reading disc count");
+    /* Restart any listing still in progress */
+    if (TaskActive(&gGlobals.listTask)) {
+        TaskStop(&gGlobals.tasks, &gGlobals.listTask);
+        EndDiscPager(&gGlobals.pager);
+    }
+    
+    if (gGlobals.paging == kExtensionUnknown) {
+        err = ProbePagedListing(gGlobals.scsiID, &paged);
+        if (err != noErr) {
+            FinishDiscListing(err, 0);
+            return;
+        }
+        gGlobals.paging = paged ? kExtensionPresent : kExtensionAbsent;
+    }
+    
+    generationRead = false;
+    if (gGlobals.generations == kExtensionUnknown) {
+        err = ProbeCatalogGeneration(gGlobals.scsiID, &supported,
+                                     &gGlobals.listingGeneration);
+        if (err != noErr) {
+            FinishDiscListing(err, 0);
+            return;
+        }
+        gGlobals.generations = supported ? kExtensionPresent : kExtensionAbsent;
+        if (!supported) {
+            gGlobals.generationKnown = false;
+        }
+        generationRead = supported;
+    }
+    
+    if (gGlobals.generations == kExtensionPresent &&
+        SyncDiscChanges(generationRead)) {
         return;
     }
     
-    gGlobals.discCount = count;
+    CatalogClear(&gGlobals.incoming);
     
-    /* Get list */
-    if (count > 0) {
-        err = GetDiscList(gGlobals.scsiID, gGlobals.discs, count);
+    if (gGlobals.paging == kExtensionPresent) {
+        err = BeginDiscPagerFormat(&gGlobals.pager, gGlobals.scsiID,
+                                   kDefaultPageEntries, ListingFormat());
         if (err != noErr) {
-            ShowError("\pError reading disc list");
+            FinishDiscListing(err, 0);
             return;
         }
+        TaskStart(&gGlobals.tasks, &gGlobals.listTask,
+                  ContinueDiscListing, nil);
+        return;
     }
     
-    /* Redraw window */
-    if (gGlobals.window != nil) {
-        InvalRect(&gGlobals.window->portRect);
+    /* Get count and list (one transaction when the transport allows) */
+    discs = (DiscEntry *)NewPtr(kMaxDiscs * sizeof(DiscEntry));
+    if (discs == nil) {
+        FinishDiscListing(memFullErr, 0);
+        return;
+    }
+    
+    err = FetchDiscList(gGlobals.scsiID, kRefreshAuto,
+                        discs, kMaxDiscs, &count);
+    if (err == noErr) {
+        err = CatalogAppendList(&gGlobals.incoming, discs, count);
+    }
+    DisposePtr((Ptr)discs);
+    
+    FinishDiscListing(err, count);
+}
+
+/*
+ * Fetch the next page of a paged listing (listTask's step)
+ */
+short ContinueDiscListing(USBODETask *task)
+{
+    OSErr err;
+    
+    (void)task;
+    
+    err = DiscPagerStep(&gGlobals.pager);
+    if (err == noErr) {
+        err = CatalogAppendPage(&gGlobals.incoming, &gGlobals.pager);
+    }
+    
+    if (err != noErr || gGlobals.pager.done) {
+        EndDiscPager(&gGlobals.pager);
+        FinishDiscListing(err, gGlobals.pager.total);
+        return kTaskDone;
+    }
+    
+    return kTaskContinue;
+}
+
+/*
+ * Wrap up a listing: publish the incoming catalog if it is complete
+ * and differs from the one on screen, format the rows, redraw and save
+ * the snapshot
+ * total is the number of entries the device reported.  A failed or
+ * incomplete listing is dropped and the last good catalog, with the
+ * generation it matches, stays.
+ */
+void FinishDiscListing(OSErr err, long total)
+{
+    if (err == noErr && !CatalogComplete(&gGlobals.incoming, total)) {
+        err = ioErr;
+    }
+    
+    if (err == noErr && CatalogHash(&gGlobals.incoming) !=
+                        CatalogHash(&gGlobals.catalog)) {
+        /* One swap of the column handles: never a torn list on screen */
+        CatalogSwap(&gGlobals.catalog, &gGlobals.incoming);
+        
+        /* Indices may have moved; UpdateMountedDisc below reads the
+           mounted one again where the firmware can say */
+        gGlobals.mountedIndex = kNoCurrentDisc;
+        
+        /* Format and sort the rows now so updates and typing only draw */
+        (void)RowCacheSync(&gGlobals.rows, &gGlobals.catalog);
+        (void)SortViewsSync(&gGlobals.sorts, &gGlobals.prefixes,
+                            &gGlobals.catalog);
+        (void)NameIndexSync(&gGlobals.names, &gGlobals.catalog);
+        if (gGlobals.window != nil) {
+            SetPort(gGlobals.window);
+            InvalRect(&gGlobals.window->portRect);
+        }
+    }
+    CatalogClear(&gGlobals.incoming);
+    
+    /* The catalog now matches the generation read before the listing */
+    if (err == noErr && gGlobals.generations == kExtensionPresent) {
+        gGlobals.generation = gGlobals.listingGeneration;
+        gGlobals.generationKnown = true;
+    }
+    
+    if (err == memFullErr) {
+        ShowError("\pNot enough memory to read disc list");
+    } else if (err != noErr) {
+        ShowError("\pError reading disc list");
+    } else {
+        SaveCatalogSnapshot();
+        UpdateMountedDisc();
     }
 }
 
@@ -326,9 +715,24 @@ void DoEvent(void)
 {
     Boolean gotEvent;
     char theChar;
+    long sleep;
+    UInt32 now;
+    UInt32 wait;
     
     if (gGlobals.hasWNE) {
-        gotEvent = WaitNextEvent(everyEvent, &gGlobals.event, kSleep, nil);
+        /* Sleep only until a background task can step or a waiting
+           mount is due */
+        now = USBODEMicroseconds();
+        wait = TaskQueueWait(&gGlobals.tasks, now);
+        if (gGlobals.mounts.pending && !TaskActive(&gGlobals.mountTask) &&
+            MountSchedulerWait(&gGlobals.mounts, now) < wait) {
+            wait = MountSchedulerWait(&gGlobals.mounts, now);
+        }
+        sleep = kSleep;
+        if (wait < (UInt32)kSleep * kMicrosPerTick) {
+            sleep = wait / kMicrosPerTick;
+        }
+        gotEvent = WaitNextEvent(everyEvent, &gGlobals.event, sleep, nil);
     } else {
         SystemTask();
         gotEvent = GetNextEvent(everyEvent, &gGlobals.event);
@@ -356,6 +760,10 @@ void DoEvent(void)
                 HandleActivate();
                 break;
         }
+    } else {
+        /* Null event: continue background work */
+        RunScheduledMount();
+        (void)TaskQueueRun(&gGlobals.tasks);
     }
 }
 
@@ -432,6 +840,8 @@ void DoMenuCommand(long menuResult)
                 RefreshDiscList();
             } else if (menuItem == iScanBus) {
                 ShowScanResults();
+            } else if (menuItem == iSaveTrace) {
+                SaveTrace();
             } else if (menuItem == iQuit) {
                 gGlobals.done = true;
             }
@@ -492,8 +902,7 @@ void HandleActivate(void)
 void DrawDiscList(void)
 {
     Str255 str;
-    Str255 sizeStr;
-    short i;
+    long i;
     short lineHeight;
     short topMargin;
     
@@ -507,73 +916,54 @@ void DrawDiscList(void)
     TextFace(bold);
     DrawString("\pUSBODE Disc Manager");
     
-    /* Draw disc count */
-    if (!gGlobals.deviceFound) {
+    /* Draw disc count; a saved catalog shows while the device is checked */
+    if (!gGlobals.deviceFound && gGlobals.catalog.count == 0) {
         MoveTo(10, topMargin);
         TextFace(normal);
-        DrawString("\pNo USBODE device found");
+        DrawString(TaskActive(&gGlobals.startTask) ?
+                   "\pChecking for the USBODE device…" :
+                   "\pNo USBODE device found");
         return;
     }
     
-    NumToString(gGlobals.discCount, str);
+    NumToString(gGlobals.catalog.count, str);
     MoveTo(10, topMargin);
     TextFace(normal);
     DrawString("\pAvailable discs: ");
     DrawString(str);
+    DrawDeviceStatus();
     
-    /* Draw disc list */
+    /* Draw disc list from the preformatted rows */
     topMargin += 20;
-    for (i = 0; i < gGlobals.discCount; i++) {
+    RowCacheLock(&gGlobals.rows);
+    for (i = 0; i < gGlobals.rows.count; i++) {
+        /* Rows past the bottom of the window are never seen */
+        if (topMargin + i * lineHeight - lineHeight >
+            gGlobals.window->portRect.bottom) {
+            break;
+        }
         MoveTo(20, topMargin + (i * lineHeight));
-        
-        /* Draw index */
-        NumToString(gGlobals.discs[i].index, str);
-        DrawString(str);
-        DrawString("\p. ");
-        
-        /* Draw name */
-        CStringToPascal((char *)gGlobals.discs[i].name, str);
-        DrawString(str);
-        
-        /* Draw size */
-        GetDiscSizeString(&gGlobals.discs[i], sizeStr);
-        DrawString("\p  (");
-        DrawString(sizeStr);
-        DrawString("\p)");
+        DrawString(RowCacheRow(&gGlobals.rows, i));
     }
+    RowCacheUnlock(&gGlobals.rows);
     
     /* Draw instructions */
-    MoveTo(10, topMargin + (gGlobals.discCount * lineHeight) + 30);
+    MoveTo(10, topMargin + (i * lineHeight) + 30);
     TextFace(italic);
     DrawString("\pDouble-click a disc to mount it, or use File > Refresh to update the list");
 }
 
 /*
- * Convert disc size to readable string
+ * Note after the disc count while the list shown is only the snapshot:
+ * the device is still being looked for, or was not found
  */
-void GetDiscSizeString(DiscEntry *disc, Str255 sizeStr)
+void DrawDeviceStatus(void)
 {
-    unsigned long size;
-    unsigned char spaceStr[4];
-    
-    /* Extract size from 5-byte big endian (skip first byte) */
-    size = ((unsigned long)disc->size[1] << 24) |
-           ((unsigned long)disc->size[2] << 16) |
-           ((unsigned long)disc->size[3] << 8) |
-           ((unsigned long)disc->size[4]);
-    
-    /* Convert to MB */
-    size = size / (1024 * 1024);
-    
-    NumToString(size, sizeStr);
-    
-    /* Append " MB" */
-    spaceStr[0] = 3;
-    spaceStr[1] = ' ';
-    spaceStr[2] = 'M';
-    spaceStr[3] = 'B';
-    BlockMove(spaceStr + 1, sizeStr + sizeStr[0] + 1, 3);
-    sizeStr[0] += 3;
+    if (TaskActive(&gGlobals.startTask)) {
+        DrawString("\p (checking device…)");
+    } else if (!gGlobals.deviceFound) {
+        DrawString("\p (device not found)");
+    }
 }
 
 /*
@@ -582,12 +972,9 @@ void GetDiscSizeString(DiscEntry *disc, Str255 sizeStr)
  */
 void MountSelectedDisc(void)
 {
-    OSErr err;
     short discIndex;
-    Str255 indexStr;
-    Str255 discName;
     
-    if (!gGlobals.deviceFound || gGlobals.discCount == 0) {
+    if (!gGlobals.deviceFound || gGlobals.catalog.count == 0) {
         ShowError("\pNo discs available to mount");
         return;
     }
@@ -598,21 +985,119 @@ void MountSelectedDisc(void)
      */
     discIndex = 0;
     
-    if (discIndex >= 0 && discIndex < gGlobals.discCount) {
-        /* Get disc name for confirmation */
-        CStringToPascal((char *)gGlobals.discs[discIndex].name, discName);
-        
-        /* Mount the disc */
-        err = SetActiveDisc(gGlobals.scsiID, gGlobals.discs[discIndex].index);
-        
-        if (err == noErr) {
-            /* Show success message */
-            ParamText(discName, "\p", "\p", "\p");
-            Alert(rUserAlert, nil);
-        } else {
-            ShowError("\pError mounting disc");
+    if (discIndex >= 0 && discIndex < gGlobals.catalog.count) {
+        RequestMount(CatalogIndex(&gGlobals.catalog, discIndex));
+    }
+}
+
+/*
+ * Ask for a disc to be mounted
+ * The mount goes out from idle time once requests stop arriving, and
+ * only the last one counts; see USBODE_MountScheduler.h.
+ */
+void RequestMount(unsigned short index)
+{
+    MountSchedulerRequest(&gGlobals.mounts, index, gGlobals.mountedIndex,
+                          USBODEMicroseconds());
+}
+
+/*
+ * Ask for a disc to be mounted by name, or by a prefix only it has
+ * Resolved against the catalog on screen as NameIndexResolve does; the
+ * mount then goes through the scheduler like any other, rather than
+ * MountDiscByName, so the event loop never waits for the disc.
+ */
+OSErr RequestMountByName(ConstStr255Param name)
+{
+    long entry;
+    OSErr err;
+    
+    err = NameIndexSync(&gGlobals.names, &gGlobals.catalog);
+    if (err == noErr) {
+        err = PrefixIndexSync(&gGlobals.prefixes, &gGlobals.catalog);
+    }
+    if (err == noErr) {
+        err = NameIndexResolve(&gGlobals.names, &gGlobals.prefixes,
+                               &gGlobals.catalog, name, &entry);
+    }
+    if (err == noErr) {
+        RequestMount(CatalogIndex(&gGlobals.catalog, entry));
+    }
+    
+    return err;
+}
+
+/*
+ * Start the waiting mount once it is due
+ * Not while discovery runs, nor while an earlier mount is still
+ * loading: the newer one goes out after it.
+ */
+void RunScheduledMount(void)
+{
+    unsigned short index;
+    
+    if (TaskActive(&gGlobals.startTask) || TaskActive(&gGlobals.mountTask)) {
+        return;
+    }
+    if (!gGlobals.deviceFound) {
+        MountSchedulerCancel(&gGlobals.mounts);
+        return;
+    }
+    
+    if (!MountSchedulerDue(&gGlobals.mounts, gGlobals.mountedIndex,
+                           USBODEMicroseconds(), &index)) {
+        return;
+    }
+    
+    BeginMountWait(&gGlobals.mountWait, gGlobals.scsiID, index, 0);
+    TaskStart(&gGlobals.tasks, &gGlobals.mountTask, ContinueMount, nil);
+}
+
+/*
+ * Send the next command of the mount (mountTask's step)
+ * The disc shows as mounted once SET NEXT CD is accepted; the alert
+ * waits for it to finish loading, polled between other work.
+ */
+short ContinueMount(USBODETask *task)
+{
+    MountWaiter *waiter;
+    Str255 discName;
+    UInt32 delay;
+    long i;
+    
+    waiter = &gGlobals.mountWait;
+    if (!MountWaitStep(waiter, &delay)) {
+        /* The first step sends SET NEXT CD and the first poll */
+        if (waiter->readiness.polls == 1) {
+            SetMountedDisc(waiter->index);
         }
+        TaskSleep(task, delay);
+        return kTaskContinue;
     }
+    
+    if (waiter->readiness.polls == 0) {
+        ShowError("\pError mounting disc. Please check SCSI connection.");
+        return kTaskDone;
+    }
+    
+    SetMountedDisc(waiter->index);
+    if (waiter->result != noErr) {
+        ShowError("\pThe disc was mounted but did not become ready.");
+        return kTaskDone;
+    }
+    
+    /* Show success message with the disc's name */
+    discName[0] = 0;
+    for (i = 0; i < gGlobals.catalog.count; i++) {
+        if (CatalogIndex(&gGlobals.catalog, i) == waiter->index) {
+            CatalogGetName(&gGlobals.catalog, i, discName);
+            break;
+        }
+    }
+    ParamText(discName, "\p", "\p", "\p");
+    Alert(rUserAlert, nil);
+    
+    return kTaskDone;
 }
 
 /*
@@ -624,112 +1109,141 @@ void ShowError(Str255 message)
     Alert(rUserAlert, nil);
 }
 
+/*
+ * TraceWriteCSV output to an open data fork
+ */
+static OSErr WriteTraceText(void *refCon, const char *text, long length)
+{
+    long count;
+    
+    count = length;
+    return FSWrite(*(short *)refCon, &count, text);
+}
+
+/*
+ * Save the command trace as a text file for usbode-trace
+ */
+void SaveTrace(void)
+{
+    StandardFileReply reply;
+    short refNum;
+    OSErr err;
+    
+    StandardPutFile("\pSave command trace as:", "\pUSBODE Trace", &reply);
+    if (!reply.sfGood) {
+        return;
+    }
+    
+    err = FSpCreate(&reply.sfFile, 'ttxt', 'TEXT', reply.sfScript);
+    if (err == dupFNErr) {
+        err = noErr;    /* replacing: reuse the file, truncated below */
+    }
+    if (err == noErr) {
+        err = FSpOpenDF(&reply.sfFile, fsWrPerm, &refNum);
+    }
+    if (err == noErr) {
+        err = SetEOF(refNum, 0);
+        if (err == noErr) {
+            err = TraceWriteCSV(WriteTraceText, &refNum);
+        }
+        FSClose(refNum);
+    }
+    
+    if (err != noErr) {
+        ShowError("\pCould not save the command trace");
+    }
+}
+
+/*
+ * Append a C string to a Pascal string, as much as fits
+ */
+static void AppendCText(Str255 message, const char *text)
+{
+    while (*text != '\0' && message[0] < 255) {
+        message[++message[0]] = (unsigned char)*text++;
+    }
+}
+
 /*
  * Show SCSI bus scan results in a dialog
+ * Every ID is probed again, and a USBODE found here becomes the device
+ * the application uses if none was found at startup.
  */
 void ShowScanResults(void)
 {
+    const InquiryIdentity *identity;
     short id;
+    short state;
     short deviceCount;
-    OSErr err;
+    short usbodeID;
     Str255 resultMsg;
-    Str255 tempStr;
-    short scsiResult;
+    char idText[8];
     
-    deviceCount = 0;
+    deviceCount = DiscoveryScanBus(&gGlobals.discovery);
+    usbodeID = -1;
     
-    /* Build result message */
-    BlockMove("\pSCSI/USB Device Scan:\r\r", resultMsg, 24);
-    resultMsg[0] = 23;
+    resultMsg[0] = 0;
+    AppendCText(resultMsg, "SCSI/USB Device Scan:\r\r");
     
-    /* Try each SCSI ID from 0 to 6 */
-    for (id = 0; id < 7; id++) {
-        err = SCSIGet();
-        if (err != noErr) continue;
+    for (id = 0; id < kDiscoveryIDCount; id++) {
+        state = DiscoveryState(&gGlobals.discovery, id);
+        if (state == kProbeEmpty) {
+            continue;
+        }
         
-        err = SCSISelect(id);
-        if (err == noErr) {
-            /* Device found */
-            deviceCount++;
-            
-            /* Add to message: "ID X: " */
-            tempStr[0] = 5;
-            tempStr[1] = 'I';
-            tempStr[2] = 'D';
-            tempStr[3] = ' ';
-            tempStr[4] = '0' + id;
-            tempStr[5] = ':';
-            tempStr[6] = ' ';
-            tempStr[0] = 6;
-            
-            /* Append to result */
-            if (resultMsg[0] + tempStr[0] < 255) {
-                BlockMove(tempStr + 1, resultMsg + resultMsg[0] + 1, tempStr[0]);
-                resultMsg[0] += tempStr[0];
+        /* "ID X: vendor product" */
+        BlockMove("ID 0: ", idText, 7);
+        idText[3] = '0' + id;
+        AppendCText(resultMsg, idText);
+        
+        identity = DiscoveryIdentity(&gGlobals.discovery, id);
+        if (identity != nil && identity->vendor[0] != '\0') {
+            AppendCText(resultMsg, identity->vendor);
+            AppendCText(resultMsg, " ");
+            AppendCText(resultMsg, identity->product);
+        } else {
+            AppendCText(resultMsg, "Unknown Device");
+        }
+        
+        if (state == kProbeUSBODE) {
+            if (usbodeID < 0) {
+                usbodeID = id;
             }
-            
-            /* Check if USBODE */
-            if (IsUSBODEDevice(id)) {
-                BlockMove("\pUSBODE Device", tempStr, 15);
-                tempStr[0] = 14;
-                
-                /* Mark as current if it's our device */
-                if (id == gGlobals.scsiID && gGlobals.deviceFound) {
-                    BlockMove("\pUSBODE (active)", tempStr, 17);
-                    tempStr[0] = 16;
-                }
+            if (id == gGlobals.scsiID && gGlobals.deviceFound) {
+                AppendCText(resultMsg, " (active)");
             } else {
-                BlockMove("\pUnknown Device", tempStr, 16);
-                tempStr[0] = 15;
-            }
-            
-            /* Append device type and newline */
-            if (resultMsg[0] + tempStr[0] + 1 < 255) {
-                BlockMove(tempStr + 1, resultMsg + resultMsg[0] + 1, tempStr[0]);
-                resultMsg[0] += tempStr[0];
-                resultMsg[resultMsg[0] + 1] = '\r';
-                resultMsg[0] += 1;
+                AppendCText(resultMsg, " (USBODE)");
             }
         }
-        
-        SCSIComplete(&scsiResult, nil, 0);
+        AppendCText(resultMsg, "\r");
     }
     
     /* Add summary */
     if (deviceCount == 0) {
-        BlockMove("\rNo devices found.", tempStr, 19);
-        tempStr[0] = 18;
+        AppendCText(resultMsg, "\rNo devices found.");
     } else {
-        tempStr[0] = 8;
-        tempStr[1] = '\r';
-        tempStr[2] = '\r';
-        tempStr[3] = 'T';
-        tempStr[4] = 'o';
-        tempStr[5] = 't';
-        tempStr[6] = 'a';
-        tempStr[7] = 'l';
-        tempStr[8] = ':';
-        tempStr[9] = ' ';
-        tempStr[10] = '0' + deviceCount;
-        tempStr[0] = 10;
-    }
-    
-    if (resultMsg[0] + tempStr[0] < 255) {
-        BlockMove(tempStr + 1, resultMsg + resultMsg[0] + 1, tempStr[0]);
-        resultMsg[0] += tempStr[0];
+        BlockMove("\rTotal: 0", idText, 10);
+        idText[8] = '0' + deviceCount;
+        AppendCText(resultMsg, idText);
     }
     
     /* Add note about USB devices */
-    BlockMove("\r\rNote: USB devices may appear as SCSI.", tempStr, 41);
-    tempStr[0] = 40;
-    if (resultMsg[0] + tempStr[0] < 255) {
-        BlockMove(tempStr + 1, resultMsg + resultMsg[0] + 1, tempStr[0]);
-        resultMsg[0] += tempStr[0];
-    }
+    AppendCText(resultMsg, "\r\rNote: USB devices may appear as SCSI.");
     
     /* Show in alert */
     ParamText(resultMsg, "\p", "\p", "\p");
     Alert(rUserAlert, nil);
+    
+    /* Adopt a device that was not there at startup */
+    if (!gGlobals.deviceFound && usbodeID >= 0) {
+        gGlobals.scsiID = usbodeID;
+        gGlobals.deviceFound = true;
+        NegotiateCapabilities();
+        if (usbodeID != gGlobals.savedID) {
+            SaveDiscoveryPrefs(usbodeID);
+        }
+        RefreshDiscList();
+    }
 }
 
 /*
@@ -29,6 +29,23 @@
 #include <Traps.h>
 #include <Devices.h>
 #include <SCSI.h>
+#include <Files.h>
+#include <StandardFile.h>
+#include <Folders.h>
+#include <Script.h>
+
+#include "USBODE_Protocol.h"
+#include "USBODE_Discovery.h"
+#include "USBODE_Catalog.h"
+#include "USBODE_Snapshot.h"
+#include "USBODE_RowCache.h"
+#include "USBODE_PrefixIndex.h"
+#include "USBODE_SortView.h"
+#include "USBODE_NameIndex.h"
+#include "USBODE_ListLayout.h"
+#include "USBODE_MountScheduler.h"
+#include "USBODE_Task.h"
+#include "USBODE_Trace.h"
 
 /* Compatibility defines for older CodeWarrior versions */
 #ifndef _WaitNextEvent
@@ -43,14 +60,7 @@
 #define kBaseResID          128
 #define kMoveToFront        (WindowPtr)-1L
 #define kSleep              20
-#define kMaxDiscs           100
-
-/* SCSI Command Definitions for USBODE */
-#define SCSI_CMD_LIST_DEVICES   0xD9
-#define SCSI_CMD_NUM_CDS        0xDA
-#define SCSI_CMD_LIST_CDS       0xD7
-#define SCSI_CMD_LIST_FILES     0xD0
-#define SCSI_CMD_SET_NEXT_CD    0xD8
+#define kMicrosPerTick      16667L
 
 /* Window Resource IDs */
 #define rMenuBar            128
@@ -65,7 +75,8 @@
 #define mFile               129
 #define iRefresh            1
 #define iScanBus            2
-#define iQuit               4
+#define iSaveTrace          3
+#define iQuit               5
 
 #define mEdit               130
 
@@ -74,13 +85,28 @@
 #define kMountButton        129
 #define kRefreshButton      130
 
-/* Disc Entry Structure (matches USBODE protocol) */
+/* Preferences file, holding where the USBODE was last found */
+#define kCreatorType        'USBO'
+#define kPrefsFileType      'pref'
+#define kPrefsFileName      "\pUSBODE Preferences"
+#define kPrefsVersion       1
+
+/* Catalog snapshot file, in the Preferences folder as well */
+#define kSnapshotFileType   'USBS'
+#define kSnapshotFileName   "\pUSBODE Catalog"
+
 typedef struct {
-    unsigned char index;
-    unsigned char type;
-    unsigned char name[33];     /* 32 chars + null terminator */
-    unsigned char size[5];      /* 40-bit big endian size */
-} DiscEntry;
+    OSType      signature;      /* kCreatorType */
+    short       version;        /* kPrefsVersion */
+    short       lastID;         /* SCSI ID, or -1 */
+} DiscoveryPrefs;
+
+/* Support for an optional protocol extension, probed on first use */
+enum {
+    kExtensionUnknown   = 0,
+    kExtensionAbsent    = 1,
+    kExtensionPresent   = 2
+};
 
 /* Application Globals */
 typedef struct {
@@ -91,12 +117,38 @@ typedef struct {
     MenuHandle  appleMenu;
     MenuHandle  fileMenu;
     MenuHandle  editMenu;
-    DiscEntry   discs[kMaxDiscs];
-    short       discCount;
+    DiscCatalog catalog;
+    DiscCatalog incoming;       /* shadow a listing fills, then swapped in */
+    RowCache    rows;           /* catalog formatted for drawing */
+    PrefixIndex prefixes;       /* catalog in folded name order */
+    SortViews   sorts;          /* ...and by size, for the list */
+    NameIndex   names;          /* catalog by folded name, for mount by name */
+    TaskQueue   tasks;          /* background work, stepped on idle */
+    USBODETask  startTask;      /* discovery and the first listing */
+    DiscoverySearch search;     /* ...its place on the bus */
+    USBODETask  listTask;       /* paged listing, a page per step */
+    DiscPager   pager;          /* ...its place in the catalog */
+    USBODETask  mountTask;      /* mount waiting for the disc to load */
+    MountWaiter mountWait;      /* ...its place in the mount */
+    UInt32      snapshotHash;   /* CatalogHash of the saved snapshot */
+    Boolean     snapshotHasGeneration;
+    UInt32      snapshotGeneration; /* generation saved with the snapshot */
+    short       paging;         /* kExtension...: LIST CDS PAGED */
+    short       generations;    /* kExtension...: CATALOG CHANGES */
+    DeviceInfo  device;         /* GET DEVICE INFO, read at discovery */
+    unsigned short mountedIndex;/* device index, or kNoCurrentDisc */
+    MountScheduler mounts;      /* mount requests waiting to be sent */
+    Boolean     generationKnown;
+    UInt32      generation;     /* device generation the catalog matches */
+    UInt32      listingGeneration;  /* read before the listing began */
+    DiscoveryCache discovery;   /* what each SCSI ID held */
+    short       savedID;        /* lastID in the preferences file */
     short       scsiID;
     Boolean     deviceFound;
 } Globals;
 
+extern Globals gGlobals;
+
 /* Function Prototypes */
 
 /* Initialization */
@@ -105,14 +157,15 @@ void MenuBarInit(void);
 void WindowInit(void);
 Boolean FindUSBODEDevice(short *scsiID);
 short ScanSCSIBus(void);  /* Returns number of devices found */
-Boolean IsUSBODEDevice(short scsiID);  /* Test if device responds to USBODE commands */
+Boolean IsUSBODEDevice(short scsiID);  /* Probe one ID (INQUIRY, short timeout) */
+short StartupDiscovery(USBODETask *task);  /* Find the device and revalidate the snapshot */
+void NegotiateCapabilities(void);  /* GET DEVICE INFO picks the listing path */
+OSErr OpenPrefsFile(ConstStr255Param name, OSType fileType, SInt8 permission,
+                    short *refNum);
+short LoadDiscoveryPrefs(void);  /* Last USBODE ID from the preferences, or -1 */
+void SaveDiscoveryPrefs(short scsiID);
 
-/* SCSI Communication */
-OSErr SendSCSICommand(short scsiID, unsigned char cmd, unsigned char param, 
-                      void *buffer, long bufferSize, long *actualSize);
-OSErr GetDiscCount(short scsiID, unsigned char *count);
-OSErr GetDiscList(short scsiID, DiscEntry *discs, unsigned char count);
-OSErr SetActiveDisc(short scsiID, unsigned char index);
+/* SCSI Communication: see USBODE_Protocol.h */
 
 /* Event Handling */
 void EventLoop(void);
@@ -125,13 +178,22 @@ void HandleActivate(void);
 
 /* UI Functions */
 void RefreshDiscList(void);
+short ContinueDiscListing(USBODETask *task);
+void FinishDiscListing(OSErr err, long total);
+void LoadCatalogSnapshot(void);
+void SaveCatalogSnapshot(void);
 void DrawDiscList(void);
+void DrawDeviceStatus(void);   /* "checking device" beside a saved catalog */
 void MountSelectedDisc(void);  /* Basic placeholder - use USBODE_UI.c for full implementation */
+void RequestMount(unsigned short index);  /* Coalesced; sent from idle time */
+OSErr RequestMountByName(ConstStr255Param name);
+void RunScheduledMount(void);
+short ContinueMount(USBODETask *task);
 void ShowError(Str255 message);
 void ShowScanResults(void);  /* Display SCSI bus scan results */
+void SaveTrace(void);  /* Write the command trace to a text file */
 
 /* Utility Functions */
-void GetDiscSizeString(DiscEntry *disc, Str255 sizeStr);
 void CStringToPascal(const char *cStr, Str255 pStr);
 void PascalToCString(ConstStr255Param pStr, char *cStr, short maxLen);
 
@@ -63,7 +63,7 @@ resource 'MENU' (128, preload) {
 resource 'MENU' (129, preload) {
     129,
     textMenuProc,
-    0b1111111111111011,  /* Items 1,2,4 enabled (separator at 3 disabled) */
+    0b1111111111101111,  /* All items enabled but the separator (item 4) */
     enabled,
     "File",
     {
@@ -71,6 +71,8 @@ resource 'MENU' (129, preload) {
             noIcon, "R", noMark, plain;
         "Scan SCSI Bus",
             noIcon, "S", noMark, plain;
+        "Save Trace…",
+            noIcon, noKey, noMark, plain;
         "-",
             noIcon, noKey, noMark, plain;
         "Quit",
@@ -0,0 +1,1111 @@
+/*
+ * USBODE_Bench.c
+ * Host benchmark suite for the protocol core
+ *
+ * Drives the protocol calls the application makes (device discovery,
+ * NUMBER OF CDS, LIST CDS, SET NEXT CD, complete catalog refreshes in
+ * both listing formats and refreshes that fetch only what changed) against the software
+ * target in USBODE_Emulator.c, for catalogs of 10 to 10,000 images and
+ * for several emulated buses, plus the wire decoding microbenchmarks.
+ * Waiting mounts are timed with and without linked commands.
+ * The tasks group steps a refresh and a mount together through the
+ * application's task queue and reports the longest single step: how
+ * long the event loop would go without an event.  The search group
+ * times sorting a listed catalog into the type-ahead index and the
+ * keystrokes of a search, against scanning every name for each.  It
+ * also times finding a disc by name through the name hash, against a
+ * scan.  The sort group times keeping the list's size order, against
+ * sorting it with string compares.
+ * Results are written as JSON so runs can be compared release to
+ * release.
+ *
+ * The emulator only accounts for bus time rather than sleeping, so an
+ * operation's latency is the host CPU time it took plus the modelled
+ * bus time it used.  Runs are quick and the numbers are repeatable.
+ *
+ *   usbode-bench [max-entries]      (default 10000, at most 65535)
+ */
+
+#include "USBODE_Catalog.h"
+#include "USBODE_RowCache.h"
+#include "USBODE_SortView.h"
+#include "USBODE_NameIndex.h"
+#include "USBODE_Discovery.h"
+#include "USBODE_Emulator.h"
+#include "USBODE_Task.h"
+
+#ifdef USBODE_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define kDefaultMaxEntries  10000L
+#define kMinIterations      20L
+#define kMaxIterations      2000L
+#define kTargetMicros       100000UL    /* wall time per operation */
+#define kBenchSCSIID        3
+#define kBenchLoadMicros    20000UL     /* image load, for the tasks group */
+#define kBenchSearch        "disc image 0042"   /* typed a key at a time */
+
+/* Emulated bus: selection and firmware time per command, data rate */
+typedef struct {
+    const char      *name;
+    UInt32          selectMicros;
+    UInt32          commandMicros;
+    UInt32          bytesPerSecond;
+} BusProfile;
+
+static const BusProfile gBuses[] = {
+    { "ideal",      0,   0,   kBusUnlimited },
+    { "scsi1",      100, 250, kBusSCSI1 },
+    { "scsi2-fast", 50,  150, kBusSCSI2Fast }
+};
+
+static const long gSizes[] = { 10, 100, 1000, 10000 };
+
+/* One benchmarked operation; returns noErr or the failing result */
+typedef OSErr (*BenchOpProcPtr)(long iteration);
+
+typedef struct {
+    const char      *name;
+    BenchOpProcPtr  proc;
+    BenchOpProcPtr  prepare;    /* untimed, before the first run, or nil */
+    Boolean         paged;      /* needs LIST CDS PAGED */
+} BenchOp;
+
+/* Cost of one background task's steps, host plus modelled bus time */
+typedef struct {
+    UInt32          startMicros;
+    unsigned long   startBus;
+    unsigned long   steps;
+    UInt32          longest;
+    double          total;
+} StepCost;
+
+static USBODEEmulator *gEmulator;
+static DiscCatalog gCatalog;
+static DiscCatalog gIncoming;
+static UInt32 gGeneration;
+static RowCache gRows;
+static DiscEntry gDiscs[kMaxDiscs];
+static UInt32 *gSamples;
+static Boolean gFirstResult = true;
+static DiscPager gPager;
+static MountWaiter gWaiter;
+static OSErr gTaskErr;
+
+static void BenchImageName(long i, char *name);
+static unsigned long BenchImageSize(long i);
+static OSErr OpCount(long iteration);
+static OSErr OpList(long iteration);
+static OSErr OpMount(long iteration);
+static OSErr OpMountWait(long iteration);
+static OSErr PrepareLinked(long iteration);
+static OSErr OpRefresh(long iteration);
+static OSErr OpRefreshCompressed(long iteration);
+static OSErr OpRefreshLongNames(long iteration);
+static OSErr OpRefreshLegacy(long iteration);
+static OSErr PrepareRefreshDelta(long iteration);
+static OSErr OpRefreshDelta(long iteration);
+static OSErr OpDiscoverCold(long iteration);
+static OSErr OpDiscoverCached(long iteration);
+
+static const BenchOp gOps[] = {
+    { "count",          OpCount,            nil,    false },
+    { "list",           OpList,             nil,    false },
+    { "mount",          OpMount,            nil,    true },
+    { "mount_wait",     OpMountWait,        nil,    true },
+    { "mount_wait_linked", OpMountWait,     PrepareLinked, true },
+    { "refresh",        OpRefresh,          nil,    true },
+    { "refresh_compressed", OpRefreshCompressed, nil, true },
+    { "refresh_long_names", OpRefreshLongNames, nil, true },
+    { "refresh_legacy", OpRefreshLegacy,    nil,    false },
+    { "refresh_delta",  OpRefreshDelta,     PrepareRefreshDelta, true },
+    { "discover_cold",  OpDiscoverCold,     nil,    false },
+    { "discover_cached", OpDiscoverCached,  nil,    false }
+};
+
+#define kBusCount   ((long)(sizeof(gBuses) / sizeof(gBuses[0])))
+#define kSizeCount  ((long)(sizeof(gSizes) / sizeof(gSizes[0])))
+#define kOpCount    ((long)(sizeof(gOps) / sizeof(gOps[0])))
+
+static int CompareMicros(const void *a, const void *b);
+static void BeginResult(const char *group, const char *bus, long entries,
+                        const char *op);
+static void RunOp(const BusProfile *bus, long entries, const BenchOp *op);
+static void RunDecode(long entries);
+static void BeginStep(StepCost *cost);
+static void EndStep(StepCost *cost);
+static short BenchListStep(USBODETask *task);
+static short BenchMountStep(USBODETask *task);
+static void RunTasks(const BusProfile *bus, long entries);
+static long ScanPrefix(const unsigned char *prefix, short length);
+static void RunSearch(long entries);
+static long ScanName(ConstStr255Param name);
+static void RunNames(long entries);
+static int CompareBySize(const void *a, const void *b);
+static void RunSort(long entries);
+
+/*
+ * Name and size of emulated image i
+ */
+static void BenchImageName(long i, char *name)
+{
+    snprintf(name, kEmulatorMaxNameLength + 1, "Disc Image %05ld.iso", i);
+}
+
+static unsigned long BenchImageSize(long i)
+{
+    return 650UL * 1024 * 1024 - i * 2048;
+}
+
+/*
+ * NUMBER OF CDS
+ */
+static OSErr OpCount(long iteration)
+{
+    unsigned char count;
+
+    (void)iteration;
+    return GetDiscCount(kBenchSCSIID, &count);
+}
+
+/*
+ * LIST CDS of everything NUMBER OF CDS reports (at most 100)
+ */
+static OSErr OpList(long iteration)
+{
+    long visible;
+
+    (void)iteration;
+    visible = (gEmulator->imageCount < kMaxDiscs) ?
+              gEmulator->imageCount : kMaxDiscs;
+    return GetDiscList(kBenchSCSIID, gDiscs, (unsigned char)visible);
+}
+
+/*
+ * SET NEXT CD, walking through the catalog
+ */
+static OSErr OpMount(long iteration)
+{
+    return SetActiveDiscIndex(kBenchSCSIID,
+                              (unsigned short)(iteration % gEmulator->imageCount));
+}
+
+/*
+ * Mount and poll until the disc is ready; the emulator loads at once,
+ * so this is the command overhead: the unit attention and its sense
+ */
+static OSErr OpMountWait(long iteration)
+{
+    MountReadiness readiness;
+
+    return MountAndWait(kBenchSCSIID,
+                        (unsigned short)(iteration % gEmulator->imageCount),
+                        0, &readiness);
+}
+
+/*
+ * Let the target link commands, so the mount and its first poll share
+ * one selection
+ */
+static OSErr PrepareLinked(long iteration)
+{
+    (void)iteration;
+    gEmulator->linkedCommands = true;
+    return noErr;
+}
+
+/*
+ * What RefreshDiscList does on a device with paged listing: every page
+ * into the catalog, then the rows formatted for drawing
+ */
+static OSErr OpRefresh(long iteration)
+{
+    OSErr err;
+
+    (void)iteration;
+    err = CatalogListPaged(&gCatalog, kBenchSCSIID, kDefaultPageEntries,
+                           kListFormatFixed);
+    if (err == noErr) {
+        err = RowCacheSync(&gRows, &gCatalog);
+    }
+    return err;
+}
+
+/*
+ * The same with front-coded pages, as on firmware that offers them
+ */
+static OSErr OpRefreshCompressed(long iteration)
+{
+    OSErr err;
+
+    (void)iteration;
+    err = CatalogListPaged(&gCatalog, kBenchSCSIID, kDefaultPageEntries,
+                           kListFormatFrontCoded);
+    if (err == noErr) {
+        err = RowCacheSync(&gRows, &gCatalog);
+    }
+    return err;
+}
+
+/*
+ * The same with front-coded long-name pages, converted from UTF-8
+ */
+static OSErr OpRefreshLongNames(long iteration)
+{
+    OSErr err;
+
+    (void)iteration;
+    err = CatalogListPaged(&gCatalog, kBenchSCSIID, kDefaultPageEntries,
+                           kListFormatFrontCoded | kListFormatLongNames);
+    if (err == noErr) {
+        err = RowCacheSync(&gRows, &gCatalog);
+    }
+    return err;
+}
+
+/*
+ * What RefreshDiscList does on older firmware
+ */
+static OSErr OpRefreshLegacy(long iteration)
+{
+    unsigned char count;
+    OSErr err;
+
+    (void)iteration;
+    CatalogClear(&gCatalog);
+    err = FetchDiscList(kBenchSCSIID, kRefreshAuto, gDiscs, kMaxDiscs, &count);
+    if (err == noErr) {
+        err = CatalogAppendList(&gCatalog, gDiscs, count);
+    }
+    if (err == noErr) {
+        err = RowCacheSync(&gRows, &gCatalog);
+    }
+    return err;
+}
+
+/*
+ * A full listing and its generation, for the delta refreshes to start from
+ */
+static OSErr PrepareRefreshDelta(long iteration)
+{
+    OSErr err;
+
+    (void)iteration;
+    err = GetCatalogGeneration(kBenchSCSIID, &gGeneration);
+    if (err == noErr) {
+        err = CatalogListPaged(&gCatalog, kBenchSCSIID, kDefaultPageEntries,
+                               kListFormatFixed);
+    }
+    return err;
+}
+
+/*
+ * What RefreshDiscList does on a device that keeps catalog generations,
+ * after one image was replaced on the device (by an identical one, so
+ * the catalog the other operations see stays the same)
+ */
+static OSErr OpRefreshDelta(long iteration)
+{
+    CatalogChanges changes;
+    char name[kEmulatorMaxNameLength + 1];
+    long index;
+    OSErr err;
+
+    index = (iteration * 7919L) % gEmulator->imageCount;
+    BenchImageName(index, name);
+    err = EmulatorReplaceImage(gEmulator, index, name, BenchImageSize(index));
+    if (err != noErr) {
+        return err;
+    }
+
+    err = GetCatalogChanges(kBenchSCSIID, gGeneration, &changes);
+    if (err == noErr) {
+        err = CatalogApplyChanges(&gIncoming, &gCatalog, &changes,
+                                  kBenchSCSIID, kDefaultPageEntries,
+                                  kListFormatFixed);
+    }
+    if (err == noErr) {
+        CatalogSwap(&gCatalog, &gIncoming);
+        gGeneration = changes.generation;
+        err = RowCacheSync(&gRows, &gCatalog);
+    }
+    return err;
+}
+
+/*
+ * Discovery at first launch: nothing cached, IDs probed in order
+ */
+static OSErr OpDiscoverCold(long iteration)
+{
+    DiscoveryCache cache;
+    short scsiID;
+
+    (void)iteration;
+    InitDiscoveryCache(&cache, -1);
+    return DiscoverUSBODE(&cache, &scsiID) ? noErr : scCommErr;
+}
+
+/*
+ * Discovery at a later launch, starting from the saved ID
+ */
+static OSErr OpDiscoverCached(long iteration)
+{
+    DiscoveryCache cache;
+    short scsiID;
+
+    (void)iteration;
+    InitDiscoveryCache(&cache, kBenchSCSIID);
+    return DiscoverUSBODE(&cache, &scsiID) ? noErr : scCommErr;
+}
+
+static int CompareMicros(const void *a, const void *b)
+{
+    UInt32 x = *(const UInt32 *)a;
+    UInt32 y = *(const UInt32 *)b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+/*
+ * Start one JSON result object
+ */
+static void BeginResult(const char *group, const char *bus, long entries,
+                        const char *op)
+{
+    printf("%s\n    {\"group\": \"%s\", \"bus\": \"%s\", \"entries\": %ld, "
+           "\"op\": \"%s\"", gFirstResult ? "" : ",", group, bus, entries, op);
+    gFirstResult = false;
+}
+
+/*
+ * Time one operation on one catalog size and bus
+ */
+static void RunOp(const BusProfile *bus, long entries, const BenchOp *op)
+{
+    EmulatorStats before;
+    UInt32 wallStart;
+    UInt32 opStart;
+    UInt32 total;
+    double sum;
+    long iterations;
+    OSErr err;
+
+    EmulatorSetTiming(gEmulator, bus->selectMicros, bus->commandMicros,
+                      bus->bytesPerSecond);
+    gEmulator->pagedListing = op->paged;
+    gEmulator->linkedCommands = false;
+    if (op->prepare != nil && (err = (*op->prepare)(0)) != noErr) {
+        BeginResult("protocol", bus->name, entries, op->name);
+        printf(", \"error\": %d}", err);
+        return;
+    }
+    EmulatorResetStats(gEmulator);
+
+    sum = 0;
+    err = noErr;
+    iterations = 0;
+    wallStart = USBODEMicroseconds();
+
+    while (iterations < kMaxIterations &&
+           (iterations < kMinIterations ||
+            USBODEMicroseconds() - wallStart < kTargetMicros)) {
+        before = gEmulator->stats;
+        opStart = USBODEMicroseconds();
+        err = (*op->proc)(iterations);
+        total = (USBODEMicroseconds() - opStart) +
+                (gEmulator->stats.busMicros - before.busMicros);
+        if (err != noErr) {
+            break;
+        }
+        gSamples[iterations++] = total;
+        sum += total;
+    }
+
+    BeginResult("protocol", bus->name, entries, op->name);
+    if (err != noErr || iterations == 0) {
+        printf(", \"error\": %d}", err);
+        return;
+    }
+
+    qsort(gSamples, (size_t)iterations, sizeof(UInt32), CompareMicros);
+
+    printf(", \"iterations\": %ld, \"ops_per_sec\": %.1f, "
+           "\"mean_us\": %.1f, \"p50_us\": %lu, \"p99_us\": %lu, "
+           "\"commands_per_op\": %.2f, \"selections_per_op\": %.2f, "
+           "\"bytes_per_op\": %.0f}",
+           iterations,
+           (sum > 0) ? (iterations * 1e6) / sum : 0.0,
+           sum / iterations,
+           (unsigned long)gSamples[iterations / 2],
+           (unsigned long)gSamples[(iterations * 99) / 100],
+           (double)gEmulator->stats.commands / iterations,
+           (double)gEmulator->stats.selections / iterations,
+           (double)gEmulator->stats.bytesMoved / iterations);
+}
+
+/*
+ * Decoding a reply already in memory, no bus involved
+ */
+static void RunDecode(long entries)
+{
+    unsigned char *wire;
+    unsigned char *coded;
+    long *pageOffsets;
+    DiscEntry *discs;
+    WireEntryView view;
+    const unsigned char *entry;
+    const unsigned char *previous;
+    UInt32 start;
+    UInt32 elapsed;
+    long runs;
+    long length;
+    long codedSize;
+    long pages;
+    long page;
+    long first;
+    long i;
+
+    pages = (entries + kDefaultPageEntries - 1) / kDefaultPageEntries;
+    wire = (unsigned char *)NewPtrClear(entries * kWireEntrySize);
+    coded = (unsigned char *)NewPtr(entries * PageEntryMaxSize(kListFormatFrontCoded));
+    pageOffsets = (long *)NewPtr((pages + 1) * (long)sizeof(long));
+    discs = (DiscEntry *)NewPtr(entries * (long)sizeof(DiscEntry));
+    if (wire == nil || coded == nil || pageOffsets == nil || discs == nil) {
+        if (wire != nil) DisposePtr((Ptr)wire);
+        if (coded != nil) DisposePtr((Ptr)coded);
+        if (pageOffsets != nil) DisposePtr((Ptr)pageOffsets);
+        if (discs != nil) DisposePtr((Ptr)discs);
+        return;
+    }
+
+    /* Mix short names with ones that fill the whole field */
+    for (i = 0; i < entries; i++) {
+        length = snprintf((char *)wire + i * kWireEntrySize + kWireNameOffset,
+                          kWireNameLength, (i % 4) ? "Disc %05ld.iso" :
+                          "Collection volume %05ld (1998).toast", i);
+        if (length >= kWireNameLength) {
+            wire[i * kWireEntrySize + kWireNameOffset + kWireNameLength - 1] = 't';
+        }
+        wire[i * kWireEntrySize + kWireSizeOffset + 1] = 0x28;
+    }
+    InitWireView(&view, wire, entries * kWireEntrySize);
+
+    /* The same entries front-coded, a page at a time as a device sends them */
+    codedSize = 0;
+    for (page = 0; page < pages; page++) {
+        pageOffsets[page] = codedSize;
+        previous = nil;
+        first = page * kDefaultPageEntries;
+        for (i = first; i < entries && i < first + kDefaultPageEntries; i++) {
+            entry = WireEntryAt(&view, i);
+            codedSize += EncodePackedEntry(kListFormatFrontCoded,
+                            WireName(entry), WireNameLength(entry),
+                            (previous != nil) ? WireName(previous) : nil,
+                            (previous != nil) ? WireNameLength(previous) : 0,
+                            WireType(entry), DecodeSizeKilobytes(WireSize(entry)),
+                            coded + codedSize);
+            previous = entry;
+        }
+    }
+    pageOffsets[pages] = codedSize;
+
+    runs = 0;
+    start = USBODEMicroseconds();
+    do {
+        DecodeWireEntries(wire, entries, discs);
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+    } while (elapsed < kTargetMicros);
+    BeginResult("decode", "none", entries, "decode_entries");
+    printf(", \"ns_per_entry\": %.1f}", (elapsed * 1000.0) / ((double)runs * entries));
+
+    runs = 0;
+    start = USBODEMicroseconds();
+    do {
+        CatalogClear(&gCatalog);
+        CatalogAppendWire(&gCatalog, &view, 0);
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+    } while (elapsed < kTargetMicros);
+    BeginResult("decode", "none", entries, "catalog_append_wire");
+    printf(", \"ns_per_entry\": %.1f, \"bytes_per_entry\": %.1f}",
+           (elapsed * 1000.0) / ((double)runs * entries), (double)kWireEntrySize);
+
+    runs = 0;
+    start = USBODEMicroseconds();
+    do {
+        CatalogClear(&gCatalog);
+        for (page = 0; page < pages; page++) {
+            first = page * kDefaultPageEntries;
+            CatalogAppendPacked(&gCatalog, kListFormatFrontCoded,
+                                coded + pageOffsets[page],
+                                pageOffsets[page + 1] - pageOffsets[page],
+                                (entries - first < kDefaultPageEntries) ?
+                                    entries - first : kDefaultPageEntries,
+                                (unsigned short)first);
+        }
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+    } while (elapsed < kTargetMicros);
+    BeginResult("decode", "none", entries, "catalog_append_front_coded");
+    printf(", \"ns_per_entry\": %.1f, \"bytes_per_entry\": %.1f}",
+           (elapsed * 1000.0) / ((double)runs * entries),
+           (double)codedSize / entries);
+
+    DisposePtr((Ptr)discs);
+    DisposePtr((Ptr)pageOffsets);
+    DisposePtr((Ptr)coded);
+    DisposePtr((Ptr)wire);
+}
+
+/*
+ * Time a task step, as the host time plus the bus time it used
+ */
+static void BeginStep(StepCost *cost)
+{
+    cost->startBus = gEmulator->stats.busMicros;
+    cost->startMicros = USBODEMicroseconds();
+}
+
+static void EndStep(StepCost *cost)
+{
+    UInt32 spent;
+
+    spent = (USBODEMicroseconds() - cost->startMicros) +
+            (UInt32)(gEmulator->stats.busMicros - cost->startBus);
+    cost->steps++;
+    cost->total += spent;
+    if (spent > cost->longest) {
+        cost->longest = spent;
+    }
+}
+
+/*
+ * A page of the refresh per step, as the application's listTask does
+ */
+static short BenchListStep(USBODETask *task)
+{
+    StepCost *cost;
+    OSErr err;
+
+    cost = (StepCost *)task->refCon;
+    BeginStep(cost);
+    err = DiscPagerStep(&gPager);
+    if (err == noErr) {
+        err = CatalogAppendPage(&gCatalog, &gPager);
+    }
+    if (err == noErr && gPager.done) {
+        err = RowCacheSync(&gRows, &gCatalog);
+    }
+    EndStep(cost);
+
+    if (err != noErr || gPager.done) {
+        if (err != noErr) {
+            gTaskErr = err;
+        }
+        EndDiscPager(&gPager);
+        return kTaskDone;
+    }
+    return kTaskContinue;
+}
+
+/*
+ * A command of the mount per step, sleeping through the backoff
+ */
+static short BenchMountStep(USBODETask *task)
+{
+    StepCost *cost;
+    UInt32 delay;
+    Boolean done;
+
+    cost = (StepCost *)task->refCon;
+    BeginStep(cost);
+    done = MountWaitStep(&gWaiter, &delay);
+    EndStep(cost);
+
+    if (done) {
+        if (gWaiter.result != noErr) {
+            gTaskErr = gWaiter.result;
+        }
+        return kTaskDone;
+    }
+    TaskSleep(task, delay);
+    return kTaskContinue;
+}
+
+/*
+ * A full refresh while a disc loads, both stepped through one queue
+ * blocking_us is the work of the two, which a synchronous refresh and
+ * mount would hold the event loop for on top of the mount_ready_us
+ * spent waiting; longest_step_us is the most it waits for events now.
+ */
+static void RunTasks(const BusProfile *bus, long entries)
+{
+    TaskQueue queue;
+    USBODETask listTask;
+    USBODETask mountTask;
+    StepCost listCost;
+    StepCost mountCost;
+    UInt32 wait;
+    OSErr err;
+
+    EmulatorSetTiming(gEmulator, bus->selectMicros, bus->commandMicros,
+                      bus->bytesPerSecond);
+    gEmulator->pagedListing = true;
+    gEmulator->loadMicros = kBenchLoadMicros;
+    EmulatorResetStats(gEmulator);
+
+    memset(&listCost, 0, sizeof(listCost));
+    memset(&mountCost, 0, sizeof(mountCost));
+    listTask.queued = false;
+    mountTask.queued = false;
+    gTaskErr = noErr;
+
+    CatalogClear(&gCatalog);
+    err = BeginDiscPagerFormat(&gPager, kBenchSCSIID, kDefaultPageEntries,
+                               kListFormatFixed);
+    if (err != noErr) {
+        gEmulator->loadMicros = 0;
+        BeginResult("tasks", bus->name, entries, "refresh_while_mounting");
+        printf(", \"error\": %d}", err);
+        return;
+    }
+    BeginMountWait(&gWaiter, kBenchSCSIID, (unsigned short)(entries - 1), 0);
+
+    InitTaskQueue(&queue, kTaskSliceMicros);
+    TaskStart(&queue, &listTask, BenchListStep, &listCost);
+    TaskStart(&queue, &mountTask, BenchMountStep, &mountCost);
+
+    /* The event loop: step, then sleep until a task can step again */
+    while (TaskQueueRun(&queue)) {
+        wait = TaskQueueWait(&queue, USBODEMicroseconds());
+        if (wait > 0 && wait != kTaskNoWake) {
+            USBODEDelayMicroseconds(wait);
+        }
+    }
+    gEmulator->loadMicros = 0;
+
+    BeginResult("tasks", bus->name, entries, "refresh_while_mounting");
+    if (gTaskErr != noErr) {
+        printf(", \"error\": %d}", gTaskErr);
+        return;
+    }
+
+    printf(", \"steps\": %lu, \"longest_step_us\": %lu, "
+           "\"blocking_us\": %.0f, \"list_steps\": %lu, "
+           "\"mount_polls\": %d, \"mount_ready_us\": %lu}",
+           queue.steps,
+           (unsigned long)((listCost.longest > mountCost.longest) ?
+                           listCost.longest : mountCost.longest),
+           listCost.total + mountCost.total,
+           listCost.steps,
+           gWaiter.readiness.polls,
+           (unsigned long)gWaiter.readiness.readyMicros);
+}
+
+/*
+ * Names in the catalog starting with a prefix, the way a search would
+ * go without the index: every name folded and compared
+ */
+static long ScanPrefix(const unsigned char *prefix, short length)
+{
+    const unsigned char *pool;
+    const unsigned char *name;
+    long matches;
+    long i;
+    short j;
+
+    pool = CatalogNamePool(&gCatalog);
+    matches = 0;
+    for (i = 0; i < gCatalog.count; i++) {
+        name = pool + CatalogNameOffsets(&gCatalog)[i];
+        if (name[0] < length) {
+            continue;
+        }
+        for (j = 0; j < length; j++) {
+            if (MacRomanFold(name[j + 1]) != MacRomanFold(prefix[j])) {
+                break;
+            }
+        }
+        if (j == length) {
+            matches++;
+        }
+    }
+
+    return matches;
+}
+
+/*
+ * Sorting a listed catalog for type-ahead, and typing a search
+ * Each keystroke narrows the previous keystroke's matches, as the
+ * list window does; the scan is the same search without the index.
+ */
+static void RunSearch(long entries)
+{
+    const unsigned char *typed;
+    PrefixIndex index;
+    PrefixRange range;
+    UInt32 start;
+    UInt32 elapsed;
+    long runs;
+    long matches;
+    short keys;
+    short key;
+    OSErr err;
+
+    typed = (const unsigned char *)kBenchSearch;
+    keys = (short)(sizeof(kBenchSearch) - 1);
+
+    EmulatorSetTiming(gEmulator, 0, 0, kBusUnlimited);
+    gEmulator->pagedListing = true;
+    err = CatalogListPaged(&gCatalog, kBenchSCSIID, kDefaultPageEntries,
+                           kListFormatFixed);
+    if (err == noErr) {
+        err = InitPrefixIndex(&index);
+    }
+    if (err != noErr) {
+        BeginResult("search", "none", entries, "index_build");
+        printf(", \"error\": %d}", err);
+        return;
+    }
+
+    runs = 0;
+    start = USBODEMicroseconds();
+    do {
+        /* A different serial sorts everything again */
+        index.serial = gCatalog.serial + 1;
+        err = PrefixIndexSync(&index, &gCatalog);
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+    } while (err == noErr && elapsed < kTargetMicros);
+    BeginResult("search", "none", entries, "index_build");
+    if (err != noErr) {
+        printf(", \"error\": %d}", err);
+        DisposePrefixIndex(&index);
+        return;
+    }
+    printf(", \"ns_per_entry\": %.1f, \"bytes_per_entry\": %.1f}",
+           (elapsed * 1000.0) / ((double)runs * entries),
+           (double)sizeof(long));
+
+    matches = 0;
+    runs = 0;
+    start = USBODEMicroseconds();
+    do {
+        PrefixIndexAll(&index, &range);
+        for (key = 1; key <= keys; key++) {
+            PrefixIndexFind(&index, &gCatalog, typed, key, &range);
+        }
+        matches = range.count;
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+    } while (elapsed < kTargetMicros);
+    BeginResult("search", "none", entries, "prefix_keystroke");
+    printf(", \"ns_per_key\": %.1f, \"matches\": %ld}",
+           (elapsed * 1000.0) / ((double)runs * keys), matches);
+
+    runs = 0;
+    start = USBODEMicroseconds();
+    do {
+        for (key = 1; key <= keys; key++) {
+            matches = ScanPrefix(typed, key);
+        }
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+    } while (elapsed < kTargetMicros);
+    BeginResult("search", "none", entries, "scan_keystroke");
+    printf(", \"ns_per_key\": %.1f, \"matches\": %ld}",
+           (elapsed * 1000.0) / ((double)runs * keys), matches);
+
+    DisposePrefixIndex(&index);
+}
+
+/*
+ * First entry whose name equals name, folded, found by scanning
+ */
+static long ScanName(ConstStr255Param name)
+{
+    const unsigned char *pool;
+    const unsigned char *candidate;
+    long i;
+    short j;
+
+    pool = CatalogNamePool(&gCatalog);
+    for (i = 0; i < gCatalog.count; i++) {
+        candidate = pool + CatalogNameOffsets(&gCatalog)[i];
+        if (candidate[0] != name[0]) {
+            continue;
+        }
+        for (j = 1; j <= name[0]; j++) {
+            if (MacRomanFold(candidate[j]) != MacRomanFold(name[j])) {
+                break;
+            }
+        }
+        if (j > name[0]) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Hashing a listed catalog's names, and resolving names typed in
+ * another case, through the hash and by scanning
+ * RunSearch leaves the catalog listed.
+ */
+static void RunNames(long entries)
+{
+    NameIndex index;
+    Str255 names[16];
+    UInt32 start;
+    UInt32 elapsed;
+    long runs;
+    long found;
+    short i;
+    OSErr err;
+
+    err = InitNameIndex(&index);
+    if (err != noErr) {
+        BeginResult("search", "none", entries, "name_index_build");
+        printf(", \"error\": %d}", err);
+        return;
+    }
+
+    runs = 0;
+    elapsed = 0;
+    start = USBODEMicroseconds();
+    while (err == noErr && elapsed < kTargetMicros) {
+        /* A different serial hashes everything again */
+        index.serial = gCatalog.serial + 1;
+        err = NameIndexSync(&index, &gCatalog);
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+    }
+    BeginResult("search", "none", entries, "name_index_build");
+    if (err != noErr) {
+        printf(", \"error\": %d}", err);
+        DisposeNameIndex(&index);
+        return;
+    }
+    printf(", \"ns_per_entry\": %.1f, \"bytes_per_entry\": %.1f}",
+           (elapsed * 1000.0) / ((double)runs * entries),
+           (2.0 * sizeof(long) + sizeof(UInt32)) +
+           (double)index.bucketCount * sizeof(long) / entries);
+
+    /* Names spread over the catalog, as a script would type them */
+    for (i = 0; i < 16; i++) {
+        names[i][0] = (unsigned char)snprintf((char *)names[i] + 1, 255,
+                          "DISC IMAGE %05ld.ISO", (i * 7919L) % entries);
+    }
+
+    found = 0;
+    runs = 0;
+    start = USBODEMicroseconds();
+    do {
+        for (i = 0; i < 16; i++) {
+            found += (NameIndexLookup(&index, &gCatalog, names[i], nil) >= 0);
+        }
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+    } while (elapsed < kTargetMicros);
+    BeginResult("search", "none", entries, "name_lookup");
+    printf(", \"ns_per_lookup\": %.1f, \"found\": %.2f}",
+           (elapsed * 1000.0) / ((double)runs * 16), found / (runs * 16.0));
+
+    found = 0;
+    runs = 0;
+    start = USBODEMicroseconds();
+    do {
+        for (i = 0; i < 16; i++) {
+            found += (ScanName(names[i]) >= 0);
+        }
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+    } while (elapsed < kTargetMicros);
+    BeginResult("search", "none", entries, "name_scan");
+    printf(", \"ns_per_lookup\": %.1f, \"found\": %.2f}",
+           (elapsed * 1000.0) / ((double)runs * 16), found / (runs * 16.0));
+
+    DisposeNameIndex(&index);
+}
+
+/*
+ * Size, then folded name, read from the catalog on every comparison:
+ * how the size order would be sorted without collation keys
+ */
+static int CompareBySize(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    const unsigned char *nameX;
+    const unsigned char *nameY;
+    unsigned long sizeX;
+    unsigned long sizeY;
+    short length;
+    short i;
+
+    sizeX = CatalogSizes(&gCatalog)[x];
+    sizeY = CatalogSizes(&gCatalog)[y];
+    if (sizeX != sizeY) {
+        return (sizeX < sizeY) ? -1 : 1;
+    }
+
+    nameX = CatalogNamePool(&gCatalog) + CatalogNameOffsets(&gCatalog)[x];
+    nameY = CatalogNamePool(&gCatalog) + CatalogNameOffsets(&gCatalog)[y];
+    length = (nameX[0] < nameY[0]) ? nameX[0] : nameY[0];
+    for (i = 1; i <= length; i++) {
+        if (MacRomanFold(nameX[i]) != MacRomanFold(nameY[i])) {
+            return (MacRomanFold(nameX[i]) < MacRomanFold(nameY[i])) ? -1 : 1;
+        }
+    }
+
+    return (int)nameX[0] - (int)nameY[0];
+}
+
+/*
+ * Keeping the size order for a listed catalog, with the name order
+ * already built for type-ahead, against sorting by size and name
+ * Images get one of a dozen sizes, so most comparisons fall to names.
+ */
+static void RunSort(long entries)
+{
+    PrefixIndex names;
+    SortViews views;
+    long *order;
+    UInt32 start;
+    UInt32 elapsed;
+    long runs;
+    long i;
+    OSErr err;
+
+    order = (long *)NewPtr(entries * (long)sizeof(long));
+    err = (order != nil) ? InitPrefixIndex(&names) : memFullErr;
+    if (err == noErr) {
+        err = InitSortViews(&views);
+    }
+    if (err != noErr) {
+        BeginResult("sort", "none", entries, "size_order_keys");
+        printf(", \"error\": %d}", err);
+        return;
+    }
+
+    /* The listed catalog, with sizes that tie */
+    EmulatorSetTiming(gEmulator, 0, 0, kBusUnlimited);
+    gEmulator->pagedListing = true;
+    err = CatalogListPaged(&gCatalog, kBenchSCSIID, kDefaultPageEntries,
+                           kListFormatFixed);
+    for (i = 0; err == noErr && i < gCatalog.count; i++) {
+        CatalogSizes(&gCatalog)[i] = 650UL * 1024 - (i % 12) * 1024;
+    }
+    if (err == noErr) {
+        err = PrefixIndexSync(&names, &gCatalog);
+    }
+
+    runs = 0;
+    elapsed = 0;
+    start = USBODEMicroseconds();
+    while (err == noErr) {
+        /* A different serial sorts everything again */
+        views.serial = gCatalog.serial + 1;
+        err = SortViewsSync(&views, &names, &gCatalog);
+        runs++;
+        elapsed = USBODEMicroseconds() - start;
+        if (elapsed >= kTargetMicros) {
+            break;
+        }
+    }
+    BeginResult("sort", "none", entries, "size_order_keys");
+    if (err != noErr) {
+        printf(", \"error\": %d}", err);
+    } else {
+        printf(", \"ns_per_entry\": %.1f, \"bytes_per_entry\": %.1f}",
+               (elapsed * 1000.0) / ((double)runs * entries),
+               2.0 * sizeof(long));
+
+        runs = 0;
+        start = USBODEMicroseconds();
+        do {
+            for (i = 0; i < gCatalog.count; i++) {
+                order[i] = i;
+            }
+            qsort(order, (size_t)gCatalog.count, sizeof(long), CompareBySize);
+            runs++;
+            elapsed = USBODEMicroseconds() - start;
+        } while (elapsed < kTargetMicros);
+        BeginResult("sort", "none", entries, "size_order_compares");
+        printf(", \"ns_per_entry\": %.1f}",
+               (elapsed * 1000.0) / ((double)runs * entries));
+    }
+
+    DisposeSortViews(&views);
+    DisposePrefixIndex(&names);
+    DisposePtr((Ptr)order);
+}
+
+int main(int argc, char *argv[])
+{
+    char name[kEmulatorMaxNameLength + 1];
+    long maxEntries;
+    long entries;
+    long size;
+    long bus;
+    long op;
+
+    maxEntries = (argc > 1) ? atol(argv[1]) : kDefaultMaxEntries;
+    if (maxEntries < 1 || maxEntries > kMaxCatalogEntries) {
+        fprintf(stderr, "usage: %s [max-entries 1-%ld]\n", argv[0],
+                kMaxCatalogEntries);
+        return 1;
+    }
+
+    gEmulator = NewUSBODEEmulator(kBenchSCSIID);
+    gSamples = (UInt32 *)NewPtr(kMaxIterations * (long)sizeof(UInt32));
+    if (gEmulator == nil || gSamples == nil ||
+        InitDiscCatalog(&gCatalog) != noErr ||
+        InitDiscCatalog(&gIncoming) != noErr || InitRowCache(&gRows) != noErr) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    gEmulator->timing.realTime = false;
+    SetUSBODETransport(NewEmulatorTransport(gEmulator));
+
+    printf("{\n  \"suite\": \"usbode-protocol\",\n  \"version\": 1,\n"
+           "  \"results\": [");
+
+    entries = 0;
+    for (size = 0; size < kSizeCount && gSizes[size] <= maxEntries; size++) {
+        /* Grow the emulated catalog to this size */
+        while (entries < gSizes[size]) {
+            BenchImageName(entries, name);
+            if (EmulatorAddImage(gEmulator, name,
+                                 BenchImageSize(entries)) != noErr) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            entries++;
+        }
+
+        for (bus = 0; bus < kBusCount; bus++) {
+            for (op = 0; op < kOpCount; op++) {
+                RunOp(&gBuses[bus], entries, &gOps[op]);
+            }
+            RunTasks(&gBuses[bus], entries);
+        }
+        RunDecode(entries);
+        RunSearch(entries);
+        RunNames(entries);
+        RunSort(entries);
+    }
+
+    printf("\n  ]\n}\n");
+
+    DisposeRowCache(&gRows);
+    DisposeDiscCatalog(&gIncoming);
+    DisposeDiscCatalog(&gCatalog);
+    return 0;
+}
+
+#endif /* USBODE_HOST */
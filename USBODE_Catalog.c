@@ -0,0 +1,763 @@
+/*
+ * USBODE_Catalog.c
+ * Growable disc catalog
+ *
+ * Column and pool storage grows geometrically so that appending page
+ * after page of a large listing stays cheap.  Portable: Memory Manager
+ * calls only.
+ */
+
+#include "USBODE_Catalog.h"
+
+#define kInitialCapacity    16
+#define kInitialPoolSize    512
+
+/* Pool bytes per entry assumed when reserving ahead of a list */
+#define kTypicalNameBytes   16
+
+/* 32-bit FNV-1a */
+#define kHashBasis          2166136261UL
+#define kHashPrime          16777619UL
+#define HashByte(h, b)      (((h) ^ (unsigned char)(b)) * kHashPrime)
+
+static OSErr GrowColumn(Handle column, long elementSize, long capacity);
+static OSErr AppendPageData(DiscCatalog *catalog, unsigned char format,
+                            const unsigned char *data, long length,
+                            long count, unsigned short firstIndex);
+
+/*
+ * Set up an empty catalog
+ */
+OSErr InitDiscCatalog(DiscCatalog *catalog)
+{
+    catalog->count = 0;
+    catalog->capacity = 0;
+    catalog->poolSize = 0;
+    catalog->poolCapacity = 0;
+    catalog->serial = 0;
+
+    catalog->indices = NewHandle(0);
+    catalog->types = NewHandle(0);
+    catalog->sizes = NewHandle(0);
+    catalog->nameOffsets = NewHandle(0);
+    catalog->names = NewHandle(0);
+
+    if (catalog->indices == nil || catalog->types == nil ||
+        catalog->sizes == nil || catalog->nameOffsets == nil ||
+        catalog->names == nil) {
+        DisposeDiscCatalog(catalog);
+        return memFullErr;
+    }
+
+    return noErr;
+}
+
+/*
+ * Release catalog storage
+ */
+void DisposeDiscCatalog(DiscCatalog *catalog)
+{
+    if (catalog->indices != nil) DisposeHandle(catalog->indices);
+    if (catalog->types != nil) DisposeHandle(catalog->types);
+    if (catalog->sizes != nil) DisposeHandle(catalog->sizes);
+    if (catalog->nameOffsets != nil) DisposeHandle(catalog->nameOffsets);
+    if (catalog->names != nil) DisposeHandle(catalog->names);
+
+    catalog->indices = nil;
+    catalog->types = nil;
+    catalog->sizes = nil;
+    catalog->nameOffsets = nil;
+    catalog->names = nil;
+    catalog->count = 0;
+    catalog->capacity = 0;
+    catalog->poolSize = 0;
+    catalog->poolCapacity = 0;
+}
+
+/*
+ * Forget all entries but keep the storage for the next refresh
+ */
+void CatalogClear(DiscCatalog *catalog)
+{
+    catalog->count = 0;
+    catalog->poolSize = 0;
+    catalog->serial++;
+}
+
+/*
+ * Resize one column block
+ */
+static OSErr GrowColumn(Handle column, long elementSize, long capacity)
+{
+    if (column == nil) {
+        return nilHandleErr;
+    }
+
+    SetHandleSize(column, capacity * elementSize);
+    return MemError();
+}
+
+/*
+ * Make room for at least the given number of entries and name bytes
+ * Capacity doubles, with an exact fit as the fallback when the heap
+ * cannot supply the doubled size.  A failed call leaves the catalog
+ * contents intact.
+ */
+OSErr CatalogReserve(DiscCatalog *catalog, long entries, long nameBytes)
+{
+    long capacity;
+    OSErr err;
+
+    if (entries > catalog->capacity) {
+        capacity = (catalog->capacity < kInitialCapacity) ?
+                   kInitialCapacity : catalog->capacity;
+        while (capacity < entries) {
+            capacity *= 2;
+        }
+
+        for (;;) {
+            err = GrowColumn(catalog->indices, sizeof(unsigned short), capacity);
+            if (err == noErr) {
+                err = GrowColumn(catalog->types, sizeof(unsigned char), capacity);
+            }
+            if (err == noErr) {
+                err = GrowColumn(catalog->sizes, sizeof(unsigned long), capacity);
+            }
+            if (err == noErr) {
+                err = GrowColumn(catalog->nameOffsets, sizeof(unsigned long),
+                                 capacity);
+            }
+            if (err == noErr || capacity == entries) {
+                break;
+            }
+            capacity = entries;
+        }
+
+        /* Columns that did grow are harmless; record what all of them hold */
+        if (err != noErr) {
+            return err;
+        }
+        catalog->capacity = capacity;
+    }
+
+    if (nameBytes > catalog->poolCapacity) {
+        capacity = (catalog->poolCapacity < kInitialPoolSize) ?
+                   kInitialPoolSize : catalog->poolCapacity;
+        while (capacity < nameBytes) {
+            capacity *= 2;
+        }
+
+        err = GrowColumn(catalog->names, 1, capacity);
+        if (err != noErr) {
+            capacity = nameBytes;
+            err = GrowColumn(catalog->names, 1, capacity);
+            if (err != noErr) {
+                return err;
+            }
+        }
+        catalog->poolCapacity = capacity;
+    }
+
+    return noErr;
+}
+
+/*
+ * Add one entry at the end
+ */
+OSErr CatalogAppend(DiscCatalog *catalog, const DiscEntry *disc,
+                    unsigned short index)
+{
+    unsigned char *pool;
+    long nameLength;
+    long i;
+    OSErr err;
+
+    nameLength = 0;
+    while (nameLength < kWireNameLength && disc->name[nameLength] != 0) {
+        nameLength++;
+    }
+
+    err = CatalogReserve(catalog, catalog->count + 1,
+                         catalog->poolSize + 1 + nameLength);
+    if (err != noErr) {
+        return err;
+    }
+
+    i = catalog->count;
+    CatalogIndices(catalog)[i] = index;
+    CatalogTypes(catalog)[i] = disc->type;
+    CatalogSizes(catalog)[i] = DecodeSizeKilobytes(disc->size);
+    CatalogNameOffsets(catalog)[i] = (unsigned long)catalog->poolSize;
+
+    pool = CatalogNamePool(catalog) + catalog->poolSize;
+    pool[0] = (unsigned char)nameLength;
+    BlockMoveData(disc->name, pool + 1, nameLength);
+
+    catalog->poolSize += 1 + nameLength;
+    catalog->count++;
+
+    return noErr;
+}
+
+/*
+ * Device index of entry i
+ */
+unsigned short CatalogIndex(const DiscCatalog *catalog, long i)
+{
+    return CatalogIndices(catalog)[i];
+}
+
+/*
+ * Image type of entry i
+ */
+unsigned char CatalogType(const DiscCatalog *catalog, long i)
+{
+    return CatalogTypes(catalog)[i];
+}
+
+/*
+ * Size of entry i in kilobytes
+ */
+unsigned long CatalogSize(const DiscCatalog *catalog, long i)
+{
+    return CatalogSizes(catalog)[i];
+}
+
+/*
+ * Copy the name of entry i out as a Pascal string
+ */
+void CatalogGetName(const DiscCatalog *catalog, long i, Str255 name)
+{
+    const unsigned char *pooled;
+
+    pooled = CatalogNamePool(catalog) + CatalogNameOffsets(catalog)[i];
+    BlockMoveData(pooled, name, 1 + pooled[0]);
+}
+
+/*
+ * Append wire entries in one pass, straight from the transfer buffer
+ * Entry i gets device index firstIndex + i, since the wire index byte
+ * only holds the low 8 bits.
+ */
+OSErr CatalogAppendWire(DiscCatalog *catalog, const WireEntryView *view,
+                        unsigned short firstIndex)
+{
+    const unsigned char *entry;
+    unsigned short *indices;
+    unsigned char *types;
+    unsigned long *sizes;
+    unsigned long *offsets;
+    unsigned char *pool;
+    unsigned char *name;
+    long poolSize;
+    long base;
+    long i;
+    short length;
+    OSErr err;
+
+    /* Reserve for full-length names so the entries are read only once;
+       the pool keeps just the bytes actually used */
+    err = CatalogReserve(catalog, catalog->count + view->count,
+                         catalog->poolSize +
+                         view->count * (1L + kWireNameLength));
+    if (err != noErr) {
+        return err;
+    }
+
+    base = catalog->count;
+    indices = CatalogIndices(catalog) + base;
+    types = CatalogTypes(catalog) + base;
+    sizes = CatalogSizes(catalog) + base;
+    offsets = CatalogNameOffsets(catalog) + base;
+    pool = CatalogNamePool(catalog);
+    poolSize = catalog->poolSize;
+
+    for (i = 0; i < view->count; i++) {
+        entry = WireEntryAt(view, i);
+
+        indices[i] = (unsigned short)(firstIndex + i);
+        types[i] = WireType(entry);
+        sizes[i] = DecodeSizeKilobytes(WireSize(entry));
+        offsets[i] = (unsigned long)poolSize;
+
+        /* Copy the whole field, then keep only the name */
+        name = pool + poolSize + 1;
+        BlockMoveData(WireName(entry), name, kWireNameLength);
+        for (length = 0; length < kWireNameLength; length++) {
+            if (name[length] == 0) {
+                break;
+            }
+        }
+        name[-1] = (unsigned char)length;
+        poolSize += 1 + length;
+    }
+
+    catalog->count += view->count;
+    catalog->poolSize = poolSize;
+
+    return noErr;
+}
+
+/*
+ * Append packed entries in one pass
+ * Each name is rebuilt from the bytes it shares with the previous one
+ * and the rest that follows, then stored in the pool, converted to
+ * MacRoman when the format carries UTF-8 long names.  The catalog is
+ * left as it was if the entries overrun the data.
+ */
+OSErr CatalogAppendPacked(DiscCatalog *catalog, unsigned char format,
+                          const unsigned char *data, long length, long count,
+                          unsigned short firstIndex)
+{
+    const unsigned char *in;
+    const unsigned char *end;
+    unsigned short *indices;
+    unsigned char *types;
+    unsigned long *sizes;
+    unsigned long *offsets;
+    unsigned char *pool;
+    unsigned char *name;
+    unsigned char raw[kLongNameLength];
+    unsigned long value;
+    long poolSize;
+    long previous;
+    long base;
+    long i;
+    short maxName;
+    short rawLength;
+    short shared;
+    short suffix;
+    short shift;
+    Boolean frontCoded;
+    Boolean longNames;
+    unsigned char byte;
+    OSErr err;
+
+    frontCoded = (format & kListFormatFrontCoded) != 0;
+    longNames = (format & kListFormatLongNames) != 0;
+    maxName = longNames ? kLongNameLength : kWireNameLength;
+
+    err = CatalogReserve(catalog, catalog->count + count,
+                         catalog->poolSize + count * (1L + kWireNameLength));
+    if (err != noErr) {
+        return err;
+    }
+
+    base = catalog->count;
+    indices = CatalogIndices(catalog) + base;
+    types = CatalogTypes(catalog) + base;
+    sizes = CatalogSizes(catalog) + base;
+    offsets = CatalogNameOffsets(catalog) + base;
+    pool = CatalogNamePool(catalog);
+    poolSize = catalog->poolSize;
+    previous = -1;
+    rawLength = 0;
+    in = data;
+    end = data + length;
+
+    for (i = 0; i < count; i++) {
+        shared = 0;
+        if (frontCoded) {
+            if (in == end) {
+                return scPhaseErr;
+            }
+            shared = *in++;
+        }
+        if (in == end) {
+            return scPhaseErr;
+        }
+        suffix = *in++;
+        if (shared > rawLength || shared + suffix > maxName ||
+            end - in < suffix + 2) {
+            return scPhaseErr;
+        }
+
+        /* Long names can outgrow the reservation; columns may move */
+        if (poolSize + 1 + shared + suffix > catalog->poolCapacity) {
+            err = CatalogReserve(catalog, catalog->count + count,
+                                 poolSize + 1 + shared + suffix +
+                                 (count - i) * kTypicalNameBytes);
+            if (err != noErr) {
+                return err;
+            }
+            indices = CatalogIndices(catalog) + base;
+            types = CatalogTypes(catalog) + base;
+            sizes = CatalogSizes(catalog) + base;
+            offsets = CatalogNameOffsets(catalog) + base;
+            pool = CatalogNamePool(catalog);
+        }
+
+        /* Short names are rebuilt in the pool from the previous one;
+           long ones in raw, which still holds the shared bytes, since
+           the pool keeps them converted */
+        name = pool + poolSize;
+        if (longNames) {
+            BlockMoveData(in, raw + shared, suffix);
+            name[0] = (unsigned char)UTF8ToMacRoman(raw, shared + suffix,
+                                                    name + 1);
+        } else {
+            if (shared > 0) {
+                BlockMoveData(pool + previous + 1, name + 1, shared);
+            }
+            BlockMoveData(in, name + 1 + shared, suffix);
+            name[0] = (unsigned char)(shared + suffix);
+        }
+        rawLength = shared + suffix;
+        previous = poolSize;
+        in += suffix;
+
+        types[i] = *in++;
+
+        value = 0;
+        shift = 0;
+        do {
+            if (in == end || shift >= 7 * kVarintMaxBytes) {
+                return scPhaseErr;
+            }
+            byte = *in++;
+            value |= (unsigned long)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        indices[i] = (unsigned short)(firstIndex + i);
+        sizes[i] = value;
+        offsets[i] = (unsigned long)poolSize;
+        poolSize += 1 + name[0];
+    }
+
+    catalog->count += count;
+    catalog->poolSize = poolSize;
+
+    return noErr;
+}
+
+/*
+ * Append count entries of a page in any listing format
+ */
+static OSErr AppendPageData(DiscCatalog *catalog, unsigned char format,
+                            const unsigned char *data, long length,
+                            long count, unsigned short firstIndex)
+{
+    WireEntryView view;
+
+    if (format != kListFormatFixed) {
+        return CatalogAppendPacked(catalog, format, data, length, count,
+                                   firstIndex);
+    }
+
+    InitWireView(&view, data, count * kWireEntrySize);
+    return CatalogAppendWire(catalog, &view, firstIndex);
+}
+
+/*
+ * Append the current page of a paged listing
+ */
+OSErr CatalogAppendPage(DiscCatalog *catalog, const DiscPager *pager)
+{
+    return AppendPageData(catalog, pager->format,
+                          (const unsigned char *)pager->buffer + kPageHeaderSize,
+                          pager->pageBytes, pager->pageCount,
+                          (unsigned short)pager->pageStart);
+}
+
+/*
+ * Append entries from a legacy LIST CDS reply
+ */
+OSErr CatalogAppendList(DiscCatalog *catalog, const DiscEntry *discs,
+                        long count)
+{
+    OSErr err;
+    long i;
+
+    err = CatalogReserve(catalog, catalog->count + count,
+                         catalog->poolSize + count * kTypicalNameBytes);
+    if (err != noErr) {
+        return err;
+    }
+
+    for (i = 0; i < count; i++) {
+        err = CatalogAppend(catalog, &discs[i], discs[i].index);
+        if (err != noErr) {
+            return err;
+        }
+    }
+
+    return noErr;
+}
+
+/*
+ * Replace the catalog with a complete paged listing
+ * Convenience for callers that do not need to interleave other work
+ * between pages; the application steps a DiscPager itself.
+ */
+OSErr CatalogListPaged(DiscCatalog *catalog, short scsiID, short pageEntries,
+                       unsigned char format)
+{
+    DiscPager pager;
+    OSErr err;
+
+    CatalogClear(catalog);
+
+    err = BeginDiscPagerFormat(&pager, scsiID, pageEntries, format);
+    while (err == noErr && !pager.done) {
+        err = DiscPagerStep(&pager);
+        if (err == noErr) {
+            err = CatalogAppendPage(catalog, &pager);
+        }
+    }
+    EndDiscPager(&pager);
+
+    return err;
+}
+
+/*
+ * Append entries first..first+count-1 of another catalog
+ * Names are stored in entry order, so theirs are one run of the pool.
+ */
+OSErr CatalogAppendRange(DiscCatalog *catalog, const DiscCatalog *source,
+                         long first, long count)
+{
+    unsigned long *offsets;
+    unsigned long from;
+    unsigned long to;
+    long shift;
+    long base;
+    long i;
+    OSErr err;
+
+    if (count == 0) {
+        return noErr;
+    }
+    if (first < 0 || count < 0 || first + count > source->count) {
+        return paramErr;
+    }
+
+    from = CatalogNameOffsets(source)[first];
+    to = (first + count < source->count) ?
+         CatalogNameOffsets(source)[first + count] :
+         (unsigned long)source->poolSize;
+
+    err = CatalogReserve(catalog, catalog->count + count,
+                         catalog->poolSize + (long)(to - from));
+    if (err != noErr) {
+        return err;
+    }
+
+    base = catalog->count;
+    BlockMoveData(CatalogIndices(source) + first, CatalogIndices(catalog) + base,
+                  count * (long)sizeof(unsigned short));
+    BlockMoveData(CatalogTypes(source) + first, CatalogTypes(catalog) + base,
+                  count);
+    BlockMoveData(CatalogSizes(source) + first, CatalogSizes(catalog) + base,
+                  count * (long)sizeof(unsigned long));
+    BlockMoveData(CatalogNamePool(source) + from,
+                  CatalogNamePool(catalog) + catalog->poolSize, (long)(to - from));
+
+    shift = catalog->poolSize - (long)from;
+    offsets = CatalogNameOffsets(catalog) + base;
+    for (i = 0; i < count; i++) {
+        offsets[i] = CatalogNameOffsets(source)[first + i] + shift;
+    }
+
+    catalog->count += count;
+    catalog->poolSize += (long)(to - from);
+
+    return noErr;
+}
+
+/*
+ * Append device entries start..start+count-1, a page at a time
+ * Each page asks for the entries still wanted with a buffer sized to
+ * match, which a transport without residuals needs.
+ */
+OSErr CatalogFetchRange(DiscCatalog *catalog, short scsiID,
+                        unsigned short start, unsigned short count,
+                        short pageEntries, unsigned char format)
+{
+    Ptr buffer;
+    long bufferSize;
+    unsigned short total;
+    unsigned short pageCount;
+    unsigned short wanted;
+    long pageBytes;
+    OSErr err;
+
+    if (pageEntries <= 0) {
+        pageEntries = kDefaultPageEntries;
+    }
+
+    bufferSize = PageBufferSize(format, pageEntries);
+    buffer = NewPtr(bufferSize);
+    if (buffer == nil) {
+        return memFullErr;
+    }
+
+    err = noErr;
+    while (count > 0) {
+        wanted = (count < (unsigned short)pageEntries) ?
+                 count : (unsigned short)pageEntries;
+        err = GetDiscPageFormat(scsiID, format, start, wanted, buffer,
+                                PageBufferSize(format, (short)wanted),
+                                &total, &pageCount, &pageBytes);
+        if (err == noErr && pageCount == 0) {
+            err = scPhaseErr;   /* the catalog shrank under us */
+        }
+        if (err != noErr) {
+            break;
+        }
+
+        err = AppendPageData(catalog, format,
+                             (const unsigned char *)buffer + kPageHeaderSize,
+                             pageBytes, pageCount, start);
+        if (err != noErr) {
+            break;
+        }
+
+        start += pageCount;
+        count -= pageCount;
+    }
+
+    DisposePtr(buffer);
+    return err;
+}
+
+/*
+ * Build into result the device catalog described by changes: entries
+ * outside the changed ranges come from current, the rest from the
+ * device.  Returns paramErr when current cannot supply the unchanged
+ * entries, in which case the caller lists everything instead.
+ */
+OSErr CatalogApplyChanges(DiscCatalog *result, const DiscCatalog *current,
+                          const CatalogChanges *changes, short scsiID,
+                          short pageEntries, unsigned char format)
+{
+    const ChangeRange *range;
+    long next;
+    long start;
+    long end;
+    short i;
+    OSErr err;
+
+    if (changes->resync) {
+        return paramErr;
+    }
+
+    CatalogClear(result);
+    err = CatalogReserve(result, changes->total,
+                         current->poolSize + kTypicalNameBytes);
+    if (err != noErr) {
+        return err;
+    }
+
+    next = 0;
+    for (i = 0; i < changes->rangeCount; i++) {
+        range = &changes->ranges[i];
+        start = range->start;
+        end = start + range->count;
+        if (start < next || end > changes->total) {
+            return paramErr;    /* not sorted or out of bounds */
+        }
+
+        err = CatalogAppendRange(result, current, next, start - next);
+        if (err == noErr) {
+            err = CatalogFetchRange(result, scsiID, range->start,
+                                    range->count, pageEntries, format);
+        }
+        if (err != noErr) {
+            return err;
+        }
+        next = end;
+    }
+
+    return CatalogAppendRange(result, current, next, changes->total - next);
+}
+
+/*
+ * Whether a finished listing is whole: as many entries as the device
+ * said it holds, each at its own device index
+ * The device numbers its images 0 to count-1 in listing order, so a
+ * dropped, repeated or misplaced entry shows as an index out of step.
+ */
+Boolean CatalogComplete(const DiscCatalog *catalog, long total)
+{
+    const unsigned short *indices;
+    long i;
+
+    if (catalog->count != total) {
+        return false;
+    }
+    if (total == 0) {
+        return true;
+    }
+
+    indices = CatalogIndices(catalog);
+    for (i = 0; i < total; i++) {
+        if (indices[i] != (unsigned short)i) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Fingerprint of the entries, for telling whether a listing changed
+ * Covers every index, type, size and name in order; 0 is never returned
+ * so callers can use it for "none".
+ */
+UInt32 CatalogHash(const DiscCatalog *catalog)
+{
+    const unsigned short *indices;
+    const unsigned char *types;
+    const unsigned long *sizes;
+    const unsigned char *pool;
+    UInt32 hash;
+    long i;
+
+    hash = kHashBasis;
+    if (catalog->count == 0) {
+        return hash;
+    }
+
+    indices = CatalogIndices(catalog);
+    types = CatalogTypes(catalog);
+    sizes = CatalogSizes(catalog);
+
+    for (i = 0; i < catalog->count; i++) {
+        hash = HashByte(hash, indices[i] >> 8);
+        hash = HashByte(hash, indices[i]);
+        hash = HashByte(hash, types[i]);
+        hash = HashByte(hash, sizes[i] >> 24);
+        hash = HashByte(hash, sizes[i] >> 16);
+        hash = HashByte(hash, sizes[i] >> 8);
+        hash = HashByte(hash, sizes[i]);
+    }
+
+    /* Names are stored back to back, so the pool covers them all */
+    pool = CatalogNamePool(catalog);
+    for (i = 0; i < catalog->poolSize; i++) {
+        hash = HashByte(hash, pool[i]);
+    }
+
+    return (hash != 0) ? hash : 1;
+}
+
+/*
+ * Exchange the contents of two catalogs
+ * Both get a serial neither has had, so caches built from either one
+ * are rebuilt.
+ */
+void CatalogSwap(DiscCatalog *a, DiscCatalog *b)
+{
+    DiscCatalog temp;
+    unsigned long serial;
+
+    serial = ((a->serial > b->serial) ? a->serial : b->serial) + 1;
+
+    temp = *a;
+    *a = *b;
+    *b = temp;
+
+    a->serial = serial;
+    b->serial = serial + 1;
+}
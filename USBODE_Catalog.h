@@ -0,0 +1,77 @@
+/*
+ * USBODE_Catalog.h
+ * Growable disc catalog
+ *
+ * Entries are stored column by column: device indices, types, decoded
+ * sizes and name offsets each live in their own dense relocatable
+ * block, and the names themselves are packed as Pascal strings in a
+ * string pool.  Scans, sorts and filters touch only the columns they
+ * need, and memory follows the number of entries actually listed.
+ *
+ * The blocks may move whenever memory is allocated, so column pointers
+ * from CatalogIndices and friends are only good until the next call
+ * that can allocate.  Names are copied out with CatalogGetName.
+ */
+
+#ifndef USBODE_CATALOG_H
+#define USBODE_CATALOG_H
+
+#include "USBODE_Protocol.h"
+
+typedef struct {
+    Handle          indices;    /* unsigned short: device index */
+    Handle          types;      /* unsigned char: image type */
+    Handle          sizes;      /* unsigned long: size in kilobytes */
+    Handle          nameOffsets;/* unsigned long: offset into names */
+    Handle          names;      /* string pool of Pascal strings */
+    long            count;
+    long            capacity;   /* entries the columns can hold */
+    long            poolSize;   /* bytes of names in use */
+    long            poolCapacity;
+    unsigned long   serial;     /* bumped whenever entries are dropped */
+} DiscCatalog;
+
+/* Column access; pointers go stale when the catalog grows */
+#define CatalogIndices(c)       ((unsigned short *)*(c)->indices)
+#define CatalogTypes(c)         ((unsigned char *)*(c)->types)
+#define CatalogSizes(c)         ((unsigned long *)*(c)->sizes)
+#define CatalogNameOffsets(c)   ((unsigned long *)*(c)->nameOffsets)
+#define CatalogNamePool(c)      ((unsigned char *)*(c)->names)
+
+OSErr InitDiscCatalog(DiscCatalog *catalog);
+void DisposeDiscCatalog(DiscCatalog *catalog);
+void CatalogClear(DiscCatalog *catalog);
+OSErr CatalogReserve(DiscCatalog *catalog, long entries, long nameBytes);
+OSErr CatalogAppend(DiscCatalog *catalog, const DiscEntry *disc,
+                    unsigned short index);
+
+unsigned short CatalogIndex(const DiscCatalog *catalog, long i);
+unsigned char CatalogType(const DiscCatalog *catalog, long i);
+unsigned long CatalogSize(const DiscCatalog *catalog, long i);
+void CatalogGetName(const DiscCatalog *catalog, long i, Str255 name);
+
+OSErr CatalogAppendWire(DiscCatalog *catalog, const WireEntryView *view,
+                        unsigned short firstIndex);
+OSErr CatalogAppendPacked(DiscCatalog *catalog, unsigned char format,
+                          const unsigned char *data, long length, long count,
+                          unsigned short firstIndex);
+OSErr CatalogAppendPage(DiscCatalog *catalog, const DiscPager *pager);
+OSErr CatalogAppendList(DiscCatalog *catalog, const DiscEntry *discs,
+                        long count);
+OSErr CatalogListPaged(DiscCatalog *catalog, short scsiID, short pageEntries,
+                       unsigned char format);
+
+OSErr CatalogAppendRange(DiscCatalog *catalog, const DiscCatalog *source,
+                         long first, long count);
+OSErr CatalogFetchRange(DiscCatalog *catalog, short scsiID,
+                        unsigned short start, unsigned short count,
+                        short pageEntries, unsigned char format);
+OSErr CatalogApplyChanges(DiscCatalog *result, const DiscCatalog *current,
+                          const CatalogChanges *changes, short scsiID,
+                          short pageEntries, unsigned char format);
+
+Boolean CatalogComplete(const DiscCatalog *catalog, long total);
+UInt32 CatalogHash(const DiscCatalog *catalog);
+void CatalogSwap(DiscCatalog *a, DiscCatalog *b);
+
+#endif /* USBODE_CATALOG_H */
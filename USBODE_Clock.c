@@ -0,0 +1,61 @@
+/*
+ * USBODE_Clock.c
+ * Microsecond clock shared by the protocol core
+ *
+ * Uses Microseconds() on the Mac and the monotonic clock on the host.
+ */
+
+#include "USBODE_Port.h"
+
+#ifdef USBODE_HOST
+#include <errno.h>
+#include <time.h>
+#else
+#include <Timer.h>
+#endif
+
+/*
+ * Current time in microseconds (arbitrary origin)
+ */
+UInt32 USBODEMicroseconds(void)
+{
+#ifdef USBODE_HOST
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UInt32)((unsigned long long)now.tv_sec * 1000000ULL +
+                    (unsigned long long)now.tv_nsec / 1000ULL);
+#else
+    UnsignedWide now;
+
+    Microseconds(&now);
+    return now.lo;
+#endif
+}
+
+/*
+ * Wait for at least the given number of microseconds
+ */
+void USBODEDelayMicroseconds(UInt32 micros)
+{
+#ifdef USBODE_HOST
+    struct timespec delay;
+
+    if (micros == 0) {
+        return;
+    }
+
+    delay.tv_sec = micros / 1000000UL;
+    delay.tv_nsec = (long)(micros % 1000000UL) * 1000L;
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+        /* interrupted: sleep for the remainder */
+    }
+#else
+    UInt32 start;
+
+    start = USBODEMicroseconds();
+    while ((UInt32)(USBODEMicroseconds() - start) < micros) {
+        /* spin: the SCSI Manager is synchronous anyway */
+    }
+#endif
+}
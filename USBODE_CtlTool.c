@@ -0,0 +1,817 @@
+/*
+ * USBODE_CtlTool.c
+ * usbode-ctl: drive a USBODE from a Linux host
+ *
+ * The protocol core the Mac application uses (NUMBER OF CDS, LIST CDS,
+ * SET NEXT CD and the extensions), run from the command line against a
+ * device on SG_IO or against the software target, for scripts, CI disc
+ * swaps and throughput tests.  Listings are written a page at a time as
+ * they arrive, so a catalog of 10,000 images takes no more memory than
+ * one page.  Output is text (tab separated), JSON or CSV; names are
+ * converted from MacRoman to UTF-8.
+ *
+ *   usbode-ctl [options] command [argument]
+ *
+ *   -d [id=]/dev/sgN   device node at a SCSI ID (0 if not given); repeatable
+ *   -e dir             software target serving the disc images in dir
+ *   -n count           software target with count generated images
+ *   -L ms              software target: time an image takes to load
+ *   -i id              SCSI ID of the USBODE, found on the bus if omitted
+ *   -f text|json|csv   output format (text)
+ *   -w                 mount and mount-name wait until the disc is ready
+ *   -t ms              how long to wait for readiness (10 seconds)
+ *   -c file            catalog cache for mount-name
+ *
+ *   count              images on the device
+ *   list               every image: index, type, size in KB, name
+ *   mount index        mount an image by its device index
+ *   mount-name name    mount an image by name, or a prefix only it has
+ *   wait-ready         wait until the mounted image is ready
+ *   scan               what answers at each SCSI ID
+ *
+ * mount-name lists the device to resolve the name.  With -c the catalog
+ * is kept in a snapshot file and only listed again once the device's
+ * catalog generation moves on; firmware without CATALOG CHANGES is
+ * listed every time.
+ */
+
+#include "USBODE_NameIndex.h"
+#include "USBODE_Discovery.h"
+#include "USBODE_Snapshot.h"
+#include "USBODE_Emulator.h"
+
+#ifdef USBODE_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define kCtlDefaultID       0       /* software target, and -d without id */
+#define kCtlImageSize       (650UL * 1024 * 1024)
+#define kCtlMaxImages       65535L  /* generated images, -n */
+#define kCtlMaxMillis       4000000L    /* -L, -t: microseconds fit 32 bits */
+#define kCtlMaxIndex        65534L  /* 0xFFFF means nothing is mounted */
+
+/* Output formats */
+enum {
+    kFormatText     = 0,
+    kFormatJSON     = 1,
+    kFormatCSV      = 2
+};
+
+static short gFormat = kFormatText;
+static long gRecords;       /* records written by this command */
+static short gFields;       /* fields written in this record */
+static Boolean gList;       /* output is a list of records */
+
+static void BeginOutput(const char *csvHeader, Boolean list);
+static void EndOutput(void);
+static void BeginRecord(void);
+static void EndRecord(void);
+static void PutKey(const char *key);
+static void FieldNumber(const char *key, long value);
+static void FieldString(const char *key, const unsigned char *text,
+                        short length);
+static OSErr ListingMode(short scsiID, Boolean *paged, unsigned char *format);
+static void PutEntries(const DiscCatalog *catalog);
+static OSErr LoadCatalog(short scsiID, const char *cachePath,
+                         DiscCatalog *catalog);
+static OSErr CommandCount(short scsiID);
+static OSErr CommandList(short scsiID);
+static OSErr PutMount(unsigned short index, ConstStr255Param name, OSErr err,
+                      const MountReadiness *readiness);
+static OSErr CommandMount(short scsiID, unsigned short index, Boolean wait,
+                          UInt32 timeoutMicros);
+static OSErr CommandMountName(short scsiID, const char *utf8,
+                              const char *cachePath, Boolean wait,
+                              UInt32 timeoutMicros);
+static OSErr CommandWaitReady(short scsiID, UInt32 timeoutMicros);
+static OSErr CommandScan(void);
+static void CloseTarget(USBODETransport *transport,
+                        USBODEEmulator *emulator);
+static Boolean ParseNumber(const char *text, long low, long high,
+                           long *value);
+static int Usage(const char *program);
+
+/*
+ * Start a command's output; CSV gets its header line
+ */
+static void BeginOutput(const char *csvHeader, Boolean list)
+{
+    gRecords = 0;
+    gList = list;
+
+    if (gFormat == kFormatCSV) {
+        printf("%s\n", csvHeader);
+    } else if (gFormat == kFormatJSON && list) {
+        printf("[");
+    }
+}
+
+static void EndOutput(void)
+{
+    if (gFormat == kFormatJSON && gList) {
+        printf("%s]\n", (gRecords > 0) ? "\n" : "");
+    }
+    fflush(stdout);
+}
+
+static void BeginRecord(void)
+{
+    gFields = 0;
+    if (gFormat == kFormatJSON) {
+        printf("%s{", gList ? ((gRecords > 0) ? ",\n  " : "\n  ") : "");
+    }
+}
+
+static void EndRecord(void)
+{
+    printf((gFormat == kFormatJSON) ? (gList ? "}" : "}\n") : "\n");
+    gRecords++;
+}
+
+/*
+ * Separator and, in JSON, the key before a field's value
+ */
+static void PutKey(const char *key)
+{
+    if (gFields++ > 0) {
+        printf((gFormat == kFormatJSON) ? ", " :
+               (gFormat == kFormatCSV) ? "," : "\t");
+    }
+    if (gFormat == kFormatJSON) {
+        printf("\"%s\": ", key);
+    }
+}
+
+static void FieldNumber(const char *key, long value)
+{
+    PutKey(key);
+    printf("%ld", value);
+}
+
+/*
+ * A MacRoman string field, as UTF-8 quoted for the format
+ */
+static void FieldString(const char *key, const unsigned char *text,
+                        short length)
+{
+    unsigned char utf8[3 * 255];
+    short count;
+    short i;
+
+    PutKey(key);
+    count = MacRomanToUTF8(text, (length > 255) ? 255 : length, utf8);
+
+    if (gFormat == kFormatText) {
+        fwrite(utf8, 1, (size_t)count, stdout);
+        return;
+    }
+
+    putchar('"');
+    for (i = 0; i < count; i++) {
+        if (utf8[i] == '"') {
+            printf((gFormat == kFormatJSON) ? "\\\"" : "\"\"");
+        } else if (gFormat == kFormatJSON && utf8[i] == '\\') {
+            printf("\\\\");
+        } else if (gFormat == kFormatJSON && utf8[i] < 0x20) {
+            printf("\\u%04x", utf8[i]);
+        } else {
+            putchar(utf8[i]);
+        }
+    }
+    putchar('"');
+}
+
+/*
+ * Whether the device lists in pages, and in which format
+ * Uses GET DEVICE INFO where the firmware has it, as the application
+ * does, and asks for an empty page otherwise.
+ */
+static OSErr ListingMode(short scsiID, Boolean *paged, unsigned char *format)
+{
+    DeviceInfo info;
+    OSErr err;
+
+    *format = kListFormatFixed;
+
+    err = ProbeDeviceInfo(scsiID, &info);
+    if (err != noErr) {
+        return err;
+    }
+    if (!info.answered) {
+        return ProbePagedListing(scsiID, paged);
+    }
+
+    *paged = DeviceHas(&info, kCapPagedListing);
+    if (!TransportReportsResidual(GetUSBODETransport())) {
+        return noErr;
+    }
+    if (DeviceHas(&info, kCapCompressedListing)) {
+        *format |= kListFormatFrontCoded;
+    }
+    if (DeviceHas(&info, kCapLongNames)) {
+        *format |= kListFormatLongNames;
+    }
+
+    return noErr;
+}
+
+/*
+ * One record per catalog entry
+ */
+static void PutEntries(const DiscCatalog *catalog)
+{
+    Str255 name;
+    long i;
+
+    for (i = 0; i < catalog->count; i++) {
+        CatalogGetName(catalog, i, name);
+        BeginRecord();
+        FieldNumber("index", CatalogIndex(catalog, i));
+        FieldNumber("type", CatalogType(catalog, i));
+        FieldNumber("size_kb", (long)CatalogSize(catalog, i));
+        FieldString("name", &name[1], name[0]);
+        EndRecord();
+    }
+}
+
+/*
+ * The device's whole catalog, from the cache if it is still current
+ * The generation is read before listing, so a catalog that changes
+ * while it is listed is cached as already out of date.
+ */
+static OSErr LoadCatalog(short scsiID, const char *cachePath,
+                         DiscCatalog *catalog)
+{
+    SnapshotInfo info;
+    DiscEntry *discs;
+    Boolean generations;
+    Boolean paged;
+    unsigned char format;
+    unsigned char count;
+    UInt32 generation;
+    OSErr err;
+
+    err = ProbeCatalogGeneration(scsiID, &generations, &generation);
+    if (err != noErr) {
+        return err;
+    }
+
+    if (cachePath != nil && generations &&
+        LoadSnapshotFile(catalog, &info, cachePath) == noErr &&
+        info.scsiID == scsiID && info.hasGeneration &&
+        info.generation == generation) {
+        return noErr;
+    }
+
+    err = ListingMode(scsiID, &paged, &format);
+    if (err != noErr) {
+        return err;
+    }
+
+    if (paged) {
+        err = CatalogListPaged(catalog, scsiID, kDefaultPageEntries, format);
+    } else {
+        CatalogClear(catalog);
+        discs = (DiscEntry *)NewPtr(kMaxDiscs * (long)sizeof(DiscEntry));
+        if (discs == nil) {
+            return memFullErr;
+        }
+        err = FetchDiscList(scsiID, kRefreshAuto, discs, kMaxDiscs, &count);
+        if (err == noErr) {
+            err = CatalogAppendList(catalog, discs, count);
+        }
+        DisposePtr((Ptr)discs);
+    }
+
+    if (err == noErr && cachePath != nil) {
+        err = SaveSnapshotFile(catalog, scsiID,
+                               generations ? &generation : nil, cachePath);
+    }
+
+    return err;
+}
+
+/*
+ * count: the paged listing's total, or NUMBER OF CDS on firmware that
+ * cannot page (which stops at 100)
+ */
+static OSErr CommandCount(short scsiID)
+{
+    unsigned char header[kPageHeaderSize];
+    unsigned short total;
+    unsigned short pageCount;
+    unsigned char count;
+    Boolean paged;
+    OSErr err;
+
+    paged = true;
+    err = GetDiscPage(scsiID, 0, 0, header, kPageHeaderSize,
+                      &total, &pageCount);
+    if (err == scsiNonZeroStatus) {
+        paged = false;
+        err = GetDiscCount(scsiID, &count);
+        total = count;
+    }
+    if (err != noErr) {
+        return err;
+    }
+
+    BeginOutput("count,paged", false);
+    BeginRecord();
+    FieldNumber("count", total);
+    PutKey("paged");
+    printf(paged ? "true" : "false");
+    EndRecord();
+    EndOutput();
+
+    return noErr;
+}
+
+/*
+ * list: write each page as it arrives
+ * Only one page of entries is held at a time.  On an error partway the
+ * output is still closed, so what arrived can be read.
+ */
+static OSErr CommandList(short scsiID)
+{
+    DiscCatalog page;
+    DiscPager pager;
+    DiscEntry *discs;
+    Boolean paged;
+    unsigned char format;
+    unsigned char count;
+    OSErr err;
+
+    err = ListingMode(scsiID, &paged, &format);
+    if (err == noErr) {
+        err = InitDiscCatalog(&page);
+    }
+    if (err != noErr) {
+        return err;
+    }
+
+    BeginOutput("index,type,size_kb,name", true);
+
+    if (paged) {
+        err = BeginDiscPagerFormat(&pager, scsiID, kDefaultPageEntries,
+                                   format);
+        while (err == noErr && !pager.done) {
+            err = DiscPagerStep(&pager);
+            if (err == noErr) {
+                CatalogClear(&page);
+                err = CatalogAppendPage(&page, &pager);
+            }
+            if (err == noErr) {
+                PutEntries(&page);
+            }
+        }
+        EndDiscPager(&pager);
+    } else {
+        discs = (DiscEntry *)NewPtr(kMaxDiscs * (long)sizeof(DiscEntry));
+        err = (discs != nil) ? noErr : memFullErr;
+        if (err == noErr) {
+            err = FetchDiscList(scsiID, kRefreshAuto, discs, kMaxDiscs,
+                                &count);
+        }
+        if (err == noErr) {
+            err = CatalogAppendList(&page, discs, count);
+        }
+        if (err == noErr) {
+            PutEntries(&page);
+        }
+        if (discs != nil) {
+            DisposePtr((Ptr)discs);
+        }
+    }
+
+    EndOutput();
+    DisposeDiscCatalog(&page);
+    return err;
+}
+
+/*
+ * Write how a mount went; the mount's own result is returned
+ * A disc that did not become ready is still reported.  name, if not
+ * nil, is written too.
+ */
+static OSErr PutMount(unsigned short index, ConstStr255Param name, OSErr err,
+                      const MountReadiness *readiness)
+{
+    if (err != noErr && err != scsiNonZeroStatus) {
+        return err;
+    }
+
+    BeginOutput(name != nil ? "index,name,result,mount_us,ready_us,polls" :
+                              "index,result,mount_us,ready_us,polls", false);
+    BeginRecord();
+    FieldNumber("index", index);
+    if (name != nil) {
+        FieldString("name", &name[1], name[0]);
+    }
+    FieldNumber("result", err);
+    FieldNumber("mount_us", (long)readiness->mountMicros);
+    FieldNumber("ready_us", (long)readiness->readyMicros);
+    FieldNumber("polls", readiness->polls);
+    EndRecord();
+    EndOutput();
+
+    return err;
+}
+
+/*
+ * mount: SET NEXT CD, and with wait, poll until the disc is ready
+ */
+static OSErr CommandMount(short scsiID, unsigned short index, Boolean wait,
+                          UInt32 timeoutMicros)
+{
+    MountReadiness readiness;
+    UInt32 start;
+    OSErr err;
+
+    memset(&readiness, 0, sizeof(readiness));
+    if (wait) {
+        err = MountAndWait(scsiID, index, timeoutMicros, &readiness);
+    } else {
+        start = USBODEMicroseconds();
+        err = SetActiveDiscIndex(scsiID, index);
+        readiness.mountMicros = USBODEMicroseconds() - start;
+    }
+
+    return PutMount(index, nil, err, &readiness);
+}
+
+/*
+ * mount-name: mount the disc a name stands for in the device's catalog
+ */
+static OSErr CommandMountName(short scsiID, const char *utf8,
+                              const char *cachePath, Boolean wait,
+                              UInt32 timeoutMicros)
+{
+    DiscCatalog catalog;
+    PrefixIndex prefixes;
+    NameIndex names;
+    MountReadiness readiness;
+    Str255 name;
+    Str255 found;
+    size_t length;
+    long entry;
+    OSErr err;
+
+    length = strlen(utf8);
+    name[0] = (unsigned char)UTF8ToMacRoman((const unsigned char *)utf8,
+                                            (short)((length > 255) ? 255 :
+                                                                     length),
+                                            &name[1]);
+
+    err = InitDiscCatalog(&catalog);
+    if (err != noErr) {
+        return err;
+    }
+    err = InitPrefixIndex(&prefixes);
+    if (err == noErr) {
+        err = InitNameIndex(&names);
+        if (err != noErr) {
+            DisposePrefixIndex(&prefixes);
+        }
+    }
+    if (err != noErr) {
+        DisposeDiscCatalog(&catalog);
+        return err;
+    }
+
+    err = LoadCatalog(scsiID, cachePath, &catalog);
+    if (err == noErr) {
+        err = PrefixIndexSync(&prefixes, &catalog);
+    }
+    if (err == noErr) {
+        err = NameIndexSync(&names, &catalog);
+    }
+    if (err == noErr) {
+        err = MountDiscByName(scsiID, &names, &prefixes, &catalog, name,
+                              wait ? timeoutMicros : 0, &entry, &readiness);
+        if (entry >= 0) {
+            CatalogGetName(&catalog, entry, found);
+            err = PutMount(CatalogIndex(&catalog, entry), found, err,
+                           &readiness);
+        }
+    }
+
+    DisposeNameIndex(&names);
+    DisposePrefixIndex(&prefixes);
+    DisposeDiscCatalog(&catalog);
+    return err;
+}
+
+/*
+ * wait-ready: poll the mounted disc until it is ready
+ */
+static OSErr CommandWaitReady(short scsiID, UInt32 timeoutMicros)
+{
+    MountReadiness readiness;
+    OSErr err;
+
+    err = WaitUntilReady(scsiID, timeoutMicros, &readiness);
+    if (err != noErr && err != scsiNonZeroStatus) {
+        return err;
+    }
+
+    BeginOutput("result,ready_us,polls,sense_key,asc,ascq", false);
+    BeginRecord();
+    FieldNumber("result", err);
+    FieldNumber("ready_us", (long)readiness.readyMicros);
+    FieldNumber("polls", readiness.polls);
+    FieldNumber("sense_key", readiness.lastSense.key);
+    FieldNumber("asc", readiness.lastSense.asc);
+    FieldNumber("ascq", readiness.lastSense.ascq);
+    EndRecord();
+    EndOutput();
+
+    return err;
+}
+
+/*
+ * scan: INQUIRY at every ID a USBODE could use
+ */
+static OSErr CommandScan(void)
+{
+    static const char *const kStates[] = { "unknown", "empty", "other",
+                                           "usbode" };
+    DiscoveryCache cache;
+    const InquiryIdentity *identity;
+    short state;
+    short id;
+
+    InitDiscoveryCache(&cache, -1);
+    (void)DiscoveryScanBus(&cache);
+
+    BeginOutput("id,state,vendor,product,revision", true);
+    for (id = 0; id < kDiscoveryIDCount; id++) {
+        state = DiscoveryState(&cache, id);
+        identity = DiscoveryIdentity(&cache, id);
+
+        BeginRecord();
+        FieldNumber("id", id);
+        FieldString("state", (const unsigned char *)kStates[state],
+                    (short)strlen(kStates[state]));
+        FieldString("vendor", (const unsigned char *)
+                    (identity != nil ? identity->vendor : ""),
+                    (short)(identity != nil ? strlen(identity->vendor) : 0));
+        FieldString("product", (const unsigned char *)
+                    (identity != nil ? identity->product : ""),
+                    (short)(identity != nil ? strlen(identity->product) : 0));
+        FieldString("revision", (const unsigned char *)
+                    (identity != nil ? identity->revision : ""),
+                    (short)(identity != nil ? strlen(identity->revision) : 0));
+        EndRecord();
+    }
+    EndOutput();
+
+    return noErr;
+}
+
+/*
+ * Release the transport, then the software target it talked to
+ */
+static void CloseTarget(USBODETransport *transport, USBODEEmulator *emulator)
+{
+    if (transport != nil) {
+        DisposeUSBODETransport(transport);
+    }
+    if (emulator != nil) {
+        DisposeUSBODEEmulator(emulator);
+    }
+}
+
+/*
+ * A decimal number from low to high, and nothing else
+ */
+static Boolean ParseNumber(const char *text, long low, long high,
+                           long *value)
+{
+    char *end;
+    long number;
+
+    errno = 0;
+    number = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE ||
+        number < low || number > high) {
+        return false;
+    }
+
+    *value = number;
+    return true;
+}
+
+static int Usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-d [id=]/dev/sgN]... [-e dir | -n count [-L ms]]\n"
+            "       [-i id] [-f text|json|csv] [-w] [-t ms] [-c cache]\n"
+            "       count | list | mount index | mount-name name |\n"
+            "       wait-ready | scan\n", program);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    USBODETransport *transport;
+    USBODEEmulator *emulator;
+    DiscoveryCache discovery;
+    char name[kEmulatorMaxNameLength + 1];
+    const char *devices[kDiscoveryIDCount];
+    const char *directory;
+    const char *cachePath;
+    const char *command;
+    const char *argument;
+    const char *path;
+    UInt32 timeoutMicros;
+    UInt32 loadMicros;
+    long images;
+    long number;
+    long i;
+    short scsiID;
+    short id;
+    Boolean needsArgument;
+    Boolean wait;
+    OSErr err;
+    int arg;
+
+    for (id = 0; id < kDiscoveryIDCount; id++) {
+        devices[id] = nil;
+    }
+    directory = nil;
+    cachePath = nil;
+    images = -1;
+    loadMicros = 0;
+    timeoutMicros = kDefaultReadyTimeout;
+    scsiID = -1;
+    wait = false;
+
+    for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-w") == 0) {
+            wait = true;
+        } else if (arg + 1 >= argc) {
+            return Usage(argv[0]);
+        } else if (strcmp(argv[arg], "-d") == 0) {
+            path = argv[++arg];
+            id = kCtlDefaultID;
+            if (path[0] >= '0' && path[0] <= '9' && path[1] == '=') {
+                id = (short)(path[0] - '0');
+                path += 2;
+            }
+            if (id >= kDiscoveryIDCount) {
+                return Usage(argv[0]);
+            }
+            devices[id] = path;
+        } else if (strcmp(argv[arg], "-e") == 0) {
+            directory = argv[++arg];
+        } else if (strcmp(argv[arg], "-n") == 0) {
+            if (!ParseNumber(argv[++arg], 0, kCtlMaxImages, &images)) {
+                return Usage(argv[0]);
+            }
+        } else if (strcmp(argv[arg], "-L") == 0) {
+            if (!ParseNumber(argv[++arg], 0, kCtlMaxMillis, &number)) {
+                return Usage(argv[0]);
+            }
+            loadMicros = (UInt32)number * 1000;
+        } else if (strcmp(argv[arg], "-i") == 0) {
+            if (!ParseNumber(argv[++arg], 0, kDiscoveryIDCount - 1, &number)) {
+                return Usage(argv[0]);
+            }
+            scsiID = (short)number;
+        } else if (strcmp(argv[arg], "-t") == 0) {
+            if (!ParseNumber(argv[++arg], 1, kCtlMaxMillis, &number)) {
+                return Usage(argv[0]);
+            }
+            timeoutMicros = (UInt32)number * 1000;
+        } else if (strcmp(argv[arg], "-c") == 0) {
+            cachePath = argv[++arg];
+        } else if (strcmp(argv[arg], "-f") == 0) {
+            arg++;
+            if (strcmp(argv[arg], "json") == 0) {
+                gFormat = kFormatJSON;
+            } else if (strcmp(argv[arg], "csv") == 0) {
+                gFormat = kFormatCSV;
+            } else if (strcmp(argv[arg], "text") == 0) {
+                gFormat = kFormatText;
+            } else {
+                return Usage(argv[0]);
+            }
+        } else {
+            return Usage(argv[0]);
+        }
+    }
+
+    if (arg >= argc) {
+        return Usage(argv[0]);
+    }
+    command = argv[arg++];
+    argument = (arg < argc) ? argv[arg++] : nil;
+    needsArgument = (strcmp(command, "mount") == 0 ||
+                     strcmp(command, "mount-name") == 0);
+    if (arg < argc || (argument != nil) != needsArgument ||
+        (!needsArgument && strcmp(command, "count") != 0 &&
+         strcmp(command, "list") != 0 && strcmp(command, "wait-ready") != 0 &&
+         strcmp(command, "scan") != 0)) {
+        return Usage(argv[0]);
+    }
+    number = 0;
+    if (strcmp(command, "mount") == 0 &&
+        !ParseNumber(argument, 0, kCtlMaxIndex, &number)) {
+        return Usage(argv[0]);
+    }
+
+    /* The software target, or the device nodes given */
+    emulator = nil;
+    if (directory != nil || images >= 0) {
+        emulator = NewUSBODEEmulator((scsiID >= 0) ? scsiID : kCtlDefaultID);
+        if (emulator == nil) {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            return 1;
+        }
+        emulator->loadMicros = loadMicros;
+        err = noErr;
+        if (directory != nil) {
+            err = EmulatorLoadDirectory(emulator, directory);
+        }
+        for (i = 0; err == noErr && i < images; i++) {
+            snprintf(name, sizeof(name), "Disc Image %05ld.iso", i);
+            err = EmulatorAddImage(emulator, name, kCtlImageSize - i * 2048);
+        }
+        transport = (err == noErr) ? NewEmulatorTransport(emulator) : nil;
+        if (err != noErr) {
+            fprintf(stderr, "%s: cannot set up the software target: %d\n",
+                    argv[0], err);
+        }
+    } else {
+        transport = NewSGIOTransport();
+        err = noErr;
+        for (id = 0; transport != nil && id < kDiscoveryIDCount; id++) {
+            if (devices[id] != nil && err == noErr) {
+                err = SGIOAttachDevice(transport, id, devices[id]);
+                if (err != noErr) {
+                    perror(devices[id]);
+                }
+            }
+        }
+    }
+    if (transport == nil && err == noErr) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        err = memFullErr;
+    }
+    if (err != noErr) {
+        CloseTarget(transport, emulator);
+        return 1;
+    }
+    SetUSBODETransport(transport);
+
+    if (scsiID < 0 && strcmp(command, "scan") != 0) {
+        InitDiscoveryCache(&discovery, -1);
+        if (!DiscoverUSBODE(&discovery, &scsiID)) {
+            fprintf(stderr, "%s: no USBODE found\n", argv[0]);
+            CloseTarget(transport, emulator);
+            return 1;
+        }
+    }
+
+    if (strcmp(command, "scan") == 0) {
+        err = CommandScan();
+    } else if (strcmp(command, "count") == 0) {
+        err = CommandCount(scsiID);
+    } else if (strcmp(command, "list") == 0) {
+        err = CommandList(scsiID);
+    } else if (strcmp(command, "mount") == 0) {
+        err = CommandMount(scsiID, (unsigned short)number, wait,
+                           timeoutMicros);
+    } else if (strcmp(command, "mount-name") == 0) {
+        err = CommandMountName(scsiID, argument, cachePath, wait,
+                               timeoutMicros);
+    } else {
+        err = CommandWaitReady(scsiID, timeoutMicros);
+    }
+
+    CloseTarget(transport, emulator);
+
+    if (err == fnfErr) {
+        fprintf(stderr, "%s: %s: no such disc\n", argv[0], argument);
+    } else if (err == dupFNErr) {
+        fprintf(stderr, "%s: %s: more than one disc matches\n", argv[0],
+                argument);
+    } else if (err != noErr) {
+        fprintf(stderr, "%s: %s failed: %d\n", argv[0], command, err);
+    }
+
+    return (err == noErr) ? 0 : 1;
+}
+
+#else
+
+int main(void)
+{
+    return 1;
+}
+
+#endif /* USBODE_HOST */
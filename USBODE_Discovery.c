@@ -0,0 +1,332 @@
+/*
+ * USBODE_Discovery.c
+ * Finding the USBODE on the SCSI chain
+ *
+ * Portable: everything goes through the active transport, so the same
+ * discovery runs over the SCSI Manager, SG_IO and the emulator.  The
+ * bus selects one target at a time, so IDs are probed in turn; the
+ * short timeout and the cache are what keep that cheap.
+ */
+
+#include "USBODE_Discovery.h"
+
+static void CopyInquiryString(const unsigned char *field, short length,
+                              char *out);
+static Boolean StartsWith(const char *text, const char *prefix);
+static Boolean IsUSBODEIdentity(const InquiryIdentity *identity);
+static void ClearIdentity(InquiryIdentity *identity);
+static Boolean IsFreshNegative(const DiscoverySlot *slot, UInt32 now);
+
+/*
+ * Copy a space padded INQUIRY field, dropping the padding
+ */
+static void CopyInquiryString(const unsigned char *field, short length,
+                              char *out)
+{
+    short i;
+
+    while (length > 0 &&
+           (field[length - 1] == ' ' || field[length - 1] == 0)) {
+        length--;
+    }
+
+    for (i = 0; i < length; i++) {
+        out[i] = (field[i] >= 0x20 && field[i] < 0x7F) ? (char)field[i] : '?';
+    }
+    out[length] = 0;
+}
+
+/*
+ * True if text begins with prefix
+ */
+static Boolean StartsWith(const char *text, const char *prefix)
+{
+    while (*prefix != 0) {
+        if (*text++ != *prefix++) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * True if the vendor string, or any part of the product string, names
+ * a USBODE
+ */
+static Boolean IsUSBODEIdentity(const InquiryIdentity *identity)
+{
+    short i;
+
+    if (StartsWith(identity->vendor, kUSBODEInquiryVendor)) {
+        return true;
+    }
+    for (i = 0; identity->product[i] != 0; i++) {
+        if (StartsWith(identity->product + i, kUSBODEInquiryVendor)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Forget an identity
+ */
+static void ClearIdentity(InquiryIdentity *identity)
+{
+    identity->deviceType = 0;
+    identity->vendor[0] = 0;
+    identity->product[0] = 0;
+    identity->revision[0] = 0;
+}
+
+/*
+ * True for an empty or foreign ID probed recently enough to skip
+ */
+static Boolean IsFreshNegative(const DiscoverySlot *slot, UInt32 now)
+{
+    if (slot->state != kProbeEmpty && slot->state != kProbeOther) {
+        return false;
+    }
+    return (now - slot->probedAt < kDiscoveryNegativeLife);
+}
+
+/*
+ * Start with nothing known but, possibly, the ID found last time
+ */
+void InitDiscoveryCache(DiscoveryCache *cache, short lastID)
+{
+    DiscoveryForget(cache);
+
+    cache->lastID = (lastID >= 0 && lastID < kDiscoveryIDCount) ? lastID : -1;
+    cache->probeTimeout = kDiscoveryProbeTimeout;
+    cache->probes = 0;
+}
+
+/*
+ * Drop every probe result; the last-known ID is kept
+ */
+void DiscoveryForget(DiscoveryCache *cache)
+{
+    short id;
+
+    for (id = 0; id < kDiscoveryIDCount; id++) {
+        cache->slots[id].state = kProbeUnknown;
+        cache->slots[id].probedAt = 0;
+        ClearIdentity(&cache->slots[id].identity);
+    }
+}
+
+/*
+ * Send INQUIRY and decode the identity
+ * Returns scCommErr when nothing answers or the target reports that no
+ * unit is connected.
+ */
+OSErr InquireDevice(short scsiID, InquiryIdentity *identity)
+{
+    unsigned char cdb[kStandardCDBLength];
+    unsigned char data[kInquiryLength];
+    long actual;
+    OSErr err;
+    short i;
+
+    for (i = 0; i < kStandardCDBLength; i++) {
+        cdb[i] = 0;
+    }
+    for (i = 0; i < kInquiryLength; i++) {
+        data[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_INQUIRY;
+    cdb[4] = kInquiryLength;
+
+    actual = 0;
+    err = SendCommandBlock(scsiID, cdb, kStandardCDBLength,
+                           data, kInquiryLength, &actual);
+    if (err != noErr) {
+        return err;
+    }
+    if ((data[0] & kPeripheralQualifierMask) == kPeripheralNotConnected) {
+        return scCommErr;
+    }
+
+    identity->deviceType = data[0] & kPeripheralTypeMask;
+    CopyInquiryString(data + kInquiryVendorOffset, kInquiryVendorLength,
+                      identity->vendor);
+    CopyInquiryString(data + kInquiryProductOffset, kInquiryProductLength,
+                      identity->product);
+    CopyInquiryString(data + kInquiryRevisionOffset, kInquiryRevisionLength,
+                      identity->revision);
+
+    return noErr;
+}
+
+/*
+ * Probe one ID and record what is there; returns the new state
+ * A CD-ROM that does not name itself, or a target that rejects INQUIRY,
+ * is a USBODE if it answers NUMBER OF CDS.
+ */
+short DiscoveryProbe(DiscoveryCache *cache, short scsiID)
+{
+    USBODETransport *transport;
+    DiscoverySlot *slot;
+    unsigned char count;
+    Boolean confirm;
+    OSErr err;
+
+    if (scsiID < 0 || scsiID >= kDiscoveryIDCount) {
+        return kProbeEmpty;
+    }
+
+    slot = &cache->slots[scsiID];
+    ClearIdentity(&slot->identity);
+    transport = GetUSBODETransport();
+
+    TransportSetTimeout(transport, cache->probeTimeout);
+    err = InquireDevice(scsiID, &slot->identity);
+    TransportSetTimeout(transport, 0);
+    cache->probes++;
+
+    confirm = false;
+    if (err == noErr) {
+        if (IsUSBODEIdentity(&slot->identity)) {
+            slot->state = kProbeUSBODE;
+        } else {
+            slot->state = kProbeOther;
+            confirm = (slot->identity.deviceType == kPeripheralCDROM);
+        }
+    } else if (err == scsiNonZeroStatus) {
+        slot->state = kProbeOther;
+        confirm = true;
+    } else {
+        slot->state = kProbeEmpty;
+    }
+
+    if (confirm && GetDiscCount(scsiID, &count) == noErr) {
+        slot->state = kProbeUSBODE;
+    }
+
+    slot->probedAt = USBODEMicroseconds();
+
+    if (slot->state == kProbeUSBODE) {
+        cache->lastID = scsiID;
+    } else if (cache->lastID == scsiID) {
+        cache->lastID = -1;
+    }
+
+    return slot->state;
+}
+
+/*
+ * Find a USBODE: the last-known ID first, then every ID not known to be
+ * empty or foreign.  Returns false and -1 when there is none.
+ */
+Boolean DiscoverUSBODE(DiscoveryCache *cache, short *scsiID)
+{
+    DiscoverySearch search;
+
+    BeginDiscoverySearch(cache, &search);
+    while (!DiscoverySearchStep(cache, &search)) {
+        /* one probe per step */
+    }
+
+    *scsiID = search.found;
+    return (search.found >= 0);
+}
+
+/*
+ * Set up a DiscoverUSBODE to be taken one probe at a time
+ */
+void BeginDiscoverySearch(const DiscoveryCache *cache, DiscoverySearch *search)
+{
+    search->tried = cache->lastID;
+    search->next = -1;
+    search->found = -1;
+    search->done = false;
+}
+
+/*
+ * Send the next probe of a search
+ * Returns true once search->found is final (-1 when there is no
+ * USBODE).  IDs known to be empty or foreign are passed over without a
+ * probe, so a step costs at most one.
+ */
+Boolean DiscoverySearchStep(DiscoveryCache *cache, DiscoverySearch *search)
+{
+    short id;
+
+    if (search->done) {
+        return true;
+    }
+
+    if (search->next < 0) {
+        search->next = 0;
+        if (search->tried >= 0) {
+            if (DiscoveryProbe(cache, search->tried) == kProbeUSBODE) {
+                search->found = search->tried;
+                search->done = true;
+            }
+            return search->done;
+        }
+    }
+
+    for (id = search->next; id < kDiscoveryIDCount; id++) {
+        if (id == search->tried ||
+            IsFreshNegative(&cache->slots[id], USBODEMicroseconds())) {
+            continue;
+        }
+        search->next = id + 1;
+        if (DiscoveryProbe(cache, id) == kProbeUSBODE) {
+            search->found = id;
+            search->done = true;
+        }
+        return search->done;
+    }
+
+    search->next = kDiscoveryIDCount;
+    search->done = true;
+    return true;
+}
+
+/*
+ * Probe every ID; returns the number of devices that answered
+ */
+short DiscoveryScanBus(DiscoveryCache *cache)
+{
+    short devices;
+    short id;
+
+    devices = 0;
+    for (id = 0; id < kDiscoveryIDCount; id++) {
+        if (DiscoveryProbe(cache, id) != kProbeEmpty) {
+            devices++;
+        }
+    }
+
+    return devices;
+}
+
+/*
+ * What the last probe found at an ID
+ */
+short DiscoveryState(const DiscoveryCache *cache, short scsiID)
+{
+    if (scsiID < 0 || scsiID >= kDiscoveryIDCount) {
+        return kProbeEmpty;
+    }
+    return cache->slots[scsiID].state;
+}
+
+/*
+ * INQUIRY identity of the device at an ID, or nil if none is known
+ */
+const InquiryIdentity *DiscoveryIdentity(const DiscoveryCache *cache,
+                                         short scsiID)
+{
+    short state;
+
+    state = DiscoveryState(cache, scsiID);
+    if (state != kProbeOther && state != kProbeUSBODE) {
+        return nil;
+    }
+    return &cache->slots[scsiID].identity;
+}
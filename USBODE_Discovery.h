@@ -0,0 +1,77 @@
+/*
+ * USBODE_Discovery.h
+ * Finding the USBODE on the SCSI chain
+ *
+ * A probe is one standard INQUIRY.  Its vendor and product strings
+ * identify the device without sending vendor commands to disks and
+ * scanners; only a CD-ROM that does not name itself gets the USBODE
+ * NUMBER OF CDS as a second check.  Probes run with a short transport
+ * timeout so an empty ID costs as little as the bus allows.
+ *
+ * The cache remembers the last ID a USBODE answered on, which is tried
+ * first and normally settles discovery in one transaction, and what
+ * every other ID held.  Empty and foreign IDs are not probed again
+ * until kDiscoveryNegativeLife has passed; a bus scan probes everything.
+ * A DiscoverySearch is the same search taken one probe per step, for
+ * callers that have other work to interleave.
+ */
+
+#ifndef USBODE_DISCOVERY_H
+#define USBODE_DISCOVERY_H
+
+#include "USBODE_Protocol.h"
+
+#define kDiscoveryIDCount       7           /* IDs 0-6; 7 is the Mac */
+#define kDiscoveryProbeTimeout  20          /* milliseconds */
+#define kDiscoveryNegativeLife  60000000UL  /* microseconds */
+
+/* What a probe found at an ID */
+enum {
+    kProbeUnknown   = 0,    /* not probed, or the result has expired */
+    kProbeEmpty     = 1,    /* nothing answered selection */
+    kProbeOther     = 2,    /* a device, but not a USBODE */
+    kProbeUSBODE    = 3
+};
+
+/* INQUIRY identity, strings NUL terminated with the padding removed */
+typedef struct {
+    unsigned char   deviceType;     /* peripheral device type */
+    char            vendor[kInquiryVendorLength + 1];
+    char            product[kInquiryProductLength + 1];
+    char            revision[kInquiryRevisionLength + 1];
+} InquiryIdentity;
+
+typedef struct {
+    unsigned char   state;          /* kProbe... */
+    UInt32          probedAt;       /* USBODEMicroseconds of the probe */
+    InquiryIdentity identity;       /* valid for kProbeOther and kProbeUSBODE */
+} DiscoverySlot;
+
+typedef struct {
+    DiscoverySlot   slots[kDiscoveryIDCount];
+    short           lastID;         /* last ID a USBODE answered on, or -1 */
+    UInt32          probeTimeout;   /* milliseconds, 0 for the transport's */
+    long            probes;         /* probes sent since InitDiscoveryCache */
+} DiscoveryCache;
+
+/* A DiscoverUSBODE taken one probe at a time */
+typedef struct {
+    short           tried;          /* last-known ID, probed first, or -1 */
+    short           next;           /* next ID to look at; -1 before tried */
+    short           found;          /* the USBODE's ID, or -1 */
+    Boolean         done;
+} DiscoverySearch;
+
+void InitDiscoveryCache(DiscoveryCache *cache, short lastID);
+void DiscoveryForget(DiscoveryCache *cache);
+OSErr InquireDevice(short scsiID, InquiryIdentity *identity);
+short DiscoveryProbe(DiscoveryCache *cache, short scsiID);
+Boolean DiscoverUSBODE(DiscoveryCache *cache, short *scsiID);
+void BeginDiscoverySearch(const DiscoveryCache *cache, DiscoverySearch *search);
+Boolean DiscoverySearchStep(DiscoveryCache *cache, DiscoverySearch *search);
+short DiscoveryScanBus(DiscoveryCache *cache);
+short DiscoveryState(const DiscoveryCache *cache, short scsiID);
+const InquiryIdentity *DiscoveryIdentity(const DiscoveryCache *cache,
+                                         short scsiID);
+
+#endif /* USBODE_DISCOVERY_H */
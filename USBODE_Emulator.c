@@ -0,0 +1,1146 @@
+/*
+ * USBODE_Emulator.c
+ * In-process software USBODE target
+ *
+ * Implements the vendor commands documented in PROTOCOL.md against an
+ * image list.  The core is portable; loading a directory of images is
+ * only available on the host build.
+ */
+
+#include "USBODE_Emulator.h"
+#include "USBODE_Trace.h"
+
+#ifdef USBODE_HOST
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+/* File name extensions served from a directory */
+static const char *kImageExtensions[] = {
+    ".iso", ".bin", ".cue", ".toast", ".cdr", ".img", nil
+};
+#endif
+
+static OSErr EmulatorExecute(USBODETransport *transport, short scsiID,
+                             const unsigned char *cdb, short cdbLength,
+                             void *buffer, long bufferSize, long *actualSize);
+static OSErr EmulatorExecuteBatch(USBODETransport *transport, short scsiID,
+                                  USBODECommand *commands, short count);
+static OSErr EmulatorRunCommand(USBODEEmulator *emulator, Boolean select,
+                                const unsigned char *cdb, short cdbLength,
+                                void *buffer, long bufferSize,
+                                long *actualSize);
+static long EmulatorVisibleCount(USBODEEmulator *emulator);
+static void EncodeWireEntry(const EmulatorImage *image, long index,
+                            unsigned char *entry);
+static void EmulatorChargeBus(USBODEEmulator *emulator, Boolean select,
+                              long bytes);
+static void EmulatorChargeNoTarget(USBODEEmulator *emulator);
+static void EmulatorSetTimeout(USBODETransport *transport,
+                               UInt32 milliseconds);
+static long EmulatorInquiry(unsigned char *out, long bufferSize);
+static OSErr EmulatorCheckCondition(USBODEEmulator *emulator, Boolean select,
+                                    unsigned char key, unsigned char asc,
+                                    unsigned char ascq);
+static long EmulatorSense(USBODEEmulator *emulator, unsigned char *out,
+                          long bufferSize);
+static void EmulatorBeginLoad(USBODEEmulator *emulator);
+static long EmulatorDeviceInfo(USBODEEmulator *emulator, unsigned char *out,
+                               long bufferSize);
+static void SetEmulatorImage(EmulatorImage *image, const char *name,
+                             UInt32 sizeHigh, UInt32 sizeLow);
+static unsigned long ImageSizeKB(const EmulatorImage *image);
+static OSErr EmulatorAppendImage(USBODEEmulator *emulator, const char *name,
+                                 UInt32 sizeHigh, UInt32 sizeLow);
+static void EmulatorLogChange(USBODEEmulator *emulator, long start,
+                              long count);
+static long EmulatorChanges(USBODEEmulator *emulator, UInt32 since,
+                            unsigned short maxRanges,
+                            unsigned char *out, long bufferSize);
+static long EmulatorListPage(USBODEEmulator *emulator, unsigned char format,
+                             unsigned short start, unsigned short maxEntries,
+                             unsigned char *out, long bufferSize);
+static short WireNameBytes(const EmulatorImage *image, short limit);
+
+/*
+ * Create an emulator answering on the given SCSI ID
+ */
+USBODEEmulator *NewUSBODEEmulator(short scsiID)
+{
+    USBODEEmulator *emulator;
+
+    emulator = (USBODEEmulator *)NewPtrClear(sizeof(USBODEEmulator));
+    if (emulator == nil) {
+        return nil;
+    }
+
+    emulator->images = NewHandle(0);
+    if (emulator->images == nil) {
+        DisposePtr((Ptr)emulator);
+        return nil;
+    }
+
+    emulator->scsiID = scsiID;
+    emulator->imageCount = 0;
+    emulator->currentIndex = -1;
+    emulator->loadMicros = 0;
+    emulator->loadStart = 0;
+    emulator->loading = false;
+    emulator->unitAttention = false;
+    emulator->sense.key = kSenseKeyNoSense;
+    emulator->sense.asc = 0;
+    emulator->sense.ascq = 0;
+    emulator->linkedCommands = false;
+    emulator->pagedListing = true;
+    emulator->frontCoded = true;
+    emulator->longNames = true;
+    emulator->catalogChanges = true;
+    emulator->currentDisc = true;
+    emulator->deviceInfo = true;
+    /* Generations start somewhere new at every power-on, so a host
+       cannot mistake one from before a restart for a current one */
+    emulator->generation = USBODEMicroseconds();
+    emulator->historyBase = emulator->generation;
+    emulator->changeCount = 0;
+    EmulatorSetTiming(emulator, 0, 0, kBusUnlimited);
+    emulator->timing.selectTimeoutMicros = kSelectTimeoutMicros;
+    emulator->timing.realTime = true;
+    emulator->timeoutMicros = 0;
+    EmulatorResetStats(emulator);
+
+    return emulator;
+}
+
+/*
+ * Release an emulator and its image list
+ */
+void DisposeUSBODEEmulator(USBODEEmulator *emulator)
+{
+    if (emulator == nil) {
+        return;
+    }
+
+    if (emulator->images != nil) {
+        DisposeHandle(emulator->images);
+    }
+    DisposePtr((Ptr)emulator);
+}
+
+/*
+ * Fill in an image, truncating the name
+ */
+static void SetEmulatorImage(EmulatorImage *image, const char *name,
+                             UInt32 sizeHigh, UInt32 sizeLow)
+{
+    long i;
+
+    image->type = 0;
+    image->size.hi = sizeHigh;
+    image->size.lo = sizeLow;
+    for (i = 0; i < kEmulatorMaxNameLength && name[i] != '\0'; i++) {
+        image->name[i] = name[i];
+    }
+    image->name[i] = '\0';
+}
+
+/*
+ * Record a catalog change and move to a new generation
+ * The oldest record is dropped when the log is full; hosts that listed
+ * before it get a resync.
+ */
+static void EmulatorLogChange(USBODEEmulator *emulator, long start,
+                              long count)
+{
+    EmulatorChange *change;
+    short i;
+
+    if (emulator->changeCount == kEmulatorChangeLog) {
+        emulator->historyBase = emulator->changes[0].generation;
+        for (i = 1; i < kEmulatorChangeLog; i++) {
+            emulator->changes[i - 1] = emulator->changes[i];
+        }
+        emulator->changeCount--;
+    }
+
+    emulator->generation++;
+
+    change = &emulator->changes[emulator->changeCount++];
+    change->generation = emulator->generation;
+    change->start = start;
+    change->count = count;
+}
+
+/*
+ * Append an image to the emulated catalog
+ */
+OSErr EmulatorAddImage(USBODEEmulator *emulator, const char *name,
+                       unsigned long size)
+{
+    return EmulatorAppendImage(emulator, name, 0, (UInt32)size);
+}
+
+/*
+ * Append an image whose size may pass 32 bits
+ */
+static OSErr EmulatorAppendImage(USBODEEmulator *emulator, const char *name,
+                                 UInt32 sizeHigh, UInt32 sizeLow)
+{
+    EmulatorImage *image;
+    OSErr err;
+
+    if (emulator == nil || name == nil) {
+        return paramErr;
+    }
+
+    SetHandleSize(emulator->images,
+                  (emulator->imageCount + 1) * (long)sizeof(EmulatorImage));
+    err = MemError();
+    if (err != noErr) {
+        return err;
+    }
+
+    image = ((EmulatorImage *)*emulator->images) + emulator->imageCount;
+    SetEmulatorImage(image, name, sizeHigh, sizeLow);
+
+    EmulatorLogChange(emulator, emulator->imageCount, 1);
+    emulator->imageCount++;
+    return noErr;
+}
+
+/*
+ * Replace the name and size of one image in place
+ */
+OSErr EmulatorReplaceImage(USBODEEmulator *emulator, long index,
+                           const char *name, unsigned long size)
+{
+    if (emulator == nil || name == nil ||
+        index < 0 || index >= emulator->imageCount) {
+        return paramErr;
+    }
+
+    SetEmulatorImage(((EmulatorImage *)*emulator->images) + index, name,
+                     0, (UInt32)size);
+    EmulatorLogChange(emulator, index, 1);
+
+    return noErr;
+}
+
+/*
+ * Remove one image; the images after it move down
+ */
+OSErr EmulatorRemoveImage(USBODEEmulator *emulator, long index)
+{
+    EmulatorImage *images;
+    long i;
+
+    if (emulator == nil || index < 0 || index >= emulator->imageCount) {
+        return paramErr;
+    }
+
+    images = (EmulatorImage *)*emulator->images;
+    for (i = index + 1; i < emulator->imageCount; i++) {
+        images[i - 1] = images[i];
+    }
+    emulator->imageCount--;
+    SetHandleSize(emulator->images,
+                  emulator->imageCount * (long)sizeof(EmulatorImage));
+
+    if (emulator->currentIndex == index) {
+        emulator->currentIndex = -1;
+    } else if (emulator->currentIndex > index) {
+        emulator->currentIndex--;
+    }
+
+    /* Every later entry now answers to a new index */
+    EmulatorLogChange(emulator, index, emulator->imageCount - index);
+
+    return noErr;
+}
+
+/*
+ * Empty the emulated catalog
+ */
+void EmulatorRemoveAllImages(USBODEEmulator *emulator)
+{
+    if (emulator == nil) {
+        return;
+    }
+
+    SetHandleSize(emulator->images, 0);
+    emulator->imageCount = 0;
+    emulator->currentIndex = -1;
+    EmulatorLogChange(emulator, 0, 0);
+}
+
+#ifdef USBODE_HOST
+
+/*
+ * True if the file name carries a disc image extension
+ */
+static Boolean IsImageFileName(const char *name)
+{
+    const char *dot;
+    short i, j;
+
+    dot = strrchr(name, '.');
+    if (dot == nil) {
+        return false;
+    }
+
+    for (i = 0; kImageExtensions[i] != nil; i++) {
+        for (j = 0; dot[j] != '\0' && kImageExtensions[i][j] != '\0'; j++) {
+            if (tolower((unsigned char)dot[j]) != kImageExtensions[i][j]) {
+                break;
+            }
+        }
+        if (dot[j] == '\0' && kImageExtensions[i][j] == '\0') {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int CompareImageNames(const void *a, const void *b)
+{
+    return strcmp(((const EmulatorImage *)a)->name,
+                  ((const EmulatorImage *)b)->name);
+}
+
+/*
+ * Replace the catalog with the disc images found in a directory,
+ * sorted by name like the device firmware
+ */
+OSErr EmulatorLoadDirectory(USBODEEmulator *emulator, const char *path)
+{
+    DIR *dir;
+    struct dirent *entry;
+    struct stat info;
+    char fullPath[4096];
+    OSErr err;
+
+    if (emulator == nil || path == nil) {
+        return paramErr;
+    }
+
+    dir = opendir(path);
+    if (dir == nil) {
+        return fnfErr;
+    }
+
+    EmulatorRemoveAllImages(emulator);
+    err = noErr;
+
+    while (err == noErr && (entry = readdir(dir)) != nil) {
+        if (entry->d_name[0] == '.' || !IsImageFileName(entry->d_name)) {
+            continue;
+        }
+
+        snprintf(fullPath, sizeof(fullPath), "%s/%s", path, entry->d_name);
+        if (stat(fullPath, &info) != 0 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+
+        /* Images past 4 GB keep their high bits */
+        err = EmulatorAppendImage(emulator, entry->d_name,
+                        (UInt32)((unsigned long long)info.st_size >> 32),
+                        (UInt32)info.st_size);
+    }
+
+    closedir(dir);
+
+    if (emulator->imageCount > 1) {
+        HLock(emulator->images);
+        qsort(*emulator->images, (size_t)emulator->imageCount,
+              sizeof(EmulatorImage), CompareImageNames);
+        HUnlock(emulator->images);
+        EmulatorLogChange(emulator, 0, emulator->imageCount);
+    }
+
+    return err;
+}
+
+#endif /* USBODE_HOST */
+
+/*
+ * Provide exactly the extensions in capabilities, as firmware that
+ * advertises them would; bits the emulator does not implement are
+ * ignored.  GET DEVICE INFO itself stays on; clear deviceInfo to model
+ * firmware from before it.
+ */
+void EmulatorSetCapabilities(USBODEEmulator *emulator, UInt32 capabilities)
+{
+    if (emulator == nil) {
+        return;
+    }
+
+    emulator->pagedListing = (capabilities & kCapPagedListing) != 0;
+    emulator->frontCoded = (capabilities & kCapCompressedListing) != 0;
+    emulator->longNames = (capabilities & kCapLongNames) != 0;
+    emulator->catalogChanges = (capabilities & kCapCatalogChanges) != 0;
+    emulator->currentDisc = (capabilities & kCapCurrentDisc) != 0;
+}
+
+/*
+ * The capability bits GET DEVICE INFO reports
+ */
+UInt32 EmulatorCapabilities(const USBODEEmulator *emulator)
+{
+    UInt32 capabilities;
+
+    capabilities = 0;
+    if (emulator->pagedListing) {
+        capabilities |= kCapPagedListing;
+    }
+    if (emulator->pagedListing && emulator->frontCoded) {
+        capabilities |= kCapCompressedListing;
+    }
+    if (emulator->pagedListing && emulator->longNames) {
+        capabilities |= kCapLongNames;
+    }
+    if (emulator->catalogChanges) {
+        capabilities |= kCapCatalogChanges;
+    }
+    if (emulator->currentDisc) {
+        capabilities |= kCapCurrentDisc;
+    }
+
+    return capabilities;
+}
+
+/*
+ * Configure the bus model
+ */
+void EmulatorSetTiming(USBODEEmulator *emulator, UInt32 selectMicros,
+                       UInt32 commandMicros, UInt32 bytesPerSecond)
+{
+    if (emulator == nil) {
+        return;
+    }
+
+    emulator->timing.selectMicros = selectMicros;
+    emulator->timing.commandMicros = commandMicros;
+    emulator->timing.bytesPerSecond = bytesPerSecond;
+}
+
+/*
+ * Clear the command and bus counters
+ */
+void EmulatorResetStats(USBODEEmulator *emulator)
+{
+    if (emulator == nil) {
+        return;
+    }
+
+    emulator->stats.commands = 0;
+    emulator->stats.selections = 0;
+    emulator->stats.bytesMoved = 0;
+    emulator->stats.busMicros = 0;
+}
+
+/*
+ * Charge selection, command and data-phase time for one command
+ */
+static void EmulatorChargeBus(USBODEEmulator *emulator, Boolean select,
+                              long bytes)
+{
+    UInt32 micros;
+    UInt32 dataMicros;
+
+    micros = emulator->timing.commandMicros;
+    if (select) {
+        micros += emulator->timing.selectMicros;
+        emulator->stats.selections++;
+        TraceMarkModelled(kTracePhaseSelect, emulator->timing.selectMicros);
+    }
+    TraceMarkModelled(kTracePhaseCommand, emulator->timing.commandMicros);
+
+    dataMicros = 0;
+    if (emulator->timing.bytesPerSecond != kBusUnlimited && bytes > 0) {
+        dataMicros = (UInt32)(((double)bytes * 1000000.0) /
+                              (double)emulator->timing.bytesPerSecond);
+        micros += dataMicros;
+    }
+    if (bytes > 0) {
+        TraceMarkModelled(kTracePhaseData, dataMicros);
+    }
+    TraceMarkModelled(kTracePhaseStatus, 0);
+
+    emulator->stats.commands++;
+    emulator->stats.bytesMoved += (unsigned long)bytes;
+    emulator->stats.busMicros += micros;
+
+    if (emulator->timing.realTime) {
+        USBODEDelayMicroseconds(micros);
+    }
+}
+
+/*
+ * Charge a selection that nobody answers: the bus waits out the
+ * selection timeout, or the transport timeout when that is shorter
+ */
+static void EmulatorChargeNoTarget(USBODEEmulator *emulator)
+{
+    UInt32 micros;
+
+    micros = emulator->timing.selectTimeoutMicros;
+    if (emulator->timeoutMicros != 0 && emulator->timeoutMicros < micros) {
+        micros = emulator->timeoutMicros;
+    }
+    TraceMarkModelled(kTracePhaseSelect, micros);
+
+    emulator->stats.selections++;
+    emulator->stats.busMicros += micros;
+
+    if (emulator->timing.realTime) {
+        USBODEDelayMicroseconds(micros);
+    }
+}
+
+/*
+ * Transport timeout, applied to selections of empty IDs
+ */
+static void EmulatorSetTimeout(USBODETransport *transport,
+                               UInt32 milliseconds)
+{
+    ((USBODEEmulator *)transport->refCon)->timeoutMicros = milliseconds * 1000;
+}
+
+/*
+ * Create a transport that delivers commands to the emulator
+ */
+USBODETransport *NewEmulatorTransport(USBODEEmulator *emulator)
+{
+    USBODETransport *transport;
+
+    if (emulator == nil) {
+        return nil;
+    }
+
+    transport = (USBODETransport *)NewPtrClear(sizeof(USBODETransport));
+    if (transport == nil) {
+        return nil;
+    }
+
+    transport->name = "Emulator";
+    transport->refCon = emulator;
+    transport->execute = EmulatorExecute;
+    transport->executeBatch = EmulatorExecuteBatch;
+    transport->close = nil;
+    transport->setTimeout = EmulatorSetTimeout;
+    transport->reportsResidual = true;
+
+    return transport;
+}
+
+/*
+ * Number of entries the device reports (protocol maximum applies)
+ */
+static long EmulatorVisibleCount(USBODEEmulator *emulator)
+{
+    if (emulator->imageCount > kMaxDiscs) {
+        return kMaxDiscs;
+    }
+    return emulator->imageCount;
+}
+
+/*
+ * Build a LIST CDS PAGED reply; returns the bytes produced
+ */
+static long EmulatorListPage(USBODEEmulator *emulator, unsigned char format,
+                             unsigned short start, unsigned short maxEntries,
+                             unsigned char *out, long bufferSize)
+{
+    unsigned char entry[kPackedMaxEntry];
+    const EmulatorImage *image;
+    const EmulatorImage *previous;
+    short nameLimit;
+    short nameLength;
+    short previousLength;
+    long total;
+    long count;
+    long length;
+    long moved;
+    long i;
+
+    if (out == nil || bufferSize < kPageHeaderSize) {
+        return 0;
+    }
+
+    total = emulator->imageCount;
+    if (total > kMaxCatalogEntries) {
+        total = kMaxCatalogEntries;
+    }
+
+    count = (start < total) ? total - start : 0;
+    if (count > maxEntries) {
+        count = maxEntries;
+    }
+
+    /* Packed: as many whole entries as fit, sizes rounded up to
+       kilobytes as the host does for the fixed format */
+    if (format != kListFormatFixed) {
+        nameLimit = (format & kListFormatLongNames) ? kLongNameLength
+                                                    : kWireNameLength;
+        moved = kPageHeaderSize;
+        previous = nil;
+        previousLength = 0;
+        HLock(emulator->images);
+        for (i = 0; i < count; i++) {
+            image = ((EmulatorImage *)*emulator->images) + start + i;
+            nameLength = WireNameBytes(image, nameLimit);
+            length = EncodePackedEntry(format,
+                        (const unsigned char *)image->name, nameLength,
+                        (previous != nil) ?
+                            (const unsigned char *)previous->name : nil,
+                        previousLength, image->type,
+                        ImageSizeKB(image), entry);
+            if (moved + length > bufferSize) {
+                break;
+            }
+            BlockMoveData(entry, out + moved, length);
+            moved += length;
+            previous = image;
+            previousLength = nameLength;
+        }
+        HUnlock(emulator->images);
+
+        PutBE16(out, total);
+        PutBE16(out + 2, i);
+        return moved;
+    }
+
+    if (count > (bufferSize - kPageHeaderSize) / kWireEntrySize) {
+        count = (bufferSize - kPageHeaderSize) / kWireEntrySize;
+    }
+
+    PutBE16(out, total);
+    PutBE16(out + 2, count);
+
+    HLock(emulator->images);
+    for (i = 0; i < count; i++) {
+        EncodeWireEntry(((EmulatorImage *)*emulator->images) + start + i,
+                        start + i,
+                        out + kPageHeaderSize + i * kWireEntrySize);
+    }
+    HUnlock(emulator->images);
+
+    return kPageHeaderSize + count * kWireEntrySize;
+}
+
+/*
+ * Build standard INQUIRY data for a CD-ROM; returns the bytes produced
+ */
+static long EmulatorInquiry(unsigned char *out, long bufferSize)
+{
+    unsigned char data[kInquiryLength];
+    long length;
+    long i;
+
+    for (i = 0; i < kInquiryLength; i++) {
+        data[i] = (i < kInquiryVendorOffset) ? 0 : ' ';
+    }
+    data[0] = kPeripheralCDROM;
+    data[1] = 0x80;                     /* removable medium */
+    data[2] = 0x02;                     /* SCSI-2 */
+    data[3] = 0x02;                     /* response data format */
+    data[4] = kInquiryLength - 5;       /* additional length */
+    BlockMoveData(kUSBODEInquiryVendor, data + kInquiryVendorOffset,
+                  sizeof(kUSBODEInquiryVendor) - 1);
+    BlockMoveData("Virtual CD-ROM", data + kInquiryProductOffset, 14);
+    BlockMoveData("1.0", data + kInquiryRevisionOffset, 3);
+
+    if (out == nil) {
+        return 0;
+    }
+    length = (bufferSize < kInquiryLength) ? bufferSize : kInquiryLength;
+    BlockMoveData(data, out, length);
+
+    return length;
+}
+
+/*
+ * GET DEVICE INFO reply, truncated to the buffer
+ */
+static long EmulatorDeviceInfo(USBODEEmulator *emulator, unsigned char *out,
+                               long bufferSize)
+{
+    unsigned char data[kDeviceInfoLength];
+    UInt32 capabilities;
+    long length;
+    long i;
+
+    for (i = 0; i < kDeviceInfoLength; i++) {
+        data[i] = 0;
+    }
+    capabilities = EmulatorCapabilities(emulator);
+    data[0] = kDeviceInfoVersion;
+    data[kDeviceInfoMajorOffset] = kEmulatorFirmwareMajor;
+    data[kDeviceInfoMinorOffset] = kEmulatorFirmwareMinor;
+    PutBE16(data + kDeviceInfoCapsOffset, capabilities >> 16);
+    PutBE16(data + kDeviceInfoCapsOffset + 2, capabilities);
+
+    if (out == nil) {
+        return 0;
+    }
+    length = (bufferSize < kDeviceInfoLength) ? bufferSize : kDeviceInfoLength;
+    BlockMoveData(data, out, length);
+
+    return length;
+}
+
+/*
+ * Reply to CATALOG CHANGES SINCE: the ranges touched by every change
+ * after since, sorted, merged and clipped to the current catalog
+ */
+static long EmulatorChanges(USBODEEmulator *emulator, UInt32 since,
+                            unsigned short maxRanges,
+                            unsigned char *out, long bufferSize)
+{
+    long starts[kEmulatorChangeLog];
+    long ends[kEmulatorChangeLog];
+    long total;
+    long start;
+    long end;
+    long length;
+    short count;
+    short merged;
+    short i;
+    short j;
+    Boolean resync;
+
+    if (out == nil || bufferSize < kChangesHeaderSize) {
+        return 0;
+    }
+
+    total = emulator->imageCount;
+    if (total > kMaxCatalogEntries) {
+        total = kMaxCatalogEntries;
+    }
+    count = 0;
+
+    /* Generations wrap, so compare distances from the oldest we know */
+    resync = (since - emulator->historyBase >
+              emulator->generation - emulator->historyBase);
+
+    for (i = 0; i < emulator->changeCount && !resync; i++) {
+        if (emulator->changes[i].generation - emulator->historyBase <=
+            since - emulator->historyBase) {
+            continue;
+        }
+        start = emulator->changes[i].start;
+        end = start + emulator->changes[i].count;
+        if (end > total) {
+            end = total;
+        }
+        if (start >= end) {
+            continue;
+        }
+
+        /* Insertion sort by start */
+        for (j = count; j > 0 && starts[j - 1] > start; j--) {
+            starts[j] = starts[j - 1];
+            ends[j] = ends[j - 1];
+        }
+        starts[j] = start;
+        ends[j] = end;
+        count++;
+    }
+
+    merged = 0;
+    for (i = 0; i < count; i++) {
+        if (merged > 0 && starts[i] <= ends[merged - 1]) {
+            if (ends[i] > ends[merged - 1]) {
+                ends[merged - 1] = ends[i];
+            }
+            continue;
+        }
+        starts[merged] = starts[i];
+        ends[merged] = ends[i];
+        merged++;
+    }
+
+    if (merged > maxRanges || merged > kMaxChangeRanges ||
+        kChangesHeaderSize + (long)merged * kChangeRangeSize > bufferSize) {
+        resync = true;
+    }
+    if (resync) {
+        merged = 0;
+    }
+
+    PutBE16(out, emulator->generation >> 16);
+    PutBE16(out + 2, emulator->generation);
+    PutBE16(out + 4, total);
+    out[6] = (unsigned char)merged;
+    out[7] = resync ? kChangesResync : 0;
+
+    length = kChangesHeaderSize;
+    for (i = 0; i < merged; i++) {
+        PutBE16(out + length, starts[i]);
+        PutBE16(out + length + 2, ends[i] - starts[i]);
+        length += kChangeRangeSize;
+    }
+
+    return length;
+}
+
+/*
+ * Length of an image name as a listing of at most limit bytes carries it
+ */
+static short WireNameBytes(const EmulatorImage *image, short limit)
+{
+    short length;
+
+    length = 0;
+    while (length < limit && image->name[length] != '\0') {
+        length++;
+    }
+    return length;
+}
+
+/*
+ * Write one image as a 39-byte wire entry
+ */
+static void EncodeWireEntry(const EmulatorImage *image, long index,
+                            unsigned char *entry)
+{
+    long i;
+
+    entry[kWireIndexOffset] = (unsigned char)index;
+    entry[kWireTypeOffset] = image->type;
+
+    for (i = 0; i < kWireNameLength; i++) {
+        entry[kWireNameOffset + i] = 0;
+    }
+    for (i = 0; i < kWireNameLength && image->name[i] != '\0'; i++) {
+        entry[kWireNameOffset + i] = (unsigned char)image->name[i];
+    }
+
+    entry[kWireSizeOffset + 0] = (unsigned char)image->size.hi;
+    entry[kWireSizeOffset + 1] = (unsigned char)(image->size.lo >> 24);
+    entry[kWireSizeOffset + 2] = (unsigned char)(image->size.lo >> 16);
+    entry[kWireSizeOffset + 3] = (unsigned char)(image->size.lo >> 8);
+    entry[kWireSizeOffset + 4] = (unsigned char)image->size.lo;
+}
+
+/*
+ * Image size in KB, rounded up, as packed entries carry it
+ * 40 bits of bytes fit 32 bits of KB.
+ */
+static unsigned long ImageSizeKB(const EmulatorImage *image)
+{
+    unsigned long kb;
+
+    kb = ((unsigned long)(image->size.hi & 0xFF) << 22) |
+         (unsigned long)(image->size.lo >> 10);
+    if ((image->size.lo & 1023) != 0) {
+        kb++;
+    }
+
+    return kb;
+}
+
+/*
+ * Execute one command block against the emulated device
+ */
+static OSErr EmulatorExecute(USBODETransport *transport, short scsiID,
+                             const unsigned char *cdb, short cdbLength,
+                             void *buffer, long bufferSize, long *actualSize)
+{
+    USBODEEmulator *emulator;
+
+    emulator = (USBODEEmulator *)transport->refCon;
+
+    if (scsiID != emulator->scsiID) {
+        EmulatorChargeNoTarget(emulator);
+        return scCommErr;
+    }
+
+    return EmulatorRunCommand(emulator, true, cdb, cdbLength,
+                              buffer, bufferSize, actualSize);
+}
+
+/*
+ * Execute a batch of command blocks
+ * With linkedCommands set the target accepts SCSI-2 linked commands: a
+ * command that follows one with the link bit set needs no selection of
+ * its own, so a linked batch costs one.  Otherwise the target ends each
+ * command and is selected again for the next.  Stops at the first
+ * failure.
+ */
+static OSErr EmulatorExecuteBatch(USBODETransport *transport, short scsiID,
+                                  USBODECommand *commands, short count)
+{
+    USBODEEmulator *emulator;
+    USBODECommand *command;
+    Boolean linked;
+    OSErr err;
+    short i;
+
+    emulator = (USBODEEmulator *)transport->refCon;
+    err = noErr;
+    linked = false;
+
+    for (i = 0; i < count; i++) {
+        command = &commands[i];
+        command->actualSize = 0;
+
+        if (err != noErr) {
+            command->result = scsiRequestAborted;
+            continue;
+        }
+
+        if (scsiID != emulator->scsiID) {
+            EmulatorChargeNoTarget(emulator);
+            command->result = scCommErr;
+        } else {
+            command->result = EmulatorRunCommand(emulator, !linked,
+                                    command->cdb, command->cdbLength,
+                                    command->buffer, command->bufferSize,
+                                    &command->actualSize);
+        }
+        err = command->result;
+        linked = emulator->linkedCommands &&
+                 (command->cdb[command->cdbLength - 1] & kControlLink) != 0;
+    }
+
+    return err;
+}
+
+/*
+ * Start loading a newly mounted image, as the device does after SET
+ * NEXT CD: the medium change is reported first, then NOT READY until
+ * loadMicros have passed
+ */
+static void EmulatorBeginLoad(USBODEEmulator *emulator)
+{
+    emulator->unitAttention = true;
+    emulator->loading = (emulator->loadMicros > 0);
+    emulator->loadStart = USBODEMicroseconds();
+}
+
+/*
+ * End a command in CHECK CONDITION, keeping the sense for REQUEST SENSE
+ */
+static OSErr EmulatorCheckCondition(USBODEEmulator *emulator, Boolean select,
+                                    unsigned char key, unsigned char asc,
+                                    unsigned char ascq)
+{
+    emulator->sense.key = key;
+    emulator->sense.asc = asc;
+    emulator->sense.ascq = ascq;
+    EmulatorChargeBus(emulator, select, 0);
+    return scsiNonZeroStatus;
+}
+
+/*
+ * Build fixed-format sense data for REQUEST SENSE; returns the bytes
+ * produced.  The sense is handed over only once.
+ */
+static long EmulatorSense(USBODEEmulator *emulator, unsigned char *out,
+                          long bufferSize)
+{
+    unsigned char data[kSenseLength];
+    long i;
+
+    for (i = 0; i < kSenseLength; i++) {
+        data[i] = 0;
+    }
+    data[0] = kSenseResponseCurrent;
+    data[kSenseKeyOffset] = emulator->sense.key;
+    data[kSenseAddLengthOffset] = kSenseLength - 8;
+    data[kSenseASCOffset] = emulator->sense.asc;
+    data[kSenseASCQOffset] = emulator->sense.ascq;
+
+    emulator->sense.key = kSenseKeyNoSense;
+    emulator->sense.asc = 0;
+    emulator->sense.ascq = 0;
+
+    for (i = 0; i < kSenseLength && i < bufferSize && out != nil; i++) {
+        out[i] = data[i];
+    }
+    return i;
+}
+
+/*
+ * Carry out one command; select is false for the later commands of a
+ * linked sequence, which do not arbitrate again
+ */
+static OSErr EmulatorRunCommand(USBODEEmulator *emulator, Boolean select,
+                                const unsigned char *cdb, short cdbLength,
+                                void *buffer, long bufferSize,
+                                long *actualSize)
+{
+    unsigned char *out;
+    long count;
+    long i;
+    long moved;
+
+    out = (unsigned char *)buffer;
+    moved = 0;
+
+    if (actualSize != nil) {
+        *actualSize = 0;
+    }
+    if (cdb == nil || cdbLength < 1) {
+        return scsiNonZeroStatus;
+    }
+
+    count = EmulatorVisibleCount(emulator);
+
+    /* Sense lasts only until the next command */
+    if (cdb[0] != SCSI_CMD_REQUEST_SENSE) {
+        emulator->sense.key = kSenseKeyNoSense;
+        emulator->sense.asc = 0;
+        emulator->sense.ascq = 0;
+    }
+
+    switch (cdb[0]) {
+        case SCSI_CMD_TEST_UNIT_READY:
+            /* A mount reports the medium change once, then loads */
+            if (emulator->unitAttention) {
+                emulator->unitAttention = false;
+                return EmulatorCheckCondition(emulator, select,
+                                              kSenseKeyUnitAttention,
+                                              kASCMediumChanged, 0);
+            }
+            if (emulator->loading) {
+                if ((UInt32)(USBODEMicroseconds() - emulator->loadStart) <
+                    emulator->loadMicros) {
+                    return EmulatorCheckCondition(emulator, select,
+                                                  kSenseKeyNotReady,
+                                                  kASCNotReady,
+                                                  kASCQBecomingReady);
+                }
+                emulator->loading = false;
+            }
+            break;
+
+        case SCSI_CMD_REQUEST_SENSE:
+            moved = EmulatorSense(emulator, out, bufferSize);
+            break;
+
+        case SCSI_CMD_INQUIRY:
+            moved = EmulatorInquiry(out, bufferSize);
+            break;
+
+        case SCSI_CMD_NUM_CDS:
+            if (out != nil && bufferSize >= 1) {
+                out[0] = (unsigned char)count;
+                moved = 1;
+            }
+            break;
+
+        case SCSI_CMD_LIST_CDS:
+        case SCSI_CMD_LIST_FILES:
+            HLock(emulator->images);
+            for (i = 0; i < count; i++) {
+                if (out == nil || moved + kWireEntrySize > bufferSize) {
+                    break;
+                }
+                EncodeWireEntry(((EmulatorImage *)*emulator->images) + i, i,
+                                out + moved);
+                moved += kWireEntrySize;
+            }
+            HUnlock(emulator->images);
+            break;
+
+        case SCSI_CMD_SET_NEXT_CD:
+            /* Invalid indices are silently ignored, as on the device */
+            if (cdbLength < 2) {
+                break;
+            }
+            if (cdb[1] == kExtendedIndexFlag && emulator->pagedListing) {
+                if (cdbLength >= 4 && GetBE16(cdb + 2) < emulator->imageCount) {
+                    emulator->currentIndex = (short)GetBE16(cdb + 2);
+                    EmulatorBeginLoad(emulator);
+                }
+            } else if (cdb[1] < count) {
+                emulator->currentIndex = cdb[1];
+                EmulatorBeginLoad(emulator);
+            }
+            break;
+
+        case SCSI_CMD_LIST_CDS_PAGED:
+            if (!emulator->pagedListing || cdbLength < kUSBODECDBLength ||
+                (cdb[1] & ~(kListFormatFrontCoded | kListFormatLongNames)) ||
+                ((cdb[1] & kListFormatFrontCoded) && !emulator->frontCoded) ||
+                ((cdb[1] & kListFormatLongNames) && !emulator->longNames)) {
+                EmulatorChargeBus(emulator, select, 0);
+                return scsiNonZeroStatus;
+            }
+            moved = EmulatorListPage(emulator, cdb[1],
+                                     GetBE16(cdb + kPageStartOffset),
+                                     GetBE16(cdb + kPageCountOffset),
+                                     out, bufferSize);
+            break;
+
+        case SCSI_CMD_GET_DEVICE_INFO:
+            if (!emulator->deviceInfo) {
+                EmulatorChargeBus(emulator, select, 0);
+                return scsiNonZeroStatus;
+            }
+            moved = EmulatorDeviceInfo(emulator, out, bufferSize);
+            break;
+
+        case SCSI_CMD_GET_CURRENT_CD:
+            if (!emulator->currentDisc) {
+                EmulatorChargeBus(emulator, select, 0);
+                return scsiNonZeroStatus;
+            }
+            if (out != nil && bufferSize >= kCurrentDiscLength) {
+                PutBE16(out, (emulator->currentIndex < 0) ?
+                             kNoCurrentDisc : (unsigned short)emulator->currentIndex);
+                moved = kCurrentDiscLength;
+            }
+            break;
+
+        case SCSI_CMD_CATALOG_CHANGES:
+            if (!emulator->catalogChanges || cdbLength < kUSBODECDBLength) {
+                EmulatorChargeBus(emulator, select, 0);
+                return scsiNonZeroStatus;
+            }
+            if (cdb[1] == kChangesModeGeneration) {
+                if (out != nil && bufferSize >= kGenerationReplySize) {
+                    PutBE16(out, emulator->generation >> 16);
+                    PutBE16(out + 2, emulator->generation);
+                    moved = kGenerationReplySize;
+                }
+            } else if (cdb[1] == kChangesModeSince) {
+                moved = EmulatorChanges(emulator,
+                            ((UInt32)GetBE16(cdb + kChangesSinceOffset) << 16) |
+                            GetBE16(cdb + kChangesSinceOffset + 2),
+                            GetBE16(cdb + kChangesMaxOffset),
+                            out, bufferSize);
+            } else {
+                EmulatorChargeBus(emulator, select, 0);
+                return scsiNonZeroStatus;
+            }
+            break;
+
+        case SCSI_CMD_LIST_DEVICES:
+            /* Device 0 is a CD-ROM, the other slots are unimplemented */
+            for (i = 0; i < kListDevicesLength && i < bufferSize; i++) {
+                if (out == nil) {
+                    break;
+                }
+                out[i] = (i == 0) ? kDeviceTypeCDROM : kDeviceTypeNone;
+            }
+            moved = i;
+            break;
+
+        default:
+            EmulatorChargeBus(emulator, select, 0);
+            return scsiNonZeroStatus;
+    }
+
+    EmulatorChargeBus(emulator, select, moved);
+
+    if (actualSize != nil) {
+        *actualSize = moved;
+    }
+
+    return noErr;
+}
@@ -0,0 +1,123 @@
+/*
+ * USBODE_Emulator.h
+ * In-process software USBODE target
+ *
+ * Answers the USBODE vendor commands (0xD0, 0xD7, 0xD8, 0xD9, 0xDA),
+ * the GET CURRENT CD (0xDB), GET DEVICE INFO (0xDD), paged listing
+ * (0xE0) and catalog change (0xE1) extensions, TEST UNIT READY and
+ * INQUIRY as documented in PROTOCOL.md, either from an in-memory image list or, on
+ * the host build, from a directory of disc images.  A simple bus model
+ * charges per-command latency, data-phase bandwidth and the selection
+ * timeout of empty IDs so that slow SCSI chains can be reproduced.
+ * Each extension can be switched off, with EmulatorSetCapabilities or
+ * its own flag, to stand in for any firmware generation.  Attach it
+ * with NewEmulatorTransport.
+ */
+
+#ifndef USBODE_EMULATOR_H
+#define USBODE_EMULATOR_H
+
+#include "USBODE_Protocol.h"
+
+#define kEmulatorMaxNameLength  255
+
+/* Firmware version GET DEVICE INFO reports (INQUIRY says "1.0") */
+#define kEmulatorFirmwareMajor  1
+#define kEmulatorFirmwareMinor  0
+
+/* Capabilities the emulator can provide */
+#define kEmulatorCapabilities   (kCapPagedListing | kCapCatalogChanges | \
+                                 kCapLongNames | kCapCompressedListing | \
+                                 kCapCurrentDisc)
+
+/* Common bus bandwidths for EmulatorTiming.bytesPerSecond */
+#define kBusUnlimited           0UL
+#define kBusSCSI1               1500000UL   /* asynchronous 53C80 */
+#define kBusSCSI2Fast           5000000UL   /* typical PowerPC Mac */
+#define kBusSCSI2Fast10         10000000UL
+
+/* Catalog changes remembered for CATALOG CHANGES SINCE */
+#define kEmulatorChangeLog      32
+
+/* Time to give up selecting an empty ID (SCSI-2 recommends 250 ms) */
+#define kSelectTimeoutMicros    250000UL
+
+typedef struct {
+    unsigned char   type;
+    UnsignedWide    size;           /* bytes; the wire carries 40 bits */
+    char            name[kEmulatorMaxNameLength + 1];
+} EmulatorImage;
+
+/* One catalog change: the generation it produced and the entries it
+   touched, in the numbering right after it */
+typedef struct {
+    UInt32          generation;
+    long            start;
+    long            count;
+} EmulatorChange;
+
+/* Bus model applied to every command */
+typedef struct {
+    UInt32          selectMicros;   /* arbitration and selection */
+    UInt32          commandMicros;  /* firmware time to process a CDB */
+    UInt32          bytesPerSecond; /* data phase rate, kBusUnlimited = free */
+    UInt32          selectTimeoutMicros;    /* cost of selecting another ID */
+    Boolean         realTime;       /* really wait, or only account time */
+} EmulatorTiming;
+
+/* Counters since the last EmulatorResetStats */
+typedef struct {
+    unsigned long   commands;
+    unsigned long   selections;
+    unsigned long   bytesMoved;
+    unsigned long   busMicros;      /* modelled bus time */
+} EmulatorStats;
+
+typedef struct {
+    short           scsiID;         /* bus position the emulator answers on */
+    Handle          images;         /* EmulatorImage array */
+    long            imageCount;
+    short           currentIndex;   /* mounted image, -1 for none */
+    UInt32          loadMicros;     /* a mounted image takes this to be ready */
+    UInt32          loadStart;      /* when the image being loaded was mounted */
+    Boolean         loading;        /* NOT READY until loadMicros have passed */
+    Boolean         unitAttention;  /* medium changed, not yet reported */
+    SenseData       sense;          /* from the last CHECK CONDITION */
+    Boolean         linkedCommands; /* accepts SCSI-2 linked commands */
+    Boolean         pagedListing;   /* implements LIST CDS PAGED (0xE0) */
+    Boolean         frontCoded;     /* ...and its front-coded format */
+    Boolean         longNames;      /* ...and its long-name formats */
+    Boolean         catalogChanges; /* implements CATALOG CHANGES (0xE1) */
+    Boolean         currentDisc;    /* implements GET CURRENT CD (0xDB) */
+    Boolean         deviceInfo;     /* implements GET DEVICE INFO (0xDD) */
+    UInt32          generation;     /* bumped by every catalog change */
+    UInt32          historyBase;    /* generation before the oldest logged */
+    EmulatorChange  changes[kEmulatorChangeLog];    /* oldest first */
+    short           changeCount;
+    EmulatorTiming  timing;
+    UInt32          timeoutMicros;  /* transport timeout, 0 for none */
+    EmulatorStats   stats;
+} USBODEEmulator;
+
+USBODEEmulator *NewUSBODEEmulator(short scsiID);
+void DisposeUSBODEEmulator(USBODEEmulator *emulator);
+OSErr EmulatorAddImage(USBODEEmulator *emulator, const char *name,
+                       unsigned long size);
+OSErr EmulatorReplaceImage(USBODEEmulator *emulator, long index,
+                           const char *name, unsigned long size);
+OSErr EmulatorRemoveImage(USBODEEmulator *emulator, long index);
+void EmulatorRemoveAllImages(USBODEEmulator *emulator);
+#ifdef USBODE_HOST
+OSErr EmulatorLoadDirectory(USBODEEmulator *emulator, const char *path);
+#endif
+
+void EmulatorSetCapabilities(USBODEEmulator *emulator, UInt32 capabilities);
+UInt32 EmulatorCapabilities(const USBODEEmulator *emulator);
+
+void EmulatorSetTiming(USBODEEmulator *emulator, UInt32 selectMicros,
+                       UInt32 commandMicros, UInt32 bytesPerSecond);
+void EmulatorResetStats(USBODEEmulator *emulator);
+
+USBODETransport *NewEmulatorTransport(USBODEEmulator *emulator);
+
+#endif /* USBODE_EMULATOR_H */
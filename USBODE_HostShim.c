@@ -0,0 +1,150 @@
+/*
+ * USBODE_HostShim.c
+ * Minimal Memory Manager stand-ins for the Linux host build
+ *
+ * Handles are emulated with a heap-allocated master pointer so that code
+ * written against the Toolbox (double dereference, SetHandleSize growth)
+ * behaves the same on the host.  Only compiled when USBODE_HOST is defined.
+ */
+
+#include "USBODE_Port.h"
+
+#ifdef USBODE_HOST
+
+#include <stdlib.h>
+
+/* Each handle block is preceded by its logical size */
+typedef struct {
+    Size    size;
+    double  align;      /* keeps the payload suitably aligned */
+} HostBlockHeader;
+
+static OSErr gMemError = noErr;
+
+static Ptr BlockPayload(HostBlockHeader *header)
+{
+    return (Ptr)(header + 1);
+}
+
+static HostBlockHeader *BlockHeader(Ptr payload)
+{
+    return ((HostBlockHeader *)payload) - 1;
+}
+
+Ptr NewPtr(Size byteCount)
+{
+    Ptr p;
+
+    p = (Ptr)malloc(byteCount > 0 ? (size_t)byteCount : 1);
+    gMemError = (p == nil) ? memFullErr : noErr;
+    return p;
+}
+
+Ptr NewPtrClear(Size byteCount)
+{
+    Ptr p;
+
+    p = (Ptr)calloc(1, byteCount > 0 ? (size_t)byteCount : 1);
+    gMemError = (p == nil) ? memFullErr : noErr;
+    return p;
+}
+
+void DisposePtr(Ptr p)
+{
+    free(p);
+    gMemError = noErr;
+}
+
+Handle NewHandle(Size byteCount)
+{
+    HostBlockHeader *header;
+    Handle h;
+
+    h = (Handle)malloc(sizeof(Ptr));
+    if (h == nil) {
+        gMemError = memFullErr;
+        return nil;
+    }
+
+    header = (HostBlockHeader *)malloc(sizeof(HostBlockHeader) + (size_t)byteCount);
+    if (header == nil) {
+        free(h);
+        gMemError = memFullErr;
+        return nil;
+    }
+
+    header->size = byteCount;
+    *h = BlockPayload(header);
+    gMemError = noErr;
+    return h;
+}
+
+Handle NewHandleClear(Size byteCount)
+{
+    Handle h;
+
+    h = NewHandle(byteCount);
+    if (h != nil && byteCount > 0) {
+        memset(*h, 0, (size_t)byteCount);
+    }
+    return h;
+}
+
+void DisposeHandle(Handle h)
+{
+    if (h != nil) {
+        free(BlockHeader(*h));
+        free(h);
+    }
+    gMemError = noErr;
+}
+
+Size GetHandleSize(Handle h)
+{
+    if (h == nil) {
+        gMemError = nilHandleErr;
+        return 0;
+    }
+    gMemError = noErr;
+    return BlockHeader(*h)->size;
+}
+
+void SetHandleSize(Handle h, Size newSize)
+{
+    HostBlockHeader *header;
+
+    if (h == nil) {
+        gMemError = nilHandleErr;
+        return;
+    }
+
+    header = (HostBlockHeader *)realloc(BlockHeader(*h),
+                                        sizeof(HostBlockHeader) + (size_t)newSize);
+    if (header == nil) {
+        gMemError = memFullErr;
+        return;
+    }
+
+    header->size = newSize;
+    *h = BlockPayload(header);
+    gMemError = noErr;
+}
+
+void HLock(Handle h)
+{
+    (void)h;
+    gMemError = noErr;
+}
+
+void HUnlock(Handle h)
+{
+    (void)h;
+    gMemError = noErr;
+}
+
+OSErr MemError(void)
+{
+    return gMemError;
+}
+
+#endif /* USBODE_HOST */
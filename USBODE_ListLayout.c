@@ -0,0 +1,207 @@
+/*
+ * USBODE_ListLayout.c
+ * Geometry of a scrolling list of fixed-height rows
+ *
+ * Scroll offsets are in pixels and kept within 0..ListLayoutMaxScroll.
+ * The calls that scroll return how far the content moved up, ready for
+ * ScrollRect, so callers only redraw the rows that were exposed.
+ */
+
+#include "USBODE_ListLayout.h"
+
+static long ListHeight(const ListLayout *layout);
+
+/*
+ * Height of the list area
+ */
+static long ListHeight(const ListLayout *layout)
+{
+    long height;
+
+    height = (long)layout->bounds.bottom - layout->bounds.top;
+    return (height > 0) ? height : 0;
+}
+
+/*
+ * Set up an empty list in the given area
+ */
+void InitListLayout(ListLayout *layout, const Rect *bounds, short rowHeight)
+{
+    layout->bounds = *bounds;
+    layout->rowHeight = (rowHeight > 0) ? rowHeight : 1;
+    layout->rowCount = 0;
+    layout->scrollOffset = 0;
+}
+
+/*
+ * Move or resize the list area, keeping the scroll offset valid
+ */
+void ListLayoutSetBounds(ListLayout *layout, const Rect *bounds)
+{
+    layout->bounds = *bounds;
+    (void)ListLayoutScrollTo(layout, layout->scrollOffset);
+}
+
+/*
+ * Change the number of rows, keeping the scroll offset valid
+ */
+void ListLayoutSetRowCount(ListLayout *layout, long rowCount)
+{
+    layout->rowCount = (rowCount > 0) ? rowCount : 0;
+    (void)ListLayoutScrollTo(layout, layout->scrollOffset);
+}
+
+/*
+ * Largest offset that still fills the area with rows
+ */
+long ListLayoutMaxScroll(const ListLayout *layout)
+{
+    long excess;
+
+    excess = layout->rowCount * layout->rowHeight - ListHeight(layout);
+    return (excess > 0) ? excess : 0;
+}
+
+/*
+ * Scroll to a pixel offset; returns the distance the content moved up
+ */
+long ListLayoutScrollTo(ListLayout *layout, long offset)
+{
+    long maxScroll;
+    long previous;
+
+    maxScroll = ListLayoutMaxScroll(layout);
+    if (offset > maxScroll) {
+        offset = maxScroll;
+    }
+    if (offset < 0) {
+        offset = 0;
+    }
+
+    previous = layout->scrollOffset;
+    layout->scrollOffset = offset;
+
+    return offset - previous;
+}
+
+/*
+ * Scroll so that row is at the top, or as near as the list allows
+ */
+long ListLayoutScrollToRow(ListLayout *layout, long row)
+{
+    return ListLayoutScrollTo(layout, row * layout->rowHeight);
+}
+
+/*
+ * Scroll the least distance that shows all of row
+ */
+long ListLayoutEnsureVisible(ListLayout *layout, long row)
+{
+    long top;
+    long bottom;
+    long height;
+
+    if (row < 0 || row >= layout->rowCount) {
+        return 0;
+    }
+
+    top = row * layout->rowHeight;
+    bottom = top + layout->rowHeight;
+    height = ListHeight(layout);
+
+    if (top < layout->scrollOffset) {
+        return ListLayoutScrollTo(layout, top);
+    }
+    if (bottom > layout->scrollOffset + height) {
+        return ListLayoutScrollTo(layout, bottom - height);
+    }
+
+    return 0;
+}
+
+/*
+ * Whole rows that fit in the area, at least one
+ */
+long ListLayoutPageRows(const ListLayout *layout)
+{
+    long rows;
+
+    rows = ListHeight(layout) / layout->rowHeight;
+    return (rows > 0) ? rows : 1;
+}
+
+/*
+ * Rows at least partly visible: first up to, but not including, last
+ */
+void ListLayoutVisibleRange(const ListLayout *layout, long *first, long *last)
+{
+    long end;
+
+    *first = layout->scrollOffset / layout->rowHeight;
+    end = (layout->scrollOffset + ListHeight(layout) +
+           layout->rowHeight - 1) / layout->rowHeight;
+    *last = (end < layout->rowCount) ? end : layout->rowCount;
+
+    if (*first > *last) {
+        *first = *last;
+    }
+}
+
+/*
+ * Row under a point in window coordinates, or -1 for none
+ */
+long ListLayoutRowAtPoint(const ListLayout *layout, Point pt)
+{
+    long row;
+
+    if (pt.v < layout->bounds.top || pt.v >= layout->bounds.bottom ||
+        pt.h < layout->bounds.left || pt.h >= layout->bounds.right) {
+        return -1;
+    }
+
+    row = ((long)pt.v - layout->bounds.top + layout->scrollOffset) /
+          layout->rowHeight;
+
+    return (row < layout->rowCount) ? row : -1;
+}
+
+/*
+ * Window coordinate of a row's top edge, which may lie outside the area
+ */
+long ListLayoutRowTop(const ListLayout *layout, long row)
+{
+    return layout->bounds.top + row * layout->rowHeight - layout->scrollOffset;
+}
+
+/*
+ * Part of the area a row covers; false when none of it is visible
+ */
+Boolean ListLayoutRowRect(const ListLayout *layout, long row, Rect *rect)
+{
+    long top;
+    long bottom;
+
+    if (row < 0 || row >= layout->rowCount) {
+        return false;
+    }
+
+    top = ListLayoutRowTop(layout, row);
+    bottom = top + layout->rowHeight;
+
+    if (top < layout->bounds.top) {
+        top = layout->bounds.top;
+    }
+    if (bottom > layout->bounds.bottom) {
+        bottom = layout->bounds.bottom;
+    }
+    if (top >= bottom) {
+        return false;
+    }
+
+    rect->top = (short)top;
+    rect->bottom = (short)bottom;
+    rect->left = layout->bounds.left;
+    rect->right = layout->bounds.right;
+
+    return true;
+}
@@ -0,0 +1,38 @@
+/*
+ * USBODE_ListLayout.h
+ * Geometry of a scrolling list of fixed-height rows
+ *
+ * Pure arithmetic, no QuickDraw: which rows are visible for a scroll
+ * offset, which row is under a point, and the rectangle a row covers.
+ * Every call is constant time whatever the number of rows, and the
+ * engine builds on the host so its behaviour can be checked there.
+ */
+
+#ifndef USBODE_LISTLAYOUT_H
+#define USBODE_LISTLAYOUT_H
+
+#include "USBODE_Port.h"
+
+typedef struct {
+    Rect            bounds;         /* list area in window coordinates */
+    short           rowHeight;
+    long            rowCount;
+    long            scrollOffset;   /* pixels scrolled past the first row */
+} ListLayout;
+
+void InitListLayout(ListLayout *layout, const Rect *bounds, short rowHeight);
+void ListLayoutSetBounds(ListLayout *layout, const Rect *bounds);
+void ListLayoutSetRowCount(ListLayout *layout, long rowCount);
+
+long ListLayoutMaxScroll(const ListLayout *layout);
+long ListLayoutScrollTo(ListLayout *layout, long offset);
+long ListLayoutScrollToRow(ListLayout *layout, long row);
+long ListLayoutEnsureVisible(ListLayout *layout, long row);
+long ListLayoutPageRows(const ListLayout *layout);
+
+void ListLayoutVisibleRange(const ListLayout *layout, long *first, long *last);
+long ListLayoutRowAtPoint(const ListLayout *layout, Point pt);
+long ListLayoutRowTop(const ListLayout *layout, long row);
+Boolean ListLayoutRowRect(const ListLayout *layout, long row, Rect *rect);
+
+#endif /* USBODE_LISTLAYOUT_H */
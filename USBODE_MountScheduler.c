@@ -0,0 +1,106 @@
+/*
+ * USBODE_MountScheduler.c
+ * Coalescing of mount requests
+ *
+ * Portable: no Toolbox calls, and the clock is the caller's, so the
+ * host build can drive it with any timeline.
+ */
+
+#include "USBODE_MountScheduler.h"
+
+/*
+ * Set up a scheduler with nothing waiting
+ */
+void InitMountScheduler(MountScheduler *scheduler, UInt32 debounceMicros)
+{
+    scheduler->pending = false;
+    scheduler->index = 0;
+    scheduler->requestedAt = 0;
+    scheduler->debounceMicros = debounceMicros;
+    scheduler->requests = 0;
+    scheduler->coalesced = 0;
+    scheduler->redundant = 0;
+    scheduler->issued = 0;
+}
+
+/*
+ * Ask for a disc to be mounted
+ * mounted is the device index mounted now, or kNoCurrentDisc.  Each
+ * request restarts the quiet period, so a burst goes out once it ends.
+ */
+void MountSchedulerRequest(MountScheduler *scheduler, unsigned short index,
+                           unsigned short mounted, UInt32 now)
+{
+    scheduler->requests++;
+    if (scheduler->pending) {
+        scheduler->coalesced++;
+    }
+
+    /* The last word is for the disc already in: nothing to change */
+    if (index == mounted) {
+        scheduler->pending = false;
+        scheduler->redundant++;
+        return;
+    }
+
+    scheduler->pending = true;
+    scheduler->index = index;
+    scheduler->requestedAt = now;
+}
+
+/*
+ * Whether the waiting mount should be sent now; if so, *index is the
+ * disc and the request is handed over
+ * A mount that has become redundant while it waited, because that disc
+ * got mounted some other way, is dropped instead.
+ */
+Boolean MountSchedulerDue(MountScheduler *scheduler, unsigned short mounted,
+                          UInt32 now, unsigned short *index)
+{
+    if (!scheduler->pending) {
+        return false;
+    }
+
+    if (scheduler->index == mounted) {
+        scheduler->pending = false;
+        scheduler->redundant++;
+        return false;
+    }
+
+    if ((UInt32)(now - scheduler->requestedAt) < scheduler->debounceMicros) {
+        return false;
+    }
+
+    scheduler->pending = false;
+    scheduler->issued++;
+    *index = scheduler->index;
+    return true;
+}
+
+/*
+ * Microseconds until the waiting mount is due; 0 when it is due now
+ * or nothing waits
+ */
+UInt32 MountSchedulerWait(const MountScheduler *scheduler, UInt32 now)
+{
+    UInt32 elapsed;
+
+    if (!scheduler->pending) {
+        return 0;
+    }
+
+    elapsed = now - scheduler->requestedAt;
+    if (elapsed >= scheduler->debounceMicros) {
+        return 0;
+    }
+
+    return scheduler->debounceMicros - elapsed;
+}
+
+/*
+ * Forget the waiting mount, if any
+ */
+void MountSchedulerCancel(MountScheduler *scheduler)
+{
+    scheduler->pending = false;
+}
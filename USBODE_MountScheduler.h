@@ -0,0 +1,41 @@
+/*
+ * USBODE_MountScheduler.h
+ * Coalescing of mount requests
+ *
+ * Every SET NEXT CD makes the device swap discs, so mount requests from
+ * clicks and keys wait out a short quiet period before one is sent.  A
+ * newer request replaces the one waiting (last writer wins), and asking
+ * for the disc that is already mounted drops whatever is waiting, so a
+ * burst of Returns or double-clicks costs at most one disc change.
+ * Pure bookkeeping on the caller's clock; the caller sends the mount.
+ */
+
+#ifndef USBODE_MOUNTSCHEDULER_H
+#define USBODE_MOUNTSCHEDULER_H
+
+#include "USBODE_Port.h"
+
+/* Quiet period before a mount goes out: longer than the key repeat
+   rate and a double-click, short against the disc change itself */
+#define kMountDebounceMicros    250000UL
+
+typedef struct {
+    Boolean         pending;        /* a mount is waiting */
+    unsigned short  index;          /* device index it is for */
+    UInt32          requestedAt;    /* clock at the latest request */
+    UInt32          debounceMicros;
+    unsigned long   requests;
+    unsigned long   coalesced;      /* replaced by a later request */
+    unsigned long   redundant;      /* dropped: that disc was mounted */
+    unsigned long   issued;         /* handed back to be sent */
+} MountScheduler;
+
+void InitMountScheduler(MountScheduler *scheduler, UInt32 debounceMicros);
+void MountSchedulerRequest(MountScheduler *scheduler, unsigned short index,
+                           unsigned short mounted, UInt32 now);
+Boolean MountSchedulerDue(MountScheduler *scheduler, unsigned short mounted,
+                          UInt32 now, unsigned short *index);
+UInt32 MountSchedulerWait(const MountScheduler *scheduler, UInt32 now);
+void MountSchedulerCancel(MountScheduler *scheduler);
+
+#endif /* USBODE_MOUNTSCHEDULER_H */
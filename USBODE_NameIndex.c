@@ -0,0 +1,322 @@
+/*
+ * USBODE_NameIndex.c
+ * Finding a disc by name
+ *
+ * Portable.  Names are hashed with FNV-1a over their folded bytes, the
+ * same hash CatalogHash uses over the raw catalog.
+ */
+
+#include "USBODE_NameIndex.h"
+
+#define kHashBasis          2166136261UL
+#define kHashPrime          16777619UL
+#define kMinBuckets         64L
+
+static UInt32 HashName(const unsigned char *name);
+static Boolean FoldedEqual(const unsigned char *a, const unsigned char *b);
+
+/*
+ * Hash of a Pascal string name, folded
+ */
+static UInt32 HashName(const unsigned char *name)
+{
+    UInt32 hash;
+    short i;
+
+    hash = kHashBasis;
+    for (i = 1; i <= name[0]; i++) {
+        hash = (hash ^ MacRomanFold(name[i])) * kHashPrime;
+    }
+
+    return hash;
+}
+
+/*
+ * Whether two Pascal string names are equal, folded
+ */
+static Boolean FoldedEqual(const unsigned char *a, const unsigned char *b)
+{
+    short i;
+
+    if (a[0] != b[0]) {
+        return false;
+    }
+    for (i = 1; i <= a[0]; i++) {
+        if (MacRomanFold(a[i]) != MacRomanFold(b[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Set up an empty table
+ */
+OSErr InitNameIndex(NameIndex *index)
+{
+    index->bucketCount = 0;
+    index->count = 0;
+    index->serial = 0;
+
+    index->buckets = NewHandle(0);
+    index->chains = NewHandle(0);
+    index->hashes = NewHandle(0);
+    if (index->buckets == nil || index->chains == nil ||
+        index->hashes == nil) {
+        DisposeNameIndex(index);
+        return memFullErr;
+    }
+
+    return noErr;
+}
+
+/*
+ * Release table storage
+ */
+void DisposeNameIndex(NameIndex *index)
+{
+    if (index->buckets != nil) DisposeHandle(index->buckets);
+    if (index->chains != nil) DisposeHandle(index->chains);
+    if (index->hashes != nil) DisposeHandle(index->hashes);
+
+    index->buckets = nil;
+    index->chains = nil;
+    index->hashes = nil;
+    index->bucketCount = 0;
+    index->count = 0;
+}
+
+/*
+ * Bring the table up to date with the catalog
+ * New entries are hashed and linked in.  When there are more entries
+ * than buckets the buckets double and every entry is linked again from
+ * the hashes already kept.  On failure the table is left empty.
+ */
+OSErr NameIndexSync(NameIndex *index, const DiscCatalog *catalog)
+{
+    const unsigned char *pool;
+    const unsigned long *nameOffsets;
+    long *buckets;
+    long *chains;
+    UInt32 *hashes;
+    long bucketCount;
+    long first;
+    long link;
+    long i;
+
+    if (index->serial != catalog->serial || index->count > catalog->count) {
+        index->count = 0;
+        index->serial = catalog->serial;
+    }
+
+    if (index->count == catalog->count) {
+        return noErr;
+    }
+
+    bucketCount = (index->bucketCount > 0) ? index->bucketCount : kMinBuckets;
+    while (bucketCount < catalog->count) {
+        bucketCount *= 2;
+    }
+
+    SetHandleSize(index->chains, catalog->count * (long)sizeof(long));
+    if (MemError() != noErr) {
+        index->count = 0;
+        return memFullErr;
+    }
+    SetHandleSize(index->hashes, catalog->count * (long)sizeof(UInt32));
+    if (MemError() != noErr) {
+        index->count = 0;
+        return memFullErr;
+    }
+    if (bucketCount != index->bucketCount) {
+        SetHandleSize(index->buckets, bucketCount * (long)sizeof(long));
+        if (MemError() != noErr) {
+            index->bucketCount = 0;
+            index->count = 0;
+            return memFullErr;
+        }
+    }
+
+    /* Nothing below allocates, so the blocks stay put */
+    buckets = (long *)*index->buckets;
+    chains = (long *)*index->chains;
+    hashes = (UInt32 *)*index->hashes;
+    pool = CatalogNamePool(catalog);
+    nameOffsets = CatalogNameOffsets(catalog);
+
+    for (i = index->count; i < catalog->count; i++) {
+        hashes[i] = HashName(pool + nameOffsets[i]);
+    }
+
+    /* Resized, or starting over: every entry goes in again */
+    first = index->count;
+    if (bucketCount != index->bucketCount || first == 0) {
+        for (i = 0; i < bucketCount; i++) {
+            buckets[i] = -1;
+        }
+        first = 0;
+        index->bucketCount = bucketCount;
+    }
+
+    for (i = first; i < catalog->count; i++) {
+        link = (long)(hashes[i] & (UInt32)(bucketCount - 1));
+        chains[i] = buckets[link];
+        buckets[link] = i;
+    }
+
+    index->count = catalog->count;
+    return noErr;
+}
+
+/*
+ * Catalog entry whose name equals name, folded, or -1
+ * Of several, the one with the same case and accents wins, then the
+ * first in the catalog.  ambiguous, if not nil, is set when several
+ * match and none exactly.
+ */
+long NameIndexLookup(const NameIndex *index, const DiscCatalog *catalog,
+                     ConstStr255Param name, Boolean *ambiguous)
+{
+    const unsigned char *pool;
+    const unsigned long *nameOffsets;
+    const long *buckets;
+    const long *chains;
+    const UInt32 *hashes;
+    const unsigned char *candidate;
+    UInt32 hash;
+    long entry;
+    long exact;
+    long folded;
+    long matches;
+    short i;
+
+    if (ambiguous != nil) {
+        *ambiguous = false;
+    }
+    if (index->count == 0) {
+        return -1;
+    }
+
+    pool = CatalogNamePool(catalog);
+    nameOffsets = CatalogNameOffsets(catalog);
+    buckets = (const long *)*index->buckets;
+    chains = (const long *)*index->chains;
+    hashes = (const UInt32 *)*index->hashes;
+
+    hash = HashName(name);
+    exact = -1;
+    folded = -1;
+    matches = 0;
+
+    /* Chains run newest first, so keep the lowest entry seen */
+    entry = buckets[hash & (UInt32)(index->bucketCount - 1)];
+    for (; entry >= 0; entry = chains[entry]) {
+        candidate = pool + nameOffsets[entry];
+        if (hashes[entry] != hash || !FoldedEqual(candidate, name)) {
+            continue;
+        }
+
+        matches++;
+        if (folded < 0 || entry < folded) {
+            folded = entry;
+        }
+        i = 1;
+        while (i <= name[0] && candidate[i] == name[i]) {
+            i++;
+        }
+        if (i > name[0] && (exact < 0 || entry < exact)) {
+            exact = entry;
+        }
+    }
+
+    if (exact >= 0) {
+        return exact;
+    }
+    if (matches > 1) {
+        if (ambiguous != nil) {
+            *ambiguous = true;
+        }
+        return -1;
+    }
+
+    return folded;
+}
+
+/*
+ * Catalog entry a name stands for: the one it equals, or else the only
+ * one it starts
+ * Returns fnfErr when nothing matches and dupFNErr when several do.
+ * The prefix index must be in step with the catalog.
+ */
+OSErr NameIndexResolve(const NameIndex *index, const PrefixIndex *prefixes,
+                       const DiscCatalog *catalog, ConstStr255Param name,
+                       long *entry)
+{
+    PrefixRange range;
+    Boolean ambiguous;
+
+    *entry = NameIndexLookup(index, catalog, name, &ambiguous);
+    if (*entry >= 0) {
+        return noErr;
+    }
+    if (ambiguous) {
+        return dupFNErr;
+    }
+
+    PrefixIndexAll(prefixes, &range);
+    PrefixIndexFind(prefixes, catalog, &name[1], name[0], &range);
+    if (range.count == 0) {
+        return fnfErr;
+    }
+    if (range.count > 1) {
+        return dupFNErr;
+    }
+
+    *entry = PrefixIndexEntry(prefixes, range.first);
+    return noErr;
+}
+
+/*
+ * Mount the disc a name stands for, as NameIndexResolve finds it
+ * With a timeout, waits until the disc is ready as MountAndWait does;
+ * with none, only sends SET NEXT CD and readiness has just its time.
+ * entry, if not nil, is the catalog entry mounted, or -1 when the name
+ * did not resolve.  The catalog must match the device, or the wrong
+ * disc is mounted.
+ */
+OSErr MountDiscByName(short scsiID, const NameIndex *index,
+                      const PrefixIndex *prefixes, const DiscCatalog *catalog,
+                      ConstStr255Param name, UInt32 timeoutMicros,
+                      long *entry, MountReadiness *readiness)
+{
+    UInt32 start;
+    long found;
+    OSErr err;
+
+    err = NameIndexResolve(index, prefixes, catalog, name, &found);
+    if (entry != nil) {
+        *entry = (err == noErr) ? found : -1;
+    }
+    if (err != noErr) {
+        return err;
+    }
+
+    if (timeoutMicros > 0) {
+        return MountAndWait(scsiID, CatalogIndex(catalog, found),
+                            timeoutMicros, readiness);
+    }
+
+    readiness->readyMicros = 0;
+    readiness->polls = 0;
+    readiness->unitAttentions = 0;
+    readiness->lastSense.key = kSenseKeyNoSense;
+    readiness->lastSense.asc = 0;
+    readiness->lastSense.ascq = 0;
+
+    start = USBODEMicroseconds();
+    err = SetActiveDiscIndex(scsiID, CatalogIndex(catalog, found));
+    readiness->mountMicros = USBODEMicroseconds() - start;
+
+    return err;
+}
@@ -0,0 +1,47 @@
+/*
+ * USBODE_NameIndex.h
+ * Finding a disc by name
+ *
+ * A hash table from names, case and diacritics folded, to catalog
+ * entries, so scripts and test rigs can ask for "System 7.5.3.iso"
+ * instead of a device index and have it resolved without listing the
+ * device again or scanning the catalog.  Chains are threaded through a
+ * per-entry column, so the table costs three longs per entry and
+ * allocates nothing per name.  Like the row cache, it follows the
+ * catalog: appended entries are hashed in, and a cleared or swapped
+ * catalog is hashed again.
+ *
+ * A name resolves to the entry it equals, ignoring case and accents;
+ * failing that, to the only entry it is a prefix of (through the
+ * type-ahead index).  Equal names prefer the one with the same case.
+ */
+
+#ifndef USBODE_NAMEINDEX_H
+#define USBODE_NAMEINDEX_H
+
+#include "USBODE_PrefixIndex.h"
+
+typedef struct {
+    Handle          buckets;    /* long per bucket: first entry, or -1 */
+    Handle          chains;     /* long per entry: next in its bucket, or -1 */
+    Handle          hashes;     /* UInt32 per entry: of the folded name */
+    long            bucketCount;/* a power of two, at least count */
+    long            count;
+    unsigned long   serial;     /* catalog serial the table belongs to */
+} NameIndex;
+
+OSErr InitNameIndex(NameIndex *index);
+void DisposeNameIndex(NameIndex *index);
+OSErr NameIndexSync(NameIndex *index, const DiscCatalog *catalog);
+long NameIndexLookup(const NameIndex *index, const DiscCatalog *catalog,
+                     ConstStr255Param name, Boolean *ambiguous);
+OSErr NameIndexResolve(const NameIndex *index, const PrefixIndex *prefixes,
+                       const DiscCatalog *catalog, ConstStr255Param name,
+                       long *entry);
+
+OSErr MountDiscByName(short scsiID, const NameIndex *index,
+                      const PrefixIndex *prefixes, const DiscCatalog *catalog,
+                      ConstStr255Param name, UInt32 timeoutMicros,
+                      long *entry, MountReadiness *readiness);
+
+#endif /* USBODE_NAMEINDEX_H */
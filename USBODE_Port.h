@@ -0,0 +1,126 @@
+/*
+ * USBODE_Port.h
+ * Portability layer for the USBODE protocol core
+ *
+ * On the Mac this just pulls in the Toolbox headers.  When compiled with
+ * USBODE_HOST defined (the Linux host build), it supplies the small set of
+ * Toolbox types, result codes and Memory Manager calls that the protocol
+ * core uses, so the same sources build on both sides.
+ */
+
+#ifndef USBODE_PORT_H
+#define USBODE_PORT_H
+
+#ifndef USBODE_HOST
+
+#ifndef __CONDITIONALMACROS__
+#include <ConditionalMacros.h>
+#endif
+
+#include <Types.h>
+#include <Memory.h>
+#include <OSUtils.h>
+#include <SCSI.h>
+
+#else /* USBODE_HOST */
+
+#include <stddef.h>
+#include <string.h>
+
+/* Basic Toolbox types */
+typedef unsigned char   Boolean;
+typedef unsigned char   Byte;
+typedef signed char     SInt8;
+typedef unsigned char   UInt8;
+typedef short           SInt16;
+typedef unsigned short  UInt16;
+typedef int             SInt32;
+typedef unsigned int    UInt32;
+typedef short           OSErr;
+typedef long            Size;
+typedef char            *Ptr;
+typedef Ptr             *Handle;
+typedef unsigned char   Str255[256];
+typedef unsigned char   Str63[64];
+typedef unsigned char   *StringPtr;
+typedef const unsigned char *ConstStr255Param;
+
+typedef struct {
+    short top;
+    short left;
+    short bottom;
+    short right;
+} Rect;
+
+typedef struct {
+    short v;
+    short h;
+} Point;
+
+typedef struct {
+    UInt32 hi;
+    UInt32 lo;
+} UnsignedWide;
+
+#ifndef nil
+#define nil NULL
+#endif
+
+#ifndef __bool_true_false_are_defined
+enum {
+    false = 0,
+    true  = 1
+};
+#endif
+
+/* Result codes (values match the Mac OS interfaces) */
+enum {
+    noErr               = 0,
+    ioErr               = -36,
+    eofErr              = -39,
+    fnfErr              = -43,
+    dupFNErr            = -48,
+    paramErr            = -50,
+    memFullErr          = -108,
+    nilHandleErr        = -109,
+
+    /* Original SCSI Manager */
+    scCommErr           = 2,
+    scArbNBErr          = 3,
+    scBadParmsErr       = 4,
+    scPhaseErr          = 5,
+    scCompareErr        = 6,
+    scMgrBusyErr        = 7,
+    scSequenceErr       = 8,
+    scBusTOErr          = 9,
+    scComplPhaseErr     = 10,
+
+    /* SCSI Manager 4.3 */
+    scsiRequestAborted  = -7934,
+    scsiNonZeroStatus   = -7932
+};
+
+/* Memory Manager (implemented in USBODE_HostShim.c) */
+Ptr     NewPtr(Size byteCount);
+Ptr     NewPtrClear(Size byteCount);
+void    DisposePtr(Ptr p);
+Handle  NewHandle(Size byteCount);
+Handle  NewHandleClear(Size byteCount);
+void    DisposeHandle(Handle h);
+Size    GetHandleSize(Handle h);
+void    SetHandleSize(Handle h, Size newSize);
+void    HLock(Handle h);
+void    HUnlock(Handle h);
+OSErr   MemError(void);
+
+#define BlockMove(src, dst, count)      memmove((dst), (src), (size_t)(count))
+#define BlockMoveData(src, dst, count)  memmove((dst), (src), (size_t)(count))
+
+#endif /* USBODE_HOST */
+
+/* Clock (USBODE_Clock.c): microsecond timer that wraps every ~71 minutes;
+   take differences with unsigned arithmetic */
+UInt32  USBODEMicroseconds(void);
+void    USBODEDelayMicroseconds(UInt32 micros);
+
+#endif /* USBODE_PORT_H */
@@ -0,0 +1,291 @@
+/*
+ * USBODE_PrefixIndex.c
+ * Type-ahead search over the disc catalog
+ *
+ * Portable.  Sorting is a merge sort of entry numbers, stable, so names
+ * that fold the same stay in device order.
+ */
+
+#include "USBODE_PrefixIndex.h"
+
+static long CompareNames(const unsigned char *a, const unsigned char *b);
+static long ComparePrefix(const unsigned char *name,
+                          const unsigned char *folded, short length);
+static void MergeRuns(const unsigned char *pool,
+                      const unsigned long *nameOffsets,
+                      const long *left, long leftCount,
+                      const long *right, long rightCount, long *out);
+static void SortEntries(const unsigned char *pool,
+                        const unsigned long *nameOffsets,
+                        long *entries, long count, long *scratch);
+
+/*
+ * Order two Pascal string names, folded
+ */
+static long CompareNames(const unsigned char *a, const unsigned char *b)
+{
+    short length;
+    short i;
+    long diff;
+
+    length = (a[0] < b[0]) ? a[0] : b[0];
+    for (i = 1; i <= length; i++) {
+        diff = (long)MacRomanFold(a[i]) - (long)MacRomanFold(b[i]);
+        if (diff != 0) {
+            return diff;
+        }
+    }
+
+    return (long)a[0] - (long)b[0];
+}
+
+/*
+ * Order a name against a folded prefix: 0 when the name starts with
+ * it, otherwise which side of every such name it sorts on
+ */
+static long ComparePrefix(const unsigned char *name,
+                          const unsigned char *folded, short length)
+{
+    short shared;
+    short i;
+    long diff;
+
+    shared = (name[0] < length) ? name[0] : length;
+    for (i = 0; i < shared; i++) {
+        diff = (long)MacRomanFold(name[i + 1]) - (long)folded[i];
+        if (diff != 0) {
+            return diff;
+        }
+    }
+
+    return (name[0] < length) ? -1 : 0;
+}
+
+/*
+ * Merge two sorted runs of entry numbers into out
+ * On equal names the left run goes first, which keeps the sort stable.
+ */
+static void MergeRuns(const unsigned char *pool,
+                      const unsigned long *nameOffsets,
+                      const long *left, long leftCount,
+                      const long *right, long rightCount, long *out)
+{
+    long i;
+    long j;
+
+    i = 0;
+    j = 0;
+    while (i < leftCount && j < rightCount) {
+        if (CompareNames(pool + nameOffsets[right[j]],
+                         pool + nameOffsets[left[i]]) < 0) {
+            *out++ = right[j++];
+        } else {
+            *out++ = left[i++];
+        }
+    }
+    while (i < leftCount) {
+        *out++ = left[i++];
+    }
+    while (j < rightCount) {
+        *out++ = right[j++];
+    }
+}
+
+/*
+ * Sort entry numbers by name, bottom up; scratch holds count entries
+ */
+static void SortEntries(const unsigned char *pool,
+                        const unsigned long *nameOffsets,
+                        long *entries, long count, long *scratch)
+{
+    long *from;
+    long *to;
+    long *swap;
+    long width;
+    long start;
+    long middle;
+    long end;
+
+    from = entries;
+    to = scratch;
+    for (width = 1; width < count; width *= 2) {
+        for (start = 0; start < count; start += 2 * width) {
+            middle = (start + width < count) ? start + width : count;
+            end = (start + 2 * width < count) ? start + 2 * width : count;
+            MergeRuns(pool, nameOffsets, from + start, middle - start,
+                      from + middle, end - middle, to + start);
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != entries) {
+        BlockMoveData(from, entries, count * (long)sizeof(long));
+    }
+}
+
+/*
+ * Set up an empty index
+ */
+OSErr InitPrefixIndex(PrefixIndex *index)
+{
+    index->count = 0;
+    index->serial = 0;
+
+    index->order = NewHandle(0);
+    if (index->order == nil) {
+        return memFullErr;
+    }
+
+    return noErr;
+}
+
+/*
+ * Release index storage
+ */
+void DisposePrefixIndex(PrefixIndex *index)
+{
+    if (index->order != nil) DisposeHandle(index->order);
+
+    index->order = nil;
+    index->count = 0;
+}
+
+/*
+ * Bring the index up to date with the catalog
+ * New entries are sorted among themselves and merged into the order; a
+ * cleared or swapped catalog is sorted from the start.  On failure the
+ * index is left empty.
+ */
+OSErr PrefixIndexSync(PrefixIndex *index, const DiscCatalog *catalog)
+{
+    const unsigned char *pool;
+    const unsigned long *nameOffsets;
+    long *order;
+    long *scratch;
+    long previous;
+    long added;
+    long i;
+
+    if (index->serial != catalog->serial || index->count > catalog->count) {
+        index->count = 0;
+        index->serial = catalog->serial;
+    }
+
+    if (index->count == catalog->count) {
+        return noErr;
+    }
+
+    previous = index->count;
+    added = catalog->count - previous;
+
+    SetHandleSize(index->order, catalog->count * (long)sizeof(long));
+    if (MemError() != noErr) {
+        index->count = 0;
+        return memFullErr;
+    }
+    scratch = (long *)NewPtr(((previous > added) ? previous : added) *
+                             (long)sizeof(long));
+    if (scratch == nil) {
+        index->count = 0;
+        return memFullErr;
+    }
+
+    /* Nothing below allocates, so the blocks stay put */
+    order = (long *)*index->order;
+    pool = CatalogNamePool(catalog);
+    nameOffsets = CatalogNameOffsets(catalog);
+
+    for (i = previous; i < catalog->count; i++) {
+        order[i] = i;
+    }
+    SortEntries(pool, nameOffsets, order + previous, added, scratch);
+
+    if (previous > 0) {
+        BlockMoveData(order, scratch, previous * (long)sizeof(long));
+        MergeRuns(pool, nameOffsets, scratch, previous,
+                  order + previous, added, order);
+    }
+
+    DisposePtr((Ptr)scratch);
+    index->count = catalog->count;
+    return noErr;
+}
+
+/*
+ * Start a search from every entry
+ */
+void PrefixIndexAll(const PrefixIndex *index, PrefixRange *range)
+{
+    range->first = 0;
+    range->count = index->count;
+}
+
+/*
+ * Narrow range to the names within it that start with prefix
+ * Start from PrefixIndexAll, or from the range a shorter prefix found:
+ * a longer prefix can only match a part of it.
+ */
+void PrefixIndexFind(const PrefixIndex *index, const DiscCatalog *catalog,
+                     const unsigned char *prefix, short length,
+                     PrefixRange *range)
+{
+    unsigned char folded[255];
+    const unsigned char *pool;
+    const unsigned long *nameOffsets;
+    const long *order;
+    long low;
+    long high;
+    long middle;
+    long first;
+    short i;
+
+    if (length > 255) {
+        length = 255;
+    }
+    for (i = 0; i < length; i++) {
+        folded[i] = MacRomanFold(prefix[i]);
+    }
+
+    order = (const long *)*index->order;
+    pool = CatalogNamePool(catalog);
+    nameOffsets = CatalogNameOffsets(catalog);
+
+    /* First name that sorts at or after the prefix */
+    low = range->first;
+    high = range->first + range->count;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (ComparePrefix(pool + nameOffsets[order[middle]],
+                          folded, length) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    first = low;
+
+    /* First name past the ones that start with it */
+    high = range->first + range->count;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (ComparePrefix(pool + nameOffsets[order[middle]],
+                          folded, length) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    range->first = first;
+    range->count = low - first;
+}
+
+/*
+ * Catalog entry at a position of the sorted order
+ */
+long PrefixIndexEntry(const PrefixIndex *index, long position)
+{
+    return ((const long *)*index->order)[position];
+}
@@ -0,0 +1,41 @@
+/*
+ * USBODE_PrefixIndex.h
+ * Type-ahead search over the disc catalog
+ *
+ * The catalog's entries sorted by name with case and diacritics folded
+ * (MacRomanFold), so "sys", "SYS" and "Sys" find the same images.  The
+ * names starting with a prefix are then one run of the sorted order,
+ * found with two binary searches, and each further keystroke only
+ * narrows the run the previous one found.  Like the row cache, the
+ * index follows the catalog: entries appended to it are sorted and
+ * merged in, and everything is sorted again when the catalog is
+ * cleared or swapped.
+ */
+
+#ifndef USBODE_PREFIXINDEX_H
+#define USBODE_PREFIXINDEX_H
+
+#include "USBODE_Catalog.h"
+
+typedef struct {
+    Handle          order;      /* long per entry: catalog entries by name */
+    long            count;
+    unsigned long   serial;     /* catalog serial the order belongs to */
+} PrefixIndex;
+
+/* Positions first..first+count-1 of the order: the names that match */
+typedef struct {
+    long            first;
+    long            count;
+} PrefixRange;
+
+OSErr InitPrefixIndex(PrefixIndex *index);
+void DisposePrefixIndex(PrefixIndex *index);
+OSErr PrefixIndexSync(PrefixIndex *index, const DiscCatalog *catalog);
+void PrefixIndexAll(const PrefixIndex *index, PrefixRange *range);
+void PrefixIndexFind(const PrefixIndex *index, const DiscCatalog *catalog,
+                     const unsigned char *prefix, short length,
+                     PrefixRange *range);
+long PrefixIndexEntry(const PrefixIndex *index, long position);
+
+#endif /* USBODE_PREFIXINDEX_H */
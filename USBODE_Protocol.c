@@ -0,0 +1,1445 @@
+/*
+ * USBODE_Protocol.c
+ * Portable USBODE protocol core
+ *
+ * Builds USBODE command blocks and hands them to the active transport.
+ * Shared by the Mac application and the host build.
+ */
+
+#include "USBODE_Protocol.h"
+#include "USBODE_Trace.h"
+
+/* Transport used by SendSCSICommand */
+static USBODETransport *gTransport = nil;
+
+/* Unicode code points of MacRoman 0x80-0xFF */
+static const unsigned short kMacRomanHigh[128] = {
+    0x00C4, 0x00C5, 0x00C7, 0x00C9, 0x00D1, 0x00D6, 0x00DC, 0x00E1,
+    0x00E0, 0x00E2, 0x00E4, 0x00E3, 0x00E5, 0x00E7, 0x00E9, 0x00E8,
+    0x00EA, 0x00EB, 0x00ED, 0x00EC, 0x00EE, 0x00EF, 0x00F1, 0x00F3,
+    0x00F2, 0x00F4, 0x00F6, 0x00F5, 0x00FA, 0x00F9, 0x00FB, 0x00FC,
+    0x2020, 0x00B0, 0x00A2, 0x00A3, 0x00A7, 0x2022, 0x00B6, 0x00DF,
+    0x00AE, 0x00A9, 0x2122, 0x00B4, 0x00A8, 0x2260, 0x00C6, 0x00D8,
+    0x221E, 0x00B1, 0x2264, 0x2265, 0x00A5, 0x00B5, 0x2202, 0x2211,
+    0x220F, 0x03C0, 0x222B, 0x00AA, 0x00BA, 0x03A9, 0x00E6, 0x00F8,
+    0x00BF, 0x00A1, 0x00AC, 0x221A, 0x0192, 0x2248, 0x2206, 0x00AB,
+    0x00BB, 0x2026, 0x00A0, 0x00C0, 0x00C3, 0x00D5, 0x0152, 0x0153,
+    0x2013, 0x2014, 0x201C, 0x201D, 0x2018, 0x2019, 0x00F7, 0x25CA,
+    0x00FF, 0x0178, 0x2044, 0x20AC, 0x2039, 0x203A, 0xFB01, 0xFB02,
+    0x2021, 0x00B7, 0x201A, 0x201E, 0x2030, 0x00C2, 0x00CA, 0x00C1,
+    0x00CB, 0x00C8, 0x00CD, 0x00CE, 0x00CF, 0x00CC, 0x00D3, 0x00D4,
+    0xF8FF, 0x00D2, 0x00DA, 0x00DB, 0x00D9, 0x0131, 0x02C6, 0x02DC,
+    0x00AF, 0x02D8, 0x02D9, 0x02DA, 0x00B8, 0x02DD, 0x02DB, 0x02C7
+};
+
+/* MacRoman with case and diacritics folded away, for name searches:
+   letters map to their unaccented lowercase form, all else to itself */
+const unsigned char gMacRomanFold[256] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+    0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F,
+    0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,
+    0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+    0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77,
+    0x78, 0x79, 0x7A, 0x5B, 0x5C, 0x5D, 0x5E, 0x5F,
+    0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,
+    0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+    0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77,
+    0x78, 0x79, 0x7A, 0x7B, 0x7C, 0x7D, 0x7E, 0x7F,
+    0x61, 0x61, 0x63, 0x65, 0x6E, 0x6F, 0x75, 0x61,
+    0x61, 0x61, 0x61, 0x61, 0x61, 0x63, 0x65, 0x65,
+    0x65, 0x65, 0x69, 0x69, 0x69, 0x69, 0x6E, 0x6F,
+    0x6F, 0x6F, 0x6F, 0x6F, 0x75, 0x75, 0x75, 0x75,
+    0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0xA8, 0xA9, 0xAA, 0xAB, 0xAC, 0xAD, 0xBE, 0xBF,
+    0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7,
+    0xB8, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF,
+    0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7,
+    0xC8, 0xC9, 0xCA, 0x61, 0x61, 0x6F, 0xCF, 0xCF,
+    0xD0, 0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7,
+    0x79, 0x79, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF,
+    0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0x61, 0x65, 0x61,
+    0x65, 0x65, 0x69, 0x69, 0x69, 0x69, 0x6F, 0x6F,
+    0xF0, 0x6F, 0x75, 0x75, 0x75, 0xF5, 0xF6, 0xF7,
+    0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
+};
+
+static unsigned char MacRomanFromUnicode(unsigned long code);
+static void BuildSetNextCD(unsigned char *cdb, unsigned short index);
+static void DecodeSense(const unsigned char *data, long length,
+                        SenseData *sense);
+
+/*
+ * Select the transport used for all subsequent commands
+ */
+void SetUSBODETransport(USBODETransport *transport)
+{
+    gTransport = transport;
+}
+
+/*
+ * Return the active transport (may be nil)
+ */
+USBODETransport *GetUSBODETransport(void)
+{
+    return gTransport;
+}
+
+/*
+ * Run one command block through a transport
+ * Every command is recorded in the trace ring.
+ */
+OSErr ExecuteTransportCommand(USBODETransport *transport, short scsiID,
+                              const unsigned char *cdb, short cdbLength,
+                              void *buffer, long bufferSize, long *actualSize)
+{
+    long moved;
+    OSErr err;
+
+    if (actualSize != nil) {
+        *actualSize = 0;
+    }
+
+    if (transport == nil || transport->execute == nil) {
+        return paramErr;
+    }
+
+    moved = 0;
+    transport->senseLength = 0;
+    TraceBegin(scsiID, cdb[0], 1);
+    err = (*transport->execute)(transport, scsiID, cdb, cdbLength,
+                                buffer, bufferSize, &moved);
+    TraceEnd(err, moved);
+
+    if (actualSize != nil) {
+        *actualSize = moved;
+    }
+
+    return err;
+}
+
+/*
+ * Run several command blocks through a transport
+ * Uses the backend's batch entry point when it has one, with the link
+ * bit set in every command but the last, otherwise runs the commands
+ * one transaction at a time with the link bit clear.  Stops at the
+ * first failure.
+ */
+OSErr ExecuteTransportBatch(USBODETransport *transport, short scsiID,
+                            USBODECommand *commands, short count)
+{
+    OSErr err;
+    long moved;
+    short last;
+    short i;
+
+    if (transport == nil || transport->execute == nil || count < 0) {
+        return paramErr;
+    }
+
+    transport->senseLength = 0;
+
+    /* A batch backend runs the batch as one traced transaction */
+    if (transport->executeBatch != nil && count > 0) {
+        for (i = 0; i < count; i++) {
+            last = commands[i].cdbLength - 1;
+            if (i < count - 1) {
+                commands[i].cdb[last] |= kControlLink;
+            } else {
+                commands[i].cdb[last] &= ~kControlLink;
+            }
+        }
+        TraceBegin(scsiID, commands[0].cdb[0], count);
+        err = (*transport->executeBatch)(transport, scsiID, commands, count);
+        moved = 0;
+        for (i = 0; i < count; i++) {
+            moved += commands[i].actualSize;
+        }
+        TraceEnd(err, moved);
+        return err;
+    }
+
+    err = noErr;
+    for (i = 0; i < count; i++) {
+        commands[i].actualSize = 0;
+        if (err != noErr) {
+            commands[i].result = scsiRequestAborted;
+            continue;
+        }
+
+        commands[i].cdb[commands[i].cdbLength - 1] &= ~kControlLink;
+        TraceBegin(scsiID, commands[i].cdb[0], 1);
+        commands[i].result = (*transport->execute)(transport, scsiID,
+                                                   commands[i].cdb,
+                                                   commands[i].cdbLength,
+                                                   commands[i].buffer,
+                                                   commands[i].bufferSize,
+                                                   &commands[i].actualSize);
+        TraceEnd(commands[i].result, commands[i].actualSize);
+        err = commands[i].result;
+    }
+
+    return err;
+}
+
+/*
+ * Close a transport and release its storage
+ */
+void DisposeUSBODETransport(USBODETransport *transport)
+{
+    if (transport == nil) {
+        return;
+    }
+
+    if (gTransport == transport) {
+        gTransport = nil;
+    }
+
+    if (transport->close != nil) {
+        (*transport->close)(transport);
+    }
+
+    DisposePtr((Ptr)transport);
+}
+
+/*
+ * True if the transport reports how many bytes were really transferred
+ */
+Boolean TransportReportsResidual(USBODETransport *transport)
+{
+    return (transport != nil && transport->reportsResidual);
+}
+
+/*
+ * Limit how long the transport waits on a target, 0 for its default
+ */
+void TransportSetTimeout(USBODETransport *transport, UInt32 milliseconds)
+{
+    if (transport != nil && transport->setTimeout != nil) {
+        (*transport->setTimeout)(transport, milliseconds);
+    }
+}
+
+/*
+ * Send a SCSI command to the USBODE device
+ */
+OSErr SendSCSICommand(short scsiID, unsigned char cmd, unsigned char param,
+                      void *buffer, long bufferSize, long *actualSize)
+{
+    unsigned char cdb[kUSBODECDBLength];
+    int i;
+
+    /* Initialize CDB */
+    for (i = 0; i < kUSBODECDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = cmd;
+    cdb[1] = param;
+
+    return ExecuteTransportCommand(gTransport, scsiID, cdb, kUSBODECDBLength,
+                                   buffer, bufferSize, actualSize);
+}
+
+/*
+ * Send an arbitrary command block to the USBODE device
+ */
+OSErr SendCommandBlock(short scsiID, const unsigned char *cdb,
+                       short cdbLength, void *buffer, long bufferSize,
+                       long *actualSize)
+{
+    return ExecuteTransportCommand(gTransport, scsiID, cdb, cdbLength,
+                                   buffer, bufferSize, actualSize);
+}
+
+/*
+ * Get number of discs available on USBODE
+ */
+OSErr GetDiscCount(short scsiID, unsigned char *count)
+{
+    long actualSize;
+    unsigned char response;
+    OSErr err;
+
+    err = SendSCSICommand(scsiID, SCSI_CMD_NUM_CDS, 0,
+                         &response, (long)sizeof(response), &actualSize);
+
+    if (err == noErr && actualSize >= 1) {
+        *count = response;
+        if (*count > kMaxDiscs) {
+            *count = kMaxDiscs;
+        }
+    } else {
+        *count = 0;
+    }
+
+    return err;
+}
+
+/*
+ * Get list of discs from USBODE
+ * The reply is read straight into discs at the 39-byte wire stride and
+ * then expanded in place to DiscEntry records.
+ */
+OSErr GetDiscList(short scsiID, DiscEntry *discs, unsigned char count)
+{
+    long actualSize;
+    OSErr err;
+    long bufferSize = (long)count * kWireEntrySize;
+
+    err = SendSCSICommand(scsiID, SCSI_CMD_LIST_CDS, 0,
+                         discs, bufferSize, &actualSize);
+    if (err == noErr) {
+        DecodeWireEntries(discs, count, discs);
+    }
+
+    return err;
+}
+
+/*
+ * Set the active disc on USBODE
+ */
+OSErr SetActiveDisc(short scsiID, unsigned char index)
+{
+    long actualSize;
+    OSErr err;
+
+    err = SendSCSICommand(scsiID, SCSI_CMD_SET_NEXT_CD, index,
+                         nil, 0, &actualSize);
+
+    return err;
+}
+
+/*
+ * Set the active disc by a 16-bit index
+ * Byte 1 only carries the legacy range (0-99), so later indices go in
+ * the extended form, which devices with paged listing accept.
+ */
+OSErr SetActiveDiscIndex(short scsiID, unsigned short index)
+{
+    unsigned char cdb[kUSBODECDBLength];
+    long actualSize;
+
+    BuildSetNextCD(cdb, index);
+
+    return SendCommandBlock(scsiID, cdb, kUSBODECDBLength,
+                            nil, 0, &actualSize);
+}
+
+/*
+ * Fill in a SET NEXT CD command block for a 16-bit index, in the legacy
+ * form when the index fits it
+ */
+static void BuildSetNextCD(unsigned char *cdb, unsigned short index)
+{
+    int i;
+
+    for (i = 0; i < kUSBODECDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_SET_NEXT_CD;
+    if (index < kMaxDiscs) {
+        cdb[1] = (unsigned char)index;
+    } else {
+        cdb[1] = kExtendedIndexFlag;
+        PutBE16(cdb + 2, index);
+    }
+}
+
+/*
+ * Read the whole disc list in one transaction
+ * Issues LIST CDS with room for maxCount entries and derives the entry
+ * count from the bytes the device actually sent, so no separate NUMBER
+ * OF CDS round trip is needed.  Only meaningful on transports that
+ * report residuals.
+ */
+OSErr GetDiscListSinglePass(short scsiID, DiscEntry *discs,
+                            unsigned char maxCount, unsigned char *count)
+{
+    long actualSize;
+    OSErr err;
+    long bufferSize = (long)maxCount * kWireEntrySize;
+
+    *count = 0;
+
+    err = SendSCSICommand(scsiID, SCSI_CMD_LIST_CDS, 0,
+                         discs, bufferSize, &actualSize);
+    if (err == noErr) {
+        *count = (unsigned char)(actualSize / kWireEntrySize);
+        DecodeWireEntries(discs, *count, discs);
+    }
+
+    return err;
+}
+
+/*
+ * Set up a view over a buffer of wire entries
+ */
+void InitWireView(WireEntryView *view, const void *buffer, long bytes)
+{
+    view->base = (const unsigned char *)buffer;
+    view->count = (buffer != nil && bytes > 0) ? bytes / kWireEntrySize : 0;
+}
+
+/*
+ * Length of an entry's name, which fills the field when it is 32 bytes
+ */
+short WireNameLength(const unsigned char *entry)
+{
+    const unsigned char *name;
+    short length;
+
+    name = WireName(entry);
+    for (length = 0; length < kWireNameLength; length++) {
+        if (name[length] == 0) {
+            break;
+        }
+    }
+
+    return length;
+}
+
+/*
+ * Decode a 40-bit big-endian size to kilobytes, rounding up
+ * Kilobytes keep images past 4 GB exact enough in 32 bits.
+ */
+unsigned long DecodeSizeKilobytes(const unsigned char *size)
+{
+    unsigned long kbytes;
+
+    kbytes = ((unsigned long)size[0] << 22) |
+             ((unsigned long)size[1] << 14) |
+             ((unsigned long)size[2] << 6) |
+             ((unsigned long)size[3] >> 2);
+    if ((size[3] & 0x03) != 0 || size[4] != 0) {
+        kbytes++;
+    }
+
+    return kbytes;
+}
+
+/*
+ * Write one packed entry; returns its length
+ * previous is the name before it in the page, or nil for the first;
+ * only the front-coded formats share bytes with it.
+ */
+long EncodePackedEntry(unsigned char format,
+                       const unsigned char *name, short nameLength,
+                       const unsigned char *previous, short previousLength,
+                       unsigned char type, unsigned long sizeKB,
+                       unsigned char *out)
+{
+    unsigned char *next;
+    short shared;
+    short i;
+
+    next = out;
+    shared = 0;
+    if (format & kListFormatFrontCoded) {
+        if (previous != nil) {
+            while (shared < nameLength && shared < previousLength &&
+                   name[shared] == previous[shared]) {
+                shared++;
+            }
+        }
+        *next++ = (unsigned char)shared;
+    }
+
+    *next++ = (unsigned char)(nameLength - shared);
+    for (i = shared; i < nameLength; i++) {
+        *next++ = name[i];
+    }
+    *next++ = type;
+
+    while (sizeKB >= 0x80) {
+        *next++ = (unsigned char)(sizeKB | 0x80);
+        sizeKB >>= 7;
+    }
+    *next++ = (unsigned char)sizeKB;
+
+    return next - out;
+}
+
+/*
+ * MacRoman byte for a Unicode code point, '?' when there is none
+ */
+static unsigned char MacRomanFromUnicode(unsigned long code)
+{
+    short i;
+
+    if (code < 0x80) {
+        return (unsigned char)code;
+    }
+    for (i = 0; i < 128; i++) {
+        if (kMacRomanHigh[i] == code) {
+            return (unsigned char)(0x80 + i);
+        }
+    }
+
+    return '?';
+}
+
+/*
+ * Convert a UTF-8 name to MacRoman; returns the converted length
+ * out needs at most length bytes.  Characters MacRoman lacks and
+ * malformed or overlong sequences become '?'.  Combining accents
+ * (U+0300-U+036F), which decomposed names carry, are dropped and leave
+ * the base letter.
+ */
+short UTF8ToMacRoman(const unsigned char *utf8, short length,
+                     unsigned char *out)
+{
+    unsigned long code;
+    unsigned long least;
+    short extra;
+    short count;
+    short i;
+
+    count = 0;
+    i = 0;
+    while (i < length) {
+        code = utf8[i++];
+        if (code < 0x80) {
+            out[count++] = (unsigned char)code;
+            continue;
+        }
+
+        if ((code & 0xE0) == 0xC0) {
+            extra = 1;
+            least = 0x80;
+            code &= 0x1F;
+        } else if ((code & 0xF0) == 0xE0) {
+            extra = 2;
+            least = 0x800;
+            code &= 0x0F;
+        } else if ((code & 0xF8) == 0xF0) {
+            extra = 3;
+            least = 0x10000;
+            code &= 0x07;
+        } else {
+            out[count++] = '?';     /* stray continuation or bad lead */
+            continue;
+        }
+
+        while (extra > 0 && i < length && (utf8[i] & 0xC0) == 0x80) {
+            code = (code << 6) | (utf8[i++] & 0x3F);
+            extra--;
+        }
+        if (extra > 0) {
+            out[count++] = '?';     /* sequence cut short */
+            continue;
+        }
+        if (code < least) {
+            out[count++] = '?';     /* overlong: a shorter form exists */
+            continue;
+        }
+
+        if (code >= 0x0300 && code <= 0x036F) {
+            continue;
+        }
+        out[count++] = MacRomanFromUnicode(code);
+    }
+
+    return count;
+}
+
+/*
+ * Convert a MacRoman name to UTF-8; returns the converted length
+ * out needs at most 3 * length bytes.
+ */
+short MacRomanToUTF8(const unsigned char *name, short length,
+                     unsigned char *out)
+{
+    unsigned long code;
+    short count;
+    short i;
+
+    count = 0;
+    for (i = 0; i < length; i++) {
+        code = (name[i] < 0x80) ? name[i] : kMacRomanHigh[name[i] - 0x80];
+        if (code < 0x80) {
+            out[count++] = (unsigned char)code;
+        } else if (code < 0x800) {
+            out[count++] = (unsigned char)(0xC0 | (code >> 6));
+            out[count++] = (unsigned char)(0x80 | (code & 0x3F));
+        } else {
+            out[count++] = (unsigned char)(0xE0 | (code >> 12));
+            out[count++] = (unsigned char)(0x80 | ((code >> 6) & 0x3F));
+            out[count++] = (unsigned char)(0x80 | (code & 0x3F));
+        }
+    }
+
+    return count;
+}
+
+/*
+ * Expand count wire entries to DiscEntry records
+ * discs may be the wire buffer itself: records are 40 bytes against 39
+ * on the wire, so working from the last entry down never overwrites an
+ * entry that has not been read yet.
+ */
+void DecodeWireEntries(const void *wire, long count, DiscEntry *discs)
+{
+    unsigned char entry[kWireEntrySize];
+    DiscEntry *disc;
+    long i;
+
+    for (i = count - 1; i >= 0; i--) {
+        BlockMoveData((const unsigned char *)wire + i * kWireEntrySize,
+                      entry, kWireEntrySize);
+
+        disc = &discs[i];
+        disc->index = entry[kWireIndexOffset];
+        disc->type = entry[kWireTypeOffset];
+        BlockMoveData(entry + kWireNameOffset, disc->name, kWireNameLength);
+        disc->name[kWireNameLength] = 0;
+        BlockMoveData(entry + kWireSizeOffset, disc->size, kWireSizeLength);
+    }
+}
+
+/*
+ * Fetch the disc list using the requested refresh strategy
+ * kRefreshAuto uses a single transaction when the active transport
+ * reports residuals and falls back to the two-step sequence otherwise.
+ */
+OSErr FetchDiscList(short scsiID, short refreshMode, DiscEntry *discs,
+                    unsigned char maxCount, unsigned char *count)
+{
+    OSErr err;
+
+    if (refreshMode == kRefreshAuto) {
+        refreshMode = TransportReportsResidual(gTransport) ?
+                      kRefreshSinglePass : kRefreshTwoStep;
+    }
+
+    if (refreshMode == kRefreshSinglePass) {
+        return GetDiscListSinglePass(scsiID, discs, maxCount, count);
+    }
+
+    /* Two-step: ask for the count, then read exactly that many */
+    err = GetDiscCount(scsiID, count);
+    if (err != noErr) {
+        return err;
+    }
+
+    if (*count > maxCount) {
+        *count = maxCount;
+    }
+
+    if (*count > 0) {
+        err = GetDiscList(scsiID, discs, *count);
+        if (err != noErr) {
+            *count = 0;
+        }
+    }
+
+    return err;
+}
+
+/*
+ * Empty a batch
+ */
+void BatchReset(USBODEBatch *batch)
+{
+    batch->count = 0;
+}
+
+/*
+ * Queue a raw command block; returns nil when the batch is full
+ */
+USBODECommand *BatchAddCDB(USBODEBatch *batch, const unsigned char *cdb,
+                           short cdbLength, void *buffer, long bufferSize)
+{
+    USBODECommand *command;
+    short i;
+
+    if (batch->count >= kMaxBatchCommands ||
+        cdbLength < 1 || cdbLength > kMaxCDBLength) {
+        return nil;
+    }
+
+    command = &batch->commands[batch->count++];
+    for (i = 0; i < kMaxCDBLength; i++) {
+        command->cdb[i] = (i < cdbLength) ? cdb[i] : 0;
+    }
+    command->cdbLength = cdbLength;
+    command->buffer = buffer;
+    command->bufferSize = bufferSize;
+    command->actualSize = 0;
+    command->result = noErr;
+
+    return command;
+}
+
+/*
+ * Queue a USBODE vendor command
+ */
+USBODECommand *BatchAddCommand(USBODEBatch *batch, unsigned char cmd,
+                               unsigned char param,
+                               void *buffer, long bufferSize)
+{
+    unsigned char cdb[kUSBODECDBLength];
+    int i;
+
+    for (i = 0; i < kUSBODECDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = cmd;
+    cdb[1] = param;
+
+    return BatchAddCDB(batch, cdb, kUSBODECDBLength, buffer, bufferSize);
+}
+
+/*
+ * Execute every queued command against one target
+ * Per-command results are left in batch->commands; the return value is
+ * the first failure, or noErr.
+ */
+OSErr ExecuteBatch(short scsiID, USBODEBatch *batch)
+{
+    return ExecuteTransportBatch(gTransport, scsiID,
+                                 batch->commands, batch->count);
+}
+
+/*
+ * Mount a disc and poll its readiness in the same transaction
+ * Returns the SET NEXT CD result.  Once the mount is accepted,
+ * *readyErr is the TEST UNIT READY that followed it, with *sense filled
+ * in as TestUnitReady does.  A target that links commands takes both
+ * under one selection.
+ */
+OSErr SetActiveDiscAndTest(short scsiID, unsigned short index,
+                           OSErr *readyErr, SenseData *sense)
+{
+    USBODEBatch batch;
+    unsigned char cdb[kUSBODECDBLength];
+    USBODECommand *mount;
+    USBODECommand *test;
+    int i;
+
+    sense->key = kSenseKeyNoSense;
+    sense->asc = 0;
+    sense->ascq = 0;
+
+    BatchReset(&batch);
+    BuildSetNextCD(cdb, index);
+    mount = BatchAddCDB(&batch, cdb, kUSBODECDBLength, nil, 0);
+    for (i = 0; i < kStandardCDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_TEST_UNIT_READY;
+    test = BatchAddCDB(&batch, cdb, kStandardCDBLength, nil, 0);
+
+    (void)ExecuteBatch(scsiID, &batch);
+
+    *readyErr = test->result;
+    if (test->result == scsiNonZeroStatus) {
+        (void)RequestSense(scsiID, sense);
+    }
+
+    return mount->result;
+}
+
+/*
+ * Pick the sense key and codes out of fixed-format sense data
+ * Whatever did not arrive reads as zero.
+ */
+static void DecodeSense(const unsigned char *data, long length,
+                        SenseData *sense)
+{
+    sense->key = (length > kSenseKeyOffset) ?
+                 (data[kSenseKeyOffset] & kSenseKeyMask) : kSenseKeyNoSense;
+    sense->asc = (length > kSenseASCOffset) ? data[kSenseASCOffset] : 0;
+    sense->ascq = (length > kSenseASCQOffset) ? data[kSenseASCQOffset] : 0;
+}
+
+/*
+ * Find out why the last command ended in CHECK CONDITION
+ * Uses the transport's autosense when it has it, since the target has
+ * then already handed the sense over; asks with REQUEST SENSE otherwise.
+ */
+OSErr RequestSense(short scsiID, SenseData *sense)
+{
+    unsigned char cdb[kStandardCDBLength];
+    unsigned char data[kSenseLength];
+    long actualSize;
+    OSErr err;
+    int i;
+
+    if (gTransport != nil && gTransport->senseLength > 0) {
+        DecodeSense(gTransport->sense, gTransport->senseLength, sense);
+        gTransport->senseLength = 0;
+        return noErr;
+    }
+
+    for (i = 0; i < kStandardCDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_REQUEST_SENSE;
+    cdb[4] = kSenseLength;
+
+    err = SendCommandBlock(scsiID, cdb, kStandardCDBLength,
+                           data, kSenseLength, &actualSize);
+    if (err != noErr) {
+        return err;
+    }
+
+    DecodeSense(data, actualSize, sense);
+    return noErr;
+}
+
+/*
+ * Ask whether the unit is ready; on CHECK CONDITION sense says why
+ * Returns the TEST UNIT READY result, or the REQUEST SENSE failure.
+ */
+OSErr TestUnitReady(short scsiID, SenseData *sense)
+{
+    unsigned char cdb[kStandardCDBLength];
+    long actualSize;
+    OSErr err;
+    int i;
+
+    sense->key = kSenseKeyNoSense;
+    sense->asc = 0;
+    sense->ascq = 0;
+
+    for (i = 0; i < kStandardCDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_TEST_UNIT_READY;
+
+    err = SendCommandBlock(scsiID, cdb, kStandardCDBLength,
+                           nil, 0, &actualSize);
+    if (err == scsiNonZeroStatus) {
+        if (RequestSense(scsiID, sense) != noErr) {
+            return err;
+        }
+    }
+
+    return err;
+}
+
+/*
+ * Mount a disc and wait until it can be used
+ * SET NEXT CD completes before the image is loaded: the unit then
+ * reports UNIT ATTENTION once, for the medium change, and NOT READY
+ * until the image is in.  Unit attentions are consumed and polled
+ * again at once; NOT READY is polled at an interval that starts short
+ * and doubles, so a quick load is seen quickly without a slow one
+ * flooding the bus.  Returns noErr once TEST UNIT READY passes, or
+ * scsiNonZeroStatus with readiness->lastSense saying why the unit was
+ * still not ready after timeoutMicros (0 for kDefaultReadyTimeout).
+ * Blocks throughout; the application steps a MountWaiter instead.
+ */
+OSErr MountAndWait(short scsiID, unsigned short index, UInt32 timeoutMicros,
+                   MountReadiness *readiness)
+{
+    MountWaiter waiter;
+    UInt32 delay;
+
+    BeginMountWait(&waiter, scsiID, index, timeoutMicros);
+    while (!MountWaitStep(&waiter, &delay)) {
+        if (delay > 0) {
+            USBODEDelayMicroseconds(delay);
+        }
+    }
+
+    *readiness = waiter.readiness;
+    return waiter.result;
+}
+
+/*
+ * Poll TEST UNIT READY until the disc already mounted is ready
+ * MountAndWait without the SET NEXT CD, for a mount sent earlier or by
+ * someone else; readiness.mountMicros is 0.
+ */
+OSErr WaitUntilReady(short scsiID, UInt32 timeoutMicros,
+                     MountReadiness *readiness)
+{
+    MountWaiter waiter;
+    UInt32 delay;
+
+    BeginMountWait(&waiter, scsiID, 0, timeoutMicros);
+    waiter.phase = kMountPhasePoll;
+    waiter.pollStart = USBODEMicroseconds();
+    while (!MountWaitStep(&waiter, &delay)) {
+        if (delay > 0) {
+            USBODEDelayMicroseconds(delay);
+        }
+    }
+
+    *readiness = waiter.readiness;
+    return waiter.result;
+}
+
+/*
+ * Set up a MountAndWait to be taken one command at a time
+ * Nothing is sent until the first MountWaitStep.
+ */
+void BeginMountWait(MountWaiter *waiter, short scsiID, unsigned short index,
+                    UInt32 timeoutMicros)
+{
+    waiter->scsiID = scsiID;
+    waiter->index = index;
+    waiter->timeoutMicros = (timeoutMicros == 0) ? kDefaultReadyTimeout :
+                                                   timeoutMicros;
+    waiter->phase = kMountPhaseSend;
+    waiter->pollStart = 0;
+    waiter->interval = kReadyPollFirstMicros;
+    waiter->result = noErr;
+
+    waiter->readiness.mountMicros = 0;
+    waiter->readiness.readyMicros = 0;
+    waiter->readiness.polls = 0;
+    waiter->readiness.unitAttentions = 0;
+    waiter->readiness.lastSense.key = kSenseKeyNoSense;
+    waiter->readiness.lastSense.asc = 0;
+    waiter->readiness.lastSense.ascq = 0;
+}
+
+/*
+ * Send the next command of a mount wait
+ * Returns true once waiter->result is final.  Otherwise *delay is how
+ * long to leave the unit alone before the next step; the caller does
+ * other work meanwhile rather than spin.
+ */
+Boolean MountWaitStep(MountWaiter *waiter, UInt32 *delay)
+{
+    SenseData sense;
+    UInt32 start;
+    UInt32 elapsed;
+    OSErr err;
+
+    *delay = 0;
+
+    if (waiter->phase == kMountPhaseSend) {
+        /* The first poll goes out with the mount */
+        start = USBODEMicroseconds();
+        err = SetActiveDiscAndTest(waiter->scsiID, waiter->index,
+                                   &waiter->result, &sense);
+        waiter->pollStart = USBODEMicroseconds();
+        waiter->readiness.mountMicros = waiter->pollStart - start;
+        if (err != noErr) {
+            waiter->result = err;
+            waiter->phase = kMountPhaseDone;
+            return true;
+        }
+        err = waiter->result;
+    } else if (waiter->phase == kMountPhasePoll) {
+        err = TestUnitReady(waiter->scsiID, &sense);
+    } else {
+        return true;
+    }
+
+    waiter->readiness.polls++;
+    elapsed = USBODEMicroseconds() - waiter->pollStart;
+    waiter->result = err;
+    waiter->phase = kMountPhaseDone;
+
+    if (err == noErr) {
+        waiter->readiness.readyMicros = elapsed;
+        return true;
+    }
+    if (err != scsiNonZeroStatus) {
+        return true;        /* the bus failed, not the load */
+    }
+
+    waiter->readiness.lastSense = sense;
+    if (sense.key != kSenseKeyNotReady &&
+        sense.key != kSenseKeyUnitAttention &&
+        sense.key != kSenseKeyNoSense) {
+        return true;        /* an error readiness will not fix */
+    }
+    if (elapsed >= waiter->timeoutMicros) {
+        return true;
+    }
+
+    waiter->phase = kMountPhasePoll;
+    if (sense.key == kSenseKeyUnitAttention) {
+        waiter->readiness.unitAttentions++;
+        return false;
+    }
+
+    *delay = waiter->interval;
+    if (*delay > waiter->timeoutMicros - elapsed) {
+        *delay = waiter->timeoutMicros - elapsed;
+    }
+    if (waiter->interval < kReadyPollMaxMicros) {
+        waiter->interval *= 2;
+        if (waiter->interval > kReadyPollMaxMicros) {
+            waiter->interval = kReadyPollMaxMicros;
+        }
+    }
+    return false;
+}
+
+/*
+ * Find out whether the device implements LIST CDS PAGED
+ * Asks for an empty page: paged firmware answers with the header,
+ * older firmware rejects the opcode.
+ */
+OSErr ProbePagedListing(short scsiID, Boolean *supported)
+{
+    unsigned char header[kPageHeaderSize];
+    unsigned short total;
+    unsigned short pageCount;
+    OSErr err;
+
+    *supported = false;
+
+    err = GetDiscPage(scsiID, 0, 0, header, kPageHeaderSize,
+                      &total, &pageCount);
+    if (err == noErr) {
+        *supported = true;
+    } else if (err == scsiNonZeroStatus) {
+        /* Opcode rejected: the device is fine, it just cannot page */
+        err = noErr;
+    }
+
+    return err;
+}
+
+/*
+ * Read one page of the listing into buffer, in the fixed format
+ * buffer receives the 4-byte page header followed by the entries.
+ */
+OSErr GetDiscPage(short scsiID, unsigned short start,
+                  unsigned short maxEntries, void *buffer, long bufferSize,
+                  unsigned short *total, unsigned short *pageCount)
+{
+    long pageBytes;
+
+    return GetDiscPageFormat(scsiID, kListFormatFixed, start, maxEntries,
+                             buffer, bufferSize, total, pageCount, &pageBytes);
+}
+
+/*
+ * Read one page of the listing in the given format
+ * pageBytes is how much of the buffer after the header arrived; a
+ * variable-length page is checked entry by entry when it is decoded.
+ * A transport that cannot report residuals says the whole buffer
+ * arrived, so there only the fixed format can be read, and the header's
+ * count is taken as what came.
+ */
+OSErr GetDiscPageFormat(short scsiID, unsigned char format,
+                        unsigned short start, unsigned short maxEntries,
+                        void *buffer, long bufferSize, unsigned short *total,
+                        unsigned short *pageCount, long *pageBytes)
+{
+    unsigned char cdb[kUSBODECDBLength];
+    unsigned char *header;
+    long actualSize;
+    long fits;
+    OSErr err;
+    int i;
+
+    *total = 0;
+    *pageCount = 0;
+    *pageBytes = 0;
+
+    if (bufferSize < kPageHeaderSize) {
+        return paramErr;
+    }
+    if (format != kListFormatFixed && !TransportReportsResidual(gTransport)) {
+        return paramErr;
+    }
+
+    for (i = 0; i < kUSBODECDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_LIST_CDS_PAGED;
+    cdb[1] = format;
+    PutBE16(cdb + kPageStartOffset, start);
+    PutBE16(cdb + kPageCountOffset, maxEntries);
+
+    err = SendCommandBlock(scsiID, cdb, kUSBODECDBLength,
+                           buffer, bufferSize, &actualSize);
+    if (err != noErr) {
+        return err;
+    }
+    if (actualSize < kPageHeaderSize) {
+        return scPhaseErr;
+    }
+
+    header = (unsigned char *)buffer;
+    *total = GetBE16(header);
+    *pageCount = GetBE16(header + 2);
+    *pageBytes = actualSize - kPageHeaderSize;
+    if (!TransportReportsResidual(gTransport) &&
+        *pageBytes > (long)*pageCount * kWireEntrySize) {
+        *pageBytes = (long)*pageCount * kWireEntrySize;
+    }
+
+    /* Never trust the header beyond what actually arrived */
+    fits = *pageBytes / ((format == kListFormatFixed) ? kWireEntrySize
+                                                   : kPackedMinEntry);
+    if (*pageCount > fits) {
+        *pageCount = (unsigned short)fits;
+    }
+    if (*pageCount > maxEntries) {
+        *pageCount = maxEntries;
+    }
+
+    return noErr;
+}
+
+/*
+ * Largest entry a listing format can carry
+ */
+long PageEntryMaxSize(unsigned char format)
+{
+    if (format == kListFormatFixed) {
+        return kWireEntrySize;
+    }
+
+    return ((format & kListFormatFrontCoded) ? 3 : 2) +
+           ((format & kListFormatLongNames) ? kLongNameLength
+                                            : kWireNameLength) +
+           kVarintMaxBytes;
+}
+
+/*
+ * Page buffer for pageEntries entries of a listing format
+ * Long names are budgeted at typical rather than worst-case length,
+ * with room for at least one entry of any length: the device sends
+ * only whole entries, so a page of long names simply holds fewer.
+ */
+long PageBufferSize(unsigned char format, short pageEntries)
+{
+    long perEntry;
+    long entries;
+
+    perEntry = PageEntryMaxSize(format);
+    if ((format & kListFormatLongNames) && perEntry > kLongNamePageBudget) {
+        perEntry = kLongNamePageBudget;
+    }
+
+    entries = (long)pageEntries * perEntry;
+    if (entries < PageEntryMaxSize(format)) {
+        entries = PageEntryMaxSize(format);
+    }
+
+    return kPageHeaderSize + entries;
+}
+
+/*
+ * Prepare a page-by-page listing in the fixed format
+ */
+OSErr BeginDiscPager(DiscPager *pager, short scsiID, short pageEntries)
+{
+    return BeginDiscPagerFormat(pager, scsiID, pageEntries, kListFormatFixed);
+}
+
+/*
+ * Prepare a page-by-page listing
+ * Only one page buffer is allocated, however large the catalog is.
+ */
+OSErr BeginDiscPagerFormat(DiscPager *pager, short scsiID, short pageEntries,
+                           unsigned char format)
+{
+    if (pageEntries <= 0) {
+        pageEntries = kDefaultPageEntries;
+    }
+
+    pager->scsiID = scsiID;
+    pager->pageEntries = pageEntries;
+    pager->nextIndex = 0;
+    pager->total = -1;
+    pager->pageStart = 0;
+    pager->pageCount = 0;
+    pager->pageBytes = 0;
+    pager->format = format;
+    pager->done = false;
+
+    pager->bufferSize = PageBufferSize(format, pageEntries);
+    pager->buffer = NewPtr(pager->bufferSize);
+    if (pager->buffer == nil) {
+        pager->done = true;
+        return memFullErr;
+    }
+
+    return noErr;
+}
+
+/*
+ * Fetch the next page; sets done once the whole catalog was seen
+ * Once the first page has told the catalog size, each page asks for
+ * just the entries that are left, with a buffer to match, so the last
+ * page is not a short transfer.  Only the first can be.
+ */
+OSErr DiscPagerStep(DiscPager *pager)
+{
+    unsigned short total;
+    unsigned short pageCount;
+    long wanted;
+    OSErr err;
+
+    pager->pageCount = 0;
+    if (pager->done) {
+        return noErr;
+    }
+
+    wanted = pager->pageEntries;
+    if (pager->total >= 0 && pager->total - pager->nextIndex < wanted) {
+        wanted = pager->total - pager->nextIndex;
+    }
+
+    err = GetDiscPageFormat(pager->scsiID, pager->format,
+                            (unsigned short)pager->nextIndex,
+                            (unsigned short)wanted, pager->buffer,
+                            PageBufferSize(pager->format, (short)wanted),
+                            &total, &pageCount, &pager->pageBytes);
+    if (err != noErr) {
+        pager->done = true;
+        return err;
+    }
+
+    pager->total = total;
+    pager->pageStart = pager->nextIndex;
+    pager->pageCount = (short)pageCount;
+    pager->nextIndex += pageCount;
+
+    /* An empty page also ends the listing if the catalog shrank */
+    if (pager->nextIndex >= pager->total || pageCount == 0) {
+        pager->done = true;
+    }
+
+    return noErr;
+}
+
+/*
+ * View the entries of the current page (fixed format only)
+ */
+void DiscPagerGetView(const DiscPager *pager, WireEntryView *view)
+{
+    view->base = (const unsigned char *)pager->buffer + kPageHeaderSize;
+    view->count = pager->pageCount;
+}
+
+/*
+ * Decode entry i of the current page (fixed format only)
+ * The wire index byte only holds the low 8 bits; the full index is the
+ * entry's position in the listing.
+ */
+void DiscPagerGetEntry(const DiscPager *pager, short i, DiscEntry *entry,
+                       unsigned short *index)
+{
+    DecodeWireEntries((const unsigned char *)pager->buffer + kPageHeaderSize +
+                      (long)i * kWireEntrySize, 1, entry);
+    *index = (unsigned short)(pager->pageStart + i);
+}
+
+/*
+ * Release the page buffer
+ */
+void EndDiscPager(DiscPager *pager)
+{
+    if (pager->buffer != nil) {
+        DisposePtr(pager->buffer);
+        pager->buffer = nil;
+    }
+    pager->done = true;
+}
+
+/*
+ * Read the catalog generation
+ * The device changes it whenever an entry is added, removed or altered,
+ * so an unchanged generation means an unchanged catalog.
+ */
+OSErr GetCatalogGeneration(short scsiID, UInt32 *generation)
+{
+    unsigned char cdb[kUSBODECDBLength];
+    unsigned char reply[kGenerationReplySize];
+    long actualSize;
+    OSErr err;
+    int i;
+
+    for (i = 0; i < kUSBODECDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_CATALOG_CHANGES;
+    cdb[1] = kChangesModeGeneration;
+
+    err = SendCommandBlock(scsiID, cdb, kUSBODECDBLength,
+                           reply, kGenerationReplySize, &actualSize);
+    if (err != noErr) {
+        return err;
+    }
+    if (actualSize < kGenerationReplySize) {
+        return scPhaseErr;
+    }
+
+    *generation = ((UInt32)GetBE16(reply) << 16) | GetBE16(reply + 2);
+    return noErr;
+}
+
+/*
+ * Find out whether the device keeps catalog generations
+ * Older firmware rejects the opcode, which is not an error here.
+ */
+OSErr ProbeCatalogGeneration(short scsiID, Boolean *supported,
+                             UInt32 *generation)
+{
+    OSErr err;
+
+    *supported = false;
+
+    err = GetCatalogGeneration(scsiID, generation);
+    if (err == noErr) {
+        *supported = true;
+    } else if (err == scsiNonZeroStatus) {
+        err = noErr;
+    }
+
+    return err;
+}
+
+/*
+ * Ask which entries changed since a generation the host listed at
+ * With resync set the device no longer knows, and the host lists the
+ * whole catalog again; so does a reply with more ranges than fit.
+ */
+OSErr GetCatalogChanges(short scsiID, UInt32 since, CatalogChanges *changes)
+{
+    unsigned char cdb[kUSBODECDBLength];
+    unsigned char reply[kChangesHeaderSize + kMaxChangeRanges * kChangeRangeSize];
+    const unsigned char *range;
+    long actualSize;
+    short declared;
+    short i;
+    OSErr err;
+
+    changes->rangeCount = 0;
+    changes->resync = true;
+
+    for (i = 0; i < kUSBODECDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_CATALOG_CHANGES;
+    cdb[1] = kChangesModeSince;
+    PutBE16(cdb + kChangesSinceOffset, since >> 16);
+    PutBE16(cdb + kChangesSinceOffset + 2, since);
+    PutBE16(cdb + kChangesMaxOffset, kMaxChangeRanges);
+
+    err = SendCommandBlock(scsiID, cdb, kUSBODECDBLength,
+                           reply, sizeof(reply), &actualSize);
+    if (err != noErr) {
+        return err;
+    }
+    if (actualSize < kChangesHeaderSize) {
+        return scPhaseErr;
+    }
+
+    changes->generation = ((UInt32)GetBE16(reply) << 16) | GetBE16(reply + 2);
+    changes->total = GetBE16(reply + 4);
+    declared = reply[6];
+    changes->resync = (reply[7] & kChangesResync) != 0;
+
+    if (declared > kMaxChangeRanges ||
+        kChangesHeaderSize + (long)declared * kChangeRangeSize > actualSize) {
+        changes->resync = true;
+        return noErr;
+    }
+
+    range = reply + kChangesHeaderSize;
+    for (i = 0; i < declared; i++) {
+        changes->ranges[i].start = GetBE16(range);
+        changes->ranges[i].count = GetBE16(range + 2);
+        range += kChangeRangeSize;
+    }
+    changes->rangeCount = declared;
+
+    return noErr;
+}
+
+/*
+ * Ask the firmware for its version and the optional commands it has
+ */
+OSErr GetDeviceInfo(short scsiID, DeviceInfo *info)
+{
+    unsigned char cdb[kUSBODECDBLength];
+    unsigned char reply[kDeviceInfoLength];
+    long actualSize;
+    OSErr err;
+    int i;
+
+    info->answered = false;
+    info->majorVersion = 0;
+    info->minorVersion = 0;
+    info->capabilities = 0;
+
+    for (i = 0; i < kUSBODECDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_GET_DEVICE_INFO;
+
+    err = SendCommandBlock(scsiID, cdb, kUSBODECDBLength,
+                           reply, kDeviceInfoLength, &actualSize);
+    if (err != noErr) {
+        return err;
+    }
+    if (actualSize < kDeviceInfoMinLength || reply[0] < kDeviceInfoVersion) {
+        return scPhaseErr;
+    }
+
+    info->answered = true;
+    info->majorVersion = reply[kDeviceInfoMajorOffset];
+    info->minorVersion = reply[kDeviceInfoMinorOffset];
+    info->capabilities = ((UInt32)GetBE16(reply + kDeviceInfoCapsOffset) << 16) |
+                         GetBE16(reply + kDeviceInfoCapsOffset + 2);
+
+    return noErr;
+}
+
+/*
+ * GET DEVICE INFO, where older firmware that rejects the opcode is not
+ * an error: info->answered is false and each extension is probed on
+ * first use instead
+ */
+OSErr ProbeDeviceInfo(short scsiID, DeviceInfo *info)
+{
+    OSErr err;
+
+    err = GetDeviceInfo(scsiID, info);
+    if (err == scsiNonZeroStatus) {
+        err = noErr;
+    }
+
+    return err;
+}
+
+/*
+ * Read the index of the mounted image, kNoCurrentDisc if there is none
+ * Only firmware reporting kCapCurrentDisc has the command.
+ */
+OSErr GetCurrentDisc(short scsiID, unsigned short *index)
+{
+    unsigned char cdb[kUSBODECDBLength];
+    unsigned char reply[kCurrentDiscLength];
+    long actualSize;
+    OSErr err;
+    int i;
+
+    *index = kNoCurrentDisc;
+
+    for (i = 0; i < kUSBODECDBLength; i++) {
+        cdb[i] = 0;
+    }
+    cdb[0] = SCSI_CMD_GET_CURRENT_CD;
+
+    err = SendCommandBlock(scsiID, cdb, kUSBODECDBLength,
+                           reply, kCurrentDiscLength, &actualSize);
+    if (err != noErr) {
+        return err;
+    }
+    if (actualSize < kCurrentDiscLength) {
+        return scPhaseErr;
+    }
+
+    *index = GetBE16(reply);
+    return noErr;
+}
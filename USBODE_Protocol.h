@@ -0,0 +1,356 @@
+/*
+ * USBODE_Protocol.h
+ * Portable USBODE protocol core
+ *
+ * Command definitions, the on-wire disc entry layout and the protocol
+ * calls used by the application.  Nothing here depends on the Toolbox
+ * beyond USBODE_Port.h, so this builds for both the Mac and the host.
+ */
+
+#ifndef USBODE_PROTOCOL_H
+#define USBODE_PROTOCOL_H
+
+#include "USBODE_Port.h"
+#include "USBODE_Transport.h"
+
+#define kMaxDiscs           100
+
+/* SCSI Command Definitions for USBODE */
+#define SCSI_CMD_LIST_DEVICES   0xD9
+#define SCSI_CMD_NUM_CDS        0xDA
+#define SCSI_CMD_LIST_CDS       0xD7
+#define SCSI_CMD_LIST_FILES     0xD0
+#define SCSI_CMD_SET_NEXT_CD    0xD8
+
+/* Protocol extensions (see PROTOCOL.md) */
+#define SCSI_CMD_LIST_CDS_PAGED 0xE0
+#define SCSI_CMD_CATALOG_CHANGES 0xE1
+#define SCSI_CMD_GET_CURRENT_CD 0xDB
+#define SCSI_CMD_GET_DEVICE_INFO 0xDD
+
+/* Standard SCSI commands used alongside the vendor set */
+#define SCSI_CMD_TEST_UNIT_READY    0x00
+#define SCSI_CMD_REQUEST_SENSE      0x03
+#define SCSI_CMD_INQUIRY            0x12
+
+/* Vendor commands use a 12-byte CDB, standard ones here a 6-byte CDB */
+#define kUSBODECDBLength        12
+#define kStandardCDBLength      6
+
+/* Commands queued for one ExecuteBatch call */
+#define kMaxBatchCommands       8
+
+/* Wire layout of one LIST FILES / LIST CDS entry (see PROTOCOL.md) */
+#define kWireEntrySize          39
+#define kWireIndexOffset        0
+#define kWireTypeOffset         1
+#define kWireNameOffset         2
+#define kWireNameLength         32      /* NUL padded, not always terminated */
+#define kWireSizeOffset         34
+#define kWireSizeLength         5
+
+/* LIST CDS PAGED (0xE0) */
+#define kListFormatFixed        0       /* CDB byte 1: 39-byte entries */
+#define kListFormatFrontCoded   0x01    /* CDB byte 1 flag: front-coded names */
+#define kListFormatLongNames    0x02    /* CDB byte 1 flag: long UTF-8 names */
+#define kPageStartOffset        2       /* CDB bytes 2-3: first entry */
+#define kPageCountOffset        4       /* CDB bytes 4-5: entries wanted */
+#define kPageHeaderSize         4       /* total (BE16), entries (BE16) */
+#define kDefaultPageEntries     64
+#define kMaxCatalogEntries      65535L
+
+/* Packed entry, any format but fixed: bytes shared with the previous
+   name of the page (8, front-coded formats only), length of the rest
+   of the name (8), the name bytes, type (8), size in kilobytes as a
+   varint (7 bits a byte, low bits first, high bit set on all but the
+   last).  The first entry of every page shares nothing.  Names are at
+   most 32 bytes, or 255 bytes of UTF-8 with kListFormatLongNames. */
+#define kVarintMaxBytes         5       /* enough for 32 bits */
+#define kLongNameLength         255
+#define kPackedMinEntry         3
+#define kPackedMaxEntry         (3 + kLongNameLength + kVarintMaxBytes)
+#define kLongNamePageBudget     64      /* page buffer bytes per entry */
+
+/* CATALOG CHANGES (0xE1) */
+#define kChangesModeGeneration  0       /* CDB byte 1: current generation */
+#define kChangesModeSince       1       /* CDB byte 1: ranges changed since */
+#define kChangesSinceOffset     2       /* CDB bytes 2-5: host's generation */
+#define kChangesMaxOffset       6       /* CDB bytes 6-7: ranges wanted */
+#define kGenerationReplySize    4       /* generation (BE32) */
+#define kChangesHeaderSize      8       /* generation, total, ranges, flags */
+#define kChangeRangeSize        4       /* start (BE16), count (BE16) */
+#define kMaxChangeRanges        16
+#define kChangesResync          0x01    /* flags: list everything again */
+
+/* GET DEVICE INFO (0xDD) */
+#define kDeviceInfoLength       16
+#define kDeviceInfoMinLength    8       /* through the capability bits */
+#define kDeviceInfoVersion      1       /* reply byte 0 */
+#define kDeviceInfoMajorOffset  2       /* firmware version, major */
+#define kDeviceInfoMinorOffset  3       /* firmware version, minor */
+#define kDeviceInfoCapsOffset   4       /* capability bits (BE32) */
+
+/* Capability bits: which optional commands the firmware implements */
+#define kCapPagedListing        0x00000001UL    /* LIST CDS PAGED, 0xE0 */
+#define kCapCatalogChanges      0x00000002UL    /* CATALOG CHANGES, 0xE1 */
+#define kCapLongNames           0x00000004UL    /* names beyond 32 bytes */
+#define kCapCompressedListing   0x00000008UL    /* front-coded pages */
+#define kCapCurrentDisc         0x00000010UL    /* GET CURRENT CD, 0xDB */
+
+/* GET CURRENT CD (0xDB) */
+#define kCurrentDiscLength      2       /* index (BE16) */
+#define kNoCurrentDisc          0xFFFF  /* nothing mounted */
+
+/* SET NEXT CD: byte 1 holds indices 0-99; this value in byte 1
+   means the index is the 16-bit big-endian value in bytes 2-3 */
+#define kExtendedIndexFlag      0xFF
+
+/* Big-endian field access */
+#define GetBE16(p)      ((unsigned short)(((unsigned short)(p)[0] << 8) | (p)[1]))
+#define PutBE16(p, v)   ((p)[0] = (unsigned char)((v) >> 8), \
+                         (p)[1] = (unsigned char)(v))
+
+/* Standard INQUIRY data, the first 36 bytes every target returns */
+#define kInquiryLength          36
+#define kInquiryVendorOffset    8
+#define kInquiryVendorLength    8       /* ASCII, space padded */
+#define kInquiryProductOffset   16
+#define kInquiryProductLength   16
+#define kInquiryRevisionOffset  32
+#define kInquiryRevisionLength  4
+#define kPeripheralTypeMask     0x1F    /* byte 0 */
+#define kPeripheralQualifierMask 0xE0
+#define kPeripheralNotConnected 0x60    /* qualifier 3: no unit at this LUN */
+#define kPeripheralCDROM        0x05
+#define kUSBODEInquiryVendor    "USBODE"
+
+/* Fixed-format sense data (REQUEST SENSE, or a transport's autosense) */
+#define kSenseLength            18
+#define kSenseResponseCurrent   0x70    /* byte 0 */
+#define kSenseKeyOffset         2       /* low 4 bits */
+#define kSenseKeyMask           0x0F
+#define kSenseAddLengthOffset   7
+#define kSenseASCOffset         12
+#define kSenseASCQOffset        13
+#define kSenseKeyNoSense        0x00
+#define kSenseKeyNotReady       0x02
+#define kSenseKeyUnitAttention  0x06
+#define kASCNotReady            0x04    /* ASCQ 0x01: becoming ready */
+#define kASCQBecomingReady      0x01
+#define kASCMediumChanged       0x28
+#define kASCMediumNotPresent    0x3A
+
+/* Mount and wait: TEST UNIT READY polls back off from the first
+   interval, doubling up to the longest */
+#define kReadyPollFirstMicros   1000UL
+#define kReadyPollMaxMicros     50000UL
+#define kDefaultReadyTimeout    10000000UL  /* 10 seconds */
+
+/* LIST DEVICES response */
+#define kListDevicesLength      8
+#define kDeviceTypeCDROM        0x02
+#define kDeviceTypeNone         0xFF
+
+/* Disc Entry Structure (in-memory form of a wire entry) */
+typedef struct {
+    unsigned char index;
+    unsigned char type;
+    unsigned char name[33];     /* 32 chars + null terminator */
+    unsigned char size[5];      /* 40-bit big endian size */
+} DiscEntry;
+
+/* Catalog refresh strategies for FetchDiscList */
+enum {
+    kRefreshAuto        = 0,    /* single pass when residuals are reported */
+    kRefreshTwoStep     = 1,    /* NUMBER OF CDS, then LIST CDS */
+    kRefreshSinglePass  = 2     /* one LIST CDS, count from bytes moved */
+};
+
+/* Where a MountWaiter is */
+enum {
+    kMountPhaseSend     = 0,    /* SET NEXT CD still to go */
+    kMountPhasePoll     = 1,    /* polling TEST UNIT READY */
+    kMountPhaseDone     = 2     /* result is final */
+};
+
+/*
+ * Read-only view of wire entries in place, at the 39-byte stride.
+ * Nothing is copied; the view is good while the buffer is.
+ */
+typedef struct {
+    const unsigned char *base;      /* first entry */
+    long            count;          /* whole entries in the buffer */
+} WireEntryView;
+
+#define WireEntryAt(v, i)   ((v)->base + (long)(i) * kWireEntrySize)
+#define WireIndex(e)        ((e)[kWireIndexOffset])
+#define WireType(e)         ((e)[kWireTypeOffset])
+#define WireName(e)         ((e) + kWireNameOffset)
+#define WireSize(e)         ((e) + kWireSizeOffset)
+
+/* Cursor for a page-by-page listing (LIST CDS PAGED) */
+typedef struct {
+    short           scsiID;
+    short           pageEntries;    /* entries requested per page */
+    long            nextIndex;      /* first entry of the next page */
+    long            total;          /* catalog size, -1 before first page */
+    long            pageStart;      /* first entry of the current page */
+    short           pageCount;      /* entries in the current page */
+    long            pageBytes;      /* bytes of entries that arrived */
+    unsigned char   format;         /* kListFormat... */
+    long            bufferSize;
+    Ptr             buffer;         /* header + pageEntries entries */
+    Boolean         done;
+} DiscPager;
+
+/* Entries whose contents changed, in the current numbering */
+typedef struct {
+    unsigned short  start;
+    unsigned short  count;
+} ChangeRange;
+
+/* Reply to CATALOG CHANGES SINCE */
+typedef struct {
+    UInt32          generation;     /* the catalog's generation now */
+    unsigned short  total;          /* entries now */
+    short           rangeCount;
+    Boolean         resync;         /* history does not reach back that far */
+    ChangeRange     ranges[kMaxChangeRanges];   /* sorted, disjoint */
+} CatalogChanges;
+
+/* What GET DEVICE INFO reports */
+typedef struct {
+    Boolean         answered;       /* false: firmware predates 0xDD */
+    unsigned char   majorVersion;
+    unsigned char   minorVersion;
+    UInt32          capabilities;   /* kCap... bits */
+} DeviceInfo;
+
+#define DeviceHas(info, cap)    (((info)->capabilities & (cap)) != 0)
+
+/* Why a command ended in CHECK CONDITION */
+typedef struct {
+    unsigned char   key;            /* kSenseKey... */
+    unsigned char   asc;            /* additional sense code */
+    unsigned char   ascq;           /* ...and its qualifier */
+} SenseData;
+
+/* How a MountAndWait went */
+typedef struct {
+    UInt32          mountMicros;    /* SET NEXT CD and the first poll */
+    UInt32          readyMicros;    /* from then until TEST UNIT READY passed */
+    short           polls;          /* TEST UNIT READY commands sent */
+    short           unitAttentions; /* consumed along the way */
+    SenseData       lastSense;      /* last reason the unit was not ready */
+} MountReadiness;
+
+/* A MountAndWait taken one command at a time */
+typedef struct {
+    short           scsiID;
+    unsigned short  index;
+    UInt32          timeoutMicros;
+    short           phase;          /* kMountPhase... */
+    UInt32          pollStart;      /* when polling began */
+    UInt32          interval;       /* next NOT READY backoff */
+    OSErr           result;         /* valid in kMountPhaseDone */
+    MountReadiness  readiness;
+} MountWaiter;
+
+/* Commands run together, ideally under a single selection */
+typedef struct {
+    short           count;
+    USBODECommand   commands[kMaxBatchCommands];
+} USBODEBatch;
+
+/* Transport selection */
+void SetUSBODETransport(USBODETransport *transport);
+USBODETransport *GetUSBODETransport(void);
+
+/* SCSI Communication */
+OSErr SendSCSICommand(short scsiID, unsigned char cmd, unsigned char param,
+                      void *buffer, long bufferSize, long *actualSize);
+OSErr GetDiscCount(short scsiID, unsigned char *count);
+OSErr GetDiscList(short scsiID, DiscEntry *discs, unsigned char count);
+OSErr SetActiveDisc(short scsiID, unsigned char index);
+OSErr SetActiveDiscIndex(short scsiID, unsigned short index);
+OSErr SendCommandBlock(short scsiID, const unsigned char *cdb,
+                       short cdbLength, void *buffer, long bufferSize,
+                       long *actualSize);
+OSErr GetDiscListSinglePass(short scsiID, DiscEntry *discs,
+                            unsigned char maxCount, unsigned char *count);
+OSErr FetchDiscList(short scsiID, short refreshMode, DiscEntry *discs,
+                    unsigned char maxCount, unsigned char *count);
+
+/* Wire entry decoding */
+void InitWireView(WireEntryView *view, const void *buffer, long bytes);
+short WireNameLength(const unsigned char *entry);
+unsigned long DecodeSizeKilobytes(const unsigned char *size);
+void DecodeWireEntries(const void *wire, long count, DiscEntry *discs);
+long EncodePackedEntry(unsigned char format,
+                       const unsigned char *name, short nameLength,
+                       const unsigned char *previous, short previousLength,
+                       unsigned char type, unsigned long sizeKB,
+                       unsigned char *out);
+short UTF8ToMacRoman(const unsigned char *utf8, short length,
+                     unsigned char *out);
+short MacRomanToUTF8(const unsigned char *name, short length,
+                     unsigned char *out);
+
+/* Case- and diacritic-insensitive MacRoman, for comparing names */
+extern const unsigned char gMacRomanFold[256];
+#define MacRomanFold(c)     (gMacRomanFold[(unsigned char)(c)])
+
+/* Paged listing */
+OSErr ProbePagedListing(short scsiID, Boolean *supported);
+OSErr GetDiscPage(short scsiID, unsigned short start,
+                  unsigned short maxEntries, void *buffer, long bufferSize,
+                  unsigned short *total, unsigned short *pageCount);
+OSErr GetDiscPageFormat(short scsiID, unsigned char format,
+                        unsigned short start, unsigned short maxEntries,
+                        void *buffer, long bufferSize, unsigned short *total,
+                        unsigned short *pageCount, long *pageBytes);
+long PageEntryMaxSize(unsigned char format);
+long PageBufferSize(unsigned char format, short pageEntries);
+OSErr BeginDiscPager(DiscPager *pager, short scsiID, short pageEntries);
+OSErr BeginDiscPagerFormat(DiscPager *pager, short scsiID, short pageEntries,
+                           unsigned char format);
+OSErr DiscPagerStep(DiscPager *pager);
+void DiscPagerGetView(const DiscPager *pager, WireEntryView *view);
+void DiscPagerGetEntry(const DiscPager *pager, short i, DiscEntry *entry,
+                       unsigned short *index);
+void EndDiscPager(DiscPager *pager);
+
+/* Catalog generations */
+OSErr ProbeCatalogGeneration(short scsiID, Boolean *supported,
+                             UInt32 *generation);
+OSErr GetCatalogGeneration(short scsiID, UInt32 *generation);
+OSErr GetCatalogChanges(short scsiID, UInt32 since, CatalogChanges *changes);
+
+/* Device information */
+OSErr GetDeviceInfo(short scsiID, DeviceInfo *info);
+OSErr ProbeDeviceInfo(short scsiID, DeviceInfo *info);
+OSErr GetCurrentDisc(short scsiID, unsigned short *index);
+
+/* Compound transactions */
+void BatchReset(USBODEBatch *batch);
+USBODECommand *BatchAddCDB(USBODEBatch *batch, const unsigned char *cdb,
+                           short cdbLength, void *buffer, long bufferSize);
+USBODECommand *BatchAddCommand(USBODEBatch *batch, unsigned char cmd,
+                               unsigned char param,
+                               void *buffer, long bufferSize);
+OSErr ExecuteBatch(short scsiID, USBODEBatch *batch);
+OSErr SetActiveDiscAndTest(short scsiID, unsigned short index,
+                           OSErr *readyErr, SenseData *sense);
+
+/* Readiness */
+OSErr RequestSense(short scsiID, SenseData *sense);
+OSErr TestUnitReady(short scsiID, SenseData *sense);
+OSErr MountAndWait(short scsiID, unsigned short index, UInt32 timeoutMicros,
+                   MountReadiness *readiness);
+OSErr WaitUntilReady(short scsiID, UInt32 timeoutMicros,
+                     MountReadiness *readiness);
+void BeginMountWait(MountWaiter *waiter, short scsiID, unsigned short index,
+                    UInt32 timeoutMicros);
+Boolean MountWaitStep(MountWaiter *waiter, UInt32 *delay);
+
+#endif /* USBODE_PROTOCOL_H */
@@ -0,0 +1,200 @@
+/*
+ * USBODE_RowCache.c
+ * Ready-to-draw disc list rows
+ *
+ * Portable: formats numbers itself rather than calling NumToString, so
+ * the host build can exercise it too.
+ */
+
+#include "USBODE_RowCache.h"
+
+/* Row bytes besides the name: 5-digit index, 7-digit size, punctuation */
+#define kRowOverhead        21
+#define kMaxRowName         (255 - kRowOverhead)
+
+static short AppendDecimal(unsigned char *row, unsigned long value);
+static short AppendText(unsigned char *row, const char *text);
+static OSErr GrowBlock(Handle block, long bytes);
+
+/*
+ * Set up an empty cache
+ */
+OSErr InitRowCache(RowCache *cache)
+{
+    cache->count = 0;
+    cache->textSize = 0;
+    cache->serial = 0;
+
+    cache->text = NewHandle(0);
+    cache->offsets = NewHandle(0);
+
+    if (cache->text == nil || cache->offsets == nil) {
+        DisposeRowCache(cache);
+        return memFullErr;
+    }
+
+    return noErr;
+}
+
+/*
+ * Release cache storage
+ */
+void DisposeRowCache(RowCache *cache)
+{
+    if (cache->text != nil) DisposeHandle(cache->text);
+    if (cache->offsets != nil) DisposeHandle(cache->offsets);
+
+    cache->text = nil;
+    cache->offsets = nil;
+    cache->count = 0;
+    cache->textSize = 0;
+}
+
+/*
+ * Append a number in decimal to a Pascal string
+ */
+static short AppendDecimal(unsigned char *row, unsigned long value)
+{
+    unsigned char digits[10];
+    short n;
+
+    n = 0;
+    do {
+        digits[n++] = (unsigned char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (n > 0) {
+        row[++row[0]] = digits[--n];
+    }
+
+    return row[0];
+}
+
+/*
+ * Append C text to a Pascal string
+ */
+static short AppendText(unsigned char *row, const char *text)
+{
+    while (*text != 0) {
+        row[++row[0]] = (unsigned char)*text++;
+    }
+
+    return row[0];
+}
+
+/*
+ * Grow a block to at least bytes, doubling
+ */
+static OSErr GrowBlock(Handle block, long bytes)
+{
+    long size;
+
+    size = GetHandleSize(block);
+    if (bytes <= size) {
+        return noErr;
+    }
+
+    if (size < 256) {
+        size = 256;
+    }
+    while (size < bytes) {
+        size *= 2;
+    }
+
+    SetHandleSize(block, size);
+    if (MemError() != noErr) {
+        SetHandleSize(block, bytes);
+    }
+
+    return MemError();
+}
+
+/*
+ * Bring the cache up to date with the catalog
+ * New entries are formatted and appended; a cleared catalog means the
+ * rows are rebuilt from the start.  Call only while unlocked.
+ */
+OSErr RowCacheSync(RowCache *cache, const DiscCatalog *catalog)
+{
+    unsigned char *row;
+    unsigned long *offsets;
+    Str255 name;
+    long nameBytes;
+    long i;
+    OSErr err;
+
+    if (cache->serial != catalog->serial || cache->count > catalog->count) {
+        cache->count = 0;
+        cache->textSize = 0;
+        cache->serial = catalog->serial;
+    }
+
+    if (cache->count == catalog->count) {
+        return noErr;
+    }
+
+    /* The new names are one run of the pool, whatever their lengths */
+    nameBytes = catalog->poolSize -
+                (long)CatalogNameOffsets(catalog)[cache->count];
+
+    err = GrowBlock(cache->offsets,
+                    catalog->count * (long)sizeof(unsigned long));
+    if (err == noErr) {
+        err = GrowBlock(cache->text, cache->textSize + nameBytes +
+                        (catalog->count - cache->count) * kRowOverhead);
+    }
+    if (err != noErr) {
+        return err;
+    }
+
+    offsets = (unsigned long *)*cache->offsets;
+
+    for (i = cache->count; i < catalog->count; i++) {
+        row = (unsigned char *)*cache->text + cache->textSize;
+        row[0] = 0;
+
+        AppendDecimal(row, CatalogIndex(catalog, i));
+        AppendText(row, ". ");
+
+        /* Long names are cut to keep the row a Pascal string */
+        CatalogGetName(catalog, i, name);
+        if (name[0] > kMaxRowName) {
+            name[0] = kMaxRowName;
+        }
+        BlockMoveData(name + 1, row + row[0] + 1, name[0]);
+        row[0] += name[0];
+
+        AppendText(row, "  (");
+        AppendDecimal(row, CatalogSize(catalog, i) / 1024);
+        AppendText(row, " MB)");
+
+        offsets[i] = (unsigned long)cache->textSize;
+        cache->textSize += 1 + row[0];
+    }
+
+    cache->count = catalog->count;
+    return noErr;
+}
+
+/*
+ * Pin the rows in memory while drawing
+ */
+void RowCacheLock(RowCache *cache)
+{
+    HLock(cache->text);
+}
+
+void RowCacheUnlock(RowCache *cache)
+{
+    HUnlock(cache->text);
+}
+
+/*
+ * Row i as a Pascal string, valid while the cache is locked
+ */
+ConstStr255Param RowCacheRow(const RowCache *cache, long i)
+{
+    return (ConstStr255Param)*cache->text +
+           ((unsigned long *)*cache->offsets)[i];
+}
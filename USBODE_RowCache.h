@@ -0,0 +1,33 @@
+/*
+ * USBODE_RowCache.h
+ * Ready-to-draw disc list rows
+ *
+ * Each catalog entry is formatted once, when it arrives, into a Pascal
+ * string of the form "12. Name.iso  (650 MB)".  Update events then only
+ * draw.  The cache follows the catalog: rows are appended as pages come
+ * in and everything is rebuilt when the catalog is cleared.
+ */
+
+#ifndef USBODE_ROWCACHE_H
+#define USBODE_ROWCACHE_H
+
+#include "USBODE_Catalog.h"
+
+typedef struct {
+    Handle          text;       /* packed Pascal strings */
+    Handle          offsets;    /* unsigned long per row into text */
+    long            count;
+    long            textSize;
+    unsigned long   serial;     /* catalog serial the rows belong to */
+} RowCache;
+
+OSErr InitRowCache(RowCache *cache);
+void DisposeRowCache(RowCache *cache);
+OSErr RowCacheSync(RowCache *cache, const DiscCatalog *catalog);
+
+/* Lock around drawing; rows are only valid while locked */
+void RowCacheLock(RowCache *cache);
+void RowCacheUnlock(RowCache *cache);
+ConstStr255Param RowCacheRow(const RowCache *cache, long i);
+
+#endif /* USBODE_ROWCACHE_H */
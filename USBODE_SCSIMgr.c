@@ -0,0 +1,165 @@
+/*
+ * USBODE_SCSIMgr.c
+ * Classic SCSI Manager transport (Mac only)
+ *
+ * One transaction per command: SCSIGet, SCSISelect, SCSICmd, an optional
+ * SCSIRead driven by a transfer instruction block, then SCSIComplete.
+ * The original SCSI Manager does not report a residual count, so on
+ * success the full requested length is reported as transferred.  A
+ * target that ends the data phase early and then returns GOOD status
+ * has sent a short reply, which is success too; callers that need to
+ * know the length ask for exactly what they expect.
+ *
+ * Selection timeout is fixed by the original SCSI Manager (about 250 ms
+ * per empty ID), so setTimeout can only shorten the wait for the status
+ * and message phases, which is where an unresponsive target hangs.
+ */
+
+#include "USBODE_Protocol.h"
+#include "USBODE_Trace.h"
+
+#ifndef USBODE_HOST
+
+/* Ticks to wait for the status and message phases */
+#define kCompleteWait       300
+#define kMinCompleteWait    2
+
+/* Status byte bits that carry the SCSI status code */
+#define kStatusMask         0x1E
+
+static OSErr SCSIManagerExecute(USBODETransport *transport, short scsiID,
+                                const unsigned char *cdb, short cdbLength,
+                                void *buffer, long bufferSize,
+                                long *actualSize);
+static void SCSIManagerClose(USBODETransport *transport);
+static void SCSIManagerSetTimeout(USBODETransport *transport,
+                                  UInt32 milliseconds);
+
+/*
+ * Create a transport that drives the original SCSI Manager
+ */
+USBODETransport *NewSCSIManagerTransport(void)
+{
+    USBODETransport *transport;
+    long *completeWait;
+
+    transport = (USBODETransport *)NewPtrClear(sizeof(USBODETransport));
+    if (transport == nil) {
+        return nil;
+    }
+
+    completeWait = (long *)NewPtr(sizeof(long));
+    if (completeWait == nil) {
+        DisposePtr((Ptr)transport);
+        return nil;
+    }
+    *completeWait = kCompleteWait;
+
+    transport->name = "SCSI Manager";
+    transport->refCon = completeWait;
+    transport->execute = SCSIManagerExecute;
+    transport->executeBatch = nil;
+    transport->close = SCSIManagerClose;
+    transport->setTimeout = SCSIManagerSetTimeout;
+    transport->reportsResidual = false;
+
+    return transport;
+}
+
+/*
+ * Release the timeout setting
+ */
+static void SCSIManagerClose(USBODETransport *transport)
+{
+    DisposePtr((Ptr)transport->refCon);
+    transport->refCon = nil;
+}
+
+/*
+ * Set the status phase wait, rounded up to whole ticks
+ */
+static void SCSIManagerSetTimeout(USBODETransport *transport,
+                                  UInt32 milliseconds)
+{
+    long ticks;
+
+    ticks = (milliseconds == 0) ? kCompleteWait :
+            (long)((milliseconds * 60 + 999) / 1000);
+    if (ticks < kMinCompleteWait) {
+        ticks = kMinCompleteWait;
+    }
+
+    *(long *)transport->refCon = ticks;
+}
+
+/*
+ * Execute one command block as a complete SCSI transaction
+ */
+static OSErr SCSIManagerExecute(USBODETransport *transport, short scsiID,
+                                const unsigned char *cdb, short cdbLength,
+                                void *buffer, long bufferSize,
+                                long *actualSize)
+{
+    SCSIInstr tib[2];
+    short scsiStatus;
+    short scsiMessage;
+    OSErr err;
+    OSErr completeErr;
+    long completeWait;
+
+    completeWait = *(long *)transport->refCon;
+
+    /* Arbitrate for the bus */
+    err = SCSIGet();
+    TraceMark(kTracePhaseArbitrate);
+    if (err != noErr) return err;
+
+    /* Select target device */
+    err = SCSISelect(scsiID);
+    TraceMark(kTracePhaseSelect);
+    if (err != noErr) {
+        SCSIComplete(&scsiStatus, &scsiMessage, completeWait);
+        return err;
+    }
+
+    /* Send command */
+    err = SCSICmd((Ptr)cdb, cdbLength);
+    TraceMark(kTracePhaseCommand);
+
+    /* Read response if buffer provided */
+    if (err == noErr && buffer != nil && bufferSize > 0) {
+        tib[0].scOpcode = scInc;
+        tib[0].scParam1 = (long)buffer;
+        tib[0].scParam2 = bufferSize;
+        tib[1].scOpcode = scStop;
+        tib[1].scParam1 = 0;
+        tib[1].scParam2 = 0;
+
+        err = SCSIRead((Ptr)tib);
+        TraceMark(kTracePhaseData);
+    }
+
+    /* Complete transaction */
+    completeErr = SCSIComplete(&scsiStatus, &scsiMessage, completeWait);
+    TraceMark(kTracePhaseStatus);
+
+    /* A target that sent less than the buffer went to status early;
+       with GOOD status that is a short reply, not a failure */
+    if (err == scPhaseErr && completeErr == noErr) {
+        err = noErr;
+    }
+    if (err == noErr) {
+        err = completeErr;
+    }
+    if (err == noErr && (scsiStatus & kStatusMask) != 0) {
+        err = scsiNonZeroStatus;
+    }
+
+    if (err == noErr && actualSize != nil && buffer != nil) {
+        *actualSize = bufferSize;
+    }
+
+    return err;
+}
+
+#endif /* USBODE_HOST */
@@ -0,0 +1,194 @@
+/*
+ * USBODE_SGIO.c
+ * Linux SG_IO transport (host only)
+ *
+ * Each SCSI ID the protocol code uses is bound to a Linux generic SCSI
+ * node (/dev/sgN) with SGIOAttachDevice.  IDs without a node behave like
+ * an empty bus position and fail selection with scCommErr.
+ */
+
+#include "USBODE_Protocol.h"
+#include "USBODE_Trace.h"
+
+#ifdef USBODE_HOST
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <scsi/sg.h>
+
+#define kSGIOMaxTargets     8
+#define kSGIOTimeoutMs      5000
+
+typedef struct {
+    int fd[kSGIOMaxTargets];
+    unsigned int timeoutMs;
+} SGIOState;
+
+static OSErr SGIOExecute(USBODETransport *transport, short scsiID,
+                         const unsigned char *cdb, short cdbLength,
+                         void *buffer, long bufferSize, long *actualSize);
+static void SGIOClose(USBODETransport *transport);
+static void SGIOSetTimeout(USBODETransport *transport, UInt32 milliseconds);
+
+/*
+ * Create an SG_IO transport with no devices attached
+ */
+USBODETransport *NewSGIOTransport(void)
+{
+    USBODETransport *transport;
+    SGIOState *state;
+    int i;
+
+    transport = (USBODETransport *)NewPtrClear(sizeof(USBODETransport));
+    if (transport == nil) {
+        return nil;
+    }
+
+    state = (SGIOState *)NewPtrClear(sizeof(SGIOState));
+    if (state == nil) {
+        DisposePtr((Ptr)transport);
+        return nil;
+    }
+
+    for (i = 0; i < kSGIOMaxTargets; i++) {
+        state->fd[i] = -1;
+    }
+    state->timeoutMs = kSGIOTimeoutMs;
+
+    transport->name = "SG_IO";
+    transport->refCon = state;
+    transport->execute = SGIOExecute;
+    transport->executeBatch = nil;
+    transport->close = SGIOClose;
+    transport->setTimeout = SGIOSetTimeout;
+    transport->reportsResidual = true;
+
+    return transport;
+}
+
+/*
+ * Bind a SCSI ID to a generic SCSI device node
+ */
+OSErr SGIOAttachDevice(USBODETransport *transport, short scsiID,
+                       const char *devicePath)
+{
+    SGIOState *state;
+    int fd;
+
+    if (transport == nil || transport->execute != SGIOExecute ||
+        scsiID < 0 || scsiID >= kSGIOMaxTargets || devicePath == nil) {
+        return paramErr;
+    }
+
+    state = (SGIOState *)transport->refCon;
+
+    fd = open(devicePath, O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        fd = open(devicePath, O_RDONLY | O_NONBLOCK);
+    }
+    if (fd < 0) {
+        return (errno == ENOENT) ? fnfErr : ioErr;
+    }
+
+    if (state->fd[scsiID] >= 0) {
+        close(state->fd[scsiID]);
+    }
+    state->fd[scsiID] = fd;
+
+    return noErr;
+}
+
+/*
+ * Set the command timeout handed to the kernel
+ */
+static void SGIOSetTimeout(USBODETransport *transport, UInt32 milliseconds)
+{
+    SGIOState *state;
+
+    state = (SGIOState *)transport->refCon;
+    state->timeoutMs = (milliseconds == 0) ? kSGIOTimeoutMs : milliseconds;
+}
+
+/*
+ * Execute one command block with a single SG_IO ioctl
+ */
+static OSErr SGIOExecute(USBODETransport *transport, short scsiID,
+                         const unsigned char *cdb, short cdbLength,
+                         void *buffer, long bufferSize, long *actualSize)
+{
+    SGIOState *state;
+    sg_io_hdr_t io;
+
+    state = (SGIOState *)transport->refCon;
+
+    if (scsiID < 0 || scsiID >= kSGIOMaxTargets || state->fd[scsiID] < 0) {
+        return scCommErr;
+    }
+
+    memset(&io, 0, sizeof(io));
+    io.interface_id = 'S';
+    io.cmdp = (unsigned char *)cdb;
+    io.cmd_len = (unsigned char)cdbLength;
+    io.sbp = transport->sense;
+    io.mx_sb_len = sizeof(transport->sense);
+    io.timeout = state->timeoutMs;
+
+    if (buffer != nil && bufferSize > 0) {
+        io.dxfer_direction = SG_DXFER_FROM_DEV;
+        io.dxferp = buffer;
+        io.dxfer_len = (unsigned int)bufferSize;
+    } else {
+        io.dxfer_direction = SG_DXFER_NONE;
+    }
+
+    /* The whole transaction happens inside the ioctl */
+    if (ioctl(state->fd[scsiID], SG_IO, &io) < 0) {
+        return ioErr;
+    }
+    TraceMark(kTracePhaseStatus);
+
+    if (io.host_status != 0 || io.driver_status != 0) {
+        if (io.status == 0 && io.masked_status == 0) {
+            return scCommErr;
+        }
+    }
+
+    if (io.status != 0) {
+        /* The kernel fetched the sense; keep it for the caller */
+        transport->senseLength = io.sb_len_wr;
+        return scsiNonZeroStatus;
+    }
+
+    if (actualSize != nil && io.dxfer_len > 0) {
+        *actualSize = (long)io.dxfer_len - io.resid;
+    }
+
+    return noErr;
+}
+
+/*
+ * Close all attached device nodes
+ */
+static void SGIOClose(USBODETransport *transport)
+{
+    SGIOState *state;
+    int i;
+
+    state = (SGIOState *)transport->refCon;
+    if (state == nil) {
+        return;
+    }
+
+    for (i = 0; i < kSGIOMaxTargets; i++) {
+        if (state->fd[i] >= 0) {
+            close(state->fd[i]);
+        }
+    }
+
+    DisposePtr((Ptr)state);
+    transport->refCon = nil;
+}
+
+#endif /* USBODE_HOST */
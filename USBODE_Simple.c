@@ -70,6 +70,8 @@ void ToolBoxInit(void);
 void MenuBarInit(void);
 void WindowInit(void);
 Boolean FindUSBODEDevice(short *scsiID);
+OSErr SendSCSICommand(short scsiID, unsigned char cmd, unsigned char param,
+                      void *buffer, long bufferSize, long *actualSize);
 OSErr GetDiscCount(short scsiID, unsigned char *count);
 OSErr GetDiscList(short scsiID, DiscEntry *discs, unsigned char count);
 OSErr SetActiveDisc(short scsiID, unsigned char index);
@@ -149,31 +151,61 @@ Boolean FindUSBODEDevice(short *scsiID)
     return (GetDiscCount(*scsiID, &count) == noErr);
 }
 
-OSErr GetDiscCount(short scsiID, unsigned char *count)
+/*
+ * Single SCSI path for every USBODE command: one full transaction
+ * (SCSIGet, SCSISelect, SCSICmd, optional SCSIRead, SCSIComplete).
+ * This mirrors the execute call of the transport layer used by the
+ * full version (USBODE_Transport.h).
+ */
+OSErr SendSCSICommand(short scsiID, unsigned char cmd, unsigned char param,
+                      void *buffer, long bufferSize, long *actualSize)
 {
-    OSErr err = SCSIGet();
+    unsigned char cdb[12] = {0};
+    SCSIInstr tib[2];
+    short stat, message;
+    OSErr err, completeErr;
+    
+    cdb[0] = cmd;
+    cdb[1] = param;
+    if (actualSize != nil) *actualSize = 0;
+    
+    err = SCSIGet();
     if (err != noErr) return err;
     
     err = SCSISelect(scsiID);
     if (err != noErr) {
-        long dummy;
-        SCSIComplete(&dummy, nil, 0);
+        SCSIComplete(&stat, &message, 300);
         return err;
     }
     
-    unsigned char cdb[12] = {SCSI_CMD_NUM_CDS, 0};
-    err = SCSICmd(cdb, 12);
-    if (err != noErr) {
-        long dummy;
-        SCSIComplete(&dummy, nil, 0);
-        return err;
+    err = SCSICmd((Ptr)cdb, 12);
+    
+    if (err == noErr && buffer != nil && bufferSize > 0) {
+        tib[0].scOpcode = scInc;
+        tib[0].scParam1 = (long)buffer;
+        tib[0].scParam2 = bufferSize;
+        tib[1].scOpcode = scStop;
+        tib[1].scParam1 = 0;
+        tib[1].scParam2 = 0;
+        err = SCSIRead((Ptr)tib);
     }
     
-    unsigned char response;
-    err = SCSIRead(&response);
+    completeErr = SCSIComplete(&stat, &message, 300);
+    if (err == noErr) err = completeErr;
+    
+    if (err == noErr && actualSize != nil && buffer != nil) {
+        *actualSize = bufferSize;
+    }
     
+    return err;
+}
+
+OSErr GetDiscCount(short scsiID, unsigned char *count)
+{
+    unsigned char response;
     long actualSize;
-    SCSIComplete(&actualSize, nil, 0);
+    OSErr err = SendSCSICommand(scsiID, SCSI_CMD_NUM_CDS, 0,
+                                &response, 1, &actualSize);
     
     if (err == noErr && actualSize >= 1) {
         *count = response;
@@ -187,51 +219,14 @@ OSErr GetDiscCount(short scsiID, unsigned char *count)
 
 OSErr GetDiscList(short scsiID, DiscEntry *discs, unsigned char count)
 {
-    OSErr err = SCSIGet();
-    if (err != noErr) return err;
-    
-    err = SCSISelect(scsiID);
-    if (err != noErr) {
-        long dummy;
-        SCSIComplete(&dummy, nil, 0);
-        return err;
-    }
-    
-    unsigned char cdb[12] = {SCSI_CMD_LIST_CDS, 0};
-    err = SCSICmd(cdb, 12);
-    if (err != noErr) {
-        long dummy;
-        SCSIComplete(&dummy, nil, 0);
-        return err;
-    }
-    
-    err = SCSIRead(discs);
-    
     long actualSize;
-    SCSIComplete(&actualSize, nil, 0);
-    
-    return err;
+    return SendSCSICommand(scsiID, SCSI_CMD_LIST_CDS, 0,
+                           discs, count * sizeof(DiscEntry), &actualSize);
 }
 
 OSErr SetActiveDisc(short scsiID, unsigned char index)
 {
-    OSErr err = SCSIGet();
-    if (err != noErr) return err;
-    
-    err = SCSISelect(scsiID);
-    if (err != noErr) {
-        long dummy;
-        SCSIComplete(&dummy, nil, 0);
-        return err;
-    }
-    
-    unsigned char cdb[12] = {SCSI_CMD_SET_NEXT_CD, index, 0};
-    err = SCSICmd(cdb, 12);
-    
-    long actualSize;
-    SCSIComplete(&actualSize, nil, 0);
-    
-    return err;
+    return SendSCSICommand(scsiID, SCSI_CMD_SET_NEXT_CD, index, nil, 0, nil);
 }
 
 void RefreshDiscList(void)
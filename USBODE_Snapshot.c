@@ -0,0 +1,266 @@
+/*
+ * USBODE_Snapshot.c
+ * Catalog snapshot for instant startup
+ *
+ * Entries are moved in blocks of kSnapshotChunk so that a large catalog
+ * takes a handful of File Manager calls, and the name pool is written
+ * and read in one piece straight from the catalog's own block.  A
+ * snapshot that is truncated, from another version or whose hash does
+ * not match its contents is rejected and leaves the catalog empty.
+ * Portable; only the stdio helpers are host specific.
+ */
+
+#include "USBODE_Snapshot.h"
+
+#define kSnapshotChunk      128     /* entries per read or write */
+
+#define GetBE32(p)      (((UInt32)(p)[0] << 24) | ((UInt32)(p)[1] << 16) | \
+                         ((UInt32)(p)[2] << 8) | (UInt32)(p)[3])
+#define PutBE32(p, v)   ((p)[0] = (unsigned char)((v) >> 24), \
+                         (p)[1] = (unsigned char)((v) >> 16), \
+                         (p)[2] = (unsigned char)((v) >> 8), \
+                         (p)[3] = (unsigned char)(v))
+
+static Boolean RebuildNameOffsets(DiscCatalog *catalog);
+
+/*
+ * Write a catalog as a snapshot; generation is nil when the device
+ * does not keep one
+ */
+OSErr WriteCatalogSnapshot(const DiscCatalog *catalog, short scsiID,
+                           const UInt32 *generation,
+                           SnapshotWriteProcPtr writeProc, void *refCon)
+{
+    unsigned char buffer[kSnapshotChunk * kSnapshotEntrySize];
+    unsigned char *out;
+    long first;
+    long i;
+    OSErr err;
+
+    PutBE32(buffer, kSnapshotMagic);
+    PutBE16(buffer + 4, kSnapshotVersion);
+    PutBE16(buffer + 6, (unsigned short)scsiID);
+    PutBE32(buffer + 8, (UInt32)catalog->count);
+    PutBE32(buffer + 12, (UInt32)catalog->poolSize);
+    PutBE32(buffer + 16, CatalogHash(catalog));
+    PutBE32(buffer + 20, (generation != nil) ? *generation : 0);
+    PutBE32(buffer + 24, (generation != nil) ? kSnapshotHasGeneration : 0);
+
+    err = (*writeProc)(refCon, buffer, kSnapshotHeaderSize);
+
+    for (first = 0; first < catalog->count && err == noErr;
+         first += kSnapshotChunk) {
+        out = buffer;
+        for (i = first; i < catalog->count && i < first + kSnapshotChunk; i++) {
+            PutBE16(out, CatalogIndices(catalog)[i]);
+            out[2] = CatalogTypes(catalog)[i];
+            PutBE32(out + 3, CatalogSizes(catalog)[i]);
+            out += kSnapshotEntrySize;
+        }
+        err = (*writeProc)(refCon, buffer, out - buffer);
+    }
+
+    if (err == noErr && catalog->poolSize > 0) {
+        HLock(catalog->names);
+        err = (*writeProc)(refCon, CatalogNamePool(catalog), catalog->poolSize);
+        HUnlock(catalog->names);
+    }
+
+    return err;
+}
+
+/*
+ * Recreate the name offsets by walking the pool; false if the pool does
+ * not hold exactly one name per entry
+ */
+static Boolean RebuildNameOffsets(DiscCatalog *catalog)
+{
+    const unsigned char *pool;
+    unsigned long *offsets;
+    long offset;
+    long i;
+
+    pool = CatalogNamePool(catalog);
+    offsets = CatalogNameOffsets(catalog);
+    offset = 0;
+
+    for (i = 0; i < catalog->count; i++) {
+        if (offset >= catalog->poolSize) {
+            return false;
+        }
+        offsets[i] = (unsigned long)offset;
+        offset += 1 + pool[offset];
+    }
+
+    return (offset == catalog->poolSize);
+}
+
+/*
+ * Replace the catalog with the contents of a snapshot
+ * Returns eofErr for a truncated snapshot and paramErr for one that is
+ * not a snapshot this version understands or fails its hash.
+ */
+OSErr ReadCatalogSnapshot(DiscCatalog *catalog, SnapshotInfo *info,
+                          SnapshotReadProcPtr readProc, void *refCon)
+{
+    unsigned char buffer[kSnapshotChunk * kSnapshotEntrySize];
+    const unsigned char *in;
+    long count;
+    long poolSize;
+    long chunk;
+    long first;
+    long i;
+    UInt32 hash;
+    OSErr err;
+
+    CatalogClear(catalog);
+
+    err = (*readProc)(refCon, buffer, kSnapshotHeaderSize);
+    if (err != noErr) {
+        return err;
+    }
+
+    count = (long)GetBE32(buffer + 8);
+    poolSize = (long)GetBE32(buffer + 12);
+    hash = GetBE32(buffer + 16);
+
+    if (GetBE32(buffer) != kSnapshotMagic ||
+        GetBE16(buffer + 4) != kSnapshotVersion ||
+        count < 0 || count > kMaxCatalogEntries ||
+        poolSize < count || poolSize > count * 256L) {
+        return paramErr;
+    }
+
+    info->scsiID = (short)GetBE16(buffer + 6);
+    info->count = count;
+    info->hash = hash;
+    info->hasGeneration = (GetBE32(buffer + 24) & kSnapshotHasGeneration) != 0;
+    info->generation = GetBE32(buffer + 20);
+
+    err = CatalogReserve(catalog, count, poolSize);
+    if (err != noErr) {
+        return err;
+    }
+
+    for (first = 0; first < count; first += chunk) {
+        chunk = (count - first < kSnapshotChunk) ? count - first : kSnapshotChunk;
+        err = (*readProc)(refCon, buffer, chunk * kSnapshotEntrySize);
+        if (err != noErr) {
+            return err;
+        }
+
+        in = buffer;
+        for (i = first; i < first + chunk; i++) {
+            CatalogIndices(catalog)[i] = GetBE16(in);
+            CatalogTypes(catalog)[i] = in[2];
+            CatalogSizes(catalog)[i] = GetBE32(in + 3);
+            in += kSnapshotEntrySize;
+        }
+    }
+
+    if (poolSize > 0) {
+        HLock(catalog->names);
+        err = (*readProc)(refCon, CatalogNamePool(catalog), poolSize);
+        HUnlock(catalog->names);
+        if (err != noErr) {
+            return err;
+        }
+    }
+
+    catalog->count = count;
+    catalog->poolSize = poolSize;
+
+    if (!RebuildNameOffsets(catalog) || CatalogHash(catalog) != hash) {
+        CatalogClear(catalog);
+        return paramErr;
+    }
+
+    return noErr;
+}
+
+#ifdef USBODE_HOST
+
+#include <stdio.h>
+
+static OSErr SnapshotWriteStdio(void *refCon, const void *data, long length);
+static OSErr SnapshotReadStdio(void *refCon, void *data, long length);
+
+/*
+ * Snapshot output to a stdio stream
+ */
+static OSErr SnapshotWriteStdio(void *refCon, const void *data, long length)
+{
+    if (fwrite(data, 1, (size_t)length, (FILE *)refCon) != (size_t)length) {
+        return ioErr;
+    }
+    return noErr;
+}
+
+/*
+ * Snapshot input from a stdio stream
+ */
+static OSErr SnapshotReadStdio(void *refCon, void *data, long length)
+{
+    if (fread(data, 1, (size_t)length, (FILE *)refCon) != (size_t)length) {
+        return eofErr;
+    }
+    return noErr;
+}
+
+/*
+ * Write a snapshot file, replacing any old one only once it is complete
+ */
+OSErr SaveSnapshotFile(const DiscCatalog *catalog, short scsiID,
+                       const UInt32 *generation, const char *path)
+{
+    char temporary[1024];
+    FILE *file;
+    OSErr err;
+
+    if (snprintf(temporary, sizeof(temporary), "%s.new", path) >=
+        (int)sizeof(temporary)) {
+        return paramErr;
+    }
+
+    file = fopen(temporary, "wb");
+    if (file == nil) {
+        return fnfErr;
+    }
+
+    err = WriteCatalogSnapshot(catalog, scsiID, generation,
+                               SnapshotWriteStdio, file);
+    if (fclose(file) != 0 && err == noErr) {
+        err = ioErr;
+    }
+    if (err == noErr && rename(temporary, path) != 0) {
+        err = ioErr;
+    }
+    if (err != noErr) {
+        remove(temporary);
+    }
+
+    return err;
+}
+
+/*
+ * Read a snapshot file
+ */
+OSErr LoadSnapshotFile(DiscCatalog *catalog, SnapshotInfo *info,
+                       const char *path)
+{
+    FILE *file;
+    OSErr err;
+
+    file = fopen(path, "rb");
+    if (file == nil) {
+        CatalogClear(catalog);
+        return fnfErr;
+    }
+
+    err = ReadCatalogSnapshot(catalog, info, SnapshotReadStdio, file);
+    fclose(file);
+
+    return err;
+}
+
+#endif /* USBODE_HOST */
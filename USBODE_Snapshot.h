@@ -0,0 +1,68 @@
+/*
+ * USBODE_Snapshot.h
+ * Catalog snapshot for instant startup
+ *
+ * The last catalog read from the device is kept in a small binary file
+ * so the next launch can show it before the device has been found.
+ * The snapshot records the SCSI ID it came from and the CatalogHash of
+ * its entries, which serves as its generation: a revalidating listing
+ * with the same hash has nothing new to show, and an unchanged catalog
+ * is not written again.  When the device keeps catalog generations
+ * (CATALOG CHANGES, 0xE1) the snapshot also records the one it was
+ * listed at, so the next launch can ask for just what changed since.
+ *
+ * Layout, all fields big-endian:
+ *
+ *   0   'USBS'                 magic
+ *   4   version (16)           kSnapshotVersion
+ *   6   SCSI ID (16, signed)   -1 when unknown
+ *   8   entry count (32)
+ *   12  name pool bytes (32)
+ *   16  CatalogHash (32)
+ *   20  device catalog generation (32)
+ *   24  flags (32)             kSnapshotHasGeneration
+ *   28  entries: index (16), type (8), size in KB (32)
+ *       name pool: the entries' names as Pascal strings, in order
+ *
+ * Reading goes through a caller-supplied proc, like TraceWriteCSV, so
+ * the same code serves File Manager and stdio files.
+ */
+
+#ifndef USBODE_SNAPSHOT_H
+#define USBODE_SNAPSHOT_H
+
+#include "USBODE_Catalog.h"
+
+#define kSnapshotMagic          0x55534253UL    /* 'USBS' */
+#define kSnapshotVersion        2
+#define kSnapshotHeaderSize     28
+#define kSnapshotHasGeneration  0x00000001UL
+#define kSnapshotEntrySize      7
+
+/* Write length bytes; read exactly length bytes or return eofErr */
+typedef OSErr (*SnapshotWriteProcPtr)(void *refCon, const void *data,
+                                      long length);
+typedef OSErr (*SnapshotReadProcPtr)(void *refCon, void *data, long length);
+
+/* What a snapshot header says */
+typedef struct {
+    short           scsiID;
+    long            count;
+    UInt32          hash;
+    Boolean         hasGeneration;
+    UInt32          generation;
+} SnapshotInfo;
+
+OSErr WriteCatalogSnapshot(const DiscCatalog *catalog, short scsiID,
+                           const UInt32 *generation,
+                           SnapshotWriteProcPtr writeProc, void *refCon);
+OSErr ReadCatalogSnapshot(DiscCatalog *catalog, SnapshotInfo *info,
+                          SnapshotReadProcPtr readProc, void *refCon);
+#ifdef USBODE_HOST
+OSErr SaveSnapshotFile(const DiscCatalog *catalog, short scsiID,
+                       const UInt32 *generation, const char *path);
+OSErr LoadSnapshotFile(DiscCatalog *catalog, SnapshotInfo *info,
+                       const char *path);
+#endif
+
+#endif /* USBODE_SNAPSHOT_H */
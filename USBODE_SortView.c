@@ -0,0 +1,256 @@
+/*
+ * USBODE_SortView.c
+ * Disc list orders: by device index, by name and by size
+ *
+ * Portable.  The size order is a stable merge sort of entry numbers on
+ * the size column and the name keys, maintained like the prefix index:
+ * new entries are sorted among themselves and merged in.
+ */
+
+#include "USBODE_SortView.h"
+
+static long CompareSizes(const unsigned long *sizes,
+                         const unsigned long *keys, long a, long b);
+static void MergeBySize(const unsigned long *sizes, const unsigned long *keys,
+                        const long *left, long leftCount,
+                        const long *right, long rightCount, long *out);
+static void SortBySize(const unsigned long *sizes, const unsigned long *keys,
+                       long *entries, long count, long *scratch);
+
+/*
+ * Order two entries by size, then by name
+ */
+static long CompareSizes(const unsigned long *sizes,
+                         const unsigned long *keys, long a, long b)
+{
+    if (sizes[a] != sizes[b]) {
+        return (sizes[a] < sizes[b]) ? -1 : 1;
+    }
+    if (keys[a] != keys[b]) {
+        return (keys[a] < keys[b]) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Merge two runs sorted by size into out, the left run first on ties
+ */
+static void MergeBySize(const unsigned long *sizes, const unsigned long *keys,
+                        const long *left, long leftCount,
+                        const long *right, long rightCount, long *out)
+{
+    long i;
+    long j;
+
+    i = 0;
+    j = 0;
+    while (i < leftCount && j < rightCount) {
+        if (CompareSizes(sizes, keys, right[j], left[i]) < 0) {
+            *out++ = right[j++];
+        } else {
+            *out++ = left[i++];
+        }
+    }
+    while (i < leftCount) {
+        *out++ = left[i++];
+    }
+    while (j < rightCount) {
+        *out++ = right[j++];
+    }
+}
+
+/*
+ * Sort entry numbers by size, bottom up; scratch holds count entries
+ */
+static void SortBySize(const unsigned long *sizes, const unsigned long *keys,
+                       long *entries, long count, long *scratch)
+{
+    long *from;
+    long *to;
+    long *swap;
+    long width;
+    long start;
+    long middle;
+    long end;
+
+    from = entries;
+    to = scratch;
+    for (width = 1; width < count; width *= 2) {
+        for (start = 0; start < count; start += 2 * width) {
+            middle = (start + width < count) ? start + width : count;
+            end = (start + 2 * width < count) ? start + 2 * width : count;
+            MergeBySize(sizes, keys, from + start, middle - start,
+                        from + middle, end - middle, to + start);
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != entries) {
+        BlockMoveData(from, entries, count * (long)sizeof(long));
+    }
+}
+
+/*
+ * Set up empty orders
+ */
+OSErr InitSortViews(SortViews *views)
+{
+    views->count = 0;
+    views->serial = 0;
+
+    views->keys = NewHandle(0);
+    views->bySize = NewHandle(0);
+    if (views->keys == nil || views->bySize == nil) {
+        DisposeSortViews(views);
+        return memFullErr;
+    }
+
+    return noErr;
+}
+
+/*
+ * Release order storage
+ */
+void DisposeSortViews(SortViews *views)
+{
+    if (views->keys != nil) DisposeHandle(views->keys);
+    if (views->bySize != nil) DisposeHandle(views->bySize);
+
+    views->keys = nil;
+    views->bySize = nil;
+    views->count = 0;
+}
+
+/*
+ * Bring the orders up to date with the catalog, name index first
+ * Merging keeps the old entries' size order even though their keys
+ * move: new names slot in between old ones without reordering them.
+ * On failure the orders are left empty.
+ */
+OSErr SortViewsSync(SortViews *views, PrefixIndex *names,
+                    const DiscCatalog *catalog)
+{
+    const unsigned long *sizes;
+    unsigned long *keys;
+    long *bySize;
+    long *scratch;
+    long previous;
+    long added;
+    long i;
+    OSErr err;
+
+    err = PrefixIndexSync(names, catalog);
+    if (err != noErr) {
+        views->count = 0;
+        return err;
+    }
+
+    if (views->serial != catalog->serial || views->count > catalog->count) {
+        views->count = 0;
+        views->serial = catalog->serial;
+    }
+
+    if (views->count == catalog->count) {
+        return noErr;
+    }
+
+    previous = views->count;
+    added = catalog->count - previous;
+
+    SetHandleSize(views->keys, catalog->count * (long)sizeof(unsigned long));
+    if (MemError() != noErr) {
+        views->count = 0;
+        return memFullErr;
+    }
+    SetHandleSize(views->bySize, catalog->count * (long)sizeof(long));
+    if (MemError() != noErr) {
+        views->count = 0;
+        return memFullErr;
+    }
+    scratch = (long *)NewPtr(((previous > added) ? previous : added) *
+                             (long)sizeof(long));
+    if (scratch == nil) {
+        views->count = 0;
+        return memFullErr;
+    }
+
+    /* Nothing below allocates, so the blocks stay put */
+    keys = (unsigned long *)*views->keys;
+    bySize = (long *)*views->bySize;
+    sizes = CatalogSizes(catalog);
+
+    for (i = 0; i < catalog->count; i++) {
+        keys[PrefixIndexEntry(names, i)] = (unsigned long)i;
+    }
+
+    for (i = previous; i < catalog->count; i++) {
+        bySize[i] = i;
+    }
+    SortBySize(sizes, keys, bySize + previous, added, scratch);
+
+    if (previous > 0) {
+        BlockMoveData(bySize, scratch, previous * (long)sizeof(long));
+        MergeBySize(sizes, keys, scratch, previous,
+                    bySize + previous, added, bySize);
+    }
+
+    DisposePtr((Ptr)scratch);
+    views->count = catalog->count;
+    return noErr;
+}
+
+/*
+ * Catalog entry at a position of an order
+ */
+long SortViewEntry(const SortViews *views, const PrefixIndex *names,
+                   short order, Boolean descending, long position)
+{
+    if (descending) {
+        position = views->count - 1 - position;
+    }
+
+    switch (order) {
+        case kSortByName:
+            return PrefixIndexEntry(names, position);
+
+        case kSortBySize:
+            return ((const long *)*views->bySize)[position];
+    }
+
+    return position;
+}
+
+/*
+ * Position of a catalog entry in an order
+ * Name and device order look it up; size order searches for it.
+ */
+long SortViewPosition(const SortViews *views, short order,
+                      Boolean descending, long entry)
+{
+    const long *bySize;
+    long position;
+
+    switch (order) {
+        case kSortByName:
+            position = (long)((const unsigned long *)*views->keys)[entry];
+            break;
+
+        case kSortBySize:
+            bySize = (const long *)*views->bySize;
+            for (position = 0; position < views->count; position++) {
+                if (bySize[position] == entry) {
+                    break;
+                }
+            }
+            break;
+
+        default:
+            position = entry;
+            break;
+    }
+
+    return descending ? views->count - 1 - position : position;
+}
@@ -0,0 +1,45 @@
+/*
+ * USBODE_SortView.h
+ * Disc list orders: by device index, by name and by size
+ *
+ * Each order is a permutation of the catalog's entry numbers, kept up
+ * to date as the catalog changes, so switching the list between orders
+ * or reversing one only reads a different permutation.  Nothing is
+ * sorted or fetched again.
+ *
+ * Device order is the catalog's own.  Name order is the type-ahead
+ * index's (USBODE_PrefixIndex.h).  Its positions double as collation
+ * keys: an entry's key is its place in name order, a fixed-width
+ * number, so the size order compares two longs per step (the decoded
+ * size column, then the key) and never a string.
+ */
+
+#ifndef USBODE_SORTVIEW_H
+#define USBODE_SORTVIEW_H
+
+#include "USBODE_PrefixIndex.h"
+
+/* List orders */
+enum {
+    kSortByIndex    = 0,    /* as the device lists them */
+    kSortByName     = 1,    /* folded name, then device order */
+    kSortBySize     = 2     /* size, then name */
+};
+
+typedef struct {
+    Handle          keys;       /* unsigned long per entry: place by name */
+    Handle          bySize;     /* long per entry: entries by size */
+    long            count;
+    unsigned long   serial;     /* catalog serial the orders belong to */
+} SortViews;
+
+OSErr InitSortViews(SortViews *views);
+void DisposeSortViews(SortViews *views);
+OSErr SortViewsSync(SortViews *views, PrefixIndex *names,
+                    const DiscCatalog *catalog);
+long SortViewEntry(const SortViews *views, const PrefixIndex *names,
+                   short order, Boolean descending, long position);
+long SortViewPosition(const SortViews *views, short order,
+                      Boolean descending, long entry);
+
+#endif /* USBODE_SORTVIEW_H */
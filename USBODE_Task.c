@@ -0,0 +1,235 @@
+/*
+ * USBODE_Task.c
+ * Cooperative background work
+ *
+ * Portable: no Toolbox calls.  The queue is a singly linked list of the
+ * caller's task records; nothing is allocated.
+ */
+
+#include "USBODE_Task.h"
+
+static void TaskLink(TaskQueue *queue, USBODETask *task);
+static void TaskUnlink(TaskQueue *queue, USBODETask *task);
+static USBODETask *NextRunnable(TaskQueue *queue, UInt32 now);
+
+/*
+ * Add a task at the back of the queue
+ */
+static void TaskLink(TaskQueue *queue, USBODETask *task)
+{
+    task->next = nil;
+    if (queue->last != nil) {
+        queue->last->next = task;
+    } else {
+        queue->first = task;
+    }
+    queue->last = task;
+}
+
+/*
+ * Take a task out of the queue, if it is linked there
+ */
+static void TaskUnlink(TaskQueue *queue, USBODETask *task)
+{
+    USBODETask *previous;
+    USBODETask *scan;
+
+    previous = nil;
+    for (scan = queue->first; scan != nil; scan = scan->next) {
+        if (scan == task) {
+            if (previous != nil) {
+                previous->next = task->next;
+            } else {
+                queue->first = task->next;
+            }
+            if (queue->last == task) {
+                queue->last = previous;
+            }
+            task->next = nil;
+            return;
+        }
+        previous = scan;
+    }
+}
+
+/*
+ * First task in the queue that may step now, or nil
+ * Sleepers whose wake time has come are woken on the way.
+ */
+static USBODETask *NextRunnable(TaskQueue *queue, UInt32 now)
+{
+    USBODETask *task;
+
+    for (task = queue->first; task != nil; task = task->next) {
+        if (task->sleeping && (SInt32)(now - task->wakeAt) < 0) {
+            continue;
+        }
+        task->sleeping = false;
+        return task;
+    }
+
+    return nil;
+}
+
+/*
+ * Set up an empty queue
+ * sliceMicros is how long one TaskQueueRun keeps stepping; 0 steps
+ * once per call.
+ */
+void InitTaskQueue(TaskQueue *queue, UInt32 sliceMicros)
+{
+    queue->first = nil;
+    queue->last = nil;
+    queue->sliceMicros = sliceMicros;
+    queue->runs = 0;
+    queue->steps = 0;
+    queue->longestRun = 0;
+}
+
+/*
+ * Start a task, or restart it from the top if it is already running
+ * The step function keeps its state wherever refCon points; it is set
+ * up by the caller before the task starts.  A step must not restart
+ * its own task.
+ */
+void TaskStart(TaskQueue *queue, USBODETask *task, TaskStepProcPtr step,
+               void *refCon)
+{
+    Boolean linked;
+
+    linked = task->queued;
+
+    task->step = step;
+    task->refCon = refCon;
+    task->queued = true;
+    task->sleeping = false;
+    task->wakeAt = 0;
+    task->steps = 0;
+    task->longestStep = 0;
+
+    if (!linked) {
+        TaskLink(queue, task);
+    }
+}
+
+/*
+ * Drop a task without stepping it again
+ * Whatever the task holds is the caller's to release.
+ */
+void TaskStop(TaskQueue *queue, USBODETask *task)
+{
+    if (!task->queued) {
+        return;
+    }
+
+    TaskUnlink(queue, task);
+    task->queued = false;
+    task->sleeping = false;
+}
+
+/*
+ * Have a task's next step wait at least micros
+ * Called by the step before it returns kTaskContinue.
+ */
+void TaskSleep(USBODETask *task, UInt32 micros)
+{
+    if (micros == 0) {
+        task->sleeping = false;
+        return;
+    }
+
+    task->sleeping = true;
+    task->wakeAt = USBODEMicroseconds() + micros;
+}
+
+/*
+ * Whether a task has been started and is not done
+ */
+Boolean TaskActive(const USBODETask *task)
+{
+    return task->queued;
+}
+
+/*
+ * Step runnable tasks until the slice is used or none can step
+ * Returns true while the queue still holds tasks, sleeping or not.
+ */
+Boolean TaskQueueRun(TaskQueue *queue)
+{
+    USBODETask *task;
+    UInt32 start;
+    UInt32 stepStart;
+    UInt32 now;
+    UInt32 elapsed;
+    Boolean stepped;
+    short result;
+
+    stepped = false;
+    start = USBODEMicroseconds();
+    now = start;
+
+    while ((task = NextRunnable(queue, now)) != nil) {
+        /* Out of the queue while it steps, so it can be stopped */
+        TaskUnlink(queue, task);
+
+        stepStart = now;
+        result = (*task->step)(task);
+        now = USBODEMicroseconds();
+
+        elapsed = now - stepStart;
+        task->steps++;
+        if (elapsed > task->longestStep) {
+            task->longestStep = elapsed;
+        }
+        queue->steps++;
+        stepped = true;
+
+        if (result == kTaskDone) {
+            task->queued = false;
+            task->sleeping = false;
+        } else if (task->queued) {
+            TaskLink(queue, task);
+        }
+
+        if ((UInt32)(now - start) >= queue->sliceMicros) {
+            break;
+        }
+    }
+
+    if (stepped) {
+        queue->runs++;
+        elapsed = now - start;
+        if (elapsed > queue->longestRun) {
+            queue->longestRun = elapsed;
+        }
+    }
+
+    return (queue->first != nil);
+}
+
+/*
+ * Microseconds until a task can step: 0 if one can now, kTaskNoWake
+ * if the queue is empty
+ */
+UInt32 TaskQueueWait(const TaskQueue *queue, UInt32 now)
+{
+    const USBODETask *task;
+    UInt32 wait;
+    SInt32 remaining;
+
+    wait = kTaskNoWake;
+    for (task = queue->first; task != nil; task = task->next) {
+        if (!task->sleeping) {
+            return 0;
+        }
+        remaining = (SInt32)(task->wakeAt - now);
+        if (remaining <= 0) {
+            return 0;
+        }
+        if ((UInt32)remaining < wait) {
+            wait = (UInt32)remaining;
+        }
+    }
+
+    return wait;
+}
@@ -0,0 +1,66 @@
+/*
+ * USBODE_Task.h
+ * Cooperative background work
+ *
+ * Long operations (discovery across the bus, a paged listing, a mount
+ * waiting for its image to load) run as tasks: a step function does one
+ * bounded piece of work, at most one SCSI transaction, keeps its place
+ * in the task's own state and returns.  The application steps its queue
+ * from null events, a time slice at a time, so the window, the menus
+ * and other applications keep running while a listing streams in.  A
+ * task that has to wait sleeps until a wake time instead of delaying,
+ * and TaskQueueWait tells WaitNextEvent how long it may sleep.
+ *
+ * Tasks are stepped round robin: one that continues goes to the back
+ * of the queue.  Portable, so the host build steps the same tasks
+ * against the emulator.
+ */
+
+#ifndef USBODE_TASK_H
+#define USBODE_TASK_H
+
+#include "USBODE_Port.h"
+
+#define kTaskSliceMicros    8000UL      /* stepping per null event */
+#define kTaskNoWake         0xFFFFFFFFUL
+
+/* What a step returns */
+enum {
+    kTaskContinue   = 0,    /* step again, after any TaskSleep */
+    kTaskDone       = 1     /* finished; the queue drops the task */
+};
+
+typedef struct USBODETask USBODETask;
+
+typedef short (*TaskStepProcPtr)(USBODETask *task);
+
+struct USBODETask {
+    TaskStepProcPtr step;
+    void            *refCon;
+    USBODETask      *next;          /* queue link */
+    Boolean         queued;         /* started and not yet done */
+    Boolean         sleeping;
+    UInt32          wakeAt;         /* USBODEMicroseconds, while sleeping */
+    unsigned long   steps;
+    UInt32          longestStep;    /* microseconds */
+};
+
+typedef struct {
+    USBODETask      *first;
+    USBODETask      *last;
+    UInt32          sliceMicros;
+    unsigned long   runs;           /* TaskQueueRun calls that stepped */
+    unsigned long   steps;
+    UInt32          longestRun;     /* microseconds, one TaskQueueRun */
+} TaskQueue;
+
+void InitTaskQueue(TaskQueue *queue, UInt32 sliceMicros);
+void TaskStart(TaskQueue *queue, USBODETask *task, TaskStepProcPtr step,
+               void *refCon);
+void TaskStop(TaskQueue *queue, USBODETask *task);
+void TaskSleep(USBODETask *task, UInt32 micros);
+Boolean TaskActive(const USBODETask *task);
+Boolean TaskQueueRun(TaskQueue *queue);
+UInt32 TaskQueueWait(const TaskQueue *queue, UInt32 now);
+
+#endif /* USBODE_TASK_H */
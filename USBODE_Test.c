@@ -0,0 +1,1758 @@
+/*
+ * USBODE_Test.c
+ * Host checks for the portable engines
+ *
+ * Runs the list geometry through the edge cases the window meets: the
+ * visible range, hit testing and scroll clamping at both ends of the
+ * list, and lists shorter than the area or empty.  Reads catalog
+ * snapshots back, whole and damaged.  Patches a catalog from the
+ * changes the software target reports and compares it with a fresh
+ * listing.  Sends a mount and its first poll as one batch, linked and
+ * not.  Decodes front-coded pages, from the software target and
+ * malformed, and lists pages through a transport without residuals.
+ * Converts names between UTF-8 and MacRoman.  Drives the mount
+ * scheduler on a made-up clock.  Steps the task queue: round robin
+ * order, time slices, sleeping and waking, and stopping tasks.
+ * Searches the type-ahead index, sorts the list orders and resolves
+ * names.  Sends MacRoman names through UTF-8 and back.  Prints each
+ * failed check and exits non-zero if there was one.
+ *
+ *   usbode-test                     (make test)
+ */
+
+#include "USBODE_ListLayout.h"
+#include "USBODE_Snapshot.h"
+#include "USBODE_Emulator.h"
+#include "USBODE_MountScheduler.h"
+#include "USBODE_Task.h"
+#include "USBODE_PrefixIndex.h"
+#include "USBODE_SortView.h"
+#include "USBODE_NameIndex.h"
+
+#ifdef USBODE_HOST
+
+#include <stdio.h>
+#include <string.h>
+
+#define kTestRowHeight      20
+#define kTestRows           12      /* 240 pixels of rows... */
+#define kTestAreaRows       5       /* ...in a 100-pixel area */
+
+#define kTestFileBytes      4096    /* a snapshot of a few entries */
+
+#define kTestSCSIID         3
+#define kTestImages         150     /* three pages, past kMaxDiscs */
+
+#define kTestStepMicros     2000UL  /* a slow step... */
+#define kTestSliceMicros    5000UL  /* ...so a slice holds two or three */
+#define kTestSleepMicros    20000UL
+#define kTestMaxLog         32
+
+#define kTestNameCount      8       /* kTestNames */
+
+#define Check(condition)    CheckResult((condition), #condition, __LINE__)
+
+/* A snapshot file in memory */
+typedef struct {
+    unsigned char   data[kTestFileBytes];
+    long            length;         /* bytes written */
+    long            offset;         /* next byte to read */
+} TestFile;
+
+/* A test task: steps until it has taken its share, logging each */
+typedef struct {
+    char            name;
+    short           stepsLeft;
+    UInt32          stepMicros;     /* busy time per step */
+    UInt32          sleepMicros;    /* TaskSleep after each step */
+} TestTask;
+
+static long gChecks;
+static long gFailures;
+static USBODEEmulator *gEmulator;
+static USBODEExecuteProcPtr gEmulatorExecute;
+static long gShortReplies;      /* replies shorter than their buffer */
+static char gLog[kTestMaxLog + 1];  /* task names, in step order */
+static short gLogLength;
+
+/* MacRoman names, in device order */
+static const char *const kTestNames[] = {
+    "System 7.5.3.iso",
+    "sys tools.img",
+    "Games.toast",
+    "\x83" "cran.img",                  /* E acute */
+    "ecran.iso",
+    "SYSTEM 7.1.iso",
+    "Apps.iso",
+    "Game Tools.img"
+};
+
+static void CheckResult(Boolean passed, const char *text, int line);
+static void SetTestPoint(Point *pt, short v, short h);
+static void InitTestLayout(ListLayout *layout, long rows);
+static void TestLayoutRange(void);
+static void TestLayoutHits(void);
+static void TestLayoutScroll(void);
+static void TestLayoutShort(void);
+static void AppendTestEntry(DiscCatalog *catalog, const char *name,
+                            unsigned long sizeKB);
+static Boolean TestNameIs(const DiscCatalog *catalog, long entry,
+                          const char *name);
+static OSErr TestFileWrite(void *refCon, const void *data, long length);
+static OSErr TestFileRead(void *refCon, void *data, long length);
+static OSErr ReadTestFile(TestFile *file, long length, DiscCatalog *catalog);
+static void TestSnapshotRoundTrip(void);
+static void TestSnapshotDamaged(void);
+static void StartTestEmulator(long images);
+static void StopTestEmulator(void);
+static void TestChangesSync(void);
+static void TestChangesResync(void);
+static void TestMountBatch(void);
+static void TestPackedListing(void);
+static void TestPackedDamaged(void);
+static OSErr TestExecuteNoResidual(USBODETransport *transport, short scsiID,
+                                   const unsigned char *cdb,
+                                   short cdbLength, void *buffer,
+                                   long bufferSize, long *actualSize);
+static void TestPagerNoResidual(void);
+static Boolean UTF8Converts(const char *utf8, const char *roman);
+static void TestUTF8ToRoman(void);
+static void TestUTF8Limits(void);
+static void TestMountDebounce(void);
+static void TestMountRedundant(void);
+static short TestStep(USBODETask *task);
+static void StartTestTask(TaskQueue *queue, USBODETask *task,
+                          TestTask *state, char name, short steps);
+static void TestTaskOrder(void);
+static void TestTaskSlice(void);
+static void TestTaskSleep(void);
+static void TestTaskStop(void);
+static void FillTestCatalog(DiscCatalog *catalog, long count);
+static long TestCompareFolded(const unsigned char *a, const unsigned char *b);
+static Boolean PrefixOrderSorted(const PrefixIndex *index,
+                                 const DiscCatalog *catalog);
+static Boolean PrefixOrdersEqual(const PrefixIndex *a, const PrefixIndex *b);
+static long FindTestPrefix(const PrefixIndex *index,
+                           const DiscCatalog *catalog, const char *prefix,
+                           PrefixRange *range);
+static void TestPrefixFind(void);
+static void TestPrefixSync(void);
+static Boolean SortOrderIs(const SortViews *views,
+                           const PrefixIndex *names, short order,
+                           Boolean descending, const long *expected);
+static void TestSortOrders(void);
+static void TestSortSync(void);
+static OSErr ResolveTestName(const NameIndex *index,
+                             const PrefixIndex *prefixes,
+                             const DiscCatalog *catalog, const char *text,
+                             long *entry);
+static void TestNameResolve(void);
+static void TestNameSync(void);
+static void TestRomanRoundTrip(void);
+
+/*
+ * Count a check, and report it if it failed
+ */
+static void CheckResult(Boolean passed, const char *text, int line)
+{
+    gChecks++;
+    if (!passed) {
+        gFailures++;
+        printf("USBODE_Test.c:%d: failed: %s\n", line, text);
+    }
+}
+
+static void SetTestPoint(Point *pt, short v, short h)
+{
+    pt->v = v;
+    pt->h = h;
+}
+
+/*
+ * A list of kTestRows rows in an area kTestAreaRows rows high, at
+ * window coordinates (10, 0)-(110, 200)
+ */
+static void InitTestLayout(ListLayout *layout, long rows)
+{
+    Rect bounds;
+
+    bounds.top = 10;
+    bounds.left = 0;
+    bounds.bottom = 10 + kTestAreaRows * kTestRowHeight;
+    bounds.right = 200;
+
+    InitListLayout(layout, &bounds, kTestRowHeight);
+    ListLayoutSetRowCount(layout, rows);
+}
+
+/*
+ * Visible range at the top, part way and at the bottom of the list
+ */
+static void TestLayoutRange(void)
+{
+    ListLayout layout;
+    long first;
+    long last;
+
+    InitTestLayout(&layout, kTestRows);
+    Check(ListLayoutMaxScroll(&layout) ==
+          (kTestRows - kTestAreaRows) * kTestRowHeight);
+    Check(ListLayoutPageRows(&layout) == kTestAreaRows);
+
+    ListLayoutVisibleRange(&layout, &first, &last);
+    Check(first == 0 && last == kTestAreaRows);
+
+    /* Half a row scrolled: the first row is partly hidden, one more
+       shows at the bottom */
+    (void)ListLayoutScrollTo(&layout, kTestRowHeight / 2);
+    ListLayoutVisibleRange(&layout, &first, &last);
+    Check(first == 0 && last == kTestAreaRows + 1);
+
+    (void)ListLayoutScrollTo(&layout, ListLayoutMaxScroll(&layout));
+    ListLayoutVisibleRange(&layout, &first, &last);
+    Check(first == kTestRows - kTestAreaRows && last == kTestRows);
+}
+
+/*
+ * Rows under points at the area's edges, scrolled and not
+ */
+static void TestLayoutHits(void)
+{
+    ListLayout layout;
+    Point pt;
+    Rect rect;
+
+    InitTestLayout(&layout, kTestRows);
+
+    SetTestPoint(&pt, 10, 0);
+    Check(ListLayoutRowAtPoint(&layout, pt) == 0);
+    SetTestPoint(&pt, 29, 199);
+    Check(ListLayoutRowAtPoint(&layout, pt) == 0);
+    SetTestPoint(&pt, 30, 100);
+    Check(ListLayoutRowAtPoint(&layout, pt) == 1);
+    SetTestPoint(&pt, 109, 100);
+    Check(ListLayoutRowAtPoint(&layout, pt) == kTestAreaRows - 1);
+
+    /* Outside the area, on any side */
+    SetTestPoint(&pt, 9, 100);
+    Check(ListLayoutRowAtPoint(&layout, pt) == -1);
+    SetTestPoint(&pt, 110, 100);
+    Check(ListLayoutRowAtPoint(&layout, pt) == -1);
+    SetTestPoint(&pt, 50, -1);
+    Check(ListLayoutRowAtPoint(&layout, pt) == -1);
+    SetTestPoint(&pt, 50, 200);
+    Check(ListLayoutRowAtPoint(&layout, pt) == -1);
+
+    /* Scrolled to the end, the bottom pixel is on the last row */
+    (void)ListLayoutScrollTo(&layout, ListLayoutMaxScroll(&layout));
+    SetTestPoint(&pt, 109, 100);
+    Check(ListLayoutRowAtPoint(&layout, pt) == kTestRows - 1);
+    SetTestPoint(&pt, 10, 100);
+    Check(ListLayoutRowAtPoint(&layout, pt) == kTestRows - kTestAreaRows);
+
+    /* A partly hidden row is clipped to the area */
+    (void)ListLayoutScrollTo(&layout, kTestRowHeight / 2);
+    Check(ListLayoutRowRect(&layout, 0, &rect));
+    Check(rect.top == 10 && rect.bottom == 10 + kTestRowHeight / 2);
+    Check(ListLayoutRowRect(&layout, kTestAreaRows, &rect));
+    Check(rect.top == 10 + kTestAreaRows * kTestRowHeight -
+                      kTestRowHeight / 2 && rect.bottom == 110);
+    Check(!ListLayoutRowRect(&layout, kTestAreaRows + 1, &rect));
+    Check(!ListLayoutRowRect(&layout, -1, &rect));
+    Check(!ListLayoutRowRect(&layout, kTestRows, &rect));
+}
+
+/*
+ * Scrolling is clamped to the list, and reports the distance moved
+ */
+static void TestLayoutScroll(void)
+{
+    ListLayout layout;
+    long maxScroll;
+
+    InitTestLayout(&layout, kTestRows);
+    maxScroll = ListLayoutMaxScroll(&layout);
+
+    Check(ListLayoutScrollTo(&layout, -50) == 0);
+    Check(layout.scrollOffset == 0);
+    Check(ListLayoutScrollTo(&layout, maxScroll + 1000) == maxScroll);
+    Check(layout.scrollOffset == maxScroll);
+    Check(ListLayoutScrollTo(&layout, maxScroll + 1) == 0);
+    Check(ListLayoutScrollToRow(&layout, kTestRows - 1) == 0);
+    Check(ListLayoutScrollToRow(&layout, 0) == -maxScroll);
+
+    /* Ensuring a row is visible scrolls the least distance */
+    Check(ListLayoutEnsureVisible(&layout, kTestAreaRows - 1) == 0);
+    Check(ListLayoutEnsureVisible(&layout, kTestAreaRows) == kTestRowHeight);
+    Check(ListLayoutEnsureVisible(&layout, 0) == -kTestRowHeight);
+    Check(ListLayoutEnsureVisible(&layout, kTestRows - 1) == maxScroll);
+    Check(ListLayoutEnsureVisible(&layout, kTestRows) == 0);
+    Check(ListLayoutEnsureVisible(&layout, -1) == 0);
+
+    /* Rows going away, or the area growing, pull the offset back */
+    ListLayoutSetRowCount(&layout, kTestRows - 2);
+    Check(layout.scrollOffset == maxScroll - 2 * kTestRowHeight);
+    ListLayoutSetRowCount(&layout, 2);
+    Check(layout.scrollOffset == 0);
+}
+
+/*
+ * Lists that do not fill the area, and the empty list
+ */
+static void TestLayoutShort(void)
+{
+    ListLayout layout;
+    Point pt;
+    Rect rect;
+    long first;
+    long last;
+
+    InitTestLayout(&layout, 3);
+    Check(ListLayoutMaxScroll(&layout) == 0);
+    Check(ListLayoutScrollTo(&layout, 100) == 0);
+    ListLayoutVisibleRange(&layout, &first, &last);
+    Check(first == 0 && last == 3);
+    SetTestPoint(&pt, 10 + 3 * kTestRowHeight - 1, 100);
+    Check(ListLayoutRowAtPoint(&layout, pt) == 2);
+    SetTestPoint(&pt, 10 + 3 * kTestRowHeight, 100);
+    Check(ListLayoutRowAtPoint(&layout, pt) == -1);
+
+    InitTestLayout(&layout, 0);
+    ListLayoutVisibleRange(&layout, &first, &last);
+    Check(first == 0 && last == 0);
+    SetTestPoint(&pt, 10, 100);
+    Check(ListLayoutRowAtPoint(&layout, pt) == -1);
+    Check(!ListLayoutRowRect(&layout, 0, &rect));
+    Check(ListLayoutEnsureVisible(&layout, 0) == 0);
+}
+
+/*
+ * Append an entry as a listing would: the next device index, type 1,
+ * a MacRoman name of up to 32 bytes and a size in KB
+ */
+static void AppendTestEntry(DiscCatalog *catalog, const char *name,
+                            unsigned long sizeKB)
+{
+    DiscEntry disc;
+    short i;
+
+    disc.index = (unsigned char)catalog->count;
+    disc.type = 1;
+    for (i = 0; i <= kWireNameLength; i++) {
+        disc.name[i] = 0;
+    }
+    for (i = 0; i < kWireNameLength && name[i] != '\0'; i++) {
+        disc.name[i] = (unsigned char)name[i];
+    }
+    disc.size[0] = (unsigned char)(sizeKB >> 22);
+    disc.size[1] = (unsigned char)(sizeKB >> 14);
+    disc.size[2] = (unsigned char)(sizeKB >> 6);
+    disc.size[3] = (unsigned char)(sizeKB << 2);
+    disc.size[4] = 0;
+
+    Check(CatalogAppend(catalog, &disc, (unsigned short)catalog->count) ==
+          noErr);
+}
+
+static Boolean TestNameIs(const DiscCatalog *catalog, long entry,
+                          const char *name)
+{
+    Str255 stored;
+
+    CatalogGetName(catalog, entry, stored);
+    return stored[0] == strlen(name) &&
+           memcmp(&stored[1], name, stored[0]) == 0;
+}
+
+static OSErr TestFileWrite(void *refCon, const void *data, long length)
+{
+    TestFile *file;
+
+    file = (TestFile *)refCon;
+    if (file->length + length > kTestFileBytes) {
+        return ioErr;
+    }
+    BlockMoveData(data, file->data + file->length, length);
+    file->length += length;
+    return noErr;
+}
+
+static OSErr TestFileRead(void *refCon, void *data, long length)
+{
+    TestFile *file;
+
+    file = (TestFile *)refCon;
+    if (file->offset + length > file->length) {
+        return eofErr;
+    }
+    BlockMoveData(file->data + file->offset, data, length);
+    file->offset += length;
+    return noErr;
+}
+
+/*
+ * Read the first length bytes of a snapshot into a catalog that
+ * already holds an entry, so a rejected one has to empty it
+ */
+static OSErr ReadTestFile(TestFile *file, long length, DiscCatalog *catalog)
+{
+    TestFile copy;
+    SnapshotInfo info;
+
+    BlockMoveData(file->data, copy.data, length);
+    copy.length = length;
+    copy.offset = 0;
+
+    CatalogClear(catalog);
+    AppendTestEntry(catalog, "Stale.iso", 1);
+    return ReadCatalogSnapshot(catalog, &info, TestFileRead, &copy);
+}
+
+/*
+ * A snapshot reads back as the catalog it was written from, with the
+ * header it was written with
+ */
+static void TestSnapshotRoundTrip(void)
+{
+    DiscCatalog catalog;
+    DiscCatalog loaded;
+    SnapshotInfo info;
+    TestFile file;
+    UInt32 generation;
+
+    Check(InitDiscCatalog(&catalog) == noErr);
+    Check(InitDiscCatalog(&loaded) == noErr);
+    AppendTestEntry(&catalog, "System 7.5.3.iso", 23000);
+    AppendTestEntry(&catalog, "", 0);
+    AppendTestEntry(&catalog, "Exactly thirty-two bytes of name", 665600UL);
+    AppendTestEntry(&catalog, "Caf\x8E.toast", 4194303UL);
+
+    generation = 0x12345678UL;
+    file.length = 0;
+    file.offset = 0;
+    Check(WriteCatalogSnapshot(&catalog, 3, &generation, TestFileWrite,
+                               &file) == noErr);
+    Check(file.length == kSnapshotHeaderSize + catalog.poolSize +
+                         catalog.count * kSnapshotEntrySize);
+
+    Check(ReadCatalogSnapshot(&loaded, &info, TestFileRead, &file) == noErr);
+    Check(loaded.count == catalog.count);
+    Check(CatalogHash(&loaded) == CatalogHash(&catalog));
+    Check(TestNameIs(&loaded, 2, "Exactly thirty-two bytes of name"));
+    Check(CatalogSize(&loaded, 3) == 4194303UL);
+    Check(CatalogIndex(&loaded, 3) == 3);
+    Check(info.scsiID == 3 && info.count == catalog.count);
+    Check(info.hash == CatalogHash(&catalog));
+    Check(info.hasGeneration && info.generation == generation);
+
+    /* No generation, no SCSI ID, no entries */
+    CatalogClear(&catalog);
+    file.length = 0;
+    file.offset = 0;
+    Check(WriteCatalogSnapshot(&catalog, -1, nil, TestFileWrite,
+                               &file) == noErr);
+    Check(file.length == kSnapshotHeaderSize);
+    Check(ReadCatalogSnapshot(&loaded, &info, TestFileRead, &file) == noErr);
+    Check(loaded.count == 0 && info.count == 0);
+    Check(info.scsiID == -1 && !info.hasGeneration);
+
+    DisposeDiscCatalog(&loaded);
+    DisposeDiscCatalog(&catalog);
+}
+
+/*
+ * Snapshots cut short or damaged anywhere are rejected and leave the
+ * catalog empty
+ */
+static void TestSnapshotDamaged(void)
+{
+    DiscCatalog catalog;
+    DiscCatalog loaded;
+    TestFile file;
+    unsigned char *hash;
+    long pool;
+
+    Check(InitDiscCatalog(&catalog) == noErr);
+    Check(InitDiscCatalog(&loaded) == noErr);
+    AppendTestEntry(&catalog, "AB", 1);
+    AppendTestEntry(&catalog, "C", 2);
+    AppendTestEntry(&catalog, "D", 3);
+    file.length = 0;
+    file.offset = 0;
+    Check(WriteCatalogSnapshot(&catalog, 0, nil, TestFileWrite,
+                               &file) == noErr);
+    pool = file.length - catalog.poolSize;
+    hash = file.data + 16;
+
+    Check(ReadTestFile(&file, file.length, &loaded) == noErr);
+    Check(loaded.count == 3);
+
+    /* Truncated in the header, the entries and the name pool */
+    Check(ReadTestFile(&file, kSnapshotHeaderSize - 1, &loaded) == eofErr);
+    Check(loaded.count == 0);
+    Check(ReadTestFile(&file, kSnapshotHeaderSize + kSnapshotEntrySize,
+                       &loaded) == eofErr);
+    Check(loaded.count == 0);
+    Check(ReadTestFile(&file, file.length - 1, &loaded) == eofErr);
+    Check(loaded.count == 0);
+
+    /* Not a snapshot, or not this version */
+    file.data[0] ^= 0xFF;
+    Check(ReadTestFile(&file, file.length, &loaded) == paramErr);
+    Check(loaded.count == 0);
+    file.data[0] ^= 0xFF;
+    file.data[5]++;
+    Check(ReadTestFile(&file, file.length, &loaded) == paramErr);
+    Check(loaded.count == 0);
+    file.data[5]--;
+
+    /* A name changed after the hash was taken */
+    file.data[pool + 1] = 'a';
+    Check(ReadTestFile(&file, file.length, &loaded) == paramErr);
+    Check(loaded.count == 0);
+    file.data[pool + 1] = 'A';
+
+    /* A pool of two names for three entries, though the hash (which
+       covers the pool's bytes) matches it */
+    file.data[pool] = 4;
+    CatalogNamePool(&catalog)[0] = 4;
+    hash[0] = (unsigned char)(CatalogHash(&catalog) >> 24);
+    hash[1] = (unsigned char)(CatalogHash(&catalog) >> 16);
+    hash[2] = (unsigned char)(CatalogHash(&catalog) >> 8);
+    hash[3] = (unsigned char)CatalogHash(&catalog);
+    Check(ReadTestFile(&file, file.length, &loaded) == paramErr);
+    Check(loaded.count == 0);
+
+    DisposeDiscCatalog(&loaded);
+    DisposeDiscCatalog(&catalog);
+}
+
+/*
+ * Attach a software target, on the model's time only, holding images
+ * named and sized like a real collection
+ */
+static void StartTestEmulator(long images)
+{
+    char name[kEmulatorMaxNameLength + 1];
+    long i;
+
+    gEmulator = NewUSBODEEmulator(kTestSCSIID);
+    gEmulator->timing.realTime = false;
+    SetUSBODETransport(NewEmulatorTransport(gEmulator));
+
+    for (i = 0; i < images; i++) {
+        sprintf(name, "Disc %03ld - %s.iso", i,
+                (i % 3 == 0) ? "Games" : (i % 3 == 1) ? "Apps" : "System");
+        Check(EmulatorAddImage(gEmulator, name, i * 700001UL + 1) == noErr);
+    }
+}
+
+static void StopTestEmulator(void)
+{
+    DisposeUSBODETransport(GetUSBODETransport());
+    DisposeUSBODEEmulator(gEmulator);
+    gEmulator = nil;
+}
+
+/*
+ * Images replaced, removed and added: the catalog patched from CATALOG
+ * CHANGES equals a fresh listing
+ */
+static void TestChangesSync(void)
+{
+    DiscCatalog current;
+    DiscCatalog patched;
+    DiscCatalog listed;
+    CatalogChanges changes;
+    UInt32 generation;
+
+    StartTestEmulator(kTestImages);
+    Check(InitDiscCatalog(&current) == noErr);
+    Check(InitDiscCatalog(&patched) == noErr);
+    Check(InitDiscCatalog(&listed) == noErr);
+
+    Check(GetCatalogGeneration(kTestSCSIID, &generation) == noErr);
+    Check(CatalogListPaged(&current, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatFixed) == noErr);
+    Check(current.count == kTestImages);
+
+    Check(EmulatorReplaceImage(gEmulator, 10, "Replaced.iso", 1234) == noErr);
+    Check(EmulatorRemoveImage(gEmulator, 100) == noErr);
+    Check(EmulatorAddImage(gEmulator, "Added 1.iso", 1) == noErr);
+    Check(EmulatorReplaceImage(gEmulator, 120, "Replaced too.iso", 5) ==
+          noErr);
+    Check(EmulatorAddImage(gEmulator, "Added 2.iso", 2) == noErr);
+
+    Check(GetCatalogChanges(kTestSCSIID, generation, &changes) == noErr);
+    Check(!changes.resync && changes.total == kTestImages + 1);
+    Check(changes.rangeCount > 0);
+    Check(CatalogApplyChanges(&patched, &current, &changes, kTestSCSIID,
+                              kDefaultPageEntries, kListFormatFixed) == noErr);
+    Check(CatalogListPaged(&listed, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatFixed) == noErr);
+    Check(patched.count == listed.count);
+    Check(CatalogHash(&patched) == CatalogHash(&listed));
+    Check(CatalogComplete(&patched, changes.total));
+    Check(TestNameIs(&patched, 10, "Replaced.iso"));
+    Check(TestNameIs(&patched, kTestImages, "Added 2.iso"));
+
+    /* The first image goes; every entry moves down */
+    generation = changes.generation;
+    CatalogSwap(&current, &patched);
+    Check(EmulatorRemoveImage(gEmulator, 0) == noErr);
+    Check(GetCatalogChanges(kTestSCSIID, generation, &changes) == noErr);
+    Check(CatalogApplyChanges(&patched, &current, &changes, kTestSCSIID,
+                              kDefaultPageEntries, kListFormatFixed) == noErr);
+    Check(CatalogListPaged(&listed, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatFixed) == noErr);
+    Check(CatalogHash(&patched) == CatalogHash(&listed));
+    Check(CatalogComplete(&patched, kTestImages));
+
+    /* Nothing since: no ranges, and the same catalog again */
+    generation = changes.generation;
+    CatalogSwap(&current, &patched);
+    Check(GetCatalogChanges(kTestSCSIID, generation, &changes) == noErr);
+    Check(changes.rangeCount == 0 && changes.generation == generation);
+    Check(CatalogApplyChanges(&patched, &current, &changes, kTestSCSIID,
+                              kDefaultPageEntries, kListFormatFixed) == noErr);
+    Check(CatalogHash(&patched) == CatalogHash(&current));
+
+    DisposeDiscCatalog(&listed);
+    DisposeDiscCatalog(&patched);
+    DisposeDiscCatalog(&current);
+    StopTestEmulator();
+}
+
+/*
+ * A host further behind than the device's history is told to list
+ * everything again, and the patch is refused
+ */
+static void TestChangesResync(void)
+{
+    DiscCatalog current;
+    DiscCatalog patched;
+    CatalogChanges changes;
+    UInt32 generation;
+    long i;
+
+    StartTestEmulator(kTestImages);
+    Check(InitDiscCatalog(&current) == noErr);
+    Check(InitDiscCatalog(&patched) == noErr);
+
+    Check(GetCatalogGeneration(kTestSCSIID, &generation) == noErr);
+    Check(CatalogListPaged(&current, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatFixed) == noErr);
+    for (i = 0; i <= kEmulatorChangeLog; i++) {
+        Check(EmulatorReplaceImage(gEmulator, i, "Churn.iso", i) == noErr);
+    }
+
+    Check(GetCatalogChanges(kTestSCSIID, generation, &changes) == noErr);
+    Check(changes.resync);
+    Check(CatalogApplyChanges(&patched, &current, &changes, kTestSCSIID,
+                              kDefaultPageEntries, kListFormatFixed) ==
+          paramErr);
+
+    /* A generation the device never had is as good as too old */
+    Check(GetCatalogChanges(kTestSCSIID, changes.generation + 1000,
+                            &changes) == noErr);
+    Check(changes.resync);
+
+    Check(CatalogListPaged(&current, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatFixed) == noErr);
+    Check(CatalogComplete(&current, kTestImages));
+    Check(TestNameIs(&current, kEmulatorChangeLog, "Churn.iso"));
+
+    DisposeDiscCatalog(&patched);
+    DisposeDiscCatalog(&current);
+    StopTestEmulator();
+}
+
+/*
+ * SET NEXT CD and its first poll go out as one batch: under a single
+ * selection when the target links commands, one at a time when it does
+ * not or the transport cannot batch
+ */
+static void TestMountBatch(void)
+{
+    USBODETransport *transport;
+    USBODEExecuteBatchProcPtr executeBatch;
+    USBODEBatch batch;
+    MountReadiness readiness;
+    SenseData sense;
+    unsigned long selections;
+    OSErr readyErr;
+
+    StartTestEmulator(kTestImages);
+    transport = GetUSBODETransport();
+
+    /* Linked: only the sense for the unit attention selects again */
+    gEmulator->linkedCommands = true;
+    selections = gEmulator->stats.selections;
+    Check(SetActiveDiscAndTest(kTestSCSIID, 120, &readyErr, &sense) ==
+          noErr);
+    Check(readyErr == scsiNonZeroStatus);
+    Check(sense.key == kSenseKeyUnitAttention);
+    Check(gEmulator->currentIndex == 120);
+    Check(gEmulator->stats.selections - selections == 2);
+
+    /* Not linked, and no batch entry at all: a selection each */
+    gEmulator->linkedCommands = false;
+    selections = gEmulator->stats.selections;
+    Check(SetActiveDiscAndTest(kTestSCSIID, 5, &readyErr, &sense) == noErr);
+    Check(readyErr == scsiNonZeroStatus && gEmulator->currentIndex == 5);
+    Check(gEmulator->stats.selections - selections == 3);
+
+    executeBatch = transport->executeBatch;
+    transport->executeBatch = nil;
+    gEmulator->linkedCommands = true;
+    selections = gEmulator->stats.selections;
+    Check(SetActiveDiscAndTest(kTestSCSIID, 7, &readyErr, &sense) == noErr);
+    Check(readyErr == scsiNonZeroStatus && gEmulator->currentIndex == 7);
+    Check(gEmulator->stats.selections - selections == 3);
+    transport->executeBatch = executeBatch;
+
+    /* A failure aborts the rest of the batch */
+    Check(SetActiveDisc(kTestSCSIID, 9) == noErr);
+    BatchReset(&batch);
+    Check(BatchAddCommand(&batch, SCSI_CMD_TEST_UNIT_READY, 0, nil, 0) !=
+          nil);
+    Check(BatchAddCommand(&batch, SCSI_CMD_NUM_CDS, 0, nil, 0) != nil);
+    Check(ExecuteBatch(kTestSCSIID, &batch) == scsiNonZeroStatus);
+    Check(batch.commands[1].result == scsiRequestAborted);
+    Check((batch.commands[0].cdb[kUSBODECDBLength - 1] & kControlLink) != 0);
+    Check((batch.commands[1].cdb[kUSBODECDBLength - 1] & kControlLink) == 0);
+
+    /* The waiter's first step is the batch */
+    Check(MountAndWait(kTestSCSIID, 3, 0, &readiness) == noErr);
+    Check(readiness.polls == 2 && readiness.unitAttentions == 1);
+    Check(gEmulator->currentIndex == 3);
+
+    StopTestEmulator();
+}
+
+/*
+ * Packed pages from the software target decode to the catalog the
+ * fixed format lists, across page boundaries
+ */
+static void TestPackedListing(void)
+{
+    DiscCatalog fixed;
+    DiscCatalog packed;
+
+    StartTestEmulator(kTestImages);
+    Check(InitDiscCatalog(&fixed) == noErr);
+    Check(InitDiscCatalog(&packed) == noErr);
+
+    Check(CatalogListPaged(&fixed, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatFixed) == noErr);
+    Check(CatalogListPaged(&packed, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatFrontCoded) == noErr);
+    Check(packed.count == kTestImages);
+    Check(CatalogHash(&packed) == CatalogHash(&fixed));
+
+    Check(CatalogListPaged(&packed, kTestSCSIID, 7,
+                           kListFormatFrontCoded) == noErr);
+    Check(CatalogHash(&packed) == CatalogHash(&fixed));
+
+    /* Long names, plain and front-coded */
+    Check(CatalogListPaged(&packed, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatLongNames) == noErr);
+    Check(CatalogHash(&packed) == CatalogHash(&fixed));
+    Check(CatalogListPaged(&packed, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatLongNames |
+                           kListFormatFrontCoded) == noErr);
+    Check(CatalogHash(&packed) == CatalogHash(&fixed));
+
+    DisposeDiscCatalog(&packed);
+    DisposeDiscCatalog(&fixed);
+    StopTestEmulator();
+}
+
+/*
+ * Pages that end early or do not add up are refused, and the catalog
+ * keeps the entries it had
+ */
+static void TestPackedDamaged(void)
+{
+    static const unsigned char page[] = {
+        0, 3, 'a', 'b', 'c', 1, 0x05,       /* "abc", 5 KB */
+        2, 1, 'd', 2, 0x81, 0x01            /* "abd", 129 KB */
+    };
+    static const unsigned char wide[] = {
+        0, 1, 'x', 1, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01
+    };
+    unsigned char bad[sizeof(page)];
+    DiscCatalog catalog;
+    UInt32 hash;
+
+    Check(InitDiscCatalog(&catalog) == noErr);
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, page,
+                              sizeof(page), 2, 0) == noErr);
+    Check(catalog.count == 2);
+    Check(TestNameIs(&catalog, 0, "abc") && CatalogSize(&catalog, 0) == 5);
+    Check(TestNameIs(&catalog, 1, "abd") && CatalogSize(&catalog, 1) == 129);
+    Check(CatalogIndex(&catalog, 1) == 1 && CatalogType(&catalog, 1) == 2);
+    hash = CatalogHash(&catalog);
+
+    /* An empty page adds nothing; entries need bytes */
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, page, 0, 0,
+                              2) == noErr);
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, page, 0, 1,
+                              2) == scPhaseErr);
+
+    /* Cut inside the last size, or one entry more than was sent */
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, page,
+                              sizeof(page) - 1, 2, 2) == scPhaseErr);
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, page,
+                              sizeof(page), 3, 2) == scPhaseErr);
+
+    /* A size past 32 bits never ends */
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, wide,
+                              sizeof(wide), 1, 2) == scPhaseErr);
+
+    /* Sharing more than the previous name has, or anything at all with
+       the first entry of a page */
+    BlockMoveData(page, bad, sizeof(page));
+    bad[7] = 4;
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, bad,
+                              sizeof(bad), 2, 2) == scPhaseErr);
+    BlockMoveData(page, bad, sizeof(page));
+    bad[0] = 1;
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, bad,
+                              sizeof(bad), 1, 2) == scPhaseErr);
+
+    /* A name running past the end of the page, or past 32 bytes */
+    BlockMoveData(page, bad, sizeof(page));
+    bad[8] = 20;
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, bad,
+                              sizeof(bad), 2, 2) == scPhaseErr);
+    bad[8] = kWireNameLength;
+    Check(CatalogAppendPacked(&catalog, kListFormatFrontCoded, bad,
+                              sizeof(bad), 2, 2) == scPhaseErr);
+
+    Check(catalog.count == 2 && CatalogHash(&catalog) == hash);
+
+    DisposeDiscCatalog(&catalog);
+}
+
+/*
+ * The emulator behind a transport like the SCSI Manager's: a short
+ * reply succeeds but reads as the whole buffer
+ */
+static OSErr TestExecuteNoResidual(USBODETransport *transport, short scsiID,
+                                   const unsigned char *cdb,
+                                   short cdbLength, void *buffer,
+                                   long bufferSize, long *actualSize)
+{
+    OSErr err;
+
+    err = (*gEmulatorExecute)(transport, scsiID, cdb, cdbLength,
+                              buffer, bufferSize, actualSize);
+    if (err == noErr && buffer != nil) {
+        if (*actualSize < bufferSize) {
+            gShortReplies++;
+        }
+        *actualSize = bufferSize;
+    }
+
+    return err;
+}
+
+/*
+ * Without residuals, paged listings and delta fetches ask for exactly
+ * what is left, so only a first page longer than the catalog comes up
+ * short; the packed formats are refused
+ */
+static void TestPagerNoResidual(void)
+{
+    USBODETransport *transport;
+    DiscCatalog listed;
+    DiscCatalog paged;
+    DiscCatalog patched;
+    CatalogChanges changes;
+    UInt32 generation;
+
+    StartTestEmulator(kTestImages);
+    Check(InitDiscCatalog(&listed) == noErr);
+    Check(InitDiscCatalog(&paged) == noErr);
+    Check(InitDiscCatalog(&patched) == noErr);
+    Check(CatalogListPaged(&listed, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatFixed) == noErr);
+
+    transport = GetUSBODETransport();
+    gEmulatorExecute = transport->execute;
+    transport->execute = TestExecuteNoResidual;
+    transport->reportsResidual = false;
+
+    gShortReplies = 0;
+    Check(CatalogListPaged(&paged, kTestSCSIID, 7, kListFormatFixed) ==
+          noErr);
+    Check(gShortReplies == 0);
+    Check(CatalogHash(&paged) == CatalogHash(&listed));
+    Check(CatalogComplete(&paged, kTestImages));
+
+    Check(CatalogListPaged(&paged, kTestSCSIID, kTestImages + 50,
+                           kListFormatFixed) == noErr);
+    Check(gShortReplies == 1);
+    Check(CatalogHash(&paged) == CatalogHash(&listed));
+
+    Check(CatalogListPaged(&paged, kTestSCSIID, 7,
+                           kListFormatFrontCoded) == paramErr);
+    Check(CatalogListPaged(&paged, kTestSCSIID, 7,
+                           kListFormatLongNames) == paramErr);
+
+    /* A delta fetch of a few entries from the middle */
+    Check(GetCatalogGeneration(kTestSCSIID, &generation) == noErr);
+    Check(EmulatorReplaceImage(gEmulator, 40, "Replaced.iso", 1234) ==
+          noErr);
+    Check(EmulatorReplaceImage(gEmulator, 41, "Replaced too.iso", 5) ==
+          noErr);
+    Check(GetCatalogChanges(kTestSCSIID, generation, &changes) == noErr);
+    gShortReplies = 0;
+    Check(CatalogApplyChanges(&patched, &listed, &changes, kTestSCSIID, 7,
+                              kListFormatFixed) == noErr);
+    Check(gShortReplies == 0);
+    Check(TestNameIs(&patched, 41, "Replaced too.iso"));
+
+    transport->execute = gEmulatorExecute;
+    transport->reportsResidual = true;
+    Check(CatalogListPaged(&listed, kTestSCSIID, kDefaultPageEntries,
+                           kListFormatFixed) == noErr);
+    Check(CatalogHash(&patched) == CatalogHash(&listed));
+
+    DisposeDiscCatalog(&patched);
+    DisposeDiscCatalog(&paged);
+    DisposeDiscCatalog(&listed);
+    StopTestEmulator();
+}
+
+/*
+ * Whether a UTF-8 name converts to the MacRoman one
+ */
+static Boolean UTF8Converts(const char *utf8, const char *roman)
+{
+    unsigned char out[kLongNameLength];
+    short length;
+
+    length = UTF8ToMacRoman((const unsigned char *)utf8, (short)strlen(utf8),
+                            out);
+    return length == (short)strlen(roman) && memcmp(out, roman, length) == 0;
+}
+
+/*
+ * Characters MacRoman has, lacks, and bytes that are not UTF-8
+ */
+static void TestUTF8ToRoman(void)
+{
+    Check(UTF8Converts("System 7.5.3.iso", "System 7.5.3.iso"));
+    Check(UTF8Converts("Caf\xC3\xA9", "Caf\x8E"));
+    Check(UTF8Converts("Cafe\xCC\x81", "Cafe"));
+    Check(UTF8Converts("\xE2\x84\xA2\xE2\x82\xAC", "\xAA\xDB"));
+    Check(UTF8Converts("\xEF\xA3\xBF", "\xF0"));
+
+    /* No MacRoman equivalent */
+    Check(UTF8Converts("\xE4\xB8\xAD.iso", "?.iso"));
+    Check(UTF8Converts("\xF0\x9F\x92\xBF", "?"));
+    Check(UTF8Converts("\xC4\x80", "?"));
+
+    /* Stray continuations, bad leads, sequences cut short */
+    Check(UTF8Converts("a\x80" "b", "a?b"));
+    Check(UTF8Converts("\xFF\xFE", "??"));
+    Check(UTF8Converts("\xC3" "A", "?A"));
+    Check(UTF8Converts("\xE2\x84" "A", "?A"));
+    Check(UTF8Converts("x\xF0\x9F\x92", "x?"));
+
+    /* Overlong forms are refused, even of a combining accent */
+    Check(UTF8Converts("\xC0\xAF", "?"));
+    Check(UTF8Converts("\xC1\xA9", "?"));
+    Check(UTF8Converts("\xE0\x83\xA9", "?"));
+    Check(UTF8Converts("\xE0\x8C\x81", "?"));
+    Check(UTF8Converts("\xF0\x80\x80\xAF", "?"));
+
+    /* Surrogates and code points past U+10FFFF */
+    Check(UTF8Converts("\xED\xA0\x80", "?"));
+    Check(UTF8Converts("\xF4\x90\x80\x80", "?"));
+}
+
+/*
+ * A character cut by the 32-byte fixed field or the 255-byte long name
+ * becomes one '?', and a full long name still fits a Str255
+ */
+static void TestUTF8Limits(void)
+{
+    unsigned char utf8[kLongNameLength + 1];
+    unsigned char roman[kLongNameLength + 1];
+    short i;
+
+    for (i = 0; i < 30; i++) {
+        utf8[i] = 'a';
+    }
+    utf8[30] = 0xC3;
+    utf8[31] = 0xA9;
+    Check(UTF8ToMacRoman(utf8, kWireNameLength - 1, roman) == 31);
+    Check(roman[29] == 'a' && roman[30] == '?');
+    Check(UTF8ToMacRoman(utf8, kWireNameLength, roman) == 31);
+    Check(roman[30] == 0x8E);
+
+    for (i = 0; i < kLongNameLength; i++) {
+        utf8[i] = 'a';
+    }
+    Check(UTF8ToMacRoman(utf8, kLongNameLength, roman) == kLongNameLength);
+
+    utf8[253] = 0xE2;
+    utf8[254] = 0x84;
+    utf8[255] = 0xA2;
+    Check(UTF8ToMacRoman(utf8, kLongNameLength, roman) == 254);
+    Check(roman[252] == 'a' && roman[253] == '?');
+    Check(UTF8ToMacRoman(utf8, kLongNameLength + 1, roman) == 254);
+    Check(roman[253] == 0xAA);
+}
+
+/*
+ * A mount waits out the quiet period from the latest request, and the
+ * last disc asked for is the one sent
+ */
+static void TestMountDebounce(void)
+{
+    MountScheduler scheduler;
+    unsigned short index;
+    UInt32 start;
+
+    InitMountScheduler(&scheduler, kMountDebounceMicros);
+    Check(MountSchedulerWait(&scheduler, 0) == 0);
+    Check(!MountSchedulerDue(&scheduler, kNoCurrentDisc, 0, &index));
+
+    /* Near the end of the clock's range, so the wait crosses its wrap */
+    start = 0xFFFFFFFFUL - kMountDebounceMicros / 2;
+    MountSchedulerRequest(&scheduler, 5, kNoCurrentDisc, start);
+    Check(MountSchedulerWait(&scheduler, start) == kMountDebounceMicros);
+    Check(MountSchedulerWait(&scheduler, start + 1000) ==
+          kMountDebounceMicros - 1000);
+    Check(!MountSchedulerDue(&scheduler, kNoCurrentDisc,
+                             start + kMountDebounceMicros - 1, &index));
+    Check(MountSchedulerDue(&scheduler, kNoCurrentDisc,
+                            start + kMountDebounceMicros, &index));
+    Check(index == 5);
+    Check(MountSchedulerWait(&scheduler, start + kMountDebounceMicros) == 0);
+    Check(!MountSchedulerDue(&scheduler, kNoCurrentDisc,
+                             start + 2 * kMountDebounceMicros, &index));
+
+    /* A burst: each request restarts the wait, the last one goes */
+    start = 1000;
+    MountSchedulerRequest(&scheduler, 3, 5, start);
+    MountSchedulerRequest(&scheduler, 4, 5, start + 100000);
+    MountSchedulerRequest(&scheduler, 7, 5, start + 200000);
+    Check(MountSchedulerWait(&scheduler, start + 300000) ==
+          kMountDebounceMicros - 100000);
+    Check(!MountSchedulerDue(&scheduler, 5, start + kMountDebounceMicros,
+                             &index));
+    Check(MountSchedulerDue(&scheduler, 5,
+                            start + 200000 + kMountDebounceMicros, &index));
+    Check(index == 7);
+
+    /* Overdue mounts go at once */
+    MountSchedulerRequest(&scheduler, 9, 7, start);
+    Check(MountSchedulerWait(&scheduler, start + 10 * kMountDebounceMicros) ==
+          0);
+    MountSchedulerCancel(&scheduler);
+    Check(!MountSchedulerDue(&scheduler, 7, start + 10 * kMountDebounceMicros,
+                             &index));
+
+    Check(scheduler.requests == 5 && scheduler.coalesced == 2);
+    Check(scheduler.redundant == 0 && scheduler.issued == 2);
+}
+
+/*
+ * Asking for the mounted disc sends nothing, and drops a mount that is
+ * still waiting
+ */
+static void TestMountRedundant(void)
+{
+    MountScheduler scheduler;
+    unsigned short index;
+
+    InitMountScheduler(&scheduler, kMountDebounceMicros);
+
+    MountSchedulerRequest(&scheduler, 2, 2, 0);
+    Check(!scheduler.pending);
+    Check(MountSchedulerWait(&scheduler, 0) == 0);
+    Check(!MountSchedulerDue(&scheduler, 2, kMountDebounceMicros, &index));
+
+    /* Clicked away, then back to the disc that is in */
+    MountSchedulerRequest(&scheduler, 6, 2, 0);
+    MountSchedulerRequest(&scheduler, 2, 2, 1000);
+    Check(!scheduler.pending);
+    Check(!MountSchedulerDue(&scheduler, 2, 2 * kMountDebounceMicros,
+                             &index));
+
+    /* The disc got mounted another way while its request waited */
+    MountSchedulerRequest(&scheduler, 8, 2, 0);
+    Check(!MountSchedulerDue(&scheduler, 8, kMountDebounceMicros, &index));
+    Check(!scheduler.pending);
+
+    Check(scheduler.requests == 4 && scheduler.coalesced == 1);
+    Check(scheduler.redundant == 3 && scheduler.issued == 0);
+}
+
+/*
+ * Log the task's name and do one step's worth of its work
+ */
+static short TestStep(USBODETask *task)
+{
+    TestTask *state;
+
+    state = (TestTask *)task->refCon;
+    if (gLogLength < kTestMaxLog) {
+        gLog[gLogLength++] = state->name;
+        gLog[gLogLength] = '\0';
+    }
+    if (state->stepMicros > 0) {
+        USBODEDelayMicroseconds(state->stepMicros);
+    }
+
+    if (--state->stepsLeft <= 0) {
+        return kTaskDone;
+    }
+    TaskSleep(task, state->sleepMicros);
+    return kTaskContinue;
+}
+
+static void StartTestTask(TaskQueue *queue, USBODETask *task,
+                          TestTask *state, char name, short steps)
+{
+    state->name = name;
+    state->stepsLeft = steps;
+    state->stepMicros = 0;
+    state->sleepMicros = 0;
+    task->queued = false;
+    TaskStart(queue, task, TestStep, state);
+}
+
+/*
+ * Tasks take turns, and finish in the order their work runs out
+ */
+static void TestTaskOrder(void)
+{
+    TaskQueue queue;
+    USBODETask tasks[3];
+    TestTask states[3];
+
+    gLogLength = 0;
+    gLog[0] = '\0';
+    InitTaskQueue(&queue, kTaskSliceMicros);
+    StartTestTask(&queue, &tasks[0], &states[0], 'a', 1);
+    StartTestTask(&queue, &tasks[1], &states[1], 'b', 2);
+    StartTestTask(&queue, &tasks[2], &states[2], 'c', 3);
+
+    Check(TaskQueueWait(&queue, USBODEMicroseconds()) == 0);
+    Check(!TaskQueueRun(&queue));
+    Check(strcmp(gLog, "abcbcc") == 0);
+    Check(!TaskActive(&tasks[0]) && !TaskActive(&tasks[1]) &&
+          !TaskActive(&tasks[2]));
+    Check(tasks[0].steps == 1 && tasks[1].steps == 2 && tasks[2].steps == 3);
+    Check(queue.steps == 6 && queue.runs == 1);
+
+    /* An empty queue has nothing to wait for */
+    Check(TaskQueueWait(&queue, USBODEMicroseconds()) == kTaskNoWake);
+    Check(!TaskQueueRun(&queue));
+    Check(queue.runs == 1);
+}
+
+/*
+ * A run stops stepping once its slice is used; a slice of 0 steps once
+ */
+static void TestTaskSlice(void)
+{
+    TaskQueue queue;
+    USBODETask task;
+    TestTask state;
+    unsigned long before;
+
+    InitTaskQueue(&queue, kTestSliceMicros);
+    StartTestTask(&queue, &task, &state, 's', 10);
+    state.stepMicros = kTestStepMicros;
+
+    Check(TaskQueueRun(&queue));
+    Check(task.steps >= 1 &&
+          task.steps <= (kTestSliceMicros + kTestStepMicros - 1) /
+                        kTestStepMicros);
+    Check(task.longestStep >= kTestStepMicros);
+    Check(queue.longestRun >= kTestSliceMicros);
+
+    queue.sliceMicros = 0;
+    before = task.steps;
+    Check(TaskQueueRun(&queue));
+    Check(task.steps == before + 1);
+
+    while (TaskQueueRun(&queue)) {
+    }
+    Check(task.steps == 10 && !TaskActive(&task));
+}
+
+/*
+ * A sleeping task is passed over until its wake time, and the queue
+ * says how long that is
+ */
+static void TestTaskSleep(void)
+{
+    TaskQueue queue;
+    USBODETask sleeper;
+    USBODETask worker;
+    TestTask sleeperState;
+    TestTask workerState;
+    UInt32 start;
+    UInt32 wait;
+
+    gLogLength = 0;
+    gLog[0] = '\0';
+    InitTaskQueue(&queue, 0);
+    StartTestTask(&queue, &sleeper, &sleeperState, 'z', 2);
+    sleeperState.sleepMicros = kTestSleepMicros;
+
+    start = USBODEMicroseconds();
+    Check(TaskQueueRun(&queue));
+    Check(sleeper.sleeping);
+
+    wait = TaskQueueWait(&queue, USBODEMicroseconds());
+    Check(wait > 0 && wait <= kTestSleepMicros);
+
+    /* Asleep, it does not step, but a task that is awake does */
+    StartTestTask(&queue, &worker, &workerState, 'w', 2);
+    Check(TaskQueueWait(&queue, USBODEMicroseconds()) == 0);
+    Check(TaskQueueRun(&queue));
+    Check(TaskQueueRun(&queue));
+    Check(!TaskActive(&worker));
+    if ((UInt32)(USBODEMicroseconds() - start) < kTestSleepMicros) {
+        Check(strcmp(gLog, "zww") == 0);
+        Check(sleeper.steps == 1);
+    }
+
+    /* Past its wake time it steps again, and is done */
+    USBODEDelayMicroseconds(kTestSleepMicros);
+    Check(TaskQueueWait(&queue, USBODEMicroseconds()) == 0);
+    Check(!TaskQueueRun(&queue));
+    Check(sleeper.steps == 2 && !TaskActive(&sleeper));
+    Check((UInt32)(USBODEMicroseconds() - start) >= kTestSleepMicros);
+}
+
+/*
+ * A stopped task is never stepped again; a restarted one starts over
+ */
+static void TestTaskStop(void)
+{
+    TaskQueue queue;
+    USBODETask tasks[2];
+    TestTask states[2];
+
+    gLogLength = 0;
+    gLog[0] = '\0';
+    InitTaskQueue(&queue, 0);
+    StartTestTask(&queue, &tasks[0], &states[0], 'a', 3);
+    StartTestTask(&queue, &tasks[1], &states[1], 'b', 3);
+
+    Check(TaskQueueRun(&queue));
+    TaskStop(&queue, &tasks[1]);
+    Check(!TaskActive(&tasks[1]));
+    TaskStop(&queue, &tasks[1]);
+
+    /* Restarting a queued task does not queue it twice */
+    states[0].stepsLeft = 2;
+    TaskStart(&queue, &tasks[0], TestStep, &states[0]);
+    Check(tasks[0].steps == 0);
+
+    while (TaskQueueRun(&queue)) {
+    }
+    Check(strcmp(gLog, "aaa") == 0);
+    Check(tasks[0].steps == 2 && tasks[1].steps == 0);
+}
+
+/*
+ * Catalog of the first count test names, sized 100 KB apart
+ */
+static void FillTestCatalog(DiscCatalog *catalog, long count)
+{
+    long i;
+
+    CatalogClear(catalog);
+    for (i = 0; i < count; i++) {
+        AppendTestEntry(catalog, kTestNames[i], 100 * (i + 1));
+    }
+}
+
+static long TestCompareFolded(const unsigned char *a, const unsigned char *b)
+{
+    short i;
+
+    for (i = 1; i <= a[0] && i <= b[0]; i++) {
+        if (MacRomanFold(a[i]) != MacRomanFold(b[i])) {
+            return (long)MacRomanFold(a[i]) - (long)MacRomanFold(b[i]);
+        }
+    }
+    return (long)a[0] - (long)b[0];
+}
+
+/*
+ * Whether the order runs through every entry once, by folded name,
+ * with equal names in device order
+ */
+static Boolean PrefixOrderSorted(const PrefixIndex *index,
+                                 const DiscCatalog *catalog)
+{
+    Str255 previous;
+    Str255 name;
+    long compare;
+    long i;
+
+    if (index->count != catalog->count) {
+        return false;
+    }
+    for (i = 1; i < index->count; i++) {
+        CatalogGetName(catalog, PrefixIndexEntry(index, i - 1), previous);
+        CatalogGetName(catalog, PrefixIndexEntry(index, i), name);
+        compare = TestCompareFolded(previous, name);
+        if (compare > 0 || (compare == 0 && PrefixIndexEntry(index, i - 1) >
+                                            PrefixIndexEntry(index, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Boolean PrefixOrdersEqual(const PrefixIndex *a, const PrefixIndex *b)
+{
+    long i;
+
+    if (a->count != b->count) {
+        return false;
+    }
+    for (i = 0; i < a->count; i++) {
+        if (PrefixIndexEntry(a, i) != PrefixIndexEntry(b, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Narrow range to a prefix; returns how many names have it
+ */
+static long FindTestPrefix(const PrefixIndex *index,
+                           const DiscCatalog *catalog, const char *prefix,
+                           PrefixRange *range)
+{
+    PrefixIndexFind(index, catalog, (const unsigned char *)prefix,
+                    (short)strlen(prefix), range);
+    return range->count;
+}
+
+/*
+ * Prefixes find their run of the order whatever their case and accents,
+ * and a longer prefix narrows the run of a shorter one
+ */
+static void TestPrefixFind(void)
+{
+    DiscCatalog catalog;
+    PrefixIndex index;
+    PrefixRange range;
+    PrefixRange all;
+
+    Check(InitDiscCatalog(&catalog) == noErr);
+    Check(InitPrefixIndex(&index) == noErr);
+    FillTestCatalog(&catalog, kTestNameCount);
+    Check(PrefixIndexSync(&index, &catalog) == noErr);
+    Check(PrefixOrderSorted(&index, &catalog));
+    Check(PrefixIndexEntry(&index, 0) == 6);    /* Apps.iso */
+
+    PrefixIndexAll(&index, &all);
+    Check(all.first == 0 && all.count == kTestNameCount);
+
+    range = all;
+    Check(FindTestPrefix(&index, &catalog, "SyS", &range) == 3);
+    Check(PrefixIndexEntry(&index, range.first) == 1);  /* sys tools.img */
+    Check(FindTestPrefix(&index, &catalog, "system ", &range) == 2);
+    Check(PrefixIndexEntry(&index, range.first) == 5);  /* SYSTEM 7.1.iso */
+    Check(FindTestPrefix(&index, &catalog, "SYSTEM 7.5", &range) == 1);
+    Check(PrefixIndexEntry(&index, range.first) == 0);
+    Check(FindTestPrefix(&index, &catalog, "System 7.5.3.iso!", &range) == 0);
+
+    /* E, e, E acute and e acute are one letter */
+    range = all;
+    Check(FindTestPrefix(&index, &catalog, "ECR", &range) == 2);
+    Check(PrefixIndexEntry(&index, range.first) == 3);
+    range = all;
+    Check(FindTestPrefix(&index, &catalog, "\x8E" "cran.i", &range) == 2);
+
+    range = all;
+    Check(FindTestPrefix(&index, &catalog, "game", &range) == 2);
+    range = all;
+    Check(FindTestPrefix(&index, &catalog, "", &range) == kTestNameCount);
+    range = all;
+    Check(FindTestPrefix(&index, &catalog, "zork", &range) == 0);
+    Check(range.first == kTestNameCount);
+    range = all;
+    Check(FindTestPrefix(&index, &catalog, "0", &range) == 0);
+    Check(range.first == 0);
+
+    DisposePrefixIndex(&index);
+    DisposeDiscCatalog(&catalog);
+}
+
+/*
+ * Entries merged in as they are appended give the order a sort from
+ * scratch gives, and a new catalog serial sorts again
+ */
+static void TestPrefixSync(void)
+{
+    DiscCatalog catalog;
+    PrefixIndex index;
+    PrefixIndex rebuilt;
+    PrefixRange range;
+    long i;
+
+    Check(InitDiscCatalog(&catalog) == noErr);
+    Check(InitPrefixIndex(&index) == noErr);
+    Check(InitPrefixIndex(&rebuilt) == noErr);
+
+    for (i = 0; i < kTestNameCount; i++) {
+        AppendTestEntry(&catalog, kTestNames[i], 1);
+        Check(PrefixIndexSync(&index, &catalog) == noErr);
+    }
+    AppendTestEntry(&catalog, "GAMES.TOAST", 1);
+    AppendTestEntry(&catalog, "apps.iso", 1);
+    Check(PrefixIndexSync(&index, &catalog) == noErr);
+    Check(PrefixOrderSorted(&index, &catalog));
+
+    Check(PrefixIndexSync(&rebuilt, &catalog) == noErr);
+    Check(PrefixOrdersEqual(&index, &rebuilt));
+    Check(PrefixIndexEntry(&index, 0) == 6 && PrefixIndexEntry(&index, 1) ==
+                                              kTestNameCount + 1);
+
+    /* As many entries as before, but a different catalog */
+    CatalogClear(&catalog);
+    for (i = kTestNameCount + 1; i >= 0; i--) {
+        AppendTestEntry(&catalog, (i < kTestNameCount) ? kTestNames[i] :
+                                  "Zork.iso", 1);
+    }
+    Check(catalog.count == index.count);
+    Check(PrefixIndexSync(&index, &catalog) == noErr);
+    Check(PrefixOrderSorted(&index, &catalog));
+    PrefixIndexAll(&index, &range);
+    Check(FindTestPrefix(&index, &catalog, "zork", &range) == 2);
+
+    DisposePrefixIndex(&rebuilt);
+    DisposePrefixIndex(&index);
+    DisposeDiscCatalog(&catalog);
+}
+
+/*
+ * Whether an order lists the entries expected, and places each one
+ * where it lists it
+ */
+static Boolean SortOrderIs(const SortViews *views,
+                           const PrefixIndex *names, short order,
+                           Boolean descending, const long *expected)
+{
+    long i;
+
+    for (i = 0; i < views->count; i++) {
+        if (SortViewEntry(views, names, order, descending, i) !=
+                expected[i] ||
+            SortViewPosition(views, order, descending, expected[i]) != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Names equal but for case keep device order; equal sizes go by name
+ */
+static void TestSortOrders(void)
+{
+    static const long byIndex[] = { 0, 1, 2, 3, 4 };
+    static const long byName[] = { 1, 2, 4, 0, 3 };
+    static const long bySize[] = { 2, 4, 1, 0, 3 };
+    static const long bySizeDown[] = { 3, 0, 1, 4, 2 };
+    DiscCatalog catalog;
+    PrefixIndex names;
+    SortViews views;
+
+    Check(InitDiscCatalog(&catalog) == noErr);
+    Check(InitPrefixIndex(&names) == noErr);
+    Check(InitSortViews(&views) == noErr);
+
+    AppendTestEntry(&catalog, "beta", 700);
+    AppendTestEntry(&catalog, "Alpha", 700);
+    AppendTestEntry(&catalog, "alpha", 300);
+    AppendTestEntry(&catalog, "Gamma", 700);
+    AppendTestEntry(&catalog, "ALPHA", 300);
+    Check(SortViewsSync(&views, &names, &catalog) == noErr);
+    Check(views.count == 5 && names.count == 5);
+
+    Check(SortOrderIs(&views, &names, kSortByIndex, false, byIndex));
+    Check(SortOrderIs(&views, &names, kSortByName, false, byName));
+    Check(SortOrderIs(&views, &names, kSortBySize, false, bySize));
+    Check(SortOrderIs(&views, &names, kSortBySize, true, bySizeDown));
+    Check(SortViewEntry(&views, &names, kSortByName, true, 0) == 3);
+    Check(SortViewPosition(&views, kSortByName, true, 1) == 4);
+
+    DisposeSortViews(&views);
+    DisposePrefixIndex(&names);
+    DisposeDiscCatalog(&catalog);
+}
+
+/*
+ * Appended entries land in both orders where a rebuild puts them, and
+ * a swapped catalog is sorted again
+ */
+static void TestSortSync(void)
+{
+    static const long byName[] = { 1, 2, 4, 5, 0, 3 };
+    static const long bySize[] = { 2, 4, 5, 1, 0, 3 };
+    DiscCatalog catalog;
+    DiscCatalog other;
+    PrefixIndex names;
+    PrefixIndex rebuiltNames;
+    SortViews views;
+    SortViews rebuilt;
+    long i;
+
+    Check(InitDiscCatalog(&catalog) == noErr);
+    Check(InitDiscCatalog(&other) == noErr);
+    Check(InitPrefixIndex(&names) == noErr);
+    Check(InitPrefixIndex(&rebuiltNames) == noErr);
+    Check(InitSortViews(&views) == noErr);
+    Check(InitSortViews(&rebuilt) == noErr);
+
+    AppendTestEntry(&catalog, "beta", 700);
+    AppendTestEntry(&catalog, "Alpha", 700);
+    AppendTestEntry(&catalog, "alpha", 300);
+    Check(SortViewsSync(&views, &names, &catalog) == noErr);
+    AppendTestEntry(&catalog, "Gamma", 700);
+    AppendTestEntry(&catalog, "ALPHA", 300);
+    Check(SortViewsSync(&views, &names, &catalog) == noErr);
+    AppendTestEntry(&catalog, "alpha", 300);
+    Check(SortViewsSync(&views, &names, &catalog) == noErr);
+
+    Check(SortOrderIs(&views, &names, kSortByName, false, byName));
+    Check(SortOrderIs(&views, &names, kSortBySize, false, bySize));
+    Check(SortViewsSync(&rebuilt, &rebuiltNames, &catalog) == noErr);
+    for (i = 0; i < catalog.count; i++) {
+        Check(SortViewEntry(&views, &names, kSortBySize, false, i) ==
+              SortViewEntry(&rebuilt, &rebuiltNames, kSortBySize, false, i));
+    }
+
+    /* Swapped for a catalog of the same size, sorted the other way */
+    for (i = 0; i < catalog.count; i++) {
+        AppendTestEntry(&other, kTestNames[i], 1000 - 100 * i);
+    }
+    CatalogSwap(&catalog, &other);
+    Check(SortViewsSync(&views, &names, &catalog) == noErr);
+    for (i = 0; i < catalog.count; i++) {
+        Check(SortViewEntry(&views, &names, kSortBySize, false, i) ==
+              catalog.count - 1 - i);
+    }
+    Check(PrefixOrderSorted(&names, &catalog));
+
+    DisposeSortViews(&rebuilt);
+    DisposeSortViews(&views);
+    DisposePrefixIndex(&rebuiltNames);
+    DisposePrefixIndex(&names);
+    DisposeDiscCatalog(&other);
+    DisposeDiscCatalog(&catalog);
+}
+
+static OSErr ResolveTestName(const NameIndex *index,
+                             const PrefixIndex *prefixes,
+                             const DiscCatalog *catalog, const char *text,
+                             long *entry)
+{
+    Str255 name;
+
+    name[0] = (unsigned char)strlen(text);
+    BlockMoveData(text, &name[1], name[0]);
+    return NameIndexResolve(index, prefixes, catalog, name, entry);
+}
+
+/*
+ * Whole names, folded names, names only one entry starts with, and
+ * names that fit several entries or none
+ */
+static void TestNameResolve(void)
+{
+    DiscCatalog catalog;
+    PrefixIndex prefixes;
+    NameIndex index;
+    long entry;
+
+    Check(InitDiscCatalog(&catalog) == noErr);
+    Check(InitPrefixIndex(&prefixes) == noErr);
+    Check(InitNameIndex(&index) == noErr);
+    FillTestCatalog(&catalog, kTestNameCount);
+    AppendTestEntry(&catalog, "Disk", 1);
+    AppendTestEntry(&catalog, "DISK", 1);
+    Check(NameIndexSync(&index, &catalog) == noErr);
+    Check(PrefixIndexSync(&prefixes, &catalog) == noErr);
+
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Games.toast",
+                          &entry) == noErr && entry == 2);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "gAMES.TOAST",
+                          &entry) == noErr && entry == 2);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "ECRAN.IMG",
+                          &entry) == noErr && entry == 3);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "\x8E" "cran.iso",
+                          &entry) == noErr && entry == 4);
+
+    /* Names equal but for case: the one with the same case, or none */
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Disk",
+                          &entry) == noErr && entry == kTestNameCount);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "DISK",
+                          &entry) == noErr && entry == kTestNameCount + 1);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "disk",
+                          &entry) == dupFNErr);
+
+    /* Prefixes: only one entry has it, several do, none does */
+    Check(ResolveTestName(&index, &prefixes, &catalog, "system 7.5",
+                          &entry) == noErr && entry == 0);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Game T",
+                          &entry) == noErr && entry == 7);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "game",
+                          &entry) == dupFNErr);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "sys",
+                          &entry) == dupFNErr);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Zork",
+                          &entry) == fnfErr);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Games.toast2",
+                          &entry) == fnfErr);
+
+    DisposeNameIndex(&index);
+    DisposePrefixIndex(&prefixes);
+    DisposeDiscCatalog(&catalog);
+}
+
+/*
+ * Appended names are found; names from a catalog that was replaced
+ * are not
+ */
+static void TestNameSync(void)
+{
+    DiscCatalog catalog;
+    PrefixIndex prefixes;
+    NameIndex index;
+    long entry;
+    long i;
+
+    Check(InitDiscCatalog(&catalog) == noErr);
+    Check(InitPrefixIndex(&prefixes) == noErr);
+    Check(InitNameIndex(&index) == noErr);
+
+    Check(NameIndexSync(&index, &catalog) == noErr);
+    Check(PrefixIndexSync(&prefixes, &catalog) == noErr);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Apps.iso",
+                          &entry) == fnfErr);
+
+    /* Enough entries to grow the table a few times */
+    for (i = 0; i < 40; i++) {
+        AppendTestEntry(&catalog, kTestNames[i % kTestNameCount], 1);
+        if (i % 7 == 0) {
+            Check(NameIndexSync(&index, &catalog) == noErr);
+        }
+    }
+    AppendTestEntry(&catalog, "Zork I.iso", 1);
+    Check(NameIndexSync(&index, &catalog) == noErr);
+    Check(PrefixIndexSync(&prefixes, &catalog) == noErr);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "zork i.ISO",
+                          &entry) == noErr && entry == 40);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Zork",
+                          &entry) == noErr && entry == 40);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Apps.iso",
+                          &entry) == noErr && entry == 6);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "apps.iso",
+                          &entry) == dupFNErr);
+
+    FillTestCatalog(&catalog, kTestNameCount);
+    Check(NameIndexSync(&index, &catalog) == noErr);
+    Check(PrefixIndexSync(&prefixes, &catalog) == noErr);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Zork I.iso",
+                          &entry) == fnfErr);
+    Check(ResolveTestName(&index, &prefixes, &catalog, "Apps.iso",
+                          &entry) == noErr && entry == 6);
+
+    DisposeNameIndex(&index);
+    DisposePrefixIndex(&prefixes);
+    DisposeDiscCatalog(&catalog);
+}
+
+/*
+ * Every MacRoman byte survives a trip through UTF-8, and a Str255 of
+ * three-byte characters fills the 765 bytes usbode-ctl allows
+ */
+static void TestRomanRoundTrip(void)
+{
+    unsigned char roman[256];
+    unsigned char utf8[3 * 256];
+    unsigned char back[3 * 256];
+    short length;
+    short i;
+
+    for (i = 0; i < 256; i++) {
+        roman[i] = (unsigned char)i;
+    }
+    length = MacRomanToUTF8(roman, 256, utf8);
+    Check(length > 256 && length <= 3 * 256);
+    Check(UTF8ToMacRoman(utf8, length, back) == 256);
+    Check(memcmp(roman, back, 256) == 0);
+
+    Check(MacRomanToUTF8((const unsigned char *)"\x8E", 1, utf8) == 2);
+    Check(utf8[0] == 0xC3 && utf8[1] == 0xA9);
+
+    for (i = 0; i < 255; i++) {
+        roman[i] = 0xAA;
+    }
+    Check(MacRomanToUTF8(roman, 255, utf8) == 3 * 255);
+    Check(UTF8ToMacRoman(utf8, 3 * 255, back) == 255);
+    Check(memcmp(roman, back, 255) == 0);
+}
+
+int main(void)
+{
+    TestLayoutRange();
+    TestLayoutHits();
+    TestLayoutScroll();
+    TestLayoutShort();
+    TestSnapshotRoundTrip();
+    TestSnapshotDamaged();
+    TestChangesSync();
+    TestChangesResync();
+    TestMountBatch();
+    TestPackedListing();
+    TestPackedDamaged();
+    TestPagerNoResidual();
+    TestUTF8ToRoman();
+    TestUTF8Limits();
+    TestMountDebounce();
+    TestMountRedundant();
+    TestTaskOrder();
+    TestTaskSlice();
+    TestTaskSleep();
+    TestTaskStop();
+    TestPrefixFind();
+    TestPrefixSync();
+    TestSortOrders();
+    TestSortSync();
+    TestNameResolve();
+    TestNameSync();
+    TestRomanRoundTrip();
+
+    printf("%ld checks, %ld failed\n", gChecks, gFailures);
+    return (gFailures == 0) ? 0 : 1;
+}
+
+#else
+
+int main(void)
+{
+    return 1;
+}
+
+#endif /* USBODE_HOST */
@@ -0,0 +1,221 @@
+/*
+ * USBODE_Trace.c
+ * Per-command latency trace
+ *
+ * One transaction is open at a time: TraceBegin fills the next ring
+ * slot, the transport marks phases into it and TraceEnd commits it.
+ * Portable; only TraceDumpFile is host specific.
+ */
+
+#include "USBODE_Trace.h"
+
+#include <stdio.h>
+
+#define kTraceLineLength    160
+
+static TraceRecord gTraceRing[kTraceRingSize];
+static long gTraceNext = 0;         /* slot the next record goes into */
+static long gTraceCount = 0;        /* committed records, up to the ring size */
+static UInt32 gTraceSequence = 0;
+static TraceRecord *gTraceOpen = nil;
+static UInt32 gTraceModelled = 0;   /* modelled time so far in gTraceOpen */
+
+static const char *const gPhaseNames[kTracePhaseCount] = {
+    "arbitrate", "select", "command", "data", "status"
+};
+
+/*
+ * Open a record for a transaction of one or more commands
+ */
+void TraceBegin(short scsiID, unsigned char opcode, short commands)
+{
+    TraceRecord *record;
+    short i;
+
+    record = &gTraceRing[gTraceNext];
+    record->sequence = gTraceSequence++;
+    record->scsiID = (unsigned char)scsiID;
+    record->opcode = opcode;
+    record->commands = (unsigned char)commands;
+    record->flags = 0;
+    record->bytes = 0;
+    record->result = noErr;
+    record->total = 0;
+    for (i = 0; i < kTracePhaseCount; i++) {
+        record->phaseEnd[i] = kTraceNotReached;
+    }
+
+    gTraceModelled = 0;
+    gTraceOpen = record;
+    record->start = USBODEMicroseconds();
+}
+
+/*
+ * Note that a phase just finished
+ */
+void TraceMark(short phase)
+{
+    if (gTraceOpen == nil || phase < 0 || phase >= kTracePhaseCount) {
+        return;
+    }
+
+    gTraceOpen->phaseEnd[phase] = USBODEMicroseconds() - gTraceOpen->start;
+}
+
+/*
+ * Note that a phase took micros of modelled bus time
+ */
+void TraceMarkModelled(short phase, UInt32 micros)
+{
+    if (gTraceOpen == nil || phase < 0 || phase >= kTracePhaseCount) {
+        return;
+    }
+
+    gTraceModelled += micros;
+    gTraceOpen->phaseEnd[phase] = gTraceModelled;
+    gTraceOpen->flags |= kTraceModelled;
+}
+
+/*
+ * Close the open record and commit it to the ring
+ */
+void TraceEnd(OSErr result, long bytes)
+{
+    TraceRecord *record;
+
+    record = gTraceOpen;
+    if (record == nil) {
+        return;
+    }
+    gTraceOpen = nil;
+
+    record->total = (record->flags & kTraceModelled) ?
+                    gTraceModelled : USBODEMicroseconds() - record->start;
+    record->result = result;
+    record->bytes = bytes;
+
+    gTraceNext = (gTraceNext + 1) % kTraceRingSize;
+    if (gTraceCount < kTraceRingSize) {
+        gTraceCount++;
+    }
+}
+
+/*
+ * Forget all records
+ */
+void TraceReset(void)
+{
+    gTraceNext = 0;
+    gTraceCount = 0;
+    gTraceOpen = nil;
+}
+
+/*
+ * Number of records held
+ */
+long TraceCount(void)
+{
+    return gTraceCount;
+}
+
+/*
+ * Copy record i out, oldest first
+ */
+void TraceGetRecord(long i, TraceRecord *record)
+{
+    long slot;
+
+    slot = (gTraceNext - gTraceCount + i + kTraceRingSize) % kTraceRingSize;
+    *record = gTraceRing[slot];
+}
+
+/*
+ * Write the ring as CSV, oldest record first
+ * Phase columns hold the time from the start of the transaction to the
+ * end of that phase and are empty for phases the transport did not see.
+ */
+OSErr TraceWriteCSV(TraceWriteProcPtr writeProc, void *refCon)
+{
+    TraceRecord record;
+    char line[kTraceLineLength];
+    int length;
+    long i;
+    short phase;
+    OSErr err;
+
+    length = sprintf(line, "sequence,start_us,scsi_id,opcode,commands,"
+                     "bytes,result");
+    for (phase = 0; phase < kTracePhaseCount; phase++) {
+        length += sprintf(line + length, ",%s_us", gPhaseNames[phase]);
+    }
+    length += sprintf(line + length, ",total_us,modelled\n");
+
+    err = (*writeProc)(refCon, line, length);
+
+    for (i = 0; i < gTraceCount && err == noErr; i++) {
+        TraceGetRecord(i, &record);
+
+        length = sprintf(line, "%lu,%lu,%d,0x%02X,%d,%ld,%d",
+                         (unsigned long)record.sequence,
+                         (unsigned long)record.start,
+                         record.scsiID, record.opcode, record.commands,
+                         record.bytes, record.result);
+        for (phase = 0; phase < kTracePhaseCount; phase++) {
+            if (record.phaseEnd[phase] == kTraceNotReached) {
+                line[length++] = ',';
+            } else {
+                length += sprintf(line + length, ",%lu",
+                                  (unsigned long)record.phaseEnd[phase]);
+            }
+        }
+        length += sprintf(line + length, ",%lu,%d\n",
+                          (unsigned long)record.total,
+                          (record.flags & kTraceModelled) ? 1 : 0);
+
+        err = (*writeProc)(refCon, line, length);
+    }
+
+    return err;
+}
+
+#ifdef USBODE_HOST
+
+static OSErr TraceWriteStdio(void *refCon, const char *text, long length);
+
+/*
+ * TraceWriteCSV output to a stdio stream
+ */
+static OSErr TraceWriteStdio(void *refCon, const char *text, long length)
+{
+    if (fwrite(text, 1, (size_t)length, (FILE *)refCon) != (size_t)length) {
+        return ioErr;
+    }
+    return noErr;
+}
+
+/*
+ * Dump the ring as CSV to a file, or to stdout for "-"
+ */
+OSErr TraceDumpFile(const char *path)
+{
+    FILE *file;
+    OSErr err;
+
+    if (strcmp(path, "-") == 0) {
+        return TraceWriteCSV(TraceWriteStdio, stdout);
+    }
+
+    file = fopen(path, "w");
+    if (file == nil) {
+        return fnfErr;
+    }
+
+    err = TraceWriteCSV(TraceWriteStdio, file);
+    if (fclose(file) != 0 && err == noErr) {
+        err = ioErr;
+    }
+
+    return err;
+}
+
+#endif /* USBODE_HOST */
@@ -0,0 +1,71 @@
+/*
+ * USBODE_Trace.h
+ * Per-command latency trace
+ *
+ * Every command that goes through a transport leaves one record in a
+ * fixed ring of the most recent kTraceRingSize transactions: opcode,
+ * target, bytes moved, result and the time at which each bus phase
+ * finished.  Recording never allocates and costs a few clock reads per
+ * command, so it is always on.
+ *
+ * Phase times are microseconds from the start of the transaction
+ * (USBODEMicroseconds).  Transports mark the phases they can see; the
+ * SCSI Manager sees all of them, SG_IO only the end of the ioctl.  The
+ * emulator marks its modelled bus time instead and sets kTraceModelled.
+ *
+ * TraceWriteCSV formats the ring as CSV for usbode-trace, the host tool
+ * that turns a dump into per-phase latency histograms.
+ */
+
+#ifndef USBODE_TRACE_H
+#define USBODE_TRACE_H
+
+#include "USBODE_Port.h"
+
+#define kTraceRingSize      256
+#define kTraceNotReached    0xFFFFFFFFUL
+
+/* Bus phases, in order */
+enum {
+    kTracePhaseArbitrate    = 0,    /* SCSIGet */
+    kTracePhaseSelect       = 1,    /* SCSISelect */
+    kTracePhaseCommand      = 2,    /* SCSICmd */
+    kTracePhaseData         = 3,    /* SCSIRead */
+    kTracePhaseStatus       = 4,    /* SCSIComplete */
+    kTracePhaseCount        = 5
+};
+
+/* TraceRecord.flags */
+#define kTraceModelled      0x01    /* times come from a bus model */
+
+typedef struct {
+    UInt32          sequence;
+    UInt32          start;      /* USBODEMicroseconds at the start */
+    UInt32          phaseEnd[kTracePhaseCount]; /* from start, or kTraceNotReached */
+    UInt32          total;      /* from start to completion */
+    long            bytes;
+    OSErr           result;
+    unsigned char   opcode;
+    unsigned char   scsiID;
+    unsigned char   commands;   /* more than one for a batch */
+    unsigned char   flags;
+} TraceRecord;
+
+typedef OSErr (*TraceWriteProcPtr)(void *refCon, const char *text, long length);
+
+/* Recording, called by the protocol core and the transports */
+void TraceBegin(short scsiID, unsigned char opcode, short commands);
+void TraceMark(short phase);
+void TraceMarkModelled(short phase, UInt32 micros);
+void TraceEnd(OSErr result, long bytes);
+
+/* Reading */
+void TraceReset(void);
+long TraceCount(void);
+void TraceGetRecord(long i, TraceRecord *record);
+OSErr TraceWriteCSV(TraceWriteProcPtr writeProc, void *refCon);
+#ifdef USBODE_HOST
+OSErr TraceDumpFile(const char *path);
+#endif
+
+#endif /* USBODE_TRACE_H */
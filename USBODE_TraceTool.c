@@ -0,0 +1,282 @@
+/*
+ * USBODE_TraceTool.c
+ * usbode-trace: per-phase latency histograms from a trace dump
+ *
+ * Reads the CSV written by TraceWriteCSV (a "Save Trace..." file from the
+ * Mac, or TraceDumpFile on the host) and prints, for each bus phase and
+ * for the whole transaction, the sample count, percentiles and a log2
+ * histogram of phase durations.
+ *
+ *   usbode-trace [-o opcode] [file]     (stdin when no file is given)
+ */
+
+#include "USBODE_Trace.h"
+
+#ifdef USBODE_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define kMaxLine            512
+#define kBuckets            25      /* up to 2^24 us, about 17 seconds */
+#define kBarWidth           40
+#define kSeries             (kTracePhaseCount + 1)  /* phases + total */
+
+typedef struct {
+    UInt32          *samples;
+    long            count;
+    long            capacity;
+} Series;
+
+static const char *const gSeriesNames[kSeries] = {
+    "arbitrate", "select", "command", "data", "status", "total"
+};
+
+static int ReadLine(FILE *input, char *line, int size);
+static int AddSample(Series *series, UInt32 micros);
+static int CompareMicros(const void *a, const void *b);
+static int ParseLine(char *line, unsigned int *opcode, long *result,
+                     UInt32 *phaseEnd, UInt32 *total);
+static void PrintSeries(const char *name, Series *series);
+
+/*
+ * Read one line ending in LF, CR or CR LF; files saved on the Mac
+ * use CR.  Returns 0 at the end of the input.
+ */
+static int ReadLine(FILE *input, char *line, int size)
+{
+    int c;
+    int n;
+
+    n = 0;
+    while ((c = getc(input)) != EOF) {
+        if (c == '\r' || c == '\n') {
+            if (n == 0) {
+                continue;       /* blank line or the LF of CR LF */
+            }
+            break;
+        }
+        if (n < size - 1) {
+            line[n++] = (char)c;
+        }
+    }
+    line[n] = 0;
+
+    return (n > 0);
+}
+
+/*
+ * Append one duration to a series
+ */
+static int AddSample(Series *series, UInt32 micros)
+{
+    UInt32 *grown;
+    long capacity;
+
+    if (series->count == series->capacity) {
+        capacity = (series->capacity == 0) ? 256 : series->capacity * 2;
+        grown = (UInt32 *)realloc(series->samples,
+                                  (size_t)capacity * sizeof(UInt32));
+        if (grown == nil) {
+            return -1;
+        }
+        series->samples = grown;
+        series->capacity = capacity;
+    }
+
+    series->samples[series->count++] = micros;
+    return 0;
+}
+
+static int CompareMicros(const void *a, const void *b)
+{
+    UInt32 x = *(const UInt32 *)a;
+    UInt32 y = *(const UInt32 *)b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+/*
+ * Split one CSV record; phases the transport did not see get
+ * kTraceNotReached.  Returns 0 for a usable record.
+ */
+static int ParseLine(char *line, unsigned int *opcode, long *result,
+                     UInt32 *phaseEnd, UInt32 *total)
+{
+    char *fields[7 + kTracePhaseCount + 2];
+    char *p;
+    int n;
+    int i;
+
+    n = 0;
+    fields[n++] = line;
+    for (p = line; *p != 0 && *p != '\n' && *p != '\r'; p++) {
+        if (*p == ',') {
+            *p = 0;
+            if (n == (int)(sizeof(fields) / sizeof(fields[0]))) {
+                return -1;
+            }
+            fields[n++] = p + 1;
+        }
+    }
+    *p = 0;
+
+    if (n != (int)(sizeof(fields) / sizeof(fields[0])) ||
+        sscanf(fields[3], "%x", opcode) != 1) {
+        return -1;
+    }
+
+    *result = strtol(fields[6], nil, 10);
+    for (i = 0; i < kTracePhaseCount; i++) {
+        phaseEnd[i] = (*fields[7 + i] == 0) ? kTraceNotReached :
+                      (UInt32)strtoul(fields[7 + i], nil, 10);
+    }
+    *total = (UInt32)strtoul(fields[7 + kTracePhaseCount], nil, 10);
+
+    return 0;
+}
+
+/*
+ * Print percentiles and a log2 histogram for one series
+ */
+static void PrintSeries(const char *name, Series *series)
+{
+    long buckets[kBuckets];
+    long largest;
+    long i;
+    int b;
+    int bar;
+
+    if (series->count == 0) {
+        printf("%-10s no samples\n\n", name);
+        return;
+    }
+
+    qsort(series->samples, (size_t)series->count, sizeof(UInt32),
+          CompareMicros);
+
+    printf("%-10s n=%ld  min=%lu  p50=%lu  p90=%lu  p99=%lu  max=%lu us\n",
+           name, series->count,
+           (unsigned long)series->samples[0],
+           (unsigned long)series->samples[series->count / 2],
+           (unsigned long)series->samples[(series->count * 90) / 100],
+           (unsigned long)series->samples[(series->count * 99) / 100],
+           (unsigned long)series->samples[series->count - 1]);
+
+    for (b = 0; b < kBuckets; b++) {
+        buckets[b] = 0;
+    }
+    for (i = 0; i < series->count; i++) {
+        for (b = 0; b < kBuckets - 1; b++) {
+            if (series->samples[i] < (1UL << b)) {
+                break;
+            }
+        }
+        buckets[b]++;
+    }
+
+    largest = 0;
+    for (b = 0; b < kBuckets; b++) {
+        if (buckets[b] > largest) {
+            largest = buckets[b];
+        }
+    }
+
+    for (b = 0; b < kBuckets; b++) {
+        if (buckets[b] == 0) {
+            continue;
+        }
+        if (b == 0) {
+            printf("  %17s", "0");
+        } else if (b == kBuckets - 1) {
+            printf("  %8lu-%8s", 1UL << (b - 1), "");
+        } else {
+            printf("  %8lu-%-8lu", 1UL << (b - 1), (1UL << b) - 1);
+        }
+        printf(" us %8ld ", buckets[b]);
+        bar = (int)((buckets[b] * kBarWidth + largest - 1) / largest);
+        while (bar-- > 0) {
+            putchar('#');
+        }
+        putchar('\n');
+    }
+    putchar('\n');
+}
+
+int main(int argc, char *argv[])
+{
+    Series series[kSeries];
+    UInt32 phaseEnd[kTracePhaseCount];
+    UInt32 total;
+    UInt32 previous;
+    char line[kMaxLine];
+    FILE *input;
+    unsigned int opcode;
+    long result;
+    long records;
+    long failed;
+    int filter;
+    int arg;
+    int i;
+
+    filter = -1;
+    input = stdin;
+
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+            filter = (int)strtol(argv[++arg], nil, 0);
+        } else if (input == stdin && argv[arg][0] != '-') {
+            input = fopen(argv[arg], "r");
+            if (input == nil) {
+                perror(argv[arg]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "usage: %s [-o opcode] [trace.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    memset(series, 0, sizeof(series));
+    records = 0;
+    failed = 0;
+
+    while (ReadLine(input, line, sizeof(line))) {
+        if (ParseLine(line, &opcode, &result, phaseEnd, &total) != 0) {
+            continue;   /* header or a damaged line */
+        }
+        if (filter >= 0 && (int)opcode != filter) {
+            continue;
+        }
+
+        records++;
+        if (result != noErr) {
+            failed++;
+        }
+
+        /* A phase lasts from the end of the last phase seen before it */
+        previous = 0;
+        for (i = 0; i < kTracePhaseCount; i++) {
+            if (phaseEnd[i] == kTraceNotReached) {
+                continue;
+            }
+            AddSample(&series[i], phaseEnd[i] - previous);
+            previous = phaseEnd[i];
+        }
+        AddSample(&series[kTracePhaseCount], total);
+    }
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    printf("%ld transactions, %ld failed\n\n", records, failed);
+    for (i = 0; i < kSeries; i++) {
+        PrintSeries(gSeriesNames[i], &series[i]);
+        free(series[i].samples);
+    }
+
+    return 0;
+}
+
+#endif /* USBODE_HOST */
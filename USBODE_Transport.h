@@ -0,0 +1,107 @@
+/*
+ * USBODE_Transport.h
+ * Pluggable command transport for the USBODE protocol core
+ *
+ * A transport moves one CDB and its data-in phase to a target and back.
+ * The protocol code never talks to a bus directly; it calls through the
+ * active transport, which may be the classic SCSI Manager (Mac), Linux
+ * SG_IO (host) or the in-process emulator (host or Mac).
+ *
+ * Result conventions for every backend:
+ *   noErr              command completed with GOOD status
+ *   scCommErr          target could not be selected / no device
+ *   scsiNonZeroStatus  target returned CHECK CONDITION or another status
+ *   other              bus or driver error from the backend
+ *
+ * A backend that sets reportsResidual fills *actualSize with the number
+ * of bytes the target really sent, even when that is less than the
+ * buffer.  Backends that cannot tell report the full buffer length.
+ *
+ * Several commands can be run as a batch.  A backend that can keep one
+ * selection across commands (SCSI-2 linked commands) provides
+ * executeBatch; ExecuteTransportBatch then sets the link bit in every
+ * control byte but the last, and the batch pays for a single
+ * arbitration and selection.  Without it the batch runs as consecutive
+ * transactions.  Either way the batch stops at the first failure and
+ * later commands report scsiRequestAborted.
+ *
+ * A backend that can shorten how long it waits on a target provides
+ * setTimeout.  Device discovery uses it so that empty bus positions
+ * fail quickly; a timeout of 0 restores the backend's default.
+ *
+ * A backend whose bus fetches sense data along with CHECK CONDITION
+ * (autosense, as SG_IO does) leaves it in sense and senseLength.  The
+ * target has then already handed it over and a REQUEST SENSE would come
+ * back empty.  Every command clears senseLength first.
+ */
+
+#ifndef USBODE_TRANSPORT_H
+#define USBODE_TRANSPORT_H
+
+#include "USBODE_Port.h"
+
+/* Largest command block a transport accepts */
+#define kMaxCDBLength       16
+
+/* Autosense data a transport keeps from the last command */
+#define kTransportSenseLength   32
+
+/* Control byte (last CDB byte) flags */
+#define kControlLink        0x01
+
+typedef struct USBODETransport USBODETransport;
+
+/* One command of a batch, with its own result */
+typedef struct {
+    unsigned char   cdb[kMaxCDBLength];
+    short           cdbLength;
+    void            *buffer;
+    long            bufferSize;
+    long            actualSize;     /* out: bytes transferred */
+    OSErr           result;         /* out: completion of this command */
+} USBODECommand;
+
+typedef OSErr (*USBODEExecuteProcPtr)(USBODETransport *transport, short scsiID,
+                                      const unsigned char *cdb, short cdbLength,
+                                      void *buffer, long bufferSize,
+                                      long *actualSize);
+typedef OSErr (*USBODEExecuteBatchProcPtr)(USBODETransport *transport,
+                                           short scsiID,
+                                           USBODECommand *commands,
+                                           short count);
+typedef void (*USBODECloseProcPtr)(USBODETransport *transport);
+typedef void (*USBODETimeoutProcPtr)(USBODETransport *transport,
+                                     UInt32 milliseconds);
+
+struct USBODETransport {
+    const char              *name;
+    void                    *refCon;
+    USBODEExecuteProcPtr    execute;
+    USBODEExecuteBatchProcPtr executeBatch;   /* nil: run one by one */
+    USBODECloseProcPtr      close;
+    USBODETimeoutProcPtr    setTimeout;     /* nil: fixed timeouts */
+    Boolean                 reportsResidual;
+    short                   senseLength;    /* 0: no autosense */
+    unsigned char           sense[kTransportSenseLength];
+};
+
+/* Generic helpers */
+OSErr ExecuteTransportCommand(USBODETransport *transport, short scsiID,
+                              const unsigned char *cdb, short cdbLength,
+                              void *buffer, long bufferSize, long *actualSize);
+OSErr ExecuteTransportBatch(USBODETransport *transport, short scsiID,
+                            USBODECommand *commands, short count);
+void DisposeUSBODETransport(USBODETransport *transport);
+Boolean TransportReportsResidual(USBODETransport *transport);
+void TransportSetTimeout(USBODETransport *transport, UInt32 milliseconds);
+
+/* Backends */
+#ifndef USBODE_HOST
+USBODETransport *NewSCSIManagerTransport(void);
+#else
+USBODETransport *NewSGIOTransport(void);
+OSErr SGIOAttachDevice(USBODETransport *transport, short scsiID,
+                       const char *devicePath);
+#endif
+
+#endif /* USBODE_TRANSPORT_H */
@@ -4,20 +4,30 @@
  * 
  * This file contains enhanced UI features including:
  * - Interactive disc list with click-to-select
- * - Mount button functionality
+ * - Scrolling that draws only visible rows (USBODE_ListLayout.c)
+ * - Mount button functionality, with the mounted disc shown in bold
  * - Keyboard shortcuts
+ * - Type-ahead search: typing shows only the discs whose names start
+ *   with what was typed (USBODE_PrefixIndex.c)
+ * - Listing by device index, name or size (USBODE_SortView.c)
  */
 
 #include "USBODE.h"
 
 /* UI State */
 typedef struct {
-    short selectedDisc;
+    long selectedDisc;
     Boolean hasSelection;
     Rect listRect;
     Rect mountButtonRect;
     Rect refreshButtonRect;
-    short scrollPosition;
+    ListLayout list;        /* row geometry and scroll position */
+    Str63 filter;           /* typed so far; empty shows every disc */
+    PrefixRange matches;    /* index positions the filter matches */
+    unsigned long matchSerial;  /* catalog serial matches were found in */
+    long matchTotal;        /* ...and its entry count */
+    short sortOrder;        /* kSortByIndex, kSortByName or kSortBySize */
+    Boolean sortDescending;
 } UIState;
 
 static UIState gUIState;
@@ -30,6 +40,26 @@ static UIState gUIState;
 #define kButtonWidth    80
 #define kRightMargin    20
 #define kBottomMargin   20
+#define kRowInset       2       /* row top sits this far above its text box */
+#define kTextBaseline   14      /* from row top */
+
+/* Keys the list responds to */
+#define kHomeKey        0x01
+#define kEndKey         0x04
+#define kPageUpKey      0x0B
+#define kPageDownKey    0x0C
+#define kBackspaceKey   0x08
+#define kEscapeKey      0x1B
+#define kDeleteKey      0x7F
+
+static void SyncListRows(void);
+static void FindMatches(Boolean narrow);
+static void ApplyFilter(Boolean narrow, long keepEntry);
+static long RowEntry(long row);
+static void SetSortOrder(short order);
+static void InvalListRow(long row);
+static void ScrollList(long delta);
+static void SelectListRow(long row);
 
 /*
  * Initialize UI state
@@ -38,7 +68,13 @@ void InitUIState(void)
 {
     gUIState.selectedDisc = -1;
     gUIState.hasSelection = false;
-    gUIState.scrollPosition = 0;
+    gUIState.filter[0] = 0;
+    gUIState.matches.first = 0;
+    gUIState.matches.count = 0;
+    gUIState.matchSerial = 0;
+    gUIState.matchTotal = -1;
+    gUIState.sortOrder = kSortByIndex;
+    gUIState.sortDescending = false;
     
     /* Calculate layout rects */
     if (gGlobals.window != nil) {
@@ -62,6 +98,202 @@ void InitUIState(void)
         gUIState.refreshButtonRect.right = kLeftMargin + kButtonWidth * 2 + 10;
         gUIState.refreshButtonRect.bottom = bounds->bottom - kBottomMargin;
     }
+    
+    /* Rows span the list area, with room for the selection inset */
+    InitListLayout(&gUIState.list, &gUIState.listRect, kLineHeight);
+    gUIState.list.bounds.top -= kRowInset;
+    gUIState.list.bounds.left -= 5;
+}
+
+/*
+ * Match the layout to the rows available for drawing
+ * While filtering, a new catalog is searched again for the same text.
+ * If the sort orders cannot be brought up to date the list goes back
+ * to device order.
+ */
+static void SyncListRows(void)
+{
+    if (gUIState.filter[0] == 0) {
+        if ((gUIState.sortOrder != kSortByIndex || gUIState.sortDescending) &&
+            SortViewsSync(&gGlobals.sorts, &gGlobals.prefixes,
+                          &gGlobals.catalog) != noErr) {
+            gUIState.sortOrder = kSortByIndex;
+            gUIState.sortDescending = false;
+            SysBeep(1);
+        }
+        ListLayoutSetRowCount(&gUIState.list, gGlobals.rows.count);
+        return;
+    }
+    
+    if (gUIState.matchSerial != gGlobals.catalog.serial ||
+        gUIState.matchTotal != gGlobals.catalog.count) {
+        FindMatches(false);
+    }
+    ListLayoutSetRowCount(&gUIState.list, gUIState.matches.count);
+}
+
+/*
+ * Find the discs whose names start with the filter
+ * narrow searches only the previous matches, which is all a longer
+ * filter can match.  If the index cannot be brought up to date the
+ * filter is dropped and every disc shows.
+ */
+static void FindMatches(Boolean narrow)
+{
+    if (PrefixIndexSync(&gGlobals.prefixes, &gGlobals.catalog) != noErr) {
+        gUIState.filter[0] = 0;
+        SysBeep(1);
+    }
+    
+    if (!narrow || gUIState.matchSerial != gGlobals.catalog.serial ||
+        gUIState.matchTotal != gGlobals.catalog.count) {
+        PrefixIndexAll(&gGlobals.prefixes, &gUIState.matches);
+    }
+    if (gUIState.filter[0] > 0) {
+        PrefixIndexFind(&gGlobals.prefixes, &gGlobals.catalog,
+                        &gUIState.filter[1], gUIState.filter[0],
+                        &gUIState.matches);
+    }
+    
+    gUIState.matchSerial = gGlobals.catalog.serial;
+    gUIState.matchTotal = gGlobals.catalog.count;
+}
+
+/*
+ * Show the matches for a changed filter, the first one selected
+ * keepEntry, if not -1, is a catalog entry to select instead; it is
+ * only looked for when the filter is empty and every disc shows.
+ */
+static void ApplyFilter(Boolean narrow, long keepEntry)
+{
+    long row;
+    
+    FindMatches(narrow);
+    SyncListRows();
+    
+    row = (gUIState.list.rowCount > 0) ? 0 : -1;
+    if (gUIState.filter[0] == 0 && keepEntry >= 0 &&
+        keepEntry < gUIState.list.rowCount) {
+        row = SortViewPosition(&gGlobals.sorts, gUIState.sortOrder,
+                               gUIState.sortDescending, keepEntry);
+    }
+    
+    gUIState.hasSelection = false;
+    gUIState.selectedDisc = -1;
+    (void)ListLayoutScrollTo(&gUIState.list, 0);
+    SelectListRow(row);
+    InvalRect(&gGlobals.window->portRect);
+}
+
+/*
+ * Catalog entry shown in a list row
+ * Matches for a filter are listed by name whatever the sort order.
+ */
+static long RowEntry(long row)
+{
+    if (gUIState.filter[0] == 0) {
+        return SortViewEntry(&gGlobals.sorts, &gGlobals.prefixes,
+                             gUIState.sortOrder, gUIState.sortDescending, row);
+    }
+    
+    return PrefixIndexEntry(&gGlobals.prefixes, gUIState.matches.first + row);
+}
+
+/*
+ * List the discs in another order; the current order again reverses it
+ * The selected disc stays selected.  While filtering, the new order
+ * takes effect once the filter is cleared.
+ */
+static void SetSortOrder(short order)
+{
+    long entry;
+    long row;
+    
+    entry = (gUIState.hasSelection && gUIState.filter[0] == 0) ?
+            RowEntry(gUIState.selectedDisc) : -1;
+    
+    if (order == gUIState.sortOrder) {
+        gUIState.sortDescending = !gUIState.sortDescending;
+    } else {
+        gUIState.sortOrder = order;
+        gUIState.sortDescending = false;
+    }
+    
+    InvalRect(&gGlobals.window->portRect);
+    if (gUIState.filter[0] > 0) {
+        return;
+    }
+    
+    SyncListRows();
+    row = -1;
+    if (entry >= 0 && entry < gUIState.list.rowCount) {
+        row = SortViewPosition(&gGlobals.sorts, gUIState.sortOrder,
+                               gUIState.sortDescending, entry);
+    }
+    
+    gUIState.hasSelection = false;
+    gUIState.selectedDisc = -1;
+    (void)ListLayoutScrollTo(&gUIState.list, 0);
+    SelectListRow(row);
+}
+
+/*
+ * Mark one row for redrawing, if any of it is visible
+ */
+static void InvalListRow(long row)
+{
+    Rect rowRect;
+    
+    if (ListLayoutRowRect(&gUIState.list, row, &rowRect)) {
+        InvalRect(&rowRect);
+    }
+}
+
+/*
+ * Move the list contents up by delta pixels (down if negative)
+ * The bits on screen are moved and only the exposed strip is redrawn.
+ */
+static void ScrollList(long delta)
+{
+    RgnHandle exposed;
+    long height;
+    
+    if (delta == 0) {
+        return;
+    }
+    
+    height = gUIState.list.bounds.bottom - gUIState.list.bounds.top;
+    exposed = NewRgn();
+    if (exposed == nil || delta >= height || -delta >= height) {
+        InvalRect(&gUIState.list.bounds);
+    } else {
+        ScrollRect(&gUIState.list.bounds, 0, (short)-delta, exposed);
+        InvalRgn(exposed);
+    }
+    if (exposed != nil) {
+        DisposeRgn(exposed);
+    }
+}
+
+/*
+ * Select a row (or none, with -1) and bring it into view
+ */
+static void SelectListRow(long row)
+{
+    if (gUIState.hasSelection) {
+        InvalListRow(gUIState.selectedDisc);
+    }
+    
+    gUIState.hasSelection = (row >= 0);
+    gUIState.selectedDisc = row;
+    
+    if (gUIState.hasSelection) {
+        ScrollList(ListLayoutEnsureVisible(&gUIState.list, row));
+        InvalListRow(row);
+    }
+    
+    /* The Mount button follows the selection */
+    InvalRect(&gUIState.mountButtonRect);
 }
 
 /*
@@ -71,9 +303,14 @@ void DrawEnhancedDiscList(void)
 {
     Rect textRect;
     Str255 str;
-    Str255 sizeStr;
-    short i;
-    short yPos;
+    Str31 matched;
+    Rect rowRect;
+    RgnHandle savedClip;
+    long first;
+    long last;
+    long i;
+    long entry;
+    long rowTop;
     
     /* Draw title */
     MoveTo(10, 20);
@@ -82,59 +319,77 @@ void DrawEnhancedDiscList(void)
     TextFace(bold);
     DrawString("\pUSBODE Disc Manager");
     
-    /* Draw disc count */
-    if (!gGlobals.deviceFound) {
+    /* Draw disc count; a saved catalog shows while the device is checked */
+    if (!gGlobals.deviceFound && gGlobals.catalog.count == 0) {
         MoveTo(10, 40);
         TextFace(normal);
-        DrawString("\pNo USBODE device found");
+        DrawString(TaskActive(&gGlobals.startTask) ?
+                   "\pChecking for the USBODE device…" :
+                   "\pNo USBODE device found");
         return;
     }
     
-    NumToString(gGlobals.discCount, str);
+    SyncListRows();
+    NumToString(gGlobals.catalog.count, str);
     MoveTo(10, 40);
     TextFace(normal);
-    DrawString("\pAvailable discs: ");
+    if (gUIState.filter[0] > 0) {
+        DrawString("\pMatching \"");
+        DrawString(gUIState.filter);
+        DrawString("\p\": ");
+        NumToString(gUIState.matches.count, matched);
+        DrawString(matched);
+        DrawString("\p of ");
+    } else {
+        DrawString("\pAvailable discs: ");
+    }
     DrawString(str);
+    if (gUIState.filter[0] == 0 && gUIState.sortOrder == kSortByName) {
+        DrawString("\p, by name");
+    } else if (gUIState.filter[0] == 0 && gUIState.sortOrder == kSortBySize) {
+        DrawString("\p, by size");
+    }
+    if (gUIState.filter[0] == 0 && gUIState.sortDescending) {
+        DrawString("\p, reversed");
+    }
+    DrawDeviceStatus();
     
-    /* Draw disc list with selection highlighting */
+    /* Draw only the visible rows, clipped to the list area */
     TextFace(normal);
-    for (i = 0; i < gGlobals.discCount; i++) {
-        yPos = kTopMargin + (i * kLineHeight);
-        
-        /* Skip if out of visible area */
-        if (yPos < gUIState.listRect.top || 
-            yPos + kLineHeight > gUIState.listRect.bottom) {
+    ListLayoutVisibleRange(&gUIState.list, &first, &last);
+    
+    savedClip = NewRgn();
+    if (savedClip != nil) {
+        GetClip(savedClip);
+        ClipRect(&gUIState.list.bounds);
+    }
+    
+    RowCacheLock(&gGlobals.rows);
+    for (i = first; i < last; i++) {
+        rowTop = ListLayoutRowTop(&gUIState.list, i);
+        entry = RowEntry(i);
+        if (entry >= gGlobals.rows.count) {
             continue;
         }
         
-        /* Highlight selected item */
-        if (i == gUIState.selectedDisc && gUIState.hasSelection) {
-            Rect highlightRect;
-            highlightRect.top = yPos - 2;
-            highlightRect.bottom = yPos + kLineHeight - 2;
-            highlightRect.left = kLeftMargin - 5;
-            highlightRect.right = gUIState.listRect.right;
-            
-            /* Invert for selection */
-            InvertRect(&highlightRect);
-        }
+        /* The mounted image is shown in bold */
+        MoveTo(kLeftMargin, (short)(rowTop + kTextBaseline));
+        TextFace((CatalogIndex(&gGlobals.catalog, entry) == gGlobals.mountedIndex) ?
+                 bold : normal);
+        DrawString(RowCacheRow(&gGlobals.rows, entry));
         
-        MoveTo(kLeftMargin, yPos + 12);
-        
-        /* Draw index */
-        NumToString(gGlobals.discs[i].index, str);
-        DrawString(str);
-        DrawString("\p. ");
-        
-        /* Draw name */
-        CStringToPascal((char *)gGlobals.discs[i].name, str);
-        DrawString(str);
-        
-        /* Draw size */
-        GetDiscSizeString(&gGlobals.discs[i], sizeStr);
-        DrawString("\p  (");
-        DrawString(sizeStr);
-        DrawString("\p)");
+        /* Invert for selection */
+        if (i == gUIState.selectedDisc && gUIState.hasSelection &&
+            ListLayoutRowRect(&gUIState.list, i, &rowRect)) {
+            InvertRect(&rowRect);
+        }
+    }
+    RowCacheUnlock(&gGlobals.rows);
+    TextFace(normal);
+    
+    if (savedClip != nil) {
+        SetClip(savedClip);
+        DisposeRgn(savedClip);
     }
     
     /* Draw buttons */
@@ -145,7 +400,7 @@ void DrawEnhancedDiscList(void)
     MoveTo(10, gUIState.listRect.bottom + 30);
     TextFace(italic);
     TextSize(10);
-    DrawString("\pClick to select, then click Mount. ⌘R to refresh.");
+    DrawString("\pClick to select, then click Mount. Type to search, ⌘R to refresh.");
 }
 
 /*
@@ -180,8 +435,7 @@ void DrawButton(Rect *rect, Str255 title, Boolean enabled)
  */
 void HandleContentClick(Point localPt)
 {
-    short i;
-    short yPos;
+    long row;
     
     /* Check if clicking on mount button */
     if (PtInRect(localPt, &gUIState.mountButtonRect)) {
@@ -210,66 +464,40 @@ void HandleContentClick(Point localPt)
     }
     
     /* Check if clicking in disc list */
-    if (PtInRect(localPt, &gUIState.listRect)) {
-        for (i = 0; i < gGlobals.discCount; i++) {
-            yPos = kTopMargin + (i * kLineHeight);
-            
-            if (localPt.v >= yPos - 2 && localPt.v < yPos + kLineHeight - 2) {
-                /* Item clicked */
-                if (gUIState.hasSelection && gUIState.selectedDisc == i) {
-                    /* Double-click: mount immediately */
-                    MountSelectedDiscEnhanced();
-                } else {
-                    /* Single click: select */
-                    gUIState.selectedDisc = i;
-                    gUIState.hasSelection = true;
-                    InvalRect(&gGlobals.window->portRect);
-                }
-                return;
-            }
-        }
+    if (PtInRect(localPt, &gUIState.list.bounds)) {
+        SyncListRows();
+        row = ListLayoutRowAtPoint(&gUIState.list, localPt);
         
-        /* Clicked in list but not on an item: deselect */
-        gUIState.hasSelection = false;
-        InvalRect(&gGlobals.window->portRect);
+        if (row >= 0 && gUIState.hasSelection && gUIState.selectedDisc == row) {
+            /* Double-click: mount immediately */
+            MountSelectedDiscEnhanced();
+        } else {
+            /* Select the row, or deselect when below the last one */
+            SelectListRow(row);
+        }
     }
 }
 
 /*
- * Mount the currently selected disc with feedback
+ * Mount the currently selected disc
+ * Goes through the mount scheduler, so repeated Returns and clicks
+ * end up as one mount of the disc selected last.
  */
 void MountSelectedDiscEnhanced(void)
 {
-    OSErr err;
-    Str255 message;
-    Str255 discName;
+    long entry;
     
+    SyncListRows();
     if (!gUIState.hasSelection || gUIState.selectedDisc < 0 || 
-        gUIState.selectedDisc >= gGlobals.discCount) {
+        gUIState.selectedDisc >= gUIState.list.rowCount) {
         return;
     }
     
-    /* Get disc name for feedback */
-    CStringToPascal((char *)gGlobals.discs[gUIState.selectedDisc].name, discName);
-    
-    /* Show mounting message */
-    BlockMove("\pMounting: ", message, 11);
-    BlockMove(discName + 1, message + 11, discName[0]);
-    message[0] = 10 + discName[0];
-    
-    /* Send mount command */
-    err = SetActiveDisc(gGlobals.scsiID, gGlobals.discs[gUIState.selectedDisc].index);
-    
-    if (err == noErr) {
-        /* Success */
-        BlockMove("\pDisc mounted successfully!", message, 26);
-        message[0] = 25;
-        ParamText(message, "\p", "\p", "\p");
-        Alert(rUserAlert, nil);
-    } else {
-        /* Error */
-        ShowError("\pError mounting disc. Please check SCSI connection.");
+    entry = RowEntry(gUIState.selectedDisc);
+    if (entry >= gGlobals.catalog.count) {
+        return;
     }
+    RequestMount(CatalogIndex(&gGlobals.catalog, entry));
 }
 
 /*
@@ -278,6 +506,7 @@ void MountSelectedDiscEnhanced(void)
 void HandleKeyDown(EventRecord *event)
 {
     char key = event->message & charCodeMask;
+    long entry;
     
     if (event->modifiers & cmdKey) {
         switch (key) {
@@ -294,37 +523,100 @@ void HandleKeyDown(EventRecord *event)
                     MountSelectedDiscEnhanced();
                 }
                 break;
+                
+            case '1':
+                /* Command-1 to 3: list by index, name or size */
+                SetSortOrder(kSortByIndex);
+                break;
+                
+            case '2':
+                SetSortOrder(kSortByName);
+                break;
+                
+            case '3':
+                SetSortOrder(kSortBySize);
+                break;
         }
     } else {
-        /* Arrow keys for navigation */
+        /* Arrow keys move the selection, paging keys scroll */
+        SyncListRows();
         switch (key) {
             case 0x1E:  /* Up arrow */
                 if (gUIState.hasSelection && gUIState.selectedDisc > 0) {
-                    gUIState.selectedDisc--;
-                    InvalRect(&gGlobals.window->portRect);
-                } else if (!gUIState.hasSelection && gGlobals.discCount > 0) {
-                    gUIState.selectedDisc = 0;
-                    gUIState.hasSelection = true;
-                    InvalRect(&gGlobals.window->portRect);
+                    SelectListRow(gUIState.selectedDisc - 1);
+                } else if (!gUIState.hasSelection && gUIState.list.rowCount > 0) {
+                    SelectListRow(0);
                 }
                 break;
                 
             case 0x1F:  /* Down arrow */
-                if (gUIState.hasSelection && gUIState.selectedDisc < gGlobals.discCount - 1) {
-                    gUIState.selectedDisc++;
-                    InvalRect(&gGlobals.window->portRect);
-                } else if (!gUIState.hasSelection && gGlobals.discCount > 0) {
-                    gUIState.selectedDisc = 0;
-                    gUIState.hasSelection = true;
-                    InvalRect(&gGlobals.window->portRect);
+                if (gUIState.hasSelection && gUIState.selectedDisc < gUIState.list.rowCount - 1) {
+                    SelectListRow(gUIState.selectedDisc + 1);
+                } else if (!gUIState.hasSelection && gUIState.list.rowCount > 0) {
+                    SelectListRow(0);
                 }
                 break;
                 
+            case kPageUpKey:
+                ScrollList(ListLayoutScrollTo(&gUIState.list,
+                    gUIState.list.scrollOffset -
+                    ListLayoutPageRows(&gUIState.list) * kLineHeight));
+                break;
+                
+            case kPageDownKey:
+                ScrollList(ListLayoutScrollTo(&gUIState.list,
+                    gUIState.list.scrollOffset +
+                    ListLayoutPageRows(&gUIState.list) * kLineHeight));
+                break;
+                
+            case kHomeKey:
+                ScrollList(ListLayoutScrollTo(&gUIState.list, 0));
+                break;
+                
+            case kEndKey:
+                ScrollList(ListLayoutScrollTo(&gUIState.list,
+                    ListLayoutMaxScroll(&gUIState.list)));
+                break;
+                
             case 0x0D:  /* Return/Enter */
+                /* A typed name mounts the disc it names, unless another
+                   match has been picked with the arrows */
+                if (gUIState.filter[0] > 0 &&
+                    (!gUIState.hasSelection || gUIState.selectedDisc == 0) &&
+                    RequestMountByName(gUIState.filter) == noErr) {
+                    break;
+                }
                 if (gUIState.hasSelection) {
                     MountSelectedDiscEnhanced();
                 }
                 break;
+                
+            case kEscapeKey:
+                /* Show every disc again, keeping the selected one */
+                if (gUIState.filter[0] > 0) {
+                    entry = gUIState.hasSelection ?
+                            RowEntry(gUIState.selectedDisc) : -1;
+                    gUIState.filter[0] = 0;
+                    ApplyFilter(false, entry);
+                }
+                break;
+                
+            case kBackspaceKey:
+                /* A shorter filter matches more: search from the top */
+                if (gUIState.filter[0] > 0) {
+                    gUIState.filter[0]--;
+                    ApplyFilter(false, -1);
+                }
+                break;
+                
+            default:
+                /* Anything printable extends the filter */
+                if ((unsigned char)key >= 0x20 && key != kDeleteKey &&
+                    gUIState.filter[0] < sizeof(Str63) - 1) {
+                    gUIState.filter[++gUIState.filter[0]] = (unsigned char)key;
+                    ApplyFilter(true, -1);
+                }
+                break;
         }
     }
 }